@@ -168,6 +168,7 @@ static int sony_sy35560_platform_enable(struct mcde_display_device *dev)
 	}
 
 	dev->update = sony_sy35560_update;
+	dev->update_async = NULL;
 
 	/* TODO: Remove when DSI send command uses interrupts */
 	dev->prepare_for_update = NULL;
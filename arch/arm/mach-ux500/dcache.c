@@ -202,6 +202,29 @@ void flush_cpu_dcache(void *vaddr, u32 paddr, u32 length, bool inner_only,
 	}
 }
 
+void clean_cpu_dcache_all_if_cheaper(u32 length, bool inner_only,
+				bool *inner_cleaned, bool *outer_cleaned)
+{
+	*inner_cleaned = false;
+	*outer_cleaned = false;
+
+	if (length >= inner_clean_breakpoint) {
+		clean_inner_dcache_all();
+		*inner_cleaned = true;
+	}
+
+	/* See clean_cpu_dcache */
+	if (!inner_only && length >= outer_flush_breakpoint) {
+		outer_cache.flush_all();
+		*outer_cleaned = true;
+	}
+}
+
+void clean_outer_cpu_dcache(u32 paddr, u32 length)
+{
+	outer_cache.clean_range(paddr, paddr + length);
+}
+
 bool speculative_data_prefetch(void)
 {
 	return true;
@@ -180,9 +180,25 @@ static struct resource ux500_hash1_resources[] = {
 	}
 };
 
+static struct hash_platform_data hash1_platform_data = {
+	.mem_to_engine = {
+		.dir = STEDMA40_MEM_TO_PERIPH,
+		.src_dev_type = STEDMA40_DEV_SRC_MEMORY,
+		.dst_dev_type = DB8500_DMA_DEV50_HAC1_TX,
+		.src_info.data_width = STEDMA40_WORD_WIDTH,
+		.dst_info.data_width = STEDMA40_WORD_WIDTH,
+		.mode = STEDMA40_MODE_LOGICAL,
+		.src_info.psize = STEDMA40_PSIZE_LOG_16,
+		.dst_info.psize = STEDMA40_PSIZE_LOG_16,
+	},
+};
+
 struct platform_device ux500_hash1_device = {
 	.name = "hash1",
 	.id = -1,
+	.dev = {
+		.platform_data = &hash1_platform_data
+	},
 	.num_resources = 1,
 	.resource = ux500_hash1_resources
 };
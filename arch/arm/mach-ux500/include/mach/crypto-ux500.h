@@ -13,4 +13,8 @@ struct cryp_platform_data {
 	struct stedma40_chan_cfg engine_to_mem;
 };
 
+struct hash_platform_data {
+	struct stedma40_chan_cfg mem_to_engine;
+};
+
 #endif
@@ -19,6 +19,13 @@ void clean_cpu_dcache(void *vaddr, u32 paddr, u32 length, bool inner_only,
 						bool *cleaned_everything);
 void flush_cpu_dcache(void *vaddr, u32 paddr, u32 length, bool inner_only,
 						bool *flushed_everything);
+/*
+ * For batches of cleans. Cleans the inner and, unless inner_only, the outer
+ * cache entirely if that is cheaper than cleaning length bytes by range.
+ */
+void clean_cpu_dcache_all_if_cheaper(u32 length, bool inner_only,
+				bool *inner_cleaned, bool *outer_cleaned);
+void clean_outer_cpu_dcache(u32 paddr, u32 length);
 bool speculative_data_prefetch(void);
 /* Returns 1 if no cache is present */
 u32 get_dcache_granularity(void);
@@ -285,4 +285,42 @@ struct dma_async_tx_descriptor *stedma40_memcpy_sg(struct dma_chan *chan,
 						   unsigned int sgl_len,
 						   unsigned long flags);
 
+/**
+ * stedma40_copy_sg() - copy between scatterlists, offloaded to a DMA40
+ * logical memcpy channel when it pays off.
+ *
+ * @sgl_dst: Destination scatter list, not DMA mapped
+ * @sgl_src: Source scatter list, not DMA mapped
+ * @sgl_len: The length of each scatterlist. Each element must be as long as
+ * the corresponding element in the other scatter list.
+ * @callback: Called with the status when the copy is done. Called from
+ * tasklet context for DMA copies and before returning for CPU copies.
+ * @param: Passed to callback
+ *
+ * Copies below the ste_dma40_copy.threshold module parameter, with elements
+ * the channel cannot take or when the channel is busy are done by the CPU.
+ * Must be called from process context.
+ *
+ * returns 0 if the copy is done or queued, else a negative errno and the
+ * callback is not called.
+ */
+int stedma40_copy_sg(struct scatterlist *sgl_dst,
+		     struct scatterlist *sgl_src,
+		     unsigned int sgl_len,
+		     void (*callback)(void *param, int status),
+		     void *param);
+
+/**
+ * stedma40_copy_pages() - copy whole pages and wait for the copy
+ *
+ * @dst: Destination pages
+ * @src: Source pages
+ * @nr_pages: Number of pages in dst and src
+ *
+ * Batches the pages into one stedma40_copy_sg() copy. Must be called from
+ * process context.
+ */
+int stedma40_copy_pages(struct page **dst, struct page **src,
+			unsigned int nr_pages);
+
 #endif
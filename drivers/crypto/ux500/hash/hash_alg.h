@@ -310,6 +310,26 @@ struct hash_ctx {
 	struct hash_device_data	*device;
 };
 
+/**
+ * struct hash_dma - DMA state of a hash device.
+ * @mask:		DMA capabilities bitmap mask.
+ * @complete:		Used to wait for a transfer to the engine to finish.
+ * @chan_mem2hash:	DMA channel feeding HASH_DIN, NULL if there is none.
+ * @cfg_mem2hash:	DMA channel configuration.
+ * @sg:			Scatterlist of the transfer in progress.
+ * @sg_len:		Number of mapped entries in @sg.
+ * @nents:		Number of entries in @sg.
+ */
+struct hash_dma {
+	dma_cap_mask_t			mask;
+	struct completion		complete;
+	struct dma_chan			*chan_mem2hash;
+	struct stedma40_chan_cfg	*cfg_mem2hash;
+	struct scatterlist		*sg;
+	int				sg_len;
+	int				nents;
+};
+
 /**
  * struct hash_device_data - structure for a hash device.
  * @base:		Pointer to the hardware base address.
@@ -322,6 +342,7 @@ struct hash_ctx {
  * @regulator:		Pointer to the device's power control.
  * @clk:		Pointer to the device's clock control.
  * @restore_dev_state:	TRUE = saved state, FALSE = no saved state.
+ * @dma:		DMA state used to feed large updates.
  */
 struct hash_device_data {
 	struct hash_register __iomem	*base;
@@ -334,6 +355,7 @@ struct hash_device_data {
 	struct ux500_regulator		*regulator;
 	struct clk			*clk;
 	bool				restore_dev_state;
+	struct hash_dma			dma;
 };
 
 int hash_check_hw(struct hash_device_data *device_data);
@@ -20,6 +20,11 @@
 #include <linux/module.h>
 #include <linux/platform_device.h>
 #include <linux/crypto.h>
+#include <linux/dmaengine.h>
+#include <linux/dma-mapping.h>
+#include <linux/scatterlist.h>
+#include <linux/completion.h>
+#include <linux/slab.h>
 
 #include <mach/regulator.h>
 #include <linux/bitops.h>
@@ -30,11 +35,20 @@
 #include <crypto/algapi.h>
 
 #include <mach/hardware.h>
+#include <mach/crypto-ux500.h>
+
+#include <plat/ste_dma40.h>
 
 #include "hash_alg.h"
 
 #define DEV_DBG_NAME "hashX hashX:"
 
+/* Time to wait for a DMA transfer to the engine to finish */
+#define HASH_DMA_TIMEOUT_MS	500
+
+/* Updates of at least this many bytes are fed to the engine by DMA */
+static unsigned int hash_dma_threshold = 8192;
+
 /**
  * struct hash_driver_data - data specific to the driver.
  *
@@ -484,6 +498,240 @@ void hash_begin(struct hash_device_data *device_data, struct hash_ctx *ctx)
 	HASH_CLEAR_BITS(&device_data->base->str, HASH_STR_NBLW_MASK);
 }
 
+/**
+ * hash_dma_setup_channel - Requests the DMA channel feeding HASH_DIN.
+ * @device_data:	Structure for the hash device.
+ * @dev:		The device, holding the channel configuration.
+ *
+ * Without a channel, all data is written to the engine by the CPU.
+ */
+static void hash_dma_setup_channel(struct hash_device_data *device_data,
+		struct device *dev)
+{
+	struct hash_platform_data *platform_data = dev->platform_data;
+
+	init_completion(&device_data->dma.complete);
+
+	if (!platform_data)
+		return;
+
+	dma_cap_zero(device_data->dma.mask);
+	dma_cap_set(DMA_SLAVE, device_data->dma.mask);
+
+	device_data->dma.cfg_mem2hash = &platform_data->mem_to_engine;
+	device_data->dma.chan_mem2hash =
+		dma_request_channel(device_data->dma.mask,
+				    stedma40_filter,
+				    device_data->dma.cfg_mem2hash);
+	if (!device_data->dma.chan_mem2hash)
+		dev_info(dev, "[%s] No DMA channel, using CPU writes",
+				__func__);
+}
+
+static void hash_dma_callback(void *data)
+{
+	struct hash_device_data *device_data = data;
+
+	complete(&device_data->dma.complete);
+}
+
+/**
+ * hash_dma_sg_walk - Describes part of a scatterlist for a DMA transfer.
+ * @src:	Scatterlist of the message.
+ * @skip:	Number of bytes of @src to skip.
+ * @len:	Number of bytes to describe.
+ * @dst:	Entries to fill in, or NULL to only count them.
+ *
+ * The channel moves whole words, so every entry must start at a word
+ * aligned address and be a multiple of a word long.
+ *
+ * Returns the number of entries needed, or -EINVAL if the data can not be
+ * transferred by DMA.
+ */
+static int hash_dma_sg_walk(struct scatterlist *src, unsigned int skip,
+		unsigned int len, struct scatterlist *dst)
+{
+	struct scatterlist *sg;
+	int nents = 0;
+
+	for (sg = src; sg && len; sg = sg_next(sg)) {
+		unsigned int count;
+
+		if (skip >= sg->length) {
+			skip -= sg->length;
+			continue;
+		}
+
+		count = min(sg->length - skip, len);
+		if ((sg->offset + skip) % sizeof(u32) || count % sizeof(u32))
+			return -EINVAL;
+
+		if (dst)
+			sg_set_page(&dst[nents], sg_page(sg), count,
+					sg->offset + skip);
+
+		nents++;
+		len -= count;
+		skip = 0;
+	}
+
+	return len ? -EINVAL : nents;
+}
+
+/**
+ * hash_dma_write - Writes a scatterlist to HASH_DIN by DMA and waits for it.
+ * @device_data:	Structure for the hash device.
+ * @sg:			Data, whole blocks and word aligned.
+ * @nents:		Number of entries in @sg.
+ */
+static int hash_dma_write(struct hash_device_data *device_data,
+		struct scatterlist *sg, int nents)
+{
+	struct dma_chan *channel = device_data->dma.chan_mem2hash;
+	struct dma_async_tx_descriptor *desc;
+	dma_cookie_t cookie;
+	int ret = 0;
+
+	device_data->dma.sg = sg;
+	device_data->dma.nents = nents;
+	device_data->dma.sg_len = dma_map_sg(channel->device->dev, sg, nents,
+			DMA_TO_DEVICE);
+	if (!device_data->dma.sg_len) {
+		dev_err(device_data->dev, "[%s] dma_map_sg() failed!",
+				__func__);
+		return -EFAULT;
+	}
+
+	desc = channel->device->device_prep_slave_sg(channel, sg,
+			device_data->dma.sg_len, DMA_TO_DEVICE,
+			DMA_CTRL_ACK | DMA_PREP_INTERRUPT);
+	if (!desc) {
+		dev_err(device_data->dev, "[%s] device_prep_slave_sg() "
+				"failed!", __func__);
+		ret = -EFAULT;
+		goto out_unmap;
+	}
+
+	INIT_COMPLETION(device_data->dma.complete);
+	desc->callback = hash_dma_callback;
+	desc->callback_param = device_data;
+
+	cookie = desc->tx_submit(desc);
+	if (dma_submit_error(cookie)) {
+		dev_err(device_data->dev, "[%s] tx_submit() failed!",
+				__func__);
+		ret = -EFAULT;
+		goto out_unmap;
+	}
+	dma_async_issue_pending(channel);
+
+	if (!wait_for_completion_timeout(&device_data->dma.complete,
+				msecs_to_jiffies(HASH_DMA_TIMEOUT_MS))) {
+		dev_err(device_data->dev, "[%s] DMA timeout!", __func__);
+		channel->device->device_control(channel, DMA_TERMINATE_ALL, 0);
+		ret = -ETIMEDOUT;
+	}
+
+out_unmap:
+	dma_unmap_sg(channel->device->dev, sg, nents, DMA_TO_DEVICE);
+
+	return ret;
+}
+
+/**
+ * hash_dma_update - Hashes a large part of the message using DMA.
+ * @device_data:	Structure for the hash device.
+ * @ctx:		Hash context.
+ * @req:		The update request.
+ *
+ * The whole blocks of the update are written to the engine by DMA. Bytes
+ * completing a block already started in the local buffer are written by the
+ * CPU first, and the bytes after the last whole block are left in the local
+ * buffer, just like in the CPU path.
+ *
+ * Returns -EAGAIN, without touching the hardware or the context, if the
+ * data can not be transferred by DMA.
+ */
+static int hash_dma_update(struct hash_device_data *device_data,
+		struct hash_ctx *ctx, struct ahash_request *req)
+{
+	u8 *p_buffer = (u8 *)ctx->state.buffer;
+	u8 index = ctx->state.index;
+	unsigned int head = (HASH_BLOCK_SIZE - index) % HASH_BLOCK_SIZE;
+	unsigned int len;
+	struct scatterlist *sg;
+	int nents;
+	int ret;
+
+	if (req->nbytes < head + HASH_BLOCK_SIZE)
+		return -EAGAIN;
+
+	len = round_down(req->nbytes - head, HASH_BLOCK_SIZE);
+
+	nents = hash_dma_sg_walk(req->src, head, len, NULL);
+	if (nents <= 0)
+		return -EAGAIN;
+
+	sg = kmalloc(nents * sizeof(*sg), GFP_KERNEL);
+	if (!sg)
+		return -EAGAIN;
+
+	sg_init_table(sg, nents);
+	hash_dma_sg_walk(req->src, head, len, sg);
+
+	if (!ctx->updated) {
+		ret = init_hash_hw(device_data, req);
+		if (ret) {
+			dev_err(device_data->dev, "[%s] init_hash_hw() "
+					"failed!", __func__);
+			goto out;
+		}
+		ctx->updated = 1;
+	} else {
+		ret = hash_resume_state(device_data, &ctx->state);
+		if (ret) {
+			dev_err(device_data->dev, "[%s] hash_resume_state() "
+					"failed!", __func__);
+			goto out;
+		}
+	}
+
+	if (head) {
+		scatterwalk_map_and_copy(p_buffer + index, req->src, 0, head,
+				0);
+		hash_processblock(device_data, (const u32 *)p_buffer);
+		hash_incrementlength(ctx, HASH_BLOCK_SIZE);
+	}
+
+	/*
+	 * DMAE bit. Data written to HASH_DIN is requested from the DMA
+	 * controller while set. It is cleared again before the state is
+	 * saved, so that a resumed calculation starts without it.
+	 */
+	HASH_CLEAR_BITS(&device_data->base->str, HASH_STR_NBLW_MASK);
+	HASH_SET_BITS(&device_data->base->cr, HASH_CR_DMAE_MASK);
+	ret = hash_dma_write(device_data, sg, nents);
+	HASH_CLEAR_BITS(&device_data->base->cr, HASH_CR_DMAE_MASK);
+	if (ret)
+		goto out;
+
+	hash_incrementlength(ctx, len);
+
+	index = req->nbytes - head - len;
+	scatterwalk_map_and_copy(p_buffer, req->src, head + len, index, 0);
+	ctx->state.index = index;
+
+	ret = hash_save_state(device_data, &ctx->state);
+	if (ret)
+		dev_err(device_data->dev, "[%s] hash_save_state() failed!",
+				__func__);
+
+out:
+	kfree(sg);
+
+	return ret;
+}
+
 /**
  * hash_hw_update - Updates current HASH computation hashing another part of
  *                  the message.
@@ -536,6 +784,20 @@ int hash_hw_update(struct ahash_request *req)
 		goto out;
 	}
 
+	/* Large updates are fed by DMA, the rest by the CPU */
+	if (device_data->dma.chan_mem2hash &&
+			req->nbytes >= hash_dma_threshold) {
+		/* Drop the mapping of the walk, the DMA path may sleep */
+		crypto_hash_walk_done(&walk, -EAGAIN);
+
+		ret = hash_dma_update(device_data, ctx, req);
+		if (ret != -EAGAIN)
+			goto out_power;
+
+		ret = 0;
+		msg_length = crypto_hash_walk_first(req, &walk);
+	}
+
 	/* Main loop */
 	while (0 != msg_length) {
 		p_data_buffer = walk.data;
@@ -1107,6 +1369,8 @@ static int u8500_hash_probe(struct platform_device *pdev)
 	spin_lock_init(&device_data->ctx_lock);
 	spin_lock_init(&device_data->power_state_lock);
 
+	hash_dma_setup_channel(device_data, dev);
+
 	/* Enable power for HASH1 hardware block */
 	device_data->regulator = ux500_regulator_get(dev);
 
@@ -1168,6 +1432,8 @@ out_regulator:
 	ux500_regulator_put(device_data->regulator);
 
 out_unmap:
+	if (device_data->dma.chan_mem2hash)
+		dma_release_channel(device_data->dma.chan_mem2hash);
 	iounmap(device_data->base);
 
 out_free_mem:
@@ -1230,6 +1496,9 @@ static int u8500_hash_remove(struct platform_device *pdev)
 	clk_put(device_data->clk);
 	ux500_regulator_put(device_data->regulator);
 
+	if (device_data->dma.chan_mem2hash)
+		dma_release_channel(device_data->dma.chan_mem2hash);
+
 	iounmap(device_data->base);
 
 	res = platform_get_resource(pdev, IORESOURCE_MEM, 0);
@@ -1409,6 +1678,10 @@ static void __exit u8500_hash_mod_fini(void)
 module_init(u8500_hash_mod_init);
 module_exit(u8500_hash_mod_fini);
 
+module_param(hash_dma_threshold, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(hash_dma_threshold,
+		"Smallest update fed to the engine by DMA (bytes)");
+
 MODULE_DESCRIPTION("Driver for ST-Ericsson U8500 HASH engine.");
 MODULE_LICENSE("GPL");
 
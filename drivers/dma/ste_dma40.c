@@ -24,6 +24,8 @@
 #include <linux/pm_runtime.h>
 #include <linux/regulator/consumer.h>
 #include <linux/err.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include <plat/ste_dma40.h>
 
@@ -38,6 +40,13 @@
 
 #define D40_NAME "dma40"
 
+/* Descriptors set up per channel when it is allocated */
+#define D40_DESC_POOL_SIZE 8
+/* Most descriptors kept for reuse per channel */
+#define D40_DESC_POOL_MAX 32
+/* LLIs per direction that the descriptors of the pool have room for */
+#define D40_DESC_POOL_LLIS 16
+
 #define D40_PHY_CHAN -1
 
 /* For masking out/in 2 bit channel positions */
@@ -132,14 +141,17 @@ static u32 d40_backup_regs_chan[] = {
  * struct d40_lli_pool - Structure for keeping LLIs in memory
  *
  * @base: Pointer to memory area when the pre_alloc_lli's are not large
- * enough, IE bigger than the most common case, 1 dst and 1 src. NULL if
- * pre_alloc_lli is used.
- * @size: The size in bytes of the memory at base or the size of pre_alloc_lli.
+ * enough, IE bigger than the most common case, 1 dst and 1 src. Kept when
+ * the descriptor is reused.
+ * @base_size: The size in bytes of the memory at base.
+ * @size: The size in bytes of the used memory at base or the size of
+ * pre_alloc_lli.
  * @pre_alloc_lli: Pre allocated area for the most common case of transfers,
  * one buffer to one buffer.
  */
 struct d40_lli_pool {
 	void	*base;
+	int	 base_size;
 	int	 size;
 	/* Space for dst and src, plus an extra for padding */
 	u8	 pre_alloc_lli[3 * sizeof(struct d40_phy_lli)];
@@ -242,9 +254,16 @@ struct d40_base;
  * @tasklet: Tasklet that gets scheduled from interrupt context to complete a
  * transfer and call client callback.
  * @client: Cliented owned descriptor list.
+ * @free: Descriptors kept for reuse, see D40_DESC_POOL_SIZE.
+ * @free_len: Number of descriptors in free.
+ * @desc_reused: Number of descriptors taken from free.
+ * @desc_allocated: Number of descriptors allocated when free was empty.
+ * @lli_allocated: Number of LLI areas allocated since the descriptor had
+ * no room for the transfer.
  * @active: Active descriptor.
  * @done: Completed jobs
  * @queue: Queued jobs.
+ * @prepare_queue: Prepared jobs, not yet submitted.
  * @dma_cfg: The client configuration of this dma channel.
  * @configured: whether the dma_cfg configuration is valid
  * @base: Pointer to the device instance struct.
@@ -271,9 +290,15 @@ struct d40_chan {
 	struct dma_chan			 chan;
 	struct tasklet_struct		 tasklet;
 	struct list_head		 client;
+	struct list_head		 free;
+	int				 free_len;
+	unsigned long			 desc_reused;
+	unsigned long			 desc_allocated;
+	unsigned long			 lli_allocated;
 	struct list_head		 active;
 	struct list_head		 done;
 	struct list_head		 queue;
+	struct list_head		 prepare_queue;
 	struct stedma40_chan_cfg	 dma_cfg;
 	bool				 configured;
 	struct d40_base			*base;
@@ -419,11 +444,12 @@ static bool chan_is_logical(struct d40_chan *chan)
 	return !chan_is_physical(chan);
 }
 
-static int d40_pool_lli_alloc(struct d40_desc *d40d,
+static int d40_pool_lli_alloc(struct d40_chan *d40c, struct d40_desc *d40d,
 			      int lli_len, bool is_log)
 {
 	u32 align;
 	void *base;
+	int size;
 
 	if (is_log)
 		align = sizeof(struct d40_log_lli);
@@ -433,15 +459,21 @@ static int d40_pool_lli_alloc(struct d40_desc *d40d,
 	if (lli_len == 1) {
 		base = d40d->lli_pool.pre_alloc_lli;
 		d40d->lli_pool.size = sizeof(d40d->lli_pool.pre_alloc_lli);
-		d40d->lli_pool.base = NULL;
 	} else {
 		d40d->lli_pool.size = ALIGN(lli_len * 2 * align, align);
-
-		base = kmalloc(d40d->lli_pool.size + align, GFP_NOWAIT);
-		d40d->lli_pool.base = base;
-
-		if (d40d->lli_pool.base == NULL)
-			return -ENOMEM;
+		size = d40d->lli_pool.size + align;
+
+		/* Reuse the area of an earlier transfer if it is large enough */
+		if (d40d->lli_pool.base_size < size) {
+			kfree(d40d->lli_pool.base);
+			d40d->lli_pool.base_size = 0;
+			d40d->lli_pool.base = kmalloc(size, GFP_NOWAIT);
+			if (d40d->lli_pool.base == NULL)
+				return -ENOMEM;
+			d40d->lli_pool.base_size = size;
+			d40c->lli_allocated++;
+		}
+		base = d40d->lli_pool.base;
 	}
 
 	if (is_log) {
@@ -459,10 +491,9 @@ static int d40_pool_lli_alloc(struct d40_desc *d40d,
 	return 0;
 }
 
+/* Forgets the LLIs of the transfer, the memory is kept for the next one */
 static void d40_pool_lli_free(struct d40_desc *d40d)
 {
-	kfree(d40d->lli_pool.base);
-	d40d->lli_pool.base = NULL;
 	d40d->lli_pool.size = 0;
 	d40d->lli_log.src = NULL;
 	d40d->lli_log.dst = NULL;
@@ -536,6 +567,41 @@ static void d40_desc_remove(struct d40_desc *d40d)
 	list_del(&d40d->node);
 }
 
+/* Clears a descriptor for reuse, keeping its LLI memory */
+static void d40_desc_reset(struct d40_desc *d40d)
+{
+	void *base = d40d->lli_pool.base;
+	int base_size = d40d->lli_pool.base_size;
+
+	memset(d40d, 0, sizeof(struct d40_desc));
+	d40d->lli_pool.base = base;
+	d40d->lli_pool.base_size = base_size;
+}
+
+static void d40_desc_destroy(struct d40_chan *d40c, struct d40_desc *d40d)
+{
+	kfree(d40d->lli_pool.base);
+	kmem_cache_free(d40c->base->desc_slab, d40d);
+}
+
+/* Allocates a descriptor with room for D40_DESC_POOL_LLIS LLIs, may sleep */
+static struct d40_desc *d40_desc_create(struct d40_chan *d40c)
+{
+	struct d40_desc *d40d;
+	int size = ALIGN(D40_DESC_POOL_LLIS * 2 * sizeof(struct d40_phy_lli),
+			 sizeof(struct d40_phy_lli)) + sizeof(struct d40_phy_lli);
+
+	d40d = kmem_cache_zalloc(d40c->base->desc_slab, GFP_KERNEL);
+	if (d40d == NULL)
+		return NULL;
+
+	d40d->lli_pool.base = kmalloc(size, GFP_KERNEL);
+	if (d40d->lli_pool.base)
+		d40d->lli_pool.base_size = size;
+
+	return d40d;
+}
+
 static struct d40_desc *d40_desc_get(struct d40_chan *d40c)
 {
 	struct d40_desc *desc = NULL;
@@ -549,14 +615,25 @@ static struct d40_desc *d40_desc_get(struct d40_chan *d40c)
 				d40_pool_lli_free(d);
 				d40_desc_remove(d);
 				desc = d;
-				memset(desc, 0, sizeof(struct d40_desc));
+				d40_desc_reset(desc);
 				break;
 			}
 		}
 	}
 
-	if (!desc)
+	if (!desc && !list_empty(&d40c->free)) {
+		desc = list_first_entry(&d40c->free, struct d40_desc, node);
+		d40_desc_remove(desc);
+		d40c->free_len--;
+		d40c->desc_reused++;
+		d40_desc_reset(desc);
+	}
+
+	if (!desc) {
 		desc = kmem_cache_zalloc(d40c->base->desc_slab, GFP_NOWAIT);
+		if (desc)
+			d40c->desc_allocated++;
+	}
 
 	if (desc)
 		INIT_LIST_HEAD(&desc->node);
@@ -568,7 +645,48 @@ static void d40_desc_free(struct d40_chan *d40c, struct d40_desc *d40d)
 {
 
 	d40_lcla_free_all(d40c, d40d);
-	kmem_cache_free(d40c->base->desc_slab, d40d);
+
+	if (d40c->free_len < D40_DESC_POOL_MAX) {
+		d40_pool_lli_free(d40d);
+		list_add(&d40d->node, &d40c->free);
+		d40c->free_len++;
+	} else {
+		d40_desc_destroy(d40c, d40d);
+	}
+}
+
+/* Fills the descriptor pool of a channel that is being allocated */
+static void d40_desc_pool_fill(struct d40_chan *d40c)
+{
+	unsigned long flags;
+	LIST_HEAD(pool);
+	int n;
+
+	for (n = 0; n < D40_DESC_POOL_SIZE; n++) {
+		struct d40_desc *d40d = d40_desc_create(d40c);
+
+		if (d40d == NULL)
+			break;
+		list_add(&d40d->node, &pool);
+	}
+
+	spin_lock_irqsave(&d40c->lock, flags);
+	list_splice(&pool, &d40c->free);
+	d40c->free_len += n;
+	spin_unlock_irqrestore(&d40c->lock, flags);
+}
+
+/* Called with the channel lock held */
+static void d40_desc_pool_empty(struct d40_chan *d40c)
+{
+	struct d40_desc *d;
+	struct d40_desc *_d;
+
+	list_for_each_entry_safe(d, _d, &d40c->free, node) {
+		d40_desc_remove(d);
+		d40_desc_destroy(d40c, d);
+	}
+	d40c->free_len = 0;
 }
 
 static void d40_desc_submit(struct d40_chan *d40c, struct d40_desc *desc)
@@ -988,6 +1106,14 @@ static void d40_term_all(struct d40_chan *d40c)
 		d40_desc_free(d40c, d40d);
 	}
 
+	/* Release descriptors prepared but never submitted */
+	while (!list_empty(&d40c->prepare_queue)) {
+		d40d = list_first_entry(&d40c->prepare_queue,
+					struct d40_desc, node);
+		d40_desc_remove(d40d);
+		d40_desc_free(d40c, d40d);
+	}
+
 	d40c->pending_tx = 0;
 }
 
@@ -1284,6 +1410,7 @@ static dma_cookie_t d40_tx_submit(struct dma_async_tx_descriptor *tx)
 
 	d40d->txd.cookie = d40c->chan.cookie;
 
+	d40_desc_remove(d40d);
 	d40_desc_queue(d40c, d40d);
 
 	spin_unlock_irqrestore(&d40c->lock, flags);
@@ -2053,7 +2180,7 @@ struct dma_async_tx_descriptor *stedma40_memcpy_sg(struct dma_chan *chan,
 
 	if (chan_is_logical(d40c)) {
 
-		if (d40_pool_lli_alloc(d40d, sgl_len, true) < 0) {
+		if (d40_pool_lli_alloc(d40c, d40d, sgl_len, true) < 0) {
 			dev_err(&d40c->chan.dev->device,
 				"[%s] Out of memory\n", __func__);
 			goto err;
@@ -2071,7 +2198,7 @@ struct dma_async_tx_descriptor *stedma40_memcpy_sg(struct dma_chan *chan,
 					 d40c->log_def.lcsp3,
 					 d40c->dma_cfg.dst_info.data_width);
 	} else {
-		if (d40_pool_lli_alloc(d40d, sgl_len, false) < 0) {
+		if (d40_pool_lli_alloc(d40c, d40d, sgl_len, false) < 0) {
 			dev_err(&d40c->chan.dev->device,
 				"[%s] Out of memory\n", __func__);
 			goto err;
@@ -2114,6 +2241,7 @@ struct dma_async_tx_descriptor *stedma40_memcpy_sg(struct dma_chan *chan,
 
 	d40d->txd.tx_submit = d40_tx_submit;
 
+	list_add_tail(&d40d->node, &d40c->prepare_queue);
 	spin_unlock_irqrestore(&d40c->lock, flags);
 
 	return &d40d->txd;
@@ -2194,6 +2322,9 @@ static int d40_alloc_chan_resources(struct dma_chan *chan)
 
 	d40_usage_inc(d40c);
 
+	/* Keeps prep from allocating memory in the common case */
+	d40_desc_pool_fill(d40c);
+
 	spin_lock_irqsave(&d40c->lock, flags);
 
 	d40c->completed = chan->cookie = 1;
@@ -2250,6 +2381,8 @@ static int d40_alloc_chan_resources(struct dma_chan *chan)
 	if (is_free_phy)
 		d40_config_write(d40c);
 fail:
+	if (err)
+		d40_desc_pool_empty(d40c);
 	d40_usage_dec(d40c);
 	spin_unlock_irqrestore(&d40c->lock, flags);
 #ifdef MMC_HOST_DEBUGGING
@@ -2286,6 +2419,8 @@ static void d40_free_chan_resources(struct dma_chan *chan)
 	if (err)
 		dev_err(&d40c->chan.dev->device,
 			"[%s] Failed to free channel\n", __func__);
+
+	d40_desc_pool_empty(d40c);
 	spin_unlock_irqrestore(&d40c->lock, flags);
 }
 
@@ -2397,7 +2532,7 @@ static struct dma_async_tx_descriptor *d40_prep_memcpy(struct dma_chan *chan,
 
 	if (chan_is_logical(d40c)) {
 
-		if (d40_pool_lli_alloc(d40d, 1, true) < 0) {
+		if (d40_pool_lli_alloc(d40c, d40d, 1, true) < 0) {
 			dev_err(&d40c->chan.dev->device,
 				"[%s] Out of memory\n", __func__);
 			goto err2;
@@ -2421,7 +2556,7 @@ static struct dma_async_tx_descriptor *d40_prep_memcpy(struct dma_chan *chan,
 
 	} else {
 
-		if (d40_pool_lli_alloc(d40d, 1, false) < 0) {
+		if (d40_pool_lli_alloc(d40c, d40d, 1, false) < 0) {
 			dev_err(&d40c->chan.dev->device,
 				"[%s] Out of memory\n", __func__);
 			goto err2;
@@ -2457,6 +2592,7 @@ static struct dma_async_tx_descriptor *d40_prep_memcpy(struct dma_chan *chan,
 	}
 
 	d40_usage_dec(d40c);
+	list_add_tail(&d40d->node, &d40c->prepare_queue);
 	spin_unlock_irqrestore(&d40c->lock, flags);
 	return &d40d->txd;
 
@@ -2530,7 +2666,7 @@ static int d40_prep_slave_sg_log(struct d40_desc *d40d,
 	dma_addr_t dev_addr = 0;
 	int total_size;
 
-	if (d40_pool_lli_alloc(d40d, sg_len, true) < 0) {
+	if (d40_pool_lli_alloc(d40c, d40d, sg_len, true) < 0) {
 		dev_err(&d40c->chan.dev->device,
 			"[%s] Out of memory\n", __func__);
 		return -ENOMEM;
@@ -2570,7 +2706,7 @@ static int d40_prep_slave_sg_phy(struct d40_desc *d40d,
 	dma_addr_t dst_dev_addr;
 	int res;
 
-	if (d40_pool_lli_alloc(d40d, sgl_len, false) < 0) {
+	if (d40_pool_lli_alloc(d40c, d40d, sgl_len, false) < 0) {
 		dev_err(&d40c->chan.dev->device,
 			"[%s] Out of memory\n", __func__);
 		return -ENOMEM;
@@ -2666,6 +2802,7 @@ d40_prep_slave_sg(struct dma_chan *chan, struct scatterlist *sgl,
 
 	d40d->txd.tx_submit = d40_tx_submit;
 
+	list_add_tail(&d40d->node, &d40c->prepare_queue);
 	spin_unlock_irqrestore(&d40c->lock, flags);
 	return &d40d->txd;
 
@@ -3172,7 +3309,9 @@ static void __init d40_chan_init(struct d40_base *base, struct dma_device *dma,
 		INIT_LIST_HEAD(&d40c->done);
 		INIT_LIST_HEAD(&d40c->active);
 		INIT_LIST_HEAD(&d40c->queue);
+		INIT_LIST_HEAD(&d40c->prepare_queue);
 		INIT_LIST_HEAD(&d40c->client);
+		INIT_LIST_HEAD(&d40c->free);
 
 		tasklet_init(&d40c->tasklet, dma_tasklet,
 			     (unsigned long) d40c);
@@ -3741,6 +3880,63 @@ failure:
 	return ret;
 }
 
+#ifdef CONFIG_DEBUG_FS
+static void d40_desc_stats_chan(struct seq_file *s, struct d40_chan *d40c,
+				const char *type, int num)
+{
+	if (!d40c->desc_reused && !d40c->desc_allocated &&
+	    !d40c->lli_allocated && !d40c->free_len)
+		return;
+
+	seq_printf(s, "%s%-3d %10lu %10lu %10lu %5d\n", type, num,
+		   d40c->desc_reused, d40c->desc_allocated,
+		   d40c->lli_allocated, d40c->free_len);
+}
+
+static int d40_desc_stats_show(struct seq_file *s, void *data)
+{
+	struct d40_base *base = s->private;
+	int i;
+
+	seq_printf(s, "%-6s %10s %10s %10s %5s\n", "chan", "reused",
+		   "desc_alloc", "lli_alloc", "free");
+
+	for (i = 0; i < base->num_phy_chans; i++)
+		d40_desc_stats_chan(s, &base->phy_chans[i], "phy", i);
+	for (i = 0; i < base->num_log_chans; i++)
+		d40_desc_stats_chan(s, &base->log_chans[i], "log", i);
+
+	return 0;
+}
+
+static int d40_desc_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, d40_desc_stats_show, inode->i_private);
+}
+
+static const struct file_operations d40_desc_stats_fops = {
+	.open = d40_desc_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void __init d40_debugfs_init(struct d40_base *base)
+{
+	struct dentry *dir = debugfs_create_dir(D40_NAME, NULL);
+
+	if (IS_ERR_OR_NULL(dir))
+		return;
+
+	debugfs_create_file("desc_stats", S_IRUGO, dir, base,
+			    &d40_desc_stats_fops);
+}
+#else
+static inline void d40_debugfs_init(struct d40_base *base)
+{
+}
+#endif
+
 static int __init d40_probe(struct platform_device *pdev)
 {
 	int err;
@@ -3891,6 +4087,7 @@ static int __init d40_probe(struct platform_device *pdev)
 #ifdef MMC_HOST_DEBUGGING
 	_base = base;
 #endif
+	d40_debugfs_init(base);
 	dev_info(base->dev, "initialized\n");
 	return 0;
 
@@ -0,0 +1,246 @@
+/*
+ * Copyright (C) ST-Ericsson SA 2011
+ * License terms: GNU General Public License (GPL) version 2
+ *
+ * Memory to memory copy offload on a DMA40 logical memcpy channel, for
+ * kernel clients that copy in bulk. Copies below a size threshold, or ones
+ * the channel cannot take, are done by the CPU.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/dmaengine.h>
+#include <linux/dma-mapping.h>
+#include <linux/scatterlist.h>
+#include <linux/highmem.h>
+#include <linux/completion.h>
+#include <linux/slab.h>
+#include <linux/err.h>
+
+#include <plat/ste_dma40.h>
+
+/* Longest element of a logical channel transfer, in bytes (byte width) */
+#define COPY_MAX_ELEM 0xFFFF
+
+/* Copies shorter than this, in bytes, are done by the CPU */
+static unsigned int threshold = 16384;
+module_param(threshold, uint, S_IRUGO | S_IWUSR);
+MODULE_PARM_DESC(threshold, "Smallest copy offloaded to DMA (bytes)");
+
+static struct dma_chan *copy_chan;
+
+struct copy_req {
+	struct scatterlist *sgl_dst;
+	struct scatterlist *sgl_src;
+	unsigned int sgl_len;
+	void (*callback)(void *param, int status);
+	void *param;
+};
+
+static void cpu_copy_elem(struct scatterlist *dst, struct scatterlist *src)
+{
+	struct page *dpage = sg_page(dst);
+	struct page *spage = sg_page(src);
+	unsigned int doff = dst->offset;
+	unsigned int soff = src->offset;
+	unsigned int left = src->length;
+
+	while (left) {
+		unsigned int len;
+		void *d;
+		void *s;
+
+		dpage += doff >> PAGE_SHIFT;
+		doff &= ~PAGE_MASK;
+		spage += soff >> PAGE_SHIFT;
+		soff &= ~PAGE_MASK;
+
+		len = min_t(unsigned int, left, PAGE_SIZE - max(doff, soff));
+
+		d = kmap_atomic(dpage, KM_USER0);
+		s = kmap_atomic(spage, KM_USER1);
+		memcpy(d + doff, s + soff, len);
+		kunmap_atomic(s, KM_USER1);
+		kunmap_atomic(d, KM_USER0);
+		flush_dcache_page(dpage);
+
+		doff += len;
+		soff += len;
+		left -= len;
+	}
+}
+
+static void cpu_copy_sg(struct scatterlist *sgl_dst,
+			struct scatterlist *sgl_src, unsigned int sgl_len)
+{
+	struct scatterlist *dst = sgl_dst;
+	struct scatterlist *src;
+	int i;
+
+	for_each_sg(sgl_src, src, sgl_len, i) {
+		cpu_copy_elem(dst, src);
+		dst = sg_next(dst);
+	}
+}
+
+static void copy_done(void *data)
+{
+	struct copy_req *req = data;
+	struct device *dev = copy_chan->device->dev;
+
+	dma_unmap_sg(dev, req->sgl_src, req->sgl_len, DMA_TO_DEVICE);
+	dma_unmap_sg(dev, req->sgl_dst, req->sgl_len, DMA_FROM_DEVICE);
+
+	req->callback(req->param, 0);
+	kfree(req);
+}
+
+/* Returns true if the channel can take the copy in one descriptor */
+static bool dma_copy_ok(struct scatterlist *sgl_dst,
+			struct scatterlist *sgl_src, unsigned int sgl_len)
+{
+	struct dma_device *dev = copy_chan->device;
+	struct scatterlist *dst = sgl_dst;
+	struct scatterlist *src;
+	size_t size = 0;
+	int i;
+
+	for_each_sg(sgl_src, src, sgl_len, i) {
+		if (src->length != dst->length || src->length > COPY_MAX_ELEM ||
+				!is_dma_copy_aligned(dev, src->offset,
+						dst->offset, src->length))
+			return false;
+		size += src->length;
+		dst = sg_next(dst);
+	}
+
+	return size >= threshold;
+}
+
+static int dma_copy_sg(struct scatterlist *sgl_dst,
+			struct scatterlist *sgl_src, unsigned int sgl_len,
+			void (*callback)(void *param, int status), void *param)
+{
+	struct device *dev = copy_chan->device->dev;
+	struct dma_async_tx_descriptor *desc;
+	struct copy_req *req;
+	dma_cookie_t cookie;
+
+	req = kmalloc(sizeof(*req), GFP_KERNEL);
+	if (!req)
+		return -ENOMEM;
+
+	req->sgl_dst = sgl_dst;
+	req->sgl_src = sgl_src;
+	req->sgl_len = sgl_len;
+	req->callback = callback;
+	req->param = param;
+
+	if (dma_map_sg(dev, sgl_src, sgl_len, DMA_TO_DEVICE) != sgl_len)
+		goto map_src_failed;
+	if (dma_map_sg(dev, sgl_dst, sgl_len, DMA_FROM_DEVICE) != sgl_len)
+		goto map_dst_failed;
+
+	desc = stedma40_memcpy_sg(copy_chan, sgl_dst, sgl_src, sgl_len,
+							DMA_PREP_INTERRUPT);
+	if (IS_ERR_OR_NULL(desc))
+		goto prep_failed;
+
+	desc->callback = copy_done;
+	desc->callback_param = req;
+
+	cookie = desc->tx_submit(desc);
+	if (dma_submit_error(cookie))
+		goto prep_failed;
+
+	dma_async_issue_pending(copy_chan);
+
+	return 0;
+
+prep_failed:
+	dma_unmap_sg(dev, sgl_dst, sgl_len, DMA_FROM_DEVICE);
+map_dst_failed:
+	dma_unmap_sg(dev, sgl_src, sgl_len, DMA_TO_DEVICE);
+map_src_failed:
+	kfree(req);
+	return -EBUSY;
+}
+
+int stedma40_copy_sg(struct scatterlist *sgl_dst,
+		     struct scatterlist *sgl_src,
+		     unsigned int sgl_len,
+		     void (*callback)(void *param, int status),
+		     void *param)
+{
+	if (!sgl_len || !callback)
+		return -EINVAL;
+
+	if (copy_chan && dma_copy_ok(sgl_dst, sgl_src, sgl_len) &&
+			!dma_copy_sg(sgl_dst, sgl_src, sgl_len, callback, param))
+		return 0;
+
+	cpu_copy_sg(sgl_dst, sgl_src, sgl_len);
+	callback(param, 0);
+
+	return 0;
+}
+EXPORT_SYMBOL(stedma40_copy_sg);
+
+static void copy_pages_done(void *param, int status)
+{
+	complete(param);
+}
+
+int stedma40_copy_pages(struct page **dst, struct page **src,
+			unsigned int nr_pages)
+{
+	struct scatterlist *sgl;
+	struct completion done;
+	unsigned int i;
+	int ret;
+
+	if (!nr_pages)
+		return 0;
+
+	sgl = kmalloc(2 * nr_pages * sizeof(*sgl), GFP_KERNEL);
+	if (!sgl) {
+		for (i = 0; i < nr_pages; i++)
+			copy_highpage(dst[i], src[i]);
+		return 0;
+	}
+
+	sg_init_table(sgl, nr_pages);
+	sg_init_table(sgl + nr_pages, nr_pages);
+	for (i = 0; i < nr_pages; i++) {
+		sg_set_page(&sgl[i], dst[i], PAGE_SIZE, 0);
+		sg_set_page(&sgl[nr_pages + i], src[i], PAGE_SIZE, 0);
+	}
+
+	init_completion(&done);
+	ret = stedma40_copy_sg(sgl, sgl + nr_pages, nr_pages,
+						copy_pages_done, &done);
+	if (!ret)
+		wait_for_completion(&done);
+
+	kfree(sgl);
+
+	return ret;
+}
+EXPORT_SYMBOL(stedma40_copy_pages);
+
+static int __init stedma40_copy_init(void)
+{
+	dma_cap_mask_t mask;
+
+	dma_cap_zero(mask);
+	dma_cap_set(DMA_MEMCPY, mask);
+
+	/* No configuration selects the logical memcpy setup */
+	copy_chan = dma_request_channel(mask, stedma40_filter, NULL);
+	if (!copy_chan)
+		pr_info("ste_dma40_copy: No memcpy channel, using the CPU\n");
+
+	return 0;
+}
+late_initcall(stedma40_copy_init);
@@ -0,0 +1,318 @@
+/*
+ * Copyright (C) ST-Ericsson SA 2011
+ * License terms: GNU General Public License (GPL) version 2
+ *
+ * Measures DMA40 memory to memory copies against memcpy, to tune the
+ * threshold of ste_dma40_copy, and checks stedma40_copy_sg() and
+ * stedma40_copy_pages() on both sides of that threshold. Runs when loaded,
+ * results are printed.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/init.h>
+#include <linux/dmaengine.h>
+#include <linux/dma-mapping.h>
+#include <linux/scatterlist.h>
+#include <linux/completion.h>
+#include <linux/gfp.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/ktime.h>
+#include <linux/err.h>
+#include <asm/div64.h>
+
+#include <plat/ste_dma40.h>
+
+static unsigned int min_size = 1024;
+module_param(min_size, uint, S_IRUGO);
+MODULE_PARM_DESC(min_size, "Smallest copy size, doubled up to max_size");
+
+static unsigned int max_size = 1024 * 1024;
+module_param(max_size, uint, S_IRUGO);
+MODULE_PARM_DESC(max_size, "Largest copy size (default: 1 MiB)");
+
+static unsigned int iterations = 100;
+module_param(iterations, uint, S_IRUGO);
+MODULE_PARM_DESC(iterations, "Copies per size (default: 100)");
+
+struct copy_test_result {
+	struct completion done;
+	int status;
+};
+
+static void copy_test_done(void *param)
+{
+	complete(param);
+}
+
+static void copy_test_sg_done(void *param, int status)
+{
+	struct copy_test_result *result = param;
+
+	result->status = status;
+	complete(&result->done);
+}
+
+/* Fills size bytes of buf with a pattern that varies with the position */
+static void copy_test_fill(u8 *buf, unsigned int size, unsigned int seed)
+{
+	unsigned int i;
+
+	for (i = 0; i < size; i++)
+		buf[i] = (u8)(i + (i >> 8) + seed);
+}
+
+/* Splits size bytes of buf into page sized elements */
+static void copy_test_sg(struct scatterlist *sgl, struct page *buf,
+							unsigned int size)
+{
+	unsigned int nents = DIV_ROUND_UP(size, PAGE_SIZE);
+	unsigned int i;
+
+	sg_init_table(sgl, nents);
+	for (i = 0; i < nents; i++)
+		sg_set_page(&sgl[i], buf + i,
+				min_t(unsigned int, size - i * PAGE_SIZE,
+							PAGE_SIZE), 0);
+}
+
+static int copy_test_dma(struct dma_chan *chan, struct page *dst,
+				struct page *src, unsigned int size)
+{
+	struct device *dev = chan->device->dev;
+	unsigned int nents = DIV_ROUND_UP(size, PAGE_SIZE);
+	struct dma_async_tx_descriptor *desc;
+	struct scatterlist *sgl;
+	struct completion done;
+	int ret = 0;
+
+	sgl = kmalloc(2 * nents * sizeof(*sgl), GFP_KERNEL);
+	if (!sgl)
+		return -ENOMEM;
+
+	copy_test_sg(sgl, dst, size);
+	copy_test_sg(sgl + nents, src, size);
+	dma_map_sg(dev, sgl + nents, nents, DMA_TO_DEVICE);
+	dma_map_sg(dev, sgl, nents, DMA_FROM_DEVICE);
+
+	desc = stedma40_memcpy_sg(chan, sgl, sgl + nents, nents,
+							DMA_PREP_INTERRUPT);
+	if (IS_ERR_OR_NULL(desc)) {
+		ret = -EBUSY;
+		goto out;
+	}
+
+	init_completion(&done);
+	desc->callback = copy_test_done;
+	desc->callback_param = &done;
+	if (dma_submit_error(desc->tx_submit(desc))) {
+		ret = -EBUSY;
+		goto out;
+	}
+	dma_async_issue_pending(chan);
+
+	if (!wait_for_completion_timeout(&done, msecs_to_jiffies(1000))) {
+		chan->device->device_control(chan, DMA_TERMINATE_ALL, 0);
+		ret = -ETIMEDOUT;
+	}
+
+out:
+	dma_unmap_sg(dev, sgl, nents, DMA_FROM_DEVICE);
+	dma_unmap_sg(dev, sgl + nents, nents, DMA_TO_DEVICE);
+	kfree(sgl);
+	return ret;
+}
+
+/* Copies through stedma40_copy_sg(), which must call back on either path */
+static int copy_test_copy_sg(struct dma_chan *chan, struct page *dst,
+				struct page *src, unsigned int size)
+{
+	unsigned int nents = DIV_ROUND_UP(size, PAGE_SIZE);
+	struct copy_test_result result;
+	struct scatterlist *sgl;
+	int ret;
+
+	sgl = kmalloc(2 * nents * sizeof(*sgl), GFP_KERNEL);
+	if (!sgl)
+		return -ENOMEM;
+
+	copy_test_sg(sgl, dst, size);
+	copy_test_sg(sgl + nents, src, size);
+
+	init_completion(&result.done);
+	result.status = -EINPROGRESS;
+	ret = stedma40_copy_sg(sgl, sgl + nents, nents, copy_test_sg_done,
+								&result);
+	if (!ret) {
+		if (wait_for_completion_timeout(&result.done,
+						msecs_to_jiffies(1000)))
+			ret = result.status;
+		else
+			ret = -ETIMEDOUT; /* no callback, sgl may still be used */
+	}
+
+	if (ret != -ETIMEDOUT)
+		kfree(sgl);
+	return ret;
+}
+
+/* Copies the whole pages of size through stedma40_copy_pages() */
+static int copy_test_copy_pages(struct dma_chan *chan, struct page *dst,
+				struct page *src, unsigned int size)
+{
+	unsigned int nr_pages = size / PAGE_SIZE;
+	struct page **pages;
+	unsigned int i;
+	int ret;
+
+	pages = kmalloc(2 * nr_pages * sizeof(*pages), GFP_KERNEL);
+	if (!pages)
+		return -ENOMEM;
+
+	for (i = 0; i < nr_pages; i++) {
+		pages[i] = dst + i;
+		pages[nr_pages + i] = src + i;
+	}
+	ret = stedma40_copy_pages(pages, pages + nr_pages, nr_pages);
+
+	kfree(pages);
+	return ret;
+}
+
+/* Returns MB/s (bytes/us) for iterations copies of size bytes in ns */
+static unsigned long copy_test_rate(unsigned int size, s64 ns)
+{
+	u64 bytes = (u64)size * iterations;
+
+	do_div(bytes, (u32)max_t(s64, ns / NSEC_PER_USEC, 1));
+	return (unsigned long)bytes;
+}
+
+/*
+ * Times iterations copies of size bytes with copy and checks the result.
+ * Returns 0 and the rate in MB/s, or a negative errno.
+ */
+static int copy_test_run(const char *name,
+		int (*copy)(struct dma_chan *chan, struct page *dst,
+				struct page *src, unsigned int size),
+		struct dma_chan *chan, struct page *dst, struct page *src,
+		unsigned int size, unsigned long *rate)
+{
+	ktime_t start;
+	s64 ns = 0;
+	unsigned int i;
+	int ret;
+
+	/* Clear dst so that only what is copied can match src */
+	for (i = 0; i < iterations; i++) {
+		memset(page_address(dst), 0, size);
+		start = ktime_get();
+		ret = copy(chan, dst, src, size);
+		ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+		if (ret) {
+			pr_err("ste_dma40_copy_test: %s copy of %u bytes "
+					"failed (%d)\n", name, size, ret);
+			return ret;
+		}
+	}
+
+	if (memcmp(page_address(dst), page_address(src), size)) {
+		pr_err("ste_dma40_copy_test: %s copy of %u bytes "
+					"is corrupt\n", name, size);
+		return -EIO;
+	}
+
+	*rate = copy_test_rate(size, ns);
+	return 0;
+}
+
+static int __init copy_test_init(void)
+{
+	struct dma_chan *chan;
+	dma_cap_mask_t mask;
+	struct page *src;
+	struct page *dst;
+	unsigned int order = get_order(max_size);
+	unsigned int size;
+	unsigned int i;
+	int ret = 0;
+
+	if (!min_size || min_size > max_size || !iterations)
+		return -EINVAL;
+
+	dma_cap_zero(mask);
+	dma_cap_set(DMA_MEMCPY, mask);
+	chan = dma_request_channel(mask, stedma40_filter, NULL);
+	if (!chan) {
+		pr_err("ste_dma40_copy_test: No memcpy channel\n");
+		return -ENODEV;
+	}
+
+	src = alloc_pages(GFP_KERNEL, order);
+	dst = alloc_pages(GFP_KERNEL, order);
+	if (!src || !dst) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	/*
+	 * copy_sg and copy_pages go through ste_dma40_copy, which uses the
+	 * CPU below its threshold; the default sizes cover both sides of its
+	 * default 16 KiB. copy_pages is 0 below a whole page.
+	 */
+	pr_info("ste_dma40_copy_test: %10s %10s %10s %10s %10s\n", "bytes",
+			"dma MB/s", "sg MB/s", "pages MB/s", "cpu MB/s");
+
+	for (size = min_size; size <= max_size; size <<= 1) {
+		unsigned long dma_rate;
+		unsigned long sg_rate;
+		unsigned long pages_rate = 0;
+		ktime_t start;
+		s64 cpu_ns;
+
+		copy_test_fill(page_address(src), size, fls(size));
+
+		ret = copy_test_run("DMA", copy_test_dma, chan, dst, src,
+							size, &dma_rate);
+		if (ret)
+			break;
+		ret = copy_test_run("copy_sg", copy_test_copy_sg, chan, dst,
+							src, size, &sg_rate);
+		if (ret)
+			break;
+		if (size >= PAGE_SIZE) {
+			ret = copy_test_run("copy_pages", copy_test_copy_pages,
+					chan, dst, src, size & PAGE_MASK,
+					&pages_rate);
+			if (ret)
+				break;
+		}
+
+		start = ktime_get();
+		for (i = 0; i < iterations; i++)
+			memcpy(page_address(dst), page_address(src), size);
+		cpu_ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+
+		pr_info("ste_dma40_copy_test: %10u %10lu %10lu %10lu %10lu\n",
+					size, dma_rate, sg_rate, pages_rate,
+					copy_test_rate(size, cpu_ns));
+	}
+
+out:
+	if (dst)
+		__free_pages(dst, order);
+	if (src)
+		__free_pages(src, order);
+	dma_release_channel(chan);
+	return ret;
+}
+module_init(copy_test_init);
+
+static void __exit copy_test_exit(void)
+{
+}
+module_exit(copy_test_exit);
+
+MODULE_DESCRIPTION("DMA40 copy offload benchmark");
+MODULE_LICENSE("GPL");
@@ -20,12 +20,12 @@
 #include <linux/mutex.h>
 #include <linux/wait.h>
 #include <linux/sched.h>
+#include <linux/poll.h>
 
 #include <linux/dispdev.h>
 #include <linux/hwmem.h>
 #include <video/mcde_dss.h>
 
-#define DENSITY_CHECK (16)
 #define MAX_BUFFERS 4
 
 static LIST_HEAD(dev_list);
@@ -33,9 +33,9 @@ static DEFINE_MUTEX(dev_list_lock);
 
 enum buffer_state {
 	BUF_UNUSED = 0,
-	BUF_QUEUED,
+	BUF_QUEUED, /* Waiting for its fence, see fence_done */
 	BUF_ACTIVATED,
-/*TODO:waitfordone	BUF_DEACTIVATED,*/
+	BUF_DEACTIVATED, /* Replaced, free once frame retire_seq is done */
 	BUF_FREE,
 	BUF_DEQUEUED,
 };
@@ -45,6 +45,7 @@ struct dispdev_buffer {
 	u32 size;
 	enum buffer_state state;
 	u32 paddr; /* if pinned */
+	u32 retire_seq;
 };
 
 struct dispdev {
@@ -59,6 +60,10 @@ struct dispdev {
 	bool overlay;
 	struct dispdev_buffer buffers[MAX_BUFFERS];
 	wait_queue_head_t waitq_dq;
+	struct mcde_chnl_frame_listener frame_listener;
+	bool frame_listener_added;
+	u32 done_seq;
+	struct mcde_overlay_fence_listener fence_listener;
 	/*
 	 * For the rotation use case
 	 * buffers_need_update is used to ensure that a set_config that
@@ -83,6 +88,92 @@ static int find_buf(struct dispdev *dd, enum buffer_state state)
 	return -1;
 }
 
+static bool buf_retired(struct dispdev *dd, struct dispdev_buffer *buf)
+{
+	return buf->state == BUF_DEACTIVATED &&
+		(s32)(ACCESS_ONCE(dd->done_seq) - buf->retire_seq) >= 0;
+}
+
+/* Free buffer or one that is no longer scanned out, -1 if none */
+static int find_dequeueable_buf(struct dispdev *dd)
+{
+	int i;
+	for (i = 0; i < MAX_BUFFERS; i++)
+		if (dd->buffers[i].state == BUF_FREE ||
+						buf_retired(dd, &dd->buffers[i]))
+			return i;
+	return -1;
+}
+
+static void frame_done(struct mcde_chnl_frame_listener *listener, u32 seq,
+								int status)
+{
+	struct dispdev *dd = container_of(listener, struct dispdev,
+								frame_listener);
+
+	ACCESS_ONCE(dd->done_seq) = seq;
+	wake_up(&dd->waitq_dq);
+}
+
+/* The buffer waiting for its fence is replaced, give it back unshown */
+static void drop_queued_buf(struct dispdev *dd)
+{
+	int i;
+
+	i = find_buf(dd, BUF_QUEUED);
+	if (i >= 0) {
+		dd->buffers[i].state = BUF_FREE;
+		wake_up(&dd->waitq_dq);
+	}
+}
+
+/* The active buffer is scanned out until the frame of update seq is done */
+static void retire_active_buf(struct dispdev *dd, u32 seq)
+{
+	int i;
+
+	i = find_buf(dd, BUF_ACTIVATED);
+	if (i < 0)
+		return;
+
+	if (seq) {
+		dd->buffers[i].state = BUF_DEACTIVATED;
+		dd->buffers[i].retire_seq = seq;
+	} else {
+		dd->buffers[i].state = BUF_FREE;
+		wake_up(&dd->waitq_dq);
+	}
+}
+
+/* Work context, the fence of the queued buffer has been signaled */
+static void fence_done(struct mcde_overlay_fence_listener *listener, u32 seq,
+								int status)
+{
+	struct dispdev *dd = container_of(listener, struct dispdev,
+								fence_listener);
+	int i;
+
+	mutex_lock(&dd->lock);
+
+	/* Replaced or released meanwhile */
+	i = find_buf(dd, BUF_QUEUED);
+	if (i < 0)
+		goto out;
+
+	if (status) {
+		/* Not shown, the active buffer stays on the display */
+		dd->buffers[i].state = BUF_FREE;
+		wake_up(&dd->waitq_dq);
+		goto out;
+	}
+
+	/* Frame done events are only seen with the frame listener */
+	retire_active_buf(dd, dd->frame_listener_added ? seq : 0);
+	dd->buffers[i].state = BUF_ACTIVATED;
+out:
+	mutex_unlock(&dd->lock);
+}
+
 int dispdev_open(struct inode *inode, struct file *file)
 {
 	int ret;
@@ -111,6 +202,10 @@ int dispdev_open(struct inode *inode, struct file *file)
 	if (ret)
 		return ret;
 
+	/* Without frame done events buffers are updated synchronously */
+	dd->frame_listener_added = !mcde_dss_add_frame_listener(dd->ddev,
+							&dd->frame_listener);
+
 	file->private_data = dd;
 
 	return 0;
@@ -132,6 +227,9 @@ int dispdev_release(struct inode *inode, struct file *file)
 
 	/* TODO: Make sure it waits for completion */
 	mcde_dss_disable_overlay(dd->ovly);
+	if (dd->frame_listener_added)
+		mcde_dss_remove_frame_listener(dd->ddev, &dd->frame_listener);
+	dd->frame_listener_added = false;
 	for (i = 0; i < MAX_BUFFERS; i++) {
 		if (dd->buffers[i].paddr)
 			hwmem_unpin(dd->buffers[i].alloc);
@@ -213,6 +311,7 @@ static int dispdev_set_config(struct dispdev *dd, struct dispdev_config *cfg)
 				mcde_dss_get_video_mode(dd->ddev, &vmode);
 				get_ovly_info(cfg, &vmode, &info, dd->overlay);
 				info.paddr = buf->paddr;
+				drop_queued_buf(dd);
 				ret = mcde_dss_apply_overlay(dd->ovly, &info);
 				if (!ret)
 					mcde_dss_update_overlay(dd->ovly,
@@ -272,6 +371,10 @@ static int dispdev_unregister_buffer(struct dispdev *dd, u32 buf_idx)
 	if (buf->state == BUF_UNUSED)
 		return -EINVAL;
 
+	/* Its update may already be in progress */
+	if (buf->state == BUF_QUEUED)
+		return -EBUSY;
+
 	if (dd->buffers_need_update)
 		dd->buffers_need_update = false;
 
@@ -285,6 +388,8 @@ static int dispdev_unregister_buffer(struct dispdev *dd, u32 buf_idx)
 		mcde_dss_apply_overlay(dd->ovly, &info);
 		mcde_dss_update_overlay(dd->ovly, false);
 		hwmem_unpin(dd->buffers[buf_idx].alloc);
+	} else if (buf->state == BUF_DEACTIVATED) {
+		hwmem_unpin(buf->alloc);
 	}
 
 	hwmem_release(buf->alloc);
@@ -297,48 +402,13 @@ static int dispdev_unregister_buffer(struct dispdev *dd, u32 buf_idx)
 	return 0;
 }
 
-
-/**
- * @brief Check if the buffer is transparent or black (ARGB = X000)
- *        Note: Only for ARGB32.
- *        Worst case: a ~full transparent buffer
- *        Results: ~2200us @800Mhz for a WVGA screen, with DENSITY_CHECK=8
- *                 ~520us  @800Mhz for a WVGA screen, with DENSITY_CHECK=16
- *
- * @param w witdh
- * @param h height
- * @param addr buffer addr
- *
- * @return 1 if the buffer is transparent, else 0
- */
-static int is_transparent(int w, int h, u32 *addr)
-{
-	int i, j;
-	u32 *c, *next_line;
-	u32 sum;
-
-	next_line = addr;
-	sum = 0;
-
-	/* TODO Optimize me */
-	for (j = 0; j < h; j += DENSITY_CHECK) {
-		c = next_line;
-		for (i = 0; i < w; i += DENSITY_CHECK) {
-			sum += ((*c) & 0x00FFFFFF);
-			c += DENSITY_CHECK;
-		}
-		if (sum)
-			return 0; /* Not "transparent" */
-		next_line += (w * DENSITY_CHECK);
-	}
-
-	return 1; /* "Transparent" */
-}
-
 static int dispdev_queue_buffer(struct dispdev *dd,
-					struct dispdev_buffer_info *buffer)
+					struct dispdev_buffer_info *buffer,
+					struct hwmem_fence *fence)
 {
-	int ret, i;
+	int ret;
+	u32 seq = 0;
+	bool queued = false;
 	struct mcde_overlay_info info;
 	struct hwmem_mem_chunk mem_chunk;
 	size_t mem_chunk_length = 1;
@@ -366,12 +436,6 @@ static int dispdev_queue_buffer(struct dispdev *dd,
 	if (ret)
 		dev_warn(dd->mdev.this_device, "Set domain failed, %d\n", ret);
 
-	i = find_buf(dd, BUF_ACTIVATED);
-	if (i >= 0) {
-		dd->buffers[i].state = BUF_FREE;
-		wake_up(&dd->waitq_dq);
-	}
-
 	if (!dd->first_update) {
 		dd->first_update = true;
 		dd->buffers_need_update = false;
@@ -385,20 +449,38 @@ static int dispdev_queue_buffer(struct dispdev *dd,
 			dd->config.format == buffer->buf_cfg.format &&
 			dd->config.stride == buffer->buf_cfg.stride) {
 		info.paddr = mem_chunk.paddr;
-		mcde_dss_apply_overlay(dd->ovly, &info);
-		mcde_dss_update_overlay(dd->ovly, false);
+		drop_queued_buf(dd);
+		if (fence) {
+			/* Shown from fence_done, once the buffer is ready */
+			ret = mcde_dss_update_overlay_fenced(dd->ovly, &info,
+						fence, &dd->fence_listener);
+			if (ret) {
+				hwmem_unpin(alloc);
+				dd->buffers[buf_idx].paddr = 0;
+				return ret;
+			}
+			queued = true;
+		} else {
+			mcde_dss_apply_overlay(dd->ovly, &info);
+			if (dd->frame_listener_added)
+				mcde_dss_update_overlay_async(dd->ovly, &seq);
+			else
+				mcde_dss_update_overlay(dd->ovly, false);
+		}
 	} else {
 		/* skip overlay update */
 		dd->buffers_need_update = true;
 	}
 
+	if (!queued)
+		retire_active_buf(dd, seq);
+
 	/* Disable the MCDE FB overlay */
 	if ((dd->parent_ovly->state != NULL) &&
 			(dd->ddev->check_transparency)) {
 		dd->ddev->check_transparency--;
-		mcde_dss_get_overlay_info(dd->parent_ovly, &info);
 		if (dd->ddev->check_transparency == 0) {
-			if (is_transparent(info.w, info.h, info.vaddr)) {
+			if (mcde_dss_overlay_is_transparent(dd->parent_ovly)) {
 				mcde_dss_disable_overlay(dd->parent_ovly);
 				printk(KERN_INFO "%s Disable overlay\n",
 								__func__);
@@ -406,7 +488,7 @@ static int dispdev_queue_buffer(struct dispdev *dd,
 		}
 	}
 
-	dd->buffers[buf_idx].state = BUF_ACTIVATED;
+	dd->buffers[buf_idx].state = queued ? BUF_QUEUED : BUF_ACTIVATED;
 
 	return 0;
 }
@@ -415,12 +497,13 @@ static int dispdev_dequeue_buffer(struct dispdev *dd)
 {
 	int i;
 
-	i = find_buf(dd, BUF_FREE);
+	i = find_dequeueable_buf(dd);
 	if (i < 0) {
-		if (find_buf(dd, BUF_ACTIVATED) < 0)
+		if (find_buf(dd, BUF_ACTIVATED) < 0 &&
+					find_buf(dd, BUF_DEACTIVATED) < 0)
 			return -EINVAL;
 		mutex_unlock(&dd->lock);
-		wait_event(dd->waitq_dq, (i = find_buf(dd, BUF_FREE)) >= 0);
+		wait_event(dd->waitq_dq, (i = find_dequeueable_buf(dd)) >= 0);
 		mutex_lock(&dd->lock);
 	}
 	hwmem_unpin(dd->buffers[i].alloc);
@@ -468,7 +551,29 @@ int dispdev_ioctl(struct inode *inode, struct file *file, unsigned int cmd,
 							sizeof(buffer)))
 			ret = -EFAULT;
 		else
-			ret = dispdev_queue_buffer(dd, &buffer);
+			ret = dispdev_queue_buffer(dd, &buffer, NULL);
+		break;
+	}
+	case DISPDEV_QUEUE_FENCED_BUFFER_IOC:
+	{
+		struct dispdev_fenced_buffer_info fenced;
+		struct hwmem_fence *fence = NULL;
+
+		if (copy_from_user(&fenced, (void __user *)arg,
+							sizeof(fenced))) {
+			ret = -EFAULT;
+			break;
+		}
+		if (fenced.fence >= 0) {
+			fence = hwmem_fence_get_by_fd(fenced.fence);
+			if (IS_ERR(fence)) {
+				ret = PTR_ERR(fence);
+				break;
+			}
+		}
+		ret = dispdev_queue_buffer(dd, &fenced.buffer, fence);
+		if (fence)
+			hwmem_fence_put(fence);
 		break;
 	}
 	case DISPDEV_DEQUEUE_BUFFER_IOC:
@@ -483,10 +588,23 @@ int dispdev_ioctl(struct inode *inode, struct file *file, unsigned int cmd,
 	return ret;
 }
 
+/* Readable when a buffer can be dequeued without blocking */
+static unsigned int dispdev_poll(struct file *file, poll_table *wait)
+{
+	struct dispdev *dd = (struct dispdev *)file->private_data;
+
+	poll_wait(file, &dd->waitq_dq, wait);
+
+	if (find_dequeueable_buf(dd) >= 0)
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
 static const struct file_operations dispdev_fops = {
 	.open = dispdev_open,
 	.release = dispdev_release,
 	.ioctl = dispdev_ioctl,
+	.poll = dispdev_poll,
 };
 
 static void init_dispdev(struct dispdev *dd, struct mcde_display_device *ddev,
@@ -518,6 +636,8 @@ static void init_dispdev(struct dispdev *dd, struct mcde_display_device *ddev,
 	dd->buffers_need_update = false;
 	dd->first_update = false;
 	init_waitqueue_head(&dd->waitq_dq);
+	dd->frame_listener.frame_done = frame_done;
+	dd->fence_listener.fence_done = fence_done;
 	dd->mdev.minor = MISC_DYNAMIC_MINOR;
 	dd->mdev.name = name;
 	dd->mdev.fops = &dispdev_fops;
@@ -10,6 +10,7 @@
  */
 
 #include <linux/hwmem.h>
+#include <linux/string.h>
 
 #include <asm/pgtable.h>
 
@@ -27,12 +28,19 @@ void cachi_set_pgprot_cache_options(enum hwmem_alloc_flags cache_settings,
 static void sync_buf_pre_cpu(struct cach_buf *buf, enum hwmem_access access,
 						struct hwmem_region *region);
 static void sync_buf_post_cpu(struct cach_buf *buf,
-	enum hwmem_access next_access, struct hwmem_region *next_region);
+	enum hwmem_access next_access, struct hwmem_region *next_region,
+						struct cach_batch *batch);
+
+static struct hwmem_region *get_region(struct cach_buf *buf,
+	struct hwmem_region *region, struct hwmem_region *full_region);
+static void set_domain(struct cach_buf *buf, enum hwmem_access access,
+	enum hwmem_domain domain, struct hwmem_region *region,
+						struct cach_batch *batch);
 
 static void invalidate_cpu_cache(struct cach_buf *buf,
 					struct cach_range *range_2b_used);
 static void clean_cpu_cache(struct cach_buf *buf,
-					struct cach_range *range_2b_used);
+		struct cach_range *range_2b_used, struct cach_batch *batch);
 static void flush_cpu_cache(struct cach_buf *buf,
 					struct cach_range *range_2b_used);
 
@@ -58,6 +66,15 @@ static u32 range_length(struct cach_range *range);
 static void region_2_range(struct hwmem_region *region, u32 buffer_size,
 						struct cach_range *range);
 
+static void null_range_set(struct cach_range_set *set);
+static void add_range_2_set(struct cach_range_set *set,
+					struct cach_range *range_2_add);
+static void remove_range_from_set(struct cach_range_set *set,
+					struct cach_range *range_2_remove);
+static void merge_closest_ranges(struct cach_range_set *set);
+static u32 range_set_intersection_length(struct cach_range_set *set,
+						struct cach_range *range);
+
 static void *offset_2_vaddr(struct cach_buf *buf, u32 offset);
 static u32 offset_2_paddr(struct cach_buf *buf, u32 offset);
 
@@ -95,17 +112,16 @@ void cach_set_buf_addrs(struct cach_buf *buf, void* vaddr, u32 paddr)
 		buf->range_in_cpu_cache.end = buf->size;
 		align_range_up(&buf->range_in_cpu_cache,
 						get_dcache_granularity());
-		buf->range_dirty_in_cpu_cache.start = 0;
-		buf->range_dirty_in_cpu_cache.end = buf->size;
-		align_range_up(&buf->range_dirty_in_cpu_cache,
-						get_dcache_granularity());
+		null_range_set(&buf->ranges_dirty_in_cpu_cache);
+		add_range_2_set(&buf->ranges_dirty_in_cpu_cache,
+						&buf->range_in_cpu_cache);
 	} else {
 		flush_cpu_dcache(buf->vstart, buf->pstart, buf->size, false,
 									&tmp);
 		drain_cpu_write_buf();
 
 		null_range(&buf->range_in_cpu_cache);
-		null_range(&buf->range_dirty_in_cpu_cache);
+		null_range_set(&buf->ranges_dirty_in_cpu_cache);
 	}
 	null_range(&buf->range_invalid_in_cpu_cache);
 }
@@ -118,38 +134,97 @@ void cach_set_pgprot_cache_options(struct cach_buf *buf, pgprot_t *pgprot)
 void cach_set_domain(struct cach_buf *buf, enum hwmem_access access,
 			enum hwmem_domain domain, struct hwmem_region *region)
 {
-	struct hwmem_region *__region;
+	set_domain(buf, access, domain, region, NULL);
+}
+
+void cach_init_batch(struct cach_batch *batch)
+{
+	memset(batch, 0, sizeof(*batch));
+	batch->inner_only = true;
+}
+
+void cach_add_2_batch(struct cach_batch *batch, struct cach_buf *buf,
+		enum hwmem_access access, enum hwmem_domain domain,
+						struct hwmem_region *region)
+{
 	struct hwmem_region full_region;
+	struct cach_range region_range;
 
-	if (region != NULL) {
-		__region = region;
-	} else {
-		full_region.offset = 0;
-		full_region.count = 1;
-		full_region.start = 0;
-		full_region.end = buf->size;
-		full_region.size = buf->size;
+	/* Only the cleans done when leaving the CPU domain are batched */
+	if (domain != HWMEM_DOMAIN_SYNC ||
+			!(access & (HWMEM_ACCESS_READ | HWMEM_ACCESS_WRITE)) ||
+			!(buf->cache_settings & HWMEM_ALLOC_HINT_CACHED))
+		return;
+
+	region_2_range(get_region(buf, region, &full_region), buf->size,
+								&region_range);
+
+	batch->clean_length += range_set_intersection_length(
+				&buf->ranges_dirty_in_cpu_cache, &region_range);
+	if (!(buf->cache_settings & HWMEM_ALLOC_HINT_INNER_CACHE_ONLY))
+		batch->inner_only = false;
+}
 
-		__region = &full_region;
+void cach_set_domain_in_batch(struct cach_batch *batch, struct cach_buf *buf,
+		enum hwmem_access access, enum hwmem_domain domain,
+						struct hwmem_region *region)
+{
+	if (!batch->started) {
+		clean_cpu_dcache_all_if_cheaper(batch->clean_length,
+				batch->inner_only, &batch->inner_cleaned,
+							&batch->outer_cleaned);
+		batch->started = true;
 	}
 
+	set_domain(buf, access, domain, region, batch);
+}
+
+void cach_end_batch(struct cach_batch *batch)
+{
+	if (batch->drain_write_buf)
+		drain_cpu_write_buf();
+}
+
+/*
+ * Local functions
+ */
+
+static struct hwmem_region *get_region(struct cach_buf *buf,
+	struct hwmem_region *region, struct hwmem_region *full_region)
+{
+	if (region != NULL)
+		return region;
+
+	full_region->offset = 0;
+	full_region->count = 1;
+	full_region->start = 0;
+	full_region->end = buf->size;
+	full_region->size = buf->size;
+
+	return full_region;
+}
+
+static void set_domain(struct cach_buf *buf, enum hwmem_access access,
+	enum hwmem_domain domain, struct hwmem_region *region,
+						struct cach_batch *batch)
+{
+	struct hwmem_region full_region;
+
+	region = get_region(buf, region, &full_region);
+
 	switch (domain) {
 	case HWMEM_DOMAIN_SYNC:
-		sync_buf_post_cpu(buf, access, __region);
+		sync_buf_post_cpu(buf, access, region, batch);
 
 		break;
 
 	case HWMEM_DOMAIN_CPU:
-		sync_buf_pre_cpu(buf, access, __region);
+		sync_buf_pre_cpu(buf, access, region);
 
 		break;
 	}
 }
 
-/*
- * Local functions
- */
-
 enum hwmem_alloc_flags __attribute__((weak)) cachi_get_cache_settings(
 			enum hwmem_alloc_flags requested_cache_settings)
 {
@@ -227,7 +302,7 @@ static void sync_buf_pre_cpu(struct cach_buf *buf, enum hwmem_access access,
 				intersect_range(&buf->range_in_cpu_cache,
 					&region_range, &dirty_range_addition);
 
-			expand_range(&buf->range_dirty_in_cpu_cache,
+			add_range_2_set(&buf->ranges_dirty_in_cpu_cache,
 							&dirty_range_addition);
 		}
 	}
@@ -238,7 +313,8 @@ static void sync_buf_pre_cpu(struct cach_buf *buf, enum hwmem_access access,
 }
 
 static void sync_buf_post_cpu(struct cach_buf *buf,
-	enum hwmem_access next_access, struct hwmem_region *next_region)
+	enum hwmem_access next_access, struct hwmem_region *next_region,
+						struct cach_batch *batch)
 {
 	bool write = next_access & HWMEM_ACCESS_WRITE;
 	bool read = next_access & HWMEM_ACCESS_READ;
@@ -260,16 +336,19 @@ static void sync_buf_post_cpu(struct cach_buf *buf,
 			expand_range(&buf->range_invalid_in_cpu_cache,
 								&intersection);
 
-			clean_cpu_cache(buf, &region_range);
+			clean_cpu_cache(buf, &region_range, batch);
 		} else {
 			flush_cpu_cache(buf, &region_range);
 		}
 	}
 	if (read)
-		clean_cpu_cache(buf, &region_range);
+		clean_cpu_cache(buf, &region_range, batch);
 
 	if (buf->in_cpu_write_buf) {
-		drain_cpu_write_buf();
+		if (batch != NULL)
+			batch->drain_write_buf = true;
+		else
+			drain_cpu_write_buf();
 
 		buf->in_cpu_write_buf = false;
 	}
@@ -302,7 +381,7 @@ static void invalidate_cpu_cache(struct cach_buf *buf, struct cach_range *range)
 
 		if (flushed_everything) {
 			null_range(&buf->range_invalid_in_cpu_cache);
-			null_range(&buf->range_dirty_in_cpu_cache);
+			null_range_set(&buf->ranges_dirty_in_cpu_cache);
 		} else {
 			/*
 			 * No need to shrink range_in_cpu_cache as invalidate
@@ -315,31 +394,48 @@ static void invalidate_cpu_cache(struct cach_buf *buf, struct cach_range *range)
 	}
 }
 
-static void clean_cpu_cache(struct cach_buf *buf, struct cach_range *range)
+static void clean_cpu_cache(struct cach_buf *buf, struct cach_range *range,
+						struct cach_batch *batch)
 {
-	struct cach_range intersection;
+	struct cach_range_set *dirty = &buf->ranges_dirty_in_cpu_cache;
+	bool inner_only = buf->cache_settings &
+					HWMEM_ALLOC_HINT_INNER_CACHE_ONLY;
+	u32 i;
 
-	intersect_range(&buf->range_dirty_in_cpu_cache, range, &intersection);
-	if (is_non_empty_range(&intersection)) {
-		bool cleaned_everything;
+	if (batch != NULL && batch->inner_cleaned &&
+					(inner_only || batch->outer_cleaned)) {
+		/* Cleaned together with the rest of the batch */
+		remove_range_from_set(dirty, range);
+		return;
+	}
 
-		expand_range_2_edge(&intersection,
-					&buf->range_dirty_in_cpu_cache);
+	/* Only the dirty parts are cleaned, not everything in between */
+	for (i = 0; i < dirty->num_ranges; i++) {
+		struct cach_range intersection;
+		bool cleaned_everything = false;
 
-		clean_cpu_dcache(
+		intersect_range(&dirty->ranges[i], range, &intersection);
+		if (!is_non_empty_range(&intersection))
+			continue;
+
+		if (batch != NULL && batch->inner_cleaned)
+			clean_outer_cpu_dcache(
+				offset_2_paddr(buf, intersection.start),
+				range_length(&intersection));
+		else
+			clean_cpu_dcache(
 				offset_2_vaddr(buf, intersection.start),
 				offset_2_paddr(buf, intersection.start),
-				range_length(&intersection),
-				buf->cache_settings &
-					HWMEM_ALLOC_HINT_INNER_CACHE_ONLY,
+				range_length(&intersection), inner_only,
 							&cleaned_everything);
 
-		if (cleaned_everything)
-			null_range(&buf->range_dirty_in_cpu_cache);
-		else
-			shrink_range(&buf->range_dirty_in_cpu_cache,
-								&intersection);
+		if (cleaned_everything) {
+			null_range_set(dirty);
+			return;
+		}
 	}
+
+	remove_range_from_set(dirty, range);
 }
 
 static void flush_cpu_cache(struct cach_buf *buf, struct cach_range *range)
@@ -363,13 +459,13 @@ static void flush_cpu_cache(struct cach_buf *buf, struct cach_range *range)
 		if (flushed_everything) {
 			if (!speculative_data_prefetch())
 				null_range(&buf->range_in_cpu_cache);
-			null_range(&buf->range_dirty_in_cpu_cache);
+			null_range_set(&buf->ranges_dirty_in_cpu_cache);
 			null_range(&buf->range_invalid_in_cpu_cache);
 		} else {
 			if (!speculative_data_prefetch())
 				shrink_range(&buf->range_in_cpu_cache,
 							 &intersection);
-			shrink_range(&buf->range_dirty_in_cpu_cache,
+			remove_range_from_set(&buf->ranges_dirty_in_cpu_cache,
 								&intersection);
 			shrink_range(&buf->range_invalid_in_cpu_cache,
 								&intersection);
@@ -473,6 +569,101 @@ static void region_2_range(struct hwmem_region *region, u32 buffer_size,
 	align_range_up(range, get_dcache_granularity());
 }
 
+static void null_range_set(struct cach_range_set *set)
+{
+	set->num_ranges = 0;
+}
+
+static void add_range_2_set(struct cach_range_set *set,
+					struct cach_range *range_2_add)
+{
+	struct cach_range range = *range_2_add;
+	u32 i, j;
+
+	if (!is_non_empty_range(&range))
+		return;
+
+	/* Absorb the ranges overlapping or touching the new one */
+	for (i = 0, j = 0; i < set->num_ranges; i++) {
+		if (set->ranges[i].end < range.start ||
+					set->ranges[i].start > range.end)
+			set->ranges[j++] = set->ranges[i];
+		else
+			expand_range(&range, &set->ranges[i]);
+	}
+
+	for (i = j; i > 0 && set->ranges[i - 1].start > range.start; i--)
+		set->ranges[i] = set->ranges[i - 1];
+	set->ranges[i] = range;
+	set->num_ranges = j + 1;
+
+	if (set->num_ranges > CACH_MAX_DIRTY_RANGES)
+		merge_closest_ranges(set);
+}
+
+static void remove_range_from_set(struct cach_range_set *set,
+					struct cach_range *range_2_remove)
+{
+	struct cach_range_set old_set = *set;
+	u32 i;
+
+	if (!is_non_empty_range(range_2_remove))
+		return;
+
+	null_range_set(set);
+
+	/* At most one range is split in two */
+	for (i = 0; i < old_set.num_ranges; i++) {
+		struct cach_range low = old_set.ranges[i];
+		struct cach_range high = old_set.ranges[i];
+
+		low.end = min(low.end, range_2_remove->start);
+		high.start = max(high.start, range_2_remove->end);
+
+		if (is_non_empty_range(&low))
+			set->ranges[set->num_ranges++] = low;
+		if (is_non_empty_range(&high))
+			set->ranges[set->num_ranges++] = high;
+	}
+
+	if (set->num_ranges > CACH_MAX_DIRTY_RANGES)
+		merge_closest_ranges(set);
+}
+
+static void merge_closest_ranges(struct cach_range_set *set)
+{
+	u32 i;
+	u32 closest = 0;
+
+	for (i = 1; i + 1 < set->num_ranges; i++) {
+		if (set->ranges[i + 1].start - set->ranges[i].end <
+				set->ranges[closest + 1].start -
+						set->ranges[closest].end)
+			closest = i;
+	}
+
+	set->ranges[closest].end = set->ranges[closest + 1].end;
+	for (i = closest + 1; i + 1 < set->num_ranges; i++)
+		set->ranges[i] = set->ranges[i + 1];
+	set->num_ranges--;
+}
+
+static u32 range_set_intersection_length(struct cach_range_set *set,
+						struct cach_range *range)
+{
+	u32 i;
+	u32 length = 0;
+
+	for (i = 0; i < set->num_ranges; i++) {
+		struct cach_range intersection;
+
+		intersect_range(&set->ranges[i], range, &intersection);
+		length += range_length(&intersection);
+	}
+
+	return length;
+}
+
 static void *offset_2_vaddr(struct cach_buf *buf, u32 offset)
 {
 	return (void *)((u32)buf->vstart + offset);
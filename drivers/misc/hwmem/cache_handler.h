@@ -31,6 +31,18 @@ struct cach_range {
 	u32 end; /* Exclusive */
 };
 
+#define CACH_MAX_DIRTY_RANGES 4
+
+/*
+ * Sorted, non-overlapping ranges. When there are too many ranges the two
+ * closest ones are merged.
+ */
+struct cach_range_set {
+	u32 num_ranges;
+	/* One extra for use while adding ranges */
+	struct cach_range ranges[CACH_MAX_DIRTY_RANGES + 1];
+};
+
 /*
  * Internal, do not touch!
  */
@@ -44,7 +56,7 @@ struct cach_buf {
 
 	bool in_cpu_write_buf;
 	struct cach_range range_in_cpu_cache;
-	struct cach_range range_dirty_in_cpu_cache;
+	struct cach_range_set ranges_dirty_in_cpu_cache;
 	struct cach_range range_invalid_in_cpu_cache;
 };
 
@@ -58,4 +70,36 @@ void cach_set_pgprot_cache_options(struct cach_buf *buf, pgprot_t *pgprot);
 void cach_set_domain(struct cach_buf *buf, enum hwmem_access access,
 			enum hwmem_domain domain, struct hwmem_region *region);
 
+/*
+ * Sets the domain of several buffers with less cache maintenance than doing
+ * it one buffer at a time. If the buffers together need a lot of cleaning
+ * the whole cache is cleaned once, and the CPU write buffer is drained once
+ * for the whole batch.
+ *
+ * Usage: cach_init_batch, cach_add_2_batch for each buffer,
+ * cach_set_domain_in_batch for each buffer with the same arguments and
+ * finally cach_end_batch.
+ */
+struct cach_batch {
+	u32 clean_length;
+	bool inner_only;
+
+	bool started;
+	bool inner_cleaned;
+	bool outer_cleaned;
+	bool drain_write_buf;
+};
+
+void cach_init_batch(struct cach_batch *batch);
+
+void cach_add_2_batch(struct cach_batch *batch, struct cach_buf *buf,
+		enum hwmem_access access, enum hwmem_domain domain,
+						struct hwmem_region *region);
+
+void cach_set_domain_in_batch(struct cach_batch *batch, struct cach_buf *buf,
+		enum hwmem_access access, enum hwmem_domain domain,
+						struct hwmem_region *region);
+
+void cach_end_batch(struct cach_batch *batch);
+
 #endif /* _CACHE_HANDLER_H_ */
@@ -12,6 +12,9 @@
 #include <linux/kernel.h>
 #include <linux/err.h>
 #include <linux/list.h>
+#include <linux/rbtree.h>
+#include <linux/mutex.h>
+#include <linux/hrtimer.h>
 #include <linux/slab.h>
 #include <linux/mm.h>
 #include <linux/debugfs.h>
@@ -19,11 +22,19 @@
 #include <linux/module.h>
 #include <linux/vmalloc.h>
 #include <asm/sizes.h>
+#include <asm/div64.h>
 
 #define MAX_INSTANCE_NAME_LENGTH 31
 
+/*
+ * All allocs of an instance, used and free, are kept in an address ordered
+ * list so that a freed alloc can be merged with its neighbours. Free allocs
+ * are also indexed by size in a tree so that the best fit is found in
+ * O(log n) rather than by scanning the list.
+ */
 struct alloc {
 	struct list_head list;
+	struct rb_node free_node;
 
 	bool in_use;
 	phys_addr_t paddr;
@@ -39,7 +50,18 @@ struct instance {
 	void *region_kaddr;
 	size_t region_size;
 
+	/* Protects alloc_list, free_tree and stats */
+	struct mutex lock;
+
 	struct list_head alloc_list;
+	/* Free allocs ordered by size, then by paddr */
+	struct rb_root free_tree;
+
+	/* Stats */
+	u32 num_allocs;
+	u32 num_failed_allocs;
+	u64 total_alloc_ns;
+	u64 max_alloc_ns;
 
 #ifdef CONFIG_DEBUG_FS
 	struct inode *debugfs_inode;
@@ -48,6 +70,7 @@ struct instance {
 
 static LIST_HEAD(instance_list);
 
+/* Protects instance_list */
 static DEFINE_MUTEX(lock);
 
 void *cona_create(const char *name, phys_addr_t region_paddr,
@@ -60,6 +83,8 @@ size_t cona_get_alloc_size(void *alloc);
 
 static int init_alloc_list(struct instance *instance);
 static void clean_alloc_list(struct instance *instance);
+static void insert_free_alloc(struct instance *instance, struct alloc *alloc);
+static void remove_free_alloc(struct instance *instance, struct alloc *alloc);
 static struct alloc *find_free_alloc_bestfit(struct instance *instance,
 								size_t size);
 static struct alloc *split_allocation(struct alloc *alloc,
@@ -86,6 +111,7 @@ void *cona_create(const char *name, phys_addr_t region_paddr,
 	instance->name[MAX_INSTANCE_NAME_LENGTH] = '\0';
 	instance->region_paddr = region_paddr;
 	instance->region_size = region_size;
+	mutex_init(&instance->lock);
 
 	vm_area = get_vm_area(region_size, VM_IOREMAP);
 	if (vm_area == NULL) {
@@ -97,6 +123,7 @@ void *cona_create(const char *name, phys_addr_t region_paddr,
 	instance->region_kaddr = vm_area->addr;
 
 	INIT_LIST_HEAD(&instance->alloc_list);
+	instance->free_tree = RB_ROOT;
 	ret = init_alloc_list(instance);
 	if (ret < 0)
 		goto init_alloc_list_failed;
@@ -123,18 +150,26 @@ vmem_alloc_failed:
 void *cona_alloc(void *instance, size_t size)
 {
 	struct instance *instance_l = (struct instance *)instance;
-	struct alloc *alloc;
+	struct alloc *alloc, *free_alloc;
+	ktime_t start;
+	u64 ns;
 
 	if (size == 0)
 		return ERR_PTR(-EINVAL);
 
-	mutex_lock(&lock);
+	start = ktime_get();
+
+	mutex_lock(&instance_l->lock);
 
 	alloc = find_free_alloc_bestfit(instance_l, size);
 	if (IS_ERR(alloc))
 		goto out;
+	free_alloc = alloc;
+	remove_free_alloc(instance_l, free_alloc);
 	if (size < alloc->size) {
-		alloc = split_allocation(alloc, size);
+		alloc = split_allocation(free_alloc, size);
+		/* The remainder, or all of it if the split failed, stays free */
+		insert_free_alloc(instance_l, free_alloc);
 		if (IS_ERR(alloc))
 			goto out;
 	} else {
@@ -142,7 +177,16 @@ void *cona_alloc(void *instance, size_t size)
 	}
 
 out:
-	mutex_unlock(&lock);
+	ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+	if (IS_ERR(alloc))
+		instance_l->num_failed_allocs++;
+	else
+		instance_l->num_allocs++;
+	instance_l->total_alloc_ns += ns;
+	if (ns > instance_l->max_alloc_ns)
+		instance_l->max_alloc_ns = ns;
+
+	mutex_unlock(&instance_l->lock);
 
 	return alloc;
 }
@@ -153,13 +197,14 @@ void cona_free(void *instance, void *alloc)
 	struct alloc *alloc_l = (struct alloc *)alloc;
 	struct alloc *other;
 
-	mutex_lock(&lock);
+	mutex_lock(&instance_l->lock);
 
 	alloc_l->in_use = false;
 
 	other = list_entry(alloc_l->list.prev, struct alloc, list);
 	if ((alloc_l->list.prev != &instance_l->alloc_list) &&
 							!other->in_use) {
+		remove_free_alloc(instance_l, other);
 		other->size += alloc_l->size;
 		list_del(&alloc_l->list);
 		kfree(alloc_l);
@@ -168,12 +213,15 @@ void cona_free(void *instance, void *alloc)
 	other = list_entry(alloc_l->list.next, struct alloc, list);
 	if ((alloc_l->list.next != &instance_l->alloc_list) &&
 							!other->in_use) {
+		remove_free_alloc(instance_l, other);
 		alloc_l->size += other->size;
 		list_del(&other->list);
 		kfree(other);
 	}
 
-	mutex_unlock(&lock);
+	insert_free_alloc(instance_l, alloc_l);
+
+	mutex_unlock(&instance_l->lock);
 }
 
 phys_addr_t cona_get_alloc_paddr(void *alloc)
@@ -250,6 +298,11 @@ static int init_alloc_list(struct instance *instance)
 	alloc->in_use = false;
 	list_add_tail(&alloc->list, &instance->alloc_list);
 
+	list_for_each_entry(alloc, &instance->alloc_list, list) {
+		if (!alloc->in_use)
+			insert_free_alloc(instance, alloc);
+	}
+
 	return 0;
 
 error:
@@ -268,21 +321,53 @@ static void clean_alloc_list(struct instance *instance)
 
 		kfree(i);
 	}
+
+	instance->free_tree = RB_ROOT;
+}
+
+static void insert_free_alloc(struct instance *instance, struct alloc *alloc)
+{
+	struct rb_node **new = &instance->free_tree.rb_node;
+	struct rb_node *parent = NULL;
+
+	while (*new != NULL) {
+		struct alloc *i = rb_entry(*new, struct alloc, free_node);
+
+		parent = *new;
+		if (alloc->size < i->size || (alloc->size == i->size &&
+							alloc->paddr < i->paddr))
+			new = &(*new)->rb_left;
+		else
+			new = &(*new)->rb_right;
+	}
+
+	rb_link_node(&alloc->free_node, parent, new);
+	rb_insert_color(&alloc->free_node, &instance->free_tree);
 }
 
+static void remove_free_alloc(struct instance *instance, struct alloc *alloc)
+{
+	rb_erase(&alloc->free_node, &instance->free_tree);
+}
+
+/*
+ * Returns the smallest free alloc that is large enough, the one with the
+ * lowest address if there are several.
+ */
 static struct alloc *find_free_alloc_bestfit(struct instance *instance,
 								size_t size)
 {
-	size_t best_diff = ~(size_t)0;
-	struct alloc *alloc = NULL, *i;
+	struct rb_node *node = instance->free_tree.rb_node;
+	struct alloc *alloc = NULL;
 
-	list_for_each_entry(i, &instance->alloc_list, list) {
-		size_t diff = i->size - size;
-		if (i->in_use || i->size < size)
-			continue;
-		if (diff < best_diff) {
+	while (node != NULL) {
+		struct alloc *i = rb_entry(node, struct alloc, free_node);
+
+		if (i->size >= size) {
 			alloc = i;
-			best_diff = diff;
+			node = node->rb_left;
+		} else {
+			node = node->rb_right;
 		}
 	}
 
@@ -319,6 +404,8 @@ static phys_addr_t get_alloc_offset(struct instance *instance,
 
 #ifdef CONFIG_DEBUG_FS
 
+static int print_stats(struct instance *instance, char **buf,
+							size_t buf_size);
 static int print_alloc(struct alloc *alloc, char **buf, size_t buf_size);
 static struct instance *get_instance_from_file(struct file *file);
 static int debugfs_allocs_read(struct file *filp, char __user *buf,
@@ -329,6 +416,36 @@ static const struct file_operations debugfs_allocs_fops = {
 	.read  = debugfs_allocs_read,
 };
 
+static int print_stats(struct instance *instance, char **buf,
+							size_t buf_size)
+{
+	int ret;
+	struct rb_node *largest = rb_last(&instance->free_tree);
+	size_t largest_free = 0;
+	u64 avg_alloc_ns = instance->total_alloc_ns;
+	u32 num_calls = instance->num_allocs + instance->num_failed_allocs;
+
+	if (largest != NULL)
+		largest_free = rb_entry(largest, struct alloc,
+							free_node)->size;
+	if (num_calls != 0)
+		do_div(avg_alloc_ns, num_calls);
+
+	ret = snprintf(*buf, buf_size, "allocs: %u\tfailed allocs: %u\t"
+			"alloc time avg/max (ns): %llu/%llu\t"
+			"largest free: %u\n", instance->num_allocs,
+			instance->num_failed_allocs, avg_alloc_ns,
+			instance->max_alloc_ns, largest_free);
+	if (ret < 0)
+		return -ENOMSG;
+	else if (ret + 1 > buf_size)
+		return -EINVAL;
+
+	*buf += ret;
+
+	return 0;
+}
+
 static int print_alloc(struct alloc *alloc, char **buf, size_t buf_size)
 {
 	int ret;
@@ -397,6 +514,15 @@ static int debugfs_allocs_read(struct file *file, char __user *buf,
 		goto out;
 	}
 
+	mutex_lock(&instance->lock);
+
+	/* Summary goes before the first alloc */
+	if (*curr_pos == NULL) {
+		ret = print_stats(instance, &local_buf_pos, available_space);
+		if (ret < 0)
+			goto out_unlock_instance;
+	}
+
 	list_for_each_entry(curr_alloc, &instance->alloc_list, list) {
 		phys_addr_t alloc_offset = get_alloc_offset(instance,
 								curr_alloc);
@@ -408,7 +534,7 @@ static int debugfs_allocs_read(struct file *file, char __user *buf,
 		if (ret == -EINVAL) /* No more room */
 			break;
 		else if (ret < 0)
-			goto out;
+			goto out_unlock_instance;
 
 		/*
 		 * There could be an overflow issue here in the unlikely case
@@ -420,6 +546,8 @@ static int debugfs_allocs_read(struct file *file, char __user *buf,
 		*curr_pos = (void *)(alloc_offset + 1);
 	}
 
+	mutex_unlock(&instance->lock);
+
 	bytes_read = (size_t)(local_buf_pos - local_buf);
 
 	ret = copy_to_user(buf, local_buf, bytes_read);
@@ -427,7 +555,10 @@ static int debugfs_allocs_read(struct file *file, char __user *buf,
 		goto out;
 
 	ret = bytes_read;
+	goto out;
 
+out_unlock_instance:
+	mutex_unlock(&instance->lock);
 out:
 	kfree(local_buf);
 
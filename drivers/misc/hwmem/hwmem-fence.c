@@ -0,0 +1,284 @@
+/*
+ * Copyright (C) ST-Ericsson SA 2011
+ *
+ * Hardware memory driver, hwmem fences
+ *
+ * License terms: GNU General Public License (GPL), version 2.
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/anon_inodes.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/kref.h>
+#include <linux/err.h>
+#include <linux/hwmem.h>
+
+/* Status of a fence that has not been signaled */
+#define FENCE_PENDING 1
+
+struct hwmem_fence {
+	struct kref ref;
+	spinlock_t lock;
+	int status;
+	struct list_head waiters;
+	wait_queue_head_t waitq;
+	/* File allowed to signal the fence from user space, not ref counted */
+	struct file *signaler;
+};
+
+static const struct file_operations fence_fops;
+
+static void fence_free(struct kref *ref)
+{
+	struct hwmem_fence *fence = container_of(ref, struct hwmem_fence, ref);
+
+	WARN_ON(!list_empty(&fence->waiters));
+
+	kfree(fence);
+}
+
+struct hwmem_fence *hwmem_fence_create(void)
+{
+	struct hwmem_fence *fence;
+
+	fence = kzalloc(sizeof(*fence), GFP_KERNEL);
+	if (fence == NULL)
+		return ERR_PTR(-ENOMEM);
+
+	kref_init(&fence->ref);
+	spin_lock_init(&fence->lock);
+	fence->status = FENCE_PENDING;
+	INIT_LIST_HEAD(&fence->waiters);
+	init_waitqueue_head(&fence->waitq);
+
+	return fence;
+}
+EXPORT_SYMBOL(hwmem_fence_create);
+
+void hwmem_fence_get(struct hwmem_fence *fence)
+{
+	kref_get(&fence->ref);
+}
+EXPORT_SYMBOL(hwmem_fence_get);
+
+void hwmem_fence_put(struct hwmem_fence *fence)
+{
+	kref_put(&fence->ref, fence_free);
+}
+EXPORT_SYMBOL(hwmem_fence_put);
+
+void hwmem_fence_signal(struct hwmem_fence *fence, int status)
+{
+	unsigned long flags;
+	struct hwmem_fence_waiter *waiter;
+	struct hwmem_fence_waiter *tmp;
+
+	if (status > 0)
+		status = 0;
+
+	spin_lock_irqsave(&fence->lock, flags);
+	if (fence->status != FENCE_PENDING) {
+		spin_unlock_irqrestore(&fence->lock, flags);
+		return;
+	}
+	fence->status = status;
+
+	/*
+	 * Waiters are called with the lock held so that a failed
+	 * hwmem_fence_remove_waiter means that the call is complete.
+	 */
+	list_for_each_entry_safe(waiter, tmp, &fence->waiters, list) {
+		list_del_init(&waiter->list);
+		waiter->func(waiter, status);
+	}
+	spin_unlock_irqrestore(&fence->lock, flags);
+
+	wake_up_all(&fence->waitq);
+}
+EXPORT_SYMBOL(hwmem_fence_signal);
+
+int hwmem_fence_status(struct hwmem_fence *fence)
+{
+	return ACCESS_ONCE(fence->status);
+}
+EXPORT_SYMBOL(hwmem_fence_status);
+
+int hwmem_fence_wait(struct hwmem_fence *fence, long timeout)
+{
+	long ret;
+
+	ret = wait_event_interruptible_timeout(fence->waitq,
+			hwmem_fence_status(fence) != FENCE_PENDING, timeout);
+	if (ret < 0)
+		return ret;
+	if (ret == 0 && hwmem_fence_status(fence) == FENCE_PENDING)
+		return -ETIME;
+
+	return hwmem_fence_status(fence);
+}
+EXPORT_SYMBOL(hwmem_fence_wait);
+
+int hwmem_fence_add_waiter(struct hwmem_fence *fence,
+				struct hwmem_fence_waiter *waiter)
+{
+	unsigned long flags;
+	int ret = 0;
+
+	spin_lock_irqsave(&fence->lock, flags);
+	if (fence->status == FENCE_PENDING)
+		list_add_tail(&waiter->list, &fence->waiters);
+	else
+		ret = 1;
+	spin_unlock_irqrestore(&fence->lock, flags);
+
+	return ret;
+}
+EXPORT_SYMBOL(hwmem_fence_add_waiter);
+
+bool hwmem_fence_remove_waiter(struct hwmem_fence *fence,
+				struct hwmem_fence_waiter *waiter)
+{
+	unsigned long flags;
+	bool removed = false;
+
+	spin_lock_irqsave(&fence->lock, flags);
+	if (fence->status == FENCE_PENDING) {
+		list_del_init(&waiter->list);
+		removed = true;
+	}
+	spin_unlock_irqrestore(&fence->lock, flags);
+
+	return removed;
+}
+EXPORT_SYMBOL(hwmem_fence_remove_waiter);
+
+struct file *hwmem_fence_get_file(struct hwmem_fence *fence)
+{
+	struct file *file;
+
+	hwmem_fence_get(fence);
+
+	file = anon_inode_getfile("hwmem_fence", &fence_fops, fence, O_RDONLY);
+	if (IS_ERR(file))
+		hwmem_fence_put(fence);
+
+	return file;
+}
+EXPORT_SYMBOL(hwmem_fence_get_file);
+
+struct hwmem_fence *hwmem_fence_get_by_fd(int fd)
+{
+	struct file *file;
+	struct hwmem_fence *fence;
+
+	file = fget(fd);
+	if (file == NULL)
+		return ERR_PTR(-EBADF);
+
+	if (file->f_op != &fence_fops) {
+		fput(file);
+		return ERR_PTR(-EINVAL);
+	}
+
+	fence = file->private_data;
+	hwmem_fence_get(fence);
+	fput(file);
+
+	return fence;
+}
+EXPORT_SYMBOL(hwmem_fence_get_by_fd);
+
+int hwmem_fence_create_user_fd(void)
+{
+	struct hwmem_fence *fence;
+	struct file *file;
+	int fd;
+
+	fence = hwmem_fence_create();
+	if (IS_ERR(fence))
+		return PTR_ERR(fence);
+
+	fd = get_unused_fd_flags(O_CLOEXEC);
+	if (fd < 0)
+		goto get_fd_failed;
+
+	/* The file gets the creation reference */
+	file = anon_inode_getfile("hwmem_fence", &fence_fops, fence, O_RDWR);
+	if (IS_ERR(file)) {
+		put_unused_fd(fd);
+		fd = PTR_ERR(file);
+		goto get_fd_failed;
+	}
+
+	fence->signaler = file;
+	fd_install(fd, file);
+
+	return fd;
+
+get_fd_failed:
+	hwmem_fence_put(fence);
+
+	return fd;
+}
+
+static unsigned int fence_poll(struct file *file, poll_table *wait)
+{
+	struct hwmem_fence *fence = file->private_data;
+	int status;
+
+	poll_wait(file, &fence->waitq, wait);
+
+	status = hwmem_fence_status(fence);
+	if (status == FENCE_PENDING)
+		return 0;
+	else if (status < 0)
+		return POLLIN | POLLRDNORM | POLLERR;
+	else
+		return POLLIN | POLLRDNORM;
+}
+
+static long fence_ioctl(struct file *file, unsigned int cmd,
+							unsigned long arg)
+{
+	struct hwmem_fence *fence = file->private_data;
+
+	switch (cmd) {
+	case HWMEM_FENCE_SIGNAL_IOC:
+		if (fence->signaler != file)
+			return -EPERM;
+		if ((int)arg > 0 || (int)arg < -MAX_ERRNO)
+			return -EINVAL;
+		hwmem_fence_signal(fence, (int)arg);
+		return 0;
+	default:
+		return -ENOSYS;
+	}
+}
+
+static int fence_release(struct inode *inode, struct file *file)
+{
+	struct hwmem_fence *fence = file->private_data;
+
+	/* Do not leave anyone waiting for a producer that is gone */
+	if (fence->signaler == file) {
+		fence->signaler = NULL;
+		hwmem_fence_signal(fence, -EPIPE);
+	}
+
+	hwmem_fence_put(fence);
+
+	return 0;
+}
+
+static const struct file_operations fence_fops = {
+	.poll = fence_poll,
+	.unlocked_ioctl = fence_ioctl,
+	.release = fence_release,
+};
@@ -172,6 +172,50 @@ static int set_sync_domain(struct hwmem_file *hwfile,
 					(struct hwmem_region *)&req->region);
 }
 
+static int set_domain_batch(struct hwmem_file *hwfile,
+		struct hwmem_set_domain_batch_request *req,
+						enum hwmem_domain domain)
+{
+	int ret;
+	u32 i;
+	struct hwmem_set_domain_request *reqs;
+	struct hwmem_set_domain_entry *entries;
+
+	if (req->count == 0 || req->count > HWMEM_MAX_SET_DOMAIN_BATCH)
+		return -EINVAL;
+
+	reqs = kmalloc(req->count * sizeof(*reqs), GFP_KERNEL);
+	entries = kmalloc(req->count * sizeof(*entries), GFP_KERNEL);
+	if (reqs == NULL || entries == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (copy_from_user(reqs, (void __user *)req->requests,
+					req->count * sizeof(*reqs))) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	for (i = 0; i < req->count; i++) {
+		entries[i].alloc = resolve_id(hwfile, reqs[i].id);
+		if (IS_ERR(entries[i].alloc)) {
+			ret = PTR_ERR(entries[i].alloc);
+			goto out;
+		}
+		entries[i].access = reqs[i].access;
+		entries[i].region = (struct hwmem_region *)&reqs[i].region;
+	}
+
+	ret = hwmem_set_domain_batch(entries, req->count, domain);
+
+out:
+	kfree(entries);
+	kfree(reqs);
+
+	return ret;
+}
+
 static int pin(struct hwmem_file *hwfile, struct hwmem_pin_request *req)
 {
 	int ret;
@@ -438,6 +482,28 @@ static long hwmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 				ret = set_sync_domain(hwfile, &req);
 		}
 		break;
+	case HWMEM_SET_CPU_DOMAIN_BATCH_IOC:
+		{
+			struct hwmem_set_domain_batch_request req;
+			if (copy_from_user(&req, (void __user *)arg,
+				sizeof(struct hwmem_set_domain_batch_request)))
+				ret = -EFAULT;
+			else
+				ret = set_domain_batch(hwfile, &req,
+							HWMEM_DOMAIN_CPU);
+		}
+		break;
+	case HWMEM_SET_SYNC_DOMAIN_BATCH_IOC:
+		{
+			struct hwmem_set_domain_batch_request req;
+			if (copy_from_user(&req, (void __user *)arg,
+				sizeof(struct hwmem_set_domain_batch_request)))
+				ret = -EFAULT;
+			else
+				ret = set_domain_batch(hwfile, &req,
+							HWMEM_DOMAIN_SYNC);
+		}
+		break;
 	case HWMEM_PIN_IOC:
 		{
 			struct hwmem_pin_request req;
@@ -486,6 +552,9 @@ static long hwmem_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 	case HWMEM_IMPORT_FD_IOC:
 		ret = import_fd(hwfile, (s32)arg);
 		break;
+	case HWMEM_CREATE_FENCE_IOC:
+		ret = hwmem_fence_create_user_fd();
+		break;
 	}
 
 	mutex_unlock(&hwfile->lock);
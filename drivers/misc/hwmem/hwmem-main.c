@@ -28,10 +28,24 @@
 #include <linux/io.h>
 #include <linux/kallsyms.h>
 #include <linux/vmalloc.h>
+#include <linux/hash.h>
+#include <linux/rcupdate.h>
+#include <linux/workqueue.h>
+#include <asm/sizes.h>
 #include "cache_handler.h"
 
 #define S32_MAX 2147483647
 
+/*
+ * Released allocs are kept in a recycle cache, hashed on size, so that
+ * the frequent free/alloc cycles of same sized graphics buffers don't go
+ * through the allocator and kernel mapping every time. Cached allocs are
+ * zeroed in the background.
+ */
+#define RECYCLE_MAX_SIZE SZ_16M
+#define RECYCLE_CLASS_BITS 4
+#define RECYCLE_NUM_CLASSES (1 << RECYCLE_CLASS_BITS)
+
 struct hwmem_alloc_threadg_info {
 	struct list_head list;
 
@@ -40,11 +54,21 @@ struct hwmem_alloc_threadg_info {
 	enum hwmem_access access;
 };
 
+/*
+ * Locking: The global lock protects alloc_list, global_idr (writes) and the
+ * recycle cache. An alloc's own lock protects its access control and cache
+ * handling state. Everything else in an alloc is constant while the alloc is
+ * referenced. Names are resolved under RCU, allocs are freed after a grace
+ * period.
+ */
 struct hwmem_alloc {
 	struct list_head list;
 
 	atomic_t ref_cnt;
 
+	struct mutex lock;
+	struct rcu_head rcu;
+
 	enum hwmem_alloc_flags flags;
 	struct hwmem_mem_type_struct *mem_type;
 
@@ -61,6 +85,11 @@ struct hwmem_alloc {
 	/* Cache handling */
 	struct cach_buf cach_buf;
 
+	/* Recycling, alloc is in the recycle cache if ref_cnt is 0 */
+	struct list_head recycle_lru;
+	bool zeroed;
+	bool zeroing;
+
 #ifdef CONFIG_DEBUG_FS
 	/* Debug */
 	void *creator;
@@ -74,6 +103,14 @@ static LIST_HEAD(alloc_list);
 static DEFINE_IDR(global_idr);
 static DEFINE_MUTEX(lock);
 
+/* Recycle cache, protected by lock */
+static struct list_head recycle_classes[RECYCLE_NUM_CLASSES];
+static LIST_HEAD(recycle_lru); /* Most recently released first */
+static size_t recycle_size;
+
+static void recycle_zero_work_fn(struct work_struct *work);
+static DECLARE_WORK(recycle_zero_work, recycle_zero_work_fn);
+
 static void vm_open(struct vm_area_struct *vma);
 static void vm_close(struct vm_area_struct *vma);
 static struct vm_operations_struct vm_ops = {
@@ -82,6 +119,7 @@ static struct vm_operations_struct vm_ops = {
 };
 
 static void kunmap_alloc(struct hwmem_alloc *alloc);
+static size_t evict_recycled_alloc(struct hwmem_mem_type_struct *mem_type);
 
 /* Helpers */
 
@@ -139,6 +177,11 @@ static void clear_alloc_mem(struct hwmem_alloc *alloc)
 	memset(alloc->kaddr, 0, alloc->size);
 }
 
+static void free_alloc_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct hwmem_alloc, rcu));
+}
+
 static void destroy_alloc(struct hwmem_alloc *alloc)
 {
 	list_del(&alloc->list);
@@ -157,9 +200,154 @@ static void destroy_alloc(struct hwmem_alloc *alloc)
 					alloc->mem_type->allocator_instance,
 							alloc->allocator_hndl);
 
-	kfree(alloc);
+	/* hwmem_resolve_by_name might still be looking at it */
+	call_rcu(&alloc->rcu, free_alloc_rcu);
+}
+
+static struct list_head *get_recycle_class(size_t size)
+{
+	return &recycle_classes[hash_long(size >> PAGE_SHIFT,
+						RECYCLE_CLASS_BITS)];
+}
+
+static void recycle_alloc(struct hwmem_alloc *alloc)
+{
+	if (alloc->size > RECYCLE_MAX_SIZE) {
+		destroy_alloc(alloc);
+		return;
+	}
+
+	list_del(&alloc->list);
+
+	if (alloc->name != 0) {
+		idr_remove(&global_idr, alloc->name);
+		alloc->name = 0;
+	}
+
+	clean_alloc_threadg_info_list(alloc);
+
+	alloc->zeroed = false;
+	list_add(&alloc->list, get_recycle_class(alloc->size));
+	list_add(&alloc->recycle_lru, &recycle_lru);
+	recycle_size += alloc->size;
+
+	while (recycle_size > RECYCLE_MAX_SIZE) {
+		if (evict_recycled_alloc(NULL) == 0)
+			break;
+	}
+
+	schedule_work(&recycle_zero_work);
+}
+
+static struct hwmem_alloc *get_recycled_alloc(size_t size,
+		enum hwmem_alloc_flags flags, enum hwmem_mem_type mem_type)
+{
+	struct hwmem_alloc *alloc;
+
+	list_for_each_entry(alloc, get_recycle_class(size), list) {
+		if (alloc->size != size || alloc->flags != flags ||
+				alloc->mem_type->id != mem_type ||
+							alloc->zeroing)
+			continue;
+
+		list_del(&alloc->list);
+		list_del(&alloc->recycle_lru);
+		recycle_size -= alloc->size;
+
+		/* The background zeroing didn't get to this one yet */
+		if (!alloc->zeroed)
+			clear_alloc_mem(alloc);
+
+		return alloc;
+	}
+
+	return NULL;
+}
+
+/*
+ * Destroys the least recently released alloc in the recycle cache, of any
+ * memory type if mem_type is NULL. Returns the number of bytes freed.
+ */
+static size_t evict_recycled_alloc(struct hwmem_mem_type_struct *mem_type)
+{
+	struct hwmem_alloc *alloc;
+	size_t size;
+
+	list_for_each_entry_reverse(alloc, &recycle_lru, recycle_lru) {
+		if (alloc->zeroing ||
+				(mem_type != NULL && alloc->mem_type != mem_type))
+			continue;
+
+		size = alloc->size;
+		list_del(&alloc->recycle_lru);
+		recycle_size -= size;
+		destroy_alloc(alloc);
+
+		return size;
+	}
+
+	return 0;
+}
+
+static void recycle_zero_work_fn(struct work_struct *work)
+{
+	struct hwmem_alloc *alloc;
+	bool found;
+
+	mutex_lock(&lock);
+
+	do {
+		found = false;
+		list_for_each_entry(alloc, &recycle_lru, recycle_lru) {
+			if (!alloc->zeroed && !alloc->zeroing) {
+				found = true;
+				break;
+			}
+		}
+		if (!found)
+			break;
+
+		/* The alloc can't be reused or evicted while we zero it */
+		alloc->zeroing = true;
+		mutex_unlock(&lock);
+
+		clear_alloc_mem(alloc);
+
+		mutex_lock(&lock);
+		alloc->zeroing = false;
+		alloc->zeroed = true;
+	} while (true);
+
+	mutex_unlock(&lock);
+}
+
+static int recycle_shrink(struct shrinker *shrinker, int nr_to_scan,
+								gfp_t gfp_mask)
+{
+	if (nr_to_scan > 0) {
+		/* We might be called from an allocation made under lock */
+		if (!mutex_trylock(&lock))
+			return -1;
+
+		while (nr_to_scan > 0) {
+			size_t freed = evict_recycled_alloc(NULL);
+			if (freed == 0)
+				break;
+
+			nr_to_scan -= freed >> PAGE_SHIFT;
+		}
+
+		mutex_unlock(&lock);
+	}
+
+	return recycle_size >> PAGE_SHIFT;
 }
 
+static struct shrinker recycle_shrinker = {
+	.shrink = recycle_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
 static int kmap_alloc(struct hwmem_alloc *alloc)
 {
 	int ret;
@@ -229,6 +417,17 @@ struct hwmem_alloc *hwmem_alloc(size_t size, enum hwmem_alloc_flags flags,
 
 	size = PAGE_ALIGN(size);
 
+	alloc = get_recycled_alloc(size, flags, mem_type);
+	if (alloc != NULL) {
+		atomic_set(&alloc->ref_cnt, 1);
+		alloc->default_access = def_access;
+		alloc->creator = __builtin_return_address(0);
+		alloc->creator_tgid = task_tgid_nr(current);
+		list_add_tail(&alloc->list, &alloc_list);
+
+		goto out;
+	}
+
 	alloc = kzalloc(sizeof(struct hwmem_alloc), GFP_KERNEL);
 	if (alloc == NULL) {
 		ret = -ENOMEM;
@@ -236,7 +435,9 @@ struct hwmem_alloc *hwmem_alloc(size_t size, enum hwmem_alloc_flags flags,
 	}
 
 	INIT_LIST_HEAD(&alloc->list);
+	INIT_LIST_HEAD(&alloc->recycle_lru);
 	atomic_inc(&alloc->ref_cnt);
+	mutex_init(&alloc->lock);
 	alloc->flags = flags;
 	alloc->default_access = def_access;
 	INIT_LIST_HEAD(&alloc->threadg_info_list);
@@ -251,6 +452,11 @@ struct hwmem_alloc *hwmem_alloc(size_t size, enum hwmem_alloc_flags flags,
 
 	alloc->allocator_hndl = alloc->mem_type->allocator_api.alloc(
 				alloc->mem_type->allocator_instance, size);
+	/* Give the memory held by the recycle cache back and try again */
+	while (IS_ERR(alloc->allocator_hndl) &&
+			evict_recycled_alloc(alloc->mem_type) != 0)
+		alloc->allocator_hndl = alloc->mem_type->allocator_api.alloc(
+				alloc->mem_type->allocator_instance, size);
 	if (IS_ERR(alloc->allocator_hndl)) {
 		ret = PTR_ERR(alloc->allocator_hndl);
 		goto allocator_failed;
@@ -289,10 +495,12 @@ EXPORT_SYMBOL(hwmem_alloc);
 
 void hwmem_release(struct hwmem_alloc *alloc)
 {
+	if (!atomic_dec_and_test(&alloc->ref_cnt))
+		return;
+
 	mutex_lock(&lock);
 
-	if (atomic_dec_and_test(&alloc->ref_cnt))
-		destroy_alloc(alloc);
+	recycle_alloc(alloc);
 
 	mutex_unlock(&lock);
 }
@@ -301,16 +509,49 @@ EXPORT_SYMBOL(hwmem_release);
 int hwmem_set_domain(struct hwmem_alloc *alloc, enum hwmem_access access,
 		enum hwmem_domain domain, struct hwmem_region *region)
 {
-	mutex_lock(&lock);
+	mutex_lock(&alloc->lock);
 
 	cach_set_domain(&alloc->cach_buf, access, domain, region);
 
-	mutex_unlock(&lock);
+	mutex_unlock(&alloc->lock);
 
 	return 0;
 }
 EXPORT_SYMBOL(hwmem_set_domain);
 
+int hwmem_set_domain_batch(struct hwmem_set_domain_entry *entries,
+			size_t num_entries, enum hwmem_domain domain)
+{
+	size_t i;
+	struct cach_batch batch;
+
+	cach_init_batch(&batch);
+
+	/*
+	 * Allocs are locked one at a time to not have to order the locks. A
+	 * buffer changing between the two passes only makes the estimate of
+	 * the work needed a bit off.
+	 */
+	for (i = 0; i < num_entries; i++) {
+		mutex_lock(&entries[i].alloc->lock);
+		cach_add_2_batch(&batch, &entries[i].alloc->cach_buf,
+				entries[i].access, domain, entries[i].region);
+		mutex_unlock(&entries[i].alloc->lock);
+	}
+
+	for (i = 0; i < num_entries; i++) {
+		mutex_lock(&entries[i].alloc->lock);
+		cach_set_domain_in_batch(&batch, &entries[i].alloc->cach_buf,
+				entries[i].access, domain, entries[i].region);
+		mutex_unlock(&entries[i].alloc->lock);
+	}
+
+	cach_end_batch(&batch);
+
+	return 0;
+}
+EXPORT_SYMBOL(hwmem_set_domain_batch);
+
 int hwmem_pin(struct hwmem_alloc *alloc, struct hwmem_mem_chunk *mem_chunks,
 							u32 *mem_chunks_length)
 {
@@ -319,14 +560,10 @@ int hwmem_pin(struct hwmem_alloc *alloc, struct hwmem_mem_chunk *mem_chunks,
 		return -ENOSPC;
 	}
 
-	mutex_lock(&lock);
-
 	mem_chunks[0].paddr = alloc->paddr;
 	mem_chunks[0].size = alloc->size;
 	*mem_chunks_length = 1;
 
-	mutex_unlock(&lock);
-
 	return 0;
 }
 EXPORT_SYMBOL(hwmem_pin);
@@ -351,7 +588,7 @@ int hwmem_mmap(struct hwmem_alloc *alloc, struct vm_area_struct *vma)
 	int ret = 0;
 	unsigned long vma_size = vma->vm_end - vma->vm_start;
 	enum hwmem_access access;
-	mutex_lock(&lock);
+	mutex_lock(&alloc->lock);
 
 	access = get_access(alloc);
 
@@ -392,7 +629,7 @@ illegal_size:
 illegal_access:
 
 out:
-	mutex_unlock(&lock);
+	mutex_unlock(&alloc->lock);
 
 	return ret;
 }
@@ -400,15 +637,7 @@ EXPORT_SYMBOL(hwmem_mmap);
 
 void *hwmem_kmap(struct hwmem_alloc *alloc)
 {
-	void *ret;
-
-	mutex_lock(&lock);
-
-	ret = alloc->kaddr;
-
-	mutex_unlock(&lock);
-
-	return ret;
+	return alloc->kaddr;
 }
 EXPORT_SYMBOL(hwmem_kmap);
 
@@ -431,6 +660,8 @@ int hwmem_set_access(struct hwmem_alloc *alloc,
 		goto error_get_pid;
 	}
 
+	mutex_lock(&alloc->lock);
+
 	list_for_each_entry(info, &(alloc->threadg_info_list), list) {
 		if (info->threadg_pid == pid) {
 			found = true;
@@ -451,11 +682,15 @@ int hwmem_set_access(struct hwmem_alloc *alloc,
 		list_add_tail(&(info->list), &(alloc->threadg_info_list));
 	} else {
 		info->access = access;
+		put_pid(pid);
 	}
 
+	mutex_unlock(&alloc->lock);
+
 	return 0;
 
 error_alloc_info:
+	mutex_unlock(&alloc->lock);
 	put_pid(pid);
 error_get_pid:
 	return ret;
@@ -465,16 +700,15 @@ EXPORT_SYMBOL(hwmem_set_access);
 void hwmem_get_info(struct hwmem_alloc *alloc, u32 *size,
 	enum hwmem_mem_type *mem_type, enum hwmem_access *access)
 {
-	mutex_lock(&lock);
-
 	if (size != NULL)
 		*size = alloc->size;
 	if (mem_type != NULL)
 		*mem_type = alloc->mem_type->id;
-	if (access != NULL)
+	if (access != NULL) {
+		mutex_lock(&alloc->lock);
 		*access = get_access(alloc);
-
-	mutex_unlock(&lock);
+		mutex_unlock(&alloc->lock);
+	}
 }
 EXPORT_SYMBOL(hwmem_get_info);
 
@@ -482,6 +716,11 @@ s32 hwmem_get_name(struct hwmem_alloc *alloc)
 {
 	int ret = 0, name;
 
+	/* Names never change while the alloc is referenced */
+	name = ACCESS_ONCE(alloc->name);
+	if (name != 0)
+		return name;
+
 	mutex_lock(&lock);
 
 	if (alloc->name != 0) {
@@ -528,21 +767,30 @@ struct hwmem_alloc *hwmem_resolve_by_name(s32 name)
 {
 	struct hwmem_alloc *alloc;
 
-	mutex_lock(&lock);
+	rcu_read_lock();
 
 	alloc = idr_find(&global_idr, name);
-	if (alloc == NULL) {
+	if (alloc == NULL || !atomic_inc_not_zero(&alloc->ref_cnt)) {
 		alloc = ERR_PTR(-EINVAL);
 		goto find_failed;
 	}
-	atomic_inc(&alloc->ref_cnt);
+
+	/*
+	 * The alloc could have been released and handed out again from the
+	 * recycle cache since we found it.
+	 */
+	if (alloc->name != name) {
+		rcu_read_unlock();
+		hwmem_release(alloc);
+		return ERR_PTR(-EINVAL);
+	}
 
 	goto out;
 
 find_failed:
 
 out:
-	mutex_unlock(&lock);
+	rcu_read_unlock();
 
 	return alloc;
 }
@@ -677,6 +925,7 @@ extern int hwmem_ioctl_init(void);
 static int __devinit hwmem_probe(struct platform_device *pdev)
 {
 	int ret;
+	unsigned int i;
 
 	if (hwdev) {
 		dev_err(&pdev->dev, "Probed multiple times\n");
@@ -685,6 +934,9 @@ static int __devinit hwmem_probe(struct platform_device *pdev)
 
 	hwdev = pdev;
 
+	for (i = 0; i < RECYCLE_NUM_CLASSES; i++)
+		INIT_LIST_HEAD(&recycle_classes[i]);
+
 	/*
 	 * No need to flush the caches here. If we can keep track of the cache
 	 * content then none of our memory will be in the caches, if we can't
@@ -701,13 +953,31 @@ static int __devinit hwmem_probe(struct platform_device *pdev)
 	init_debugfs();
 #endif
 
+	/* Last, nothing can fail once the pool is reachable from reclaim */
+	register_shrinker(&recycle_shrinker);
+
 	dev_info(&pdev->dev, "Probed OK\n");
 
 	return 0;
 }
 
+static int __devexit hwmem_remove(struct platform_device *pdev)
+{
+	unregister_shrinker(&recycle_shrinker);
+	/* Zeroing skips the allocs it works on, don't leave any behind */
+	cancel_work_sync(&recycle_zero_work);
+
+	mutex_lock(&lock);
+	while (evict_recycled_alloc(NULL) != 0)
+		;
+	mutex_unlock(&lock);
+
+	return 0;
+}
+
 static struct platform_driver hwmem_driver = {
 	.probe	= hwmem_probe,
+	.remove	= __devexit_p(hwmem_remove),
 	.driver = {
 		.name	= "hwmem",
 	},
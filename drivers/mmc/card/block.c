@@ -178,11 +178,22 @@ static const struct block_device_operations mmc_bdops = {
 	.owner			= THIS_MODULE,
 };
 
-struct mmc_blk_request {
-	struct mmc_request	mrq;
-	struct mmc_command	cmd;
-	struct mmc_command	stop;
-	struct mmc_data		data;
+/* Writes whose addresses and sizes fit the one block packed header */
+#define MMC_BLK_PACKED_MAX	63
+
+/* Largest block count that SET_BLOCK_COUNT can take */
+#define MMC_BLK_SBC_MAX		0xffff
+
+/*
+ * Outcome of a read or write, as judged by mmc_blk_err_check().
+ */
+enum mmc_blk_status {
+	MMC_BLK_SUCCESS = 0,
+	MMC_BLK_PARTIAL,	/* no error, but the request is not done */
+	MMC_BLK_RETRY,		/* transfer to be redone as is */
+	MMC_BLK_RETRY_SINGLE,	/* read to be redone a sector at a time */
+	MMC_BLK_DATA_ERR,	/* single sector read failed */
+	MMC_BLK_CMD_ERR,	/* give up on the request */
 };
 
 static u32 mmc_sd_num_wr_blocks(struct mmc_card *card)
@@ -339,335 +350,499 @@ mmc_blk_set_blksize(struct mmc_blk_data *md, struct mmc_card *card)
 	return 0;
 }
 
-static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
+static void mmc_blk_stop_transmission(struct mmc_card *card)
 {
-	struct mmc_blk_data *md = mq->data;
-	struct mmc_card *card = md->queue.card;
-	struct mmc_blk_request brq;
-	int ret = 1, disable_multi = 0;
-
-#ifdef CONFIG_MMC_BLOCK_DEFERRED_RESUME
-	if (mmc_bus_needs_resume(card->host)) {
-		mmc_resume_bus(card->host);
-		mmc_blk_set_blksize(md, card);
-	}
-#endif
-
-	mmc_claim_host(card->host);
-
-	do {
-		struct mmc_command cmd;
-		u32 readcmd, writecmd, status = 0;
+	struct mmc_command cmd;
 
-		memset(&brq, 0, sizeof(struct mmc_blk_request));
-		brq.mrq.cmd = &brq.cmd;
-		brq.mrq.data = &brq.data;
+	memset(&cmd, 0, sizeof(struct mmc_command));
+	cmd.opcode = MMC_STOP_TRANSMISSION;
+	cmd.arg = 0;
+	cmd.flags = MMC_RSP_SPI_R1B | MMC_RSP_R1B | MMC_CMD_AC;
+	mmc_wait_for_cmd(card->host, &cmd, 0);
+	printk(KERN_ERR "mmc_blk_issue_rq: sent CMD12 due to error!!! Resp:0x%08x\n", cmd.resp[0]);
+}
 
-		brq.cmd.arg = blk_rq_pos(req);
-		if (!mmc_card_blockaddr(card))
-			brq.cmd.arg <<= 9;
-		brq.cmd.flags = MMC_RSP_SPI_R1 | MMC_RSP_R1 | MMC_CMD_ADTC;
-		brq.data.blksz = 512;
-		brq.stop.opcode = MMC_STOP_TRANSMISSION;
-		brq.stop.arg = 0;
-		brq.stop.flags = MMC_RSP_SPI_R1B | MMC_RSP_R1B | MMC_CMD_AC;
-		brq.data.blocks = blk_rq_sectors(req);
+/*
+ * Called by mmc_start_req() once a read or write is done, before the next
+ * one is started. Waits for a written card to be ready for data again.
+ */
+static int mmc_blk_err_check(struct mmc_card *card,
+			     struct mmc_async_req *areq)
+{
+	struct mmc_queue_req *mq_mrq = container_of(areq, struct mmc_queue_req,
+						    mmc_active);
+	struct mmc_blk_request *brq = &mq_mrq->brq;
+	struct request *req = mq_mrq->req;
+	u32 status = 0;
 
-		/*
-		 * The block layer doesn't support all sector count
-		 * restrictions, so we need to be prepared for too big
-		 * requests.
-		 */
-		if (brq.data.blocks > card->host->max_blk_count)
-			brq.data.blocks = card->host->max_blk_count;
+/* debug code */
+#ifdef MOVI_DEBUG
+	if (card->type == MMC_TYPE_MMC) {
 
-		/*
-		 * After a read error, we redo the request one sector at a time
-		 * in order to accurately determine which sectors can be read
-		 * successfully.
-		 */
-		if (disable_multi && brq.data.blocks > 1)
-			brq.data.blocks = 1;
+		gaCmdLog[gnCmdLogIdx].cmd = brq->cmd.opcode;
+		gaCmdLog[gnCmdLogIdx].arg = brq->cmd.arg;
+		gaCmdLog[gnCmdLogIdx].cnt = brq->data.blocks;
+		gaCmdLog[gnCmdLogIdx].rsp = brq->cmd.resp[0];
+		gaCmdLog[gnCmdLogIdx].stoprsp = brq->stop.resp[0];
+		gnCmdLogIdx++;
 
-		if (brq.data.blocks > 1) {
-			/* SPI multiblock writes terminate using a special
-			 * token, not a STOP_TRANSMISSION request.
-			 */
-			if (!mmc_host_is_spi(card->host)
-					|| rq_data_dir(req) == READ)
-				brq.mrq.stop = &brq.stop;
-			readcmd = MMC_READ_MULTIPLE_BLOCK;
-			writecmd = MMC_WRITE_MULTIPLE_BLOCK;
-		} else {
-			brq.mrq.stop = NULL;
-			readcmd = MMC_READ_SINGLE_BLOCK;
-			writecmd = MMC_WRITE_BLOCK;
-		}
-		if (rq_data_dir(req) == READ) {
-			brq.cmd.opcode = readcmd;
-			brq.data.flags |= MMC_DATA_READ;
-		} else {
-			brq.cmd.opcode = writecmd;
-			brq.data.flags |= MMC_DATA_WRITE;
-		}
-
-#ifdef _MMC_SAFE_ACCESS_
-		if (card->type == MMC_TYPE_SD)
-			if (!mmc_is_available)
-				goto cmd_sdremove;
+		if (gnCmdLogIdx >= 5)
+			gnCmdLogIdx = 0;
+	}
 #endif
+	/*
+	 * Check for errors here, but don't give up on the request
+	 * until later as we need to wait for the card to leave
+	 * programming mode even when things go wrong.
+	 */
+	if (!brq->cmd.error && !brq->stop.error &&
+		brq->data.error == -EAGAIN) {
+		printk(KERN_WARNING "%s: retrying transfer\n",
+				req->rq_disk->disk_name);
+		if (wait_for_ready_state(card, req))
+			return MMC_BLK_CMD_ERR;
+		return MMC_BLK_RETRY;
+	}
 
-		mmc_set_data_timeout(&brq.data, card);
-
-		brq.data.sg = mq->sg;
-		brq.data.sg_len = mmc_queue_map_sg(mq);
-
-		/*
-		 * Adjust the sg list so it is the same size as the
-		 * request.
-		 */
-		if (brq.data.blocks != blk_rq_sectors(req)) {
-			int i, data_size = brq.data.blocks << 9;
-			struct scatterlist *sg;
-
-			for_each_sg(brq.data.sg, sg, brq.data.sg_len, i) {
-				data_size -= sg->length;
-				if (data_size <= 0) {
-					sg->length += data_size;
-					i++;
-					break;
-				}
-			}
-			brq.data.sg_len = i;
+	if (brq->cmd.error || brq->data.error || brq->stop.error) {
+		if (brq->data.blocks > 1 && rq_data_dir(req) == READ) {
+			/* Redo read one sector at a time */
+			printk(KERN_WARNING "%s: retrying using single "
+			       "block read\n", req->rq_disk->disk_name);
+			return MMC_BLK_RETRY_SINGLE;
 		}
+		get_card_status(card, req, &status, 0);
+	}
 
-#ifdef _MMC_SAFE_ACCESS_
-		if (card->type == MMC_TYPE_SD)
-			if (!mmc_is_available)
-				goto cmd_sdremove;
-#endif
-
-
-		mmc_queue_bounce_pre(mq);
-
-		mmc_wait_for_req(card->host, &brq.mrq);
-
-		mmc_queue_bounce_post(mq);
-
-/* debug code */
 #ifdef MOVI_DEBUG
+	if (brq->cmd.error) {
 		if (card->type == MMC_TYPE_MMC) {
+			struct mmc_command cmd;
 
-			gaCmdLog[gnCmdLogIdx].cmd = brq.cmd.opcode;
-			gaCmdLog[gnCmdLogIdx].arg = brq.cmd.arg;
-			gaCmdLog[gnCmdLogIdx].cnt = brq.data.blocks;
-			gaCmdLog[gnCmdLogIdx].rsp = brq.cmd.resp[0];
-			gaCmdLog[gnCmdLogIdx].stoprsp = brq.stop.resp[0];
-			gnCmdLogIdx++;
-
-			if (gnCmdLogIdx >= 5)
-				gnCmdLogIdx = 0;
-		}
-#endif
-		/*
-		 * Check for errors here, but don't jump to cmd_err
-		 * until later as we need to wait for the card to leave
-		 * programming mode even when things go wrong.
-		 */
-		if (!brq.cmd.error && !brq.stop.error &&
-			brq.data.error == -EAGAIN) {
-			printk(KERN_WARNING "%s: retrying transfer\n",
-					req->rq_disk->disk_name);
-			if (wait_for_ready_state(card, req))
-				goto cmd_err;
-			continue;
-		}
+			status = get_card_status(card, req, &status, 0);
+			if (!status) {
+/* ! put the panic code here */
+				int err, i, j;
+				for (i = 0; i < 5; i++) {
+				printk("[CMD LOG] CMD:%d, ARG:0x%x, CNT:%d, RSP:0x%x, STRSP:0x%x\n",
+					gaCmdLog[gnCmdLogIdx].cmd, gaCmdLog[gnCmdLogIdx].arg,
+					gaCmdLog[gnCmdLogIdx].cnt, gaCmdLog[gnCmdLogIdx].rsp,
+					gaCmdLog[gnCmdLogIdx].stoprsp);
+					gnCmdLogIdx++;
+					if (gnCmdLogIdx >= 5)
+						gnCmdLogIdx = 0;
+				}
 
-		if (brq.cmd.error || brq.data.error || brq.stop.error) {
-			if (brq.data.blocks > 1 && rq_data_dir(req) == READ) {
-				/* Redo read one sector at a time */
-				printk(KERN_WARNING "%s: retrying using single "
-				       "block read\n", req->rq_disk->disk_name);
-				disable_multi = 1;
-				continue;
-			}
-			get_card_status(card, req, &status, 0);
-		} else if (disable_multi == 1) {
-			disable_multi = 0;
-		}
+				status = get_card_status(card, req, &status, 0);
+				printk("COMMAND13 response = 0x%x\n", status);
 
-#ifdef MOVI_DEBUG
-		if (brq.cmd.error) {
-			if (card->type == MMC_TYPE_MMC) {
+				cmd.opcode = 12;
+				cmd.arg = 0;
+				cmd.flags = MMC_RSP_R1;
+				err = mmc_wait_for_cmd(card->host, &cmd, 0);
+				if (err) {
+					printk(KERN_ERR "%s: error %d CMD12\n",
+				       req->rq_disk->disk_name, err);
+				}
+				printk("COMD12 RESP = 0x%x\n", cmd.resp[0]);
+				msleep(100);
 
 				status = get_card_status(card, req, &status, 0);
-				if (!status) {
-/* ! put the panic code here */
-					int err, i, j;
-					for (i = 0; i < 5; i++) {
-					printk("[CMD LOG] CMD:%d, ARG:0x%x, CNT:%d, RSP:0x%x, STRSP:0x%x\n",
-						gaCmdLog[gnCmdLogIdx].cmd, gaCmdLog[gnCmdLogIdx].arg,
-						gaCmdLog[gnCmdLogIdx].cnt, gaCmdLog[gnCmdLogIdx].rsp,
-						gaCmdLog[gnCmdLogIdx].stoprsp);
-						gnCmdLogIdx++;
-						if (gnCmdLogIdx >= 5)
-							gnCmdLogIdx = 0;
-					}
+				printk("COMMAND13 response = 0x%x\n", status);
 
-					status = get_card_status(card, req, &status, 0);
-					printk("COMMAND13 response = 0x%x\n", status);
+				mmc_set_clock(card->host, 400000);
 
-					cmd.opcode = 12;
-					cmd.arg = 0;
-					cmd.flags = MMC_RSP_R1;
+				for (i = 0; i < 3; i++) {
+					cmd.opcode = 1;
+					cmd.arg = 0x40ff8080;
+					cmd.flags = MMC_RSP_R3 | MMC_CMD_BCR;
 					err = mmc_wait_for_cmd(card->host, &cmd, 0);
 					if (err) {
-						printk(KERN_ERR "%s: error %d CMD12\n",
-					       req->rq_disk->disk_name, err);
+						printk(KERN_ERR "%s: error %d CMD0\n",
+						       req->rq_disk->disk_name, err);
 					}
-					printk("COMD12 RESP = 0x%x\n", cmd.resp[0]);
-					msleep(100);
-
-					status = get_card_status(card, req, &status, 0);
-					printk("COMMAND13 response = 0x%x\n", status);
-
-					mmc_set_clock(card->host, 400000);
+					printk("COMD1 RESP = 0x%x\n", cmd.resp[0]);
+					msleep(50);
+				}
 
-					for (i = 0; i < 3; i++) {
-						cmd.opcode = 1;
-						cmd.arg = 0x40ff8080;
-						cmd.flags = MMC_RSP_R3 | MMC_CMD_BCR;
-						err = mmc_wait_for_cmd(card->host, &cmd, 0);
-						if (err) {
-							printk(KERN_ERR "%s: error %d CMD0\n",
-							       req->rq_disk->disk_name, err);
-						}
-						printk("COMD1 RESP = 0x%x\n", cmd.resp[0]);
-						msleep(50);
+				for (i = 0; i < 3; i++) {
+					cmd.opcode = 0;
+					cmd.arg = 0x20110210;
+					cmd.flags = MMC_RSP_NONE | MMC_CMD_BC;
+					err = mmc_wait_for_cmd(card->host, &cmd, 0);
+					if (err) {
+						printk(KERN_ERR "%s: error %d CMD0\n",
+					       req->rq_disk->disk_name, err);
 					}
-
-					for (i = 0; i < 3; i++) {
-						cmd.opcode = 0;
-						cmd.arg = 0x20110210;
-						cmd.flags = MMC_RSP_NONE | MMC_CMD_BC;
-						err = mmc_wait_for_cmd(card->host, &cmd, 0);
-						if (err) {
-							printk(KERN_ERR "%s: error %d CMD0\n",
+					msleep(50);
+					cmd.opcode = 0;
+					cmd.arg = 0x60FACC06;
+					cmd.flags = MMC_RSP_NONE | MMC_CMD_BC;
+					err = mmc_wait_for_cmd(card->host, &cmd, 0);
+					if (err) {
+						printk(KERN_ERR "%s: error %d CMD0\n",
 						       req->rq_disk->disk_name, err);
-						}
+					}
+					for (j = 0; j < 3; j++) {
 						msleep(50);
-						cmd.opcode = 0;
-						cmd.arg = 0x60FACC06;
-						cmd.flags = MMC_RSP_NONE | MMC_CMD_BC;
+						cmd.opcode = 1;
+						cmd.arg = 0x0;
+						cmd.flags = MMC_RSP_R3 | MMC_CMD_BCR;
 						err = mmc_wait_for_cmd(card->host, &cmd, 0);
 						if (err) {
 							printk(KERN_ERR "%s: error %d CMD0\n",
-							       req->rq_disk->disk_name, err);
-						}
-						for (j = 0; j < 3; j++) {
-							msleep(50);
-							cmd.opcode = 1;
-							cmd.arg = 0x0;
-							cmd.flags = MMC_RSP_R3 | MMC_CMD_BCR;
-							err = mmc_wait_for_cmd(card->host, &cmd, 0);
-							if (err) {
-								printk(KERN_ERR "%s: error %d CMD0\n",
-							       req->rq_disk->disk_name, err);
-							}
-
-							printk("COMD1 RESP = 0x%x\n", cmd.resp[0]);
+						       req->rq_disk->disk_name, err);
 						}
+
+						printk("COMD1 RESP = 0x%x\n", cmd.resp[0]);
 					}
-				panic(" MOVINAND DEBUG PANIC\n");
 				}
+			panic(" MOVINAND DEBUG PANIC\n");
 			}
 		}
+	}
 #endif
-		if (brq.cmd.error) {
-			printk(KERN_ERR "%s: error %d sending read/write "
-			       "command, response %#x, card status %#x\n",
-			       req->rq_disk->disk_name, brq.cmd.error,
-			       brq.cmd.resp[0], status);
-			if (R1_CURRENT_STATE(status) == 6 || R1_CURRENT_STATE(status) == 5) {
-				struct mmc_command cmd;
-				memset(&cmd, 0, sizeof(struct mmc_command));
-
-				cmd.opcode = MMC_STOP_TRANSMISSION;
-				cmd.arg = 0;
-				cmd.flags = MMC_RSP_SPI_R1B | MMC_RSP_R1B | MMC_CMD_AC;
-				mmc_wait_for_cmd(card->host, &cmd, 0);
-				printk(KERN_ERR "mmc_blk_issue_rq: sent CMD12 due to error!!! Resp:0x%08x\n", cmd.resp[0]);
-			}
-		}
+	if (brq->cmd.error) {
+		printk(KERN_ERR "%s: error %d sending read/write "
+		       "command, response %#x, card status %#x\n",
+		       req->rq_disk->disk_name, brq->cmd.error,
+		       brq->cmd.resp[0], status);
+		if (R1_CURRENT_STATE(status) == 6 || R1_CURRENT_STATE(status) == 5)
+			mmc_blk_stop_transmission(card);
+	}
 
-		if (brq.data.error) {
-			if (brq.data.error == -ETIMEDOUT && brq.mrq.stop)
-				/* 'Stop' response contains card status */
-				status = brq.mrq.stop->resp[0];
-			printk(KERN_ERR "%s: error %d transferring data,"
-			       " sector %u, nr %u, card status %#x\n",
-			       req->rq_disk->disk_name, brq.data.error,
-			       (unsigned)blk_rq_pos(req),
-			       (unsigned)blk_rq_sectors(req), status);
-		}
+	if (brq->data.error) {
+		if (brq->data.error == -ETIMEDOUT && brq->mrq.stop)
+			/* 'Stop' response contains card status */
+			status = brq->mrq.stop->resp[0];
+		printk(KERN_ERR "%s: error %d transferring data,"
+		       " sector %u, nr %u, card status %#x\n",
+		       req->rq_disk->disk_name, brq->data.error,
+		       (unsigned)blk_rq_pos(req),
+		       (unsigned)blk_rq_sectors(req), status);
+
+		/* Packed writes have no stop command to end them */
+		if (mq_mrq->packed_cmd != MMC_PACKED_NONE &&
+		    R1_CURRENT_STATE(status) == 6)
+			mmc_blk_stop_transmission(card);
+	}
 
-		if (brq.stop.error) {
-			printk(KERN_ERR "%s: error %d sending stop command, "
-			       "response %#x, card status %#x\n",
-			       req->rq_disk->disk_name, brq.stop.error,
-			       brq.stop.resp[0], status);
-		}
+	if (brq->stop.error) {
+		printk(KERN_ERR "%s: error %d sending stop command, "
+		       "response %#x, card status %#x\n",
+		       req->rq_disk->disk_name, brq->stop.error,
+		       brq->stop.resp[0], status);
+	}
 
 #ifdef _MMC_SAFE_ACCESS_
-		if (brq.cmd.error || brq.data.error || brq.stop.error) {
-			if (card->type == MMC_TYPE_SD) {
-				if (mmc_is_available)
-					status = get_card_status(card,
-						req, &status, 0);
-				else
-					printk(KERN_ERR"[MMC]SD card is removed\n");
-			}
+	if (brq->cmd.error || brq->data.error || brq->stop.error) {
+		if (card->type == MMC_TYPE_SD) {
+			if (mmc_is_available)
+				status = get_card_status(card,
+					req, &status, 0);
+			else
+				printk(KERN_ERR"[MMC]SD card is removed\n");
 		}
+	}
 #endif
 
-		if (wait_for_ready_state(card, req))
-			goto cmd_err;
+	if (wait_for_ready_state(card, req))
+		return MMC_BLK_CMD_ERR;
+
+	if (brq->cmd.error || brq->stop.error || brq->data.error) {
+		if (rq_data_dir(req) == READ)
+			return MMC_BLK_DATA_ERR;
+		return MMC_BLK_CMD_ERR;
+	}
+
+	if (mq_mrq->packed_cmd != MMC_PACKED_NONE) {
+		if (brq->data.bytes_xfered < brq->data.blocks * brq->data.blksz)
+			return MMC_BLK_PARTIAL;
+	} else if (brq->data.bytes_xfered < blk_rq_bytes(req)) {
+		return MMC_BLK_PARTIAL;
+	}
+
+	return MMC_BLK_SUCCESS;
+}
+
+static void mmc_blk_rw_rq_prep(struct mmc_queue_req *mqrq,
+			       struct mmc_card *card,
+			       int disable_multi,
+			       struct mmc_queue *mq)
+{
+	u32 readcmd, writecmd;
+	struct mmc_blk_request *brq = &mqrq->brq;
+	struct request *req = mqrq->req;
+
+	mqrq->packed_cmd = MMC_PACKED_NONE;
+
+	memset(brq, 0, sizeof(struct mmc_blk_request));
+	brq->mrq.cmd = &brq->cmd;
+	brq->mrq.data = &brq->data;
+
+	brq->cmd.arg = blk_rq_pos(req);
+	if (!mmc_card_blockaddr(card))
+		brq->cmd.arg <<= 9;
+	brq->cmd.flags = MMC_RSP_SPI_R1 | MMC_RSP_R1 | MMC_CMD_ADTC;
+	brq->data.blksz = 512;
+	brq->stop.opcode = MMC_STOP_TRANSMISSION;
+	brq->stop.arg = 0;
+	brq->stop.flags = MMC_RSP_SPI_R1B | MMC_RSP_R1B | MMC_CMD_AC;
+	brq->data.blocks = blk_rq_sectors(req);
+
+	/*
+	 * The block layer doesn't support all sector count
+	 * restrictions, so we need to be prepared for too big
+	 * requests.
+	 */
+	if (brq->data.blocks > card->host->max_blk_count)
+		brq->data.blocks = card->host->max_blk_count;
 
-		if (brq.cmd.error || brq.stop.error || brq.data.error) {
-			if (rq_data_dir(req) == READ) {
-				/*
-				 * After an error, we redo I/O one sector at a
-				 * time, so we only reach here after trying to
-				 * read a single sector.
-				 */
-				spin_lock_irq(&md->lock);
-				ret = __blk_end_request(req,
-					-EIO, brq.data.blksz);
-				spin_unlock_irq(&md->lock);
-				continue;
+	/*
+	 * After a read error, we redo the request one sector at a time
+	 * in order to accurately determine which sectors can be read
+	 * successfully.
+	 */
+	if (disable_multi && brq->data.blocks > 1)
+		brq->data.blocks = 1;
+
+	if (brq->data.blocks > 1) {
+		/* SPI multiblock writes terminate using a special
+		 * token, not a STOP_TRANSMISSION request.
+		 */
+		if (!mmc_host_is_spi(card->host)
+				|| rq_data_dir(req) == READ)
+			brq->mrq.stop = &brq->stop;
+		readcmd = MMC_READ_MULTIPLE_BLOCK;
+		writecmd = MMC_WRITE_MULTIPLE_BLOCK;
+	} else {
+		brq->mrq.stop = NULL;
+		readcmd = MMC_READ_SINGLE_BLOCK;
+		writecmd = MMC_WRITE_BLOCK;
+	}
+	if (rq_data_dir(req) == READ) {
+		brq->cmd.opcode = readcmd;
+		brq->data.flags |= MMC_DATA_READ;
+	} else {
+		brq->cmd.opcode = writecmd;
+		brq->data.flags |= MMC_DATA_WRITE;
+	}
+
+	mmc_set_data_timeout(&brq->data, card);
+
+	brq->data.sg = mqrq->sg;
+	brq->data.sg_len = mmc_queue_map_sg(mq, mqrq);
+
+	/*
+	 * Adjust the sg list so it is the same size as the
+	 * request.
+	 */
+	if (brq->data.blocks != blk_rq_sectors(req)) {
+		int i, data_size = brq->data.blocks << 9;
+		struct scatterlist *sg;
+
+		for_each_sg(brq->data.sg, sg, brq->data.sg_len, i) {
+			data_size -= sg->length;
+			if (data_size <= 0) {
+				sg->length += data_size;
+				i++;
+				break;
 			}
+		}
+		brq->data.sg_len = i;
+	}
+
+	mqrq->mmc_active.mrq = &brq->mrq;
+	mqrq->mmc_active.err_check = mmc_blk_err_check;
+
+	mmc_queue_bounce_pre(mqrq);
+}
+
+static inline int mmc_blk_packable(struct request *req)
+{
+	return rq_data_dir(req) == WRITE && blk_fs_request(req) &&
+		!(req->cmd_flags & (REQ_HARDBARRIER | REQ_FUA | REQ_DISCARD));
+}
+
+/*
+ * Moves the writes queued right behind req onto the packed list of the
+ * current request, as long as the lot fits one packed command. Returns
+ * the number of requests on the list, 0 if there was nothing to pack.
+ */
+static unsigned int mmc_blk_prep_packed_list(struct mmc_queue *mq,
+					     struct request *req)
+{
+	struct mmc_queue_req *mqrq = mq->mqrq_cur;
+	struct request_queue *q = mq->queue;
+	struct mmc_card *card = mq->card;
+	struct mmc_host *host = card->host;
+	unsigned int max_num, max_blocks, max_segs;
+	unsigned int num, blocks, segs;
+	struct request *next;
+
+	if (!mqrq->packed_cmd_hdr || !mmc_blk_packable(req))
+		return 0;
+
+	max_num = min_t(unsigned int, card->ext_csd.max_packed_writes,
+			MMC_BLK_PACKED_MAX);
+
+	/* The header takes one block and one segment of the transfer */
+	max_blocks = min(host->max_blk_count, host->max_req_size / 512) - 1;
+	max_blocks = min_t(unsigned int, max_blocks, MMC_BLK_SBC_MAX - 1);
+	max_segs = host->max_segs - 1;
+
+	num = 1;
+	blocks = blk_rq_sectors(req);
+	segs = req->nr_phys_segments;
+	if (blocks > max_blocks || segs > max_segs)
+		return 0;
+
+	spin_lock_irq(q->queue_lock);
+	while (num < max_num) {
+		next = blk_peek_request(q);
+		if (!next || !mmc_blk_packable(next))
+			break;
+
+		if (blocks + blk_rq_sectors(next) > max_blocks ||
+		    segs + next->nr_phys_segments > max_segs)
+			break;
+
+		blk_start_request(next);
+		if (num == 1)
+			list_add_tail(&req->queuelist, &mqrq->packed_list);
+		list_add_tail(&next->queuelist, &mqrq->packed_list);
+
+		blocks += blk_rq_sectors(next);
+		segs += next->nr_phys_segments;
+		num++;
+	}
+	spin_unlock_irq(q->queue_lock);
+
+	return num > 1 ? num : 0;
+}
+
+/*
+ * Prepares the writes on the packed list as one packed command: CMD23
+ * with the packed flag, then CMD25 carrying a header block that holds the
+ * address and size of each write, followed by their data.
+ */
+static void mmc_blk_packed_hdr_wrq_prep(struct mmc_queue_req *mqrq,
+					struct mmc_card *card,
+					struct mmc_queue *mq)
+{
+	struct mmc_blk_request *brq = &mqrq->brq;
+	u32 *hdr = mqrq->packed_cmd_hdr;
+	struct request *req;
+	unsigned int i = 1;
+	u32 addr;
+
+	mqrq->packed_cmd = MMC_PACKED_WRITE;
+	mqrq->packed_blocks = 0;
+
+	memset(hdr, 0, 512);
+	list_for_each_entry(req, &mqrq->packed_list, queuelist) {
+		addr = blk_rq_pos(req);
+		if (!mmc_card_blockaddr(card))
+			addr <<= 9;
+
+		/* Arguments of the CMD23 and CMD25 the write stands for */
+		hdr[i * 2] = cpu_to_le32(blk_rq_sectors(req));
+		hdr[i * 2 + 1] = cpu_to_le32(addr);
+
+		mqrq->packed_blocks += blk_rq_sectors(req);
+		i++;
+	}
+	mqrq->packed_num = i - 1;
+	hdr[0] = cpu_to_le32(mqrq->packed_num << 16 |
+			     MMC_PACKED_CMD_WR << 8 | MMC_PACKED_CMD_VER);
+
+	memset(brq, 0, sizeof(struct mmc_blk_request));
+	brq->mrq.sbc = &brq->sbc;
+	brq->mrq.cmd = &brq->cmd;
+	brq->mrq.data = &brq->data;
+
+	brq->sbc.opcode = MMC_SET_BLOCK_COUNT;
+	brq->sbc.arg = MMC_CMD23_ARG_PACKED | (mqrq->packed_blocks + 1);
+	brq->sbc.flags = MMC_RSP_R1 | MMC_CMD_AC;
+
+	/* The block count is given up front, so there is no stop command */
+	brq->cmd.opcode = MMC_WRITE_MULTIPLE_BLOCK;
+	brq->cmd.arg = blk_rq_pos(mqrq->req);
+	if (!mmc_card_blockaddr(card))
+		brq->cmd.arg <<= 9;
+	brq->cmd.flags = MMC_RSP_SPI_R1 | MMC_RSP_R1 | MMC_CMD_ADTC;
+
+	brq->data.blksz = 512;
+	brq->data.blocks = mqrq->packed_blocks + 1;
+	brq->data.flags |= MMC_DATA_WRITE;
+
+	mmc_set_data_timeout(&brq->data, card);
+
+	brq->data.sg = mqrq->sg;
+	brq->data.sg_len = mmc_queue_map_sg(mq, mqrq);
+
+	mqrq->mmc_active.mrq = &brq->mrq;
+	mqrq->mmc_active.err_check = mmc_blk_err_check;
+}
+
+/*
+ * Completes the request of mq_rq, whose transfer ended with status. If it
+ * needs more than one transfer because of errors or its size, the rest
+ * is done here. Returns 0 if the request failed.
+ */
+static int mmc_blk_finish_rw_rq(struct mmc_queue *mq,
+				struct mmc_queue_req *mq_rq, int status)
+{
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_card *card = md->queue.card;
+	struct mmc_blk_request *brq = &mq_rq->brq;
+	struct request *req = mq_rq->req;
+	int ret = 1, disable_multi = 0;
+
+	do {
+		mmc_queue_bounce_post(mq_rq);
+
+		switch (status) {
+		case MMC_BLK_SUCCESS:
+		case MMC_BLK_PARTIAL:
+			disable_multi = 0;
+
+			/*
+			 * A block was successfully transferred.
+			 */
+			spin_lock_irq(&md->lock);
+			ret = __blk_end_request(req, 0, brq->data.bytes_xfered);
+			spin_unlock_irq(&md->lock);
+			break;
+		case MMC_BLK_RETRY:
+			break;
+		case MMC_BLK_RETRY_SINGLE:
+			disable_multi = 1;
+			break;
+		case MMC_BLK_DATA_ERR:
+			/*
+			 * After an error, we redo I/O one sector at a
+			 * time, so we only reach here after trying to
+			 * read a single sector.
+			 */
+			spin_lock_irq(&md->lock);
+			ret = __blk_end_request(req, -EIO, brq->data.blksz);
+			spin_unlock_irq(&md->lock);
+			break;
+		default:
 			goto cmd_err;
 		}
 
-		/*
-		 * A block was successfully transferred.
-		 */
-		spin_lock_irq(&md->lock);
-		ret = __blk_end_request(req, 0, brq.data.bytes_xfered);
-		spin_unlock_irq(&md->lock);
+		if (ret) {
+			/* Redo the rest of the request on its own */
+			mmc_blk_rw_rq_prep(mq_rq, card, disable_multi, mq);
+			mmc_start_req(card->host, &mq_rq->mmc_active, NULL);
+			mmc_start_req(card->host, NULL, &status);
+		}
 	} while (ret);
 
-	mmc_release_host(card->host);
-
 	return 1;
 
-cmd_sdremove:
-	spin_lock_irq(&md->lock);
-	__blk_end_request_all(req, -EIO);
-	spin_unlock_irq(&md->lock);
-	mmc_release_host(card->host);
-	return 0;
-
  cmd_err:
  /*
  * If this is an SD card and we're writing, we can first
@@ -688,12 +863,10 @@ cmd_sdremove:
 		}
 	} else {
 		spin_lock_irq(&md->lock);
-		ret = __blk_end_request(req, 0, brq.data.bytes_xfered);
+		ret = __blk_end_request(req, 0, brq->data.bytes_xfered);
 		spin_unlock_irq(&md->lock);
 	}
 
-	mmc_release_host(card->host);
-
 	spin_lock_irq(&md->lock);
 	while (ret)
 		ret = __blk_end_request(req, -EIO, blk_rq_cur_bytes(req));
@@ -702,6 +875,143 @@ cmd_sdremove:
 	return 0;
 }
 
+/*
+ * Completes the writes of a packed command. If it failed, which of them
+ * made it to the card is not known, so they are all written again one by
+ * one, with the error handling of unpacked requests.
+ */
+static int mmc_blk_end_packed_req(struct mmc_queue *mq,
+				  struct mmc_queue_req *mq_rq, int status)
+{
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_card *card = md->queue.card;
+	struct request *req;
+	int ret = 1;
+
+	if (status == MMC_BLK_SUCCESS) {
+		spin_lock_irq(&md->lock);
+		while (!list_empty(&mq_rq->packed_list)) {
+			req = list_first_entry(&mq_rq->packed_list,
+					       struct request, queuelist);
+			list_del_init(&req->queuelist);
+			__blk_end_request_all(req, 0);
+		}
+		spin_unlock_irq(&md->lock);
+		return 1;
+	}
+
+	printk(KERN_WARNING "%s: packed write of %u requests failed, "
+	       "writing them one by one\n", md->disk->disk_name,
+	       mq_rq->packed_num);
+	card->wr_pack_stats.fallbacks++;
+
+	while (!list_empty(&mq_rq->packed_list)) {
+		req = list_first_entry(&mq_rq->packed_list, struct request,
+				       queuelist);
+		list_del_init(&req->queuelist);
+
+		mq_rq->req = req;
+		mmc_blk_rw_rq_prep(mq_rq, card, 0, mq);
+		mmc_start_req(card->host, &mq_rq->mmc_active, NULL);
+		mmc_start_req(card->host, NULL, &status);
+		if (!mmc_blk_finish_rw_rq(mq, mq_rq, status))
+			ret = 0;
+	}
+
+	return ret;
+}
+
+/*
+ * Starts the read or write rqc, if any, as soon as the one in flight is
+ * done, so that preparing rqc overlaps that transfer. The request in flight
+ * is then completed; if it needs more than one transfer because of errors
+ * or its size, the rest is done before rqc is started.
+ */
+static int mmc_blk_issue_rw_rq(struct mmc_queue *mq, struct request *rqc)
+{
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_card *card = md->queue.card;
+	struct mmc_queue_req *mq_rq;
+	struct mmc_async_req *areq;
+	unsigned int packed_num;
+	bool rqc_started;
+	int status;
+	int ret;
+
+#ifdef _MMC_SAFE_ACCESS_
+	if (rqc && card->type == MMC_TYPE_SD && !mmc_is_available) {
+		spin_lock_irq(&md->lock);
+		__blk_end_request_all(rqc, -EIO);
+		spin_unlock_irq(&md->lock);
+		mq->mqrq_cur->req = NULL;
+		rqc = NULL;
+	}
+#endif
+
+	if (rqc) {
+		packed_num = mmc_blk_prep_packed_list(mq, rqc);
+		if (packed_num) {
+			mmc_blk_packed_hdr_wrq_prep(mq->mqrq_cur, card, mq);
+			card->wr_pack_stats.packed_cmds++;
+			card->wr_pack_stats.packed_reqs += packed_num;
+		} else {
+			mmc_blk_rw_rq_prep(mq->mqrq_cur, card, 0, mq);
+			if (rq_data_dir(rqc) == WRITE)
+				card->wr_pack_stats.unpacked_reqs++;
+		}
+		areq = &mq->mqrq_cur->mmc_active;
+	} else {
+		areq = NULL;
+	}
+
+	areq = mmc_start_req(card->host, areq, &status);
+	if (!areq)
+		return 1;
+
+	/* mmc_start_req() only starts rqc if the previous request is done */
+	rqc_started = rqc && status == MMC_BLK_SUCCESS;
+
+	mq_rq = container_of(areq, struct mmc_queue_req, mmc_active);
+	if (mq_rq->packed_cmd != MMC_PACKED_NONE)
+		ret = mmc_blk_end_packed_req(mq, mq_rq, status);
+	else
+		ret = mmc_blk_finish_rw_rq(mq, mq_rq, status);
+
+	if (rqc && !rqc_started)
+		mmc_start_req(card->host, &mq->mqrq_cur->mmc_active, NULL);
+
+	return ret;
+}
+
+/*
+ * Called by the queue thread with the next request, or with NULL to only
+ * complete the one in flight. The host stays claimed while requests are
+ * in flight.
+ */
+static int mmc_blk_issue_rq(struct mmc_queue *mq, struct request *req)
+{
+	struct mmc_blk_data *md = mq->data;
+	struct mmc_card *card = md->queue.card;
+	int ret;
+
+	if (req && !mq->mqrq_prev->req) {
+#ifdef CONFIG_MMC_BLOCK_DEFERRED_RESUME
+		if (mmc_bus_needs_resume(card->host)) {
+			mmc_resume_bus(card->host);
+			mmc_blk_set_blksize(md, card);
+		}
+#endif
+		mmc_claim_host(card->host);
+	}
+
+	ret = mmc_blk_issue_rw_rq(mq, req);
+
+	if (!mq->mqrq_cur->req)
+		mmc_release_host(card->host);
+
+	return ret;
+}
+
 static inline int mmc_blk_readonly(struct mmc_card *card)
 {
 	return mmc_card_readonly(card) ||
@@ -52,15 +52,24 @@ static int mmc_queue_thread(void *d)
 	down(&mq->thread_sem);
 	do {
 		struct request *req = NULL;
+		struct mmc_queue_req *tmp;
 
 		spin_lock_irq(q->queue_lock);
 		set_current_state(TASK_INTERRUPTIBLE);
 		if (!blk_queue_plugged(q))
 			req = blk_fetch_request(q);
-		mq->req = req;
+		mq->mqrq_cur->req = req;
 		spin_unlock_irq(q->queue_lock);
 
-		if (!req) {
+		if (req || mq->mqrq_prev->req) {
+			/*
+			 * Issue the new request, if any, once the one in
+			 * flight is done. Without a new request this only
+			 * completes the one in flight.
+			 */
+			set_current_state(TASK_RUNNING);
+			mq->issue_fn(mq, req);
+		} else {
 			if (kthread_should_stop()) {
 				set_current_state(TASK_RUNNING);
 				break;
@@ -68,11 +77,14 @@ static int mmc_queue_thread(void *d)
 			up(&mq->thread_sem);
 			schedule();
 			down(&mq->thread_sem);
-			continue;
 		}
-		set_current_state(TASK_RUNNING);
 
-		mq->issue_fn(mq, req);
+		/* The current request is now the one in flight */
+		mq->mqrq_prev->brq.mrq.data = NULL;
+		mq->mqrq_prev->req = NULL;
+		tmp = mq->mqrq_prev;
+		mq->mqrq_prev = mq->mqrq_cur;
+		mq->mqrq_cur = tmp;
 	} while (1);
 	up(&mq->thread_sem);
 
@@ -98,10 +110,32 @@ static void mmc_request(struct request_queue *q)
 		return;
 	}
 
-	if (!mq->req)
+	if (!mq->mqrq_cur->req && !mq->mqrq_prev->req)
 		wake_up_process(mq->thread);
 }
 
+static void mmc_queue_free_bufs(struct mmc_queue *mq)
+{
+	struct mmc_queue_req *mqrq;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(mq->mqrq); i++) {
+		mqrq = &mq->mqrq[i];
+
+		kfree(mqrq->bounce_sg);
+		mqrq->bounce_sg = NULL;
+
+		kfree(mqrq->sg);
+		mqrq->sg = NULL;
+
+		kfree(mqrq->bounce_buf);
+		mqrq->bounce_buf = NULL;
+
+		kfree(mqrq->packed_cmd_hdr);
+		mqrq->packed_cmd_hdr = NULL;
+	}
+}
+
 /**
  * mmc_init_queue - initialise a queue structure.
  * @mq: mmc queue
@@ -113,8 +147,10 @@ static void mmc_request(struct request_queue *q)
 int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card, spinlock_t *lock)
 {
 	struct mmc_host *host = card->host;
+	struct mmc_queue_req *mqrq;
 	u64 limit = BLK_BOUNCE_HIGH;
 	int ret;
+	int i;
 
 	if (mmc_dev(host)->dma_mask && *mmc_dev(host)->dma_mask)
 		limit = *mmc_dev(host)->dma_mask;
@@ -125,7 +161,10 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card, spinlock_t *lock
 		return -ENOMEM;
 
 	mq->queue->queuedata = mq;
-	mq->req = NULL;
+	mq->mqrq_cur = &mq->mqrq[0];
+	mq->mqrq_prev = &mq->mqrq[1];
+	for (i = 0; i < ARRAY_SIZE(mq->mqrq); i++)
+		INIT_LIST_HEAD(&mq->mqrq[i].packed_list);
 
 	blk_queue_prep_rq(mq->queue, mmc_prep_request);
 	blk_queue_ordered(mq->queue, QUEUE_ORDERED_DRAIN, NULL);
@@ -145,53 +184,71 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card, spinlock_t *lock
 			bouncesz = host->max_blk_count * 512;
 
 		if (bouncesz > 512) {
-			mq->bounce_buf = kmalloc(bouncesz, GFP_KERNEL);
-			if (!mq->bounce_buf) {
-				printk(KERN_WARNING "%s: unable to "
-					"allocate bounce buffer\n",
-					mmc_card_name(card));
+			for (i = 0; i < ARRAY_SIZE(mq->mqrq); i++) {
+				mqrq = &mq->mqrq[i];
+				mqrq->bounce_buf = kmalloc(bouncesz,
+							   GFP_KERNEL);
+				if (!mqrq->bounce_buf) {
+					printk(KERN_WARNING "%s: unable to "
+						"allocate bounce buffer\n",
+						mmc_card_name(card));
+					mmc_queue_free_bufs(mq);
+					break;
+				}
 			}
 		}
 
-		if (mq->bounce_buf) {
+		if (mq->mqrq[0].bounce_buf) {
 			blk_queue_bounce_limit(mq->queue, BLK_BOUNCE_ANY);
 			blk_queue_max_hw_sectors(mq->queue, bouncesz / 512);
 			blk_queue_max_segments(mq->queue, bouncesz / 512);
 			blk_queue_max_segment_size(mq->queue, bouncesz);
 
-			mq->sg = kmalloc(sizeof(struct scatterlist),
-				GFP_KERNEL);
-			if (!mq->sg) {
-				ret = -ENOMEM;
-				goto cleanup_queue;
-			}
-			sg_init_table(mq->sg, 1);
-
-			mq->bounce_sg = kmalloc(sizeof(struct scatterlist) *
-				bouncesz / 512, GFP_KERNEL);
-			if (!mq->bounce_sg) {
-				ret = -ENOMEM;
-				goto cleanup_queue;
+			for (i = 0; i < ARRAY_SIZE(mq->mqrq); i++) {
+				mqrq = &mq->mqrq[i];
+				mqrq->sg = kmalloc(sizeof(struct scatterlist),
+					GFP_KERNEL);
+				if (!mqrq->sg) {
+					ret = -ENOMEM;
+					goto cleanup_queue;
+				}
+				sg_init_table(mqrq->sg, 1);
+
+				mqrq->bounce_sg = kmalloc(
+					sizeof(struct scatterlist) *
+					bouncesz / 512, GFP_KERNEL);
+				if (!mqrq->bounce_sg) {
+					ret = -ENOMEM;
+					goto cleanup_queue;
+				}
+				sg_init_table(mqrq->bounce_sg, bouncesz / 512);
 			}
-			sg_init_table(mq->bounce_sg, bouncesz / 512);
 		}
 	}
 #endif
 
-	if (!mq->bounce_buf) {
+	if (!mq->mqrq[0].bounce_buf) {
 		blk_queue_bounce_limit(mq->queue, limit);
 		blk_queue_max_hw_sectors(mq->queue,
 			min(host->max_blk_count, host->max_req_size / 512));
 		blk_queue_max_segments(mq->queue, host->max_segs);
 		blk_queue_max_segment_size(mq->queue, host->max_seg_size);
 
-		mq->sg = kmalloc(sizeof(struct scatterlist) *
-			host->max_segs, GFP_KERNEL);
-		if (!mq->sg) {
-			ret = -ENOMEM;
-			goto cleanup_queue;
+		for (i = 0; i < ARRAY_SIZE(mq->mqrq); i++) {
+			mqrq = &mq->mqrq[i];
+			mqrq->sg = kmalloc(sizeof(struct scatterlist) *
+				host->max_segs, GFP_KERNEL);
+			if (!mqrq->sg) {
+				ret = -ENOMEM;
+				goto cleanup_queue;
+			}
+			sg_init_table(mqrq->sg, host->max_segs);
+
+			/* Writes are not packed if this fails */
+			if (card->ext_csd.max_packed_writes &&
+			    !mmc_host_is_spi(host))
+				mqrq->packed_cmd_hdr = kmalloc(512, GFP_KERNEL);
 		}
-		sg_init_table(mq->sg, host->max_segs);
 	}
 
 	init_MUTEX(&mq->thread_sem);
@@ -199,21 +256,12 @@ int mmc_init_queue(struct mmc_queue *mq, struct mmc_card *card, spinlock_t *lock
 	mq->thread = kthread_run(mmc_queue_thread, mq, "mmcqd");
 	if (IS_ERR(mq->thread)) {
 		ret = PTR_ERR(mq->thread);
-		goto free_bounce_sg;
+		goto cleanup_queue;
 	}
 
 	return 0;
- free_bounce_sg:
- 	if (mq->bounce_sg)
- 		kfree(mq->bounce_sg);
- 	mq->bounce_sg = NULL;
  cleanup_queue:
- 	if (mq->sg)
-		kfree(mq->sg);
-	mq->sg = NULL;
-	if (mq->bounce_buf)
-		kfree(mq->bounce_buf);
-	mq->bounce_buf = NULL;
+	mmc_queue_free_bufs(mq);
 	blk_cleanup_queue(mq->queue);
 	return ret;
 }
@@ -235,16 +283,7 @@ void mmc_cleanup_queue(struct mmc_queue *mq)
 	blk_start_queue(q);
 	spin_unlock_irqrestore(q->queue_lock, flags);
 
- 	if (mq->bounce_sg)
- 		kfree(mq->bounce_sg);
- 	mq->bounce_sg = NULL;
-
-	kfree(mq->sg);
-	mq->sg = NULL;
-
-	if (mq->bounce_buf)
-		kfree(mq->bounce_buf);
-	mq->bounce_buf = NULL;
+	mmc_queue_free_bufs(mq);
 
 	mq->card = NULL;
 }
@@ -294,30 +333,54 @@ void mmc_queue_resume(struct mmc_queue *mq)
 	}
 }
 
+/*
+ * Maps the packed command header followed by the data of every packed
+ * request, which blk_rq_map_sg() does not know how to chain.
+ */
+static unsigned int mmc_queue_packed_map_sg(struct mmc_queue *mq,
+					    struct mmc_queue_req *mqrq)
+{
+	struct scatterlist *sg = mqrq->sg;
+	struct request *req;
+	unsigned int sg_len = 1;
+
+	sg_set_buf(sg, mqrq->packed_cmd_hdr, 512);
+	list_for_each_entry(req, &mqrq->packed_list, queuelist) {
+		/* Not the end of the list after all */
+		sg[sg_len - 1].page_link &= ~0x02;
+		sg_len += blk_rq_map_sg(mq->queue, req, sg + sg_len);
+	}
+
+	return sg_len;
+}
+
 /*
  * Prepare the sg list(s) to be handed of to the host driver
  */
-unsigned int mmc_queue_map_sg(struct mmc_queue *mq)
+unsigned int mmc_queue_map_sg(struct mmc_queue *mq, struct mmc_queue_req *mqrq)
 {
 	unsigned int sg_len;
 	size_t buflen;
 	struct scatterlist *sg;
 	int i;
 
-	if (!mq->bounce_buf)
-		return blk_rq_map_sg(mq->queue, mq->req, mq->sg);
+	if (mqrq->packed_cmd != MMC_PACKED_NONE)
+		return mmc_queue_packed_map_sg(mq, mqrq);
+
+	if (!mqrq->bounce_buf)
+		return blk_rq_map_sg(mq->queue, mqrq->req, mqrq->sg);
 
-	BUG_ON(!mq->bounce_sg);
+	BUG_ON(!mqrq->bounce_sg);
 
-	sg_len = blk_rq_map_sg(mq->queue, mq->req, mq->bounce_sg);
+	sg_len = blk_rq_map_sg(mq->queue, mqrq->req, mqrq->bounce_sg);
 
-	mq->bounce_sg_len = sg_len;
+	mqrq->bounce_sg_len = sg_len;
 
 	buflen = 0;
-	for_each_sg(mq->bounce_sg, sg, sg_len, i)
+	for_each_sg(mqrq->bounce_sg, sg, sg_len, i)
 		buflen += sg->length;
 
-	sg_init_one(mq->sg, mq->bounce_buf, buflen);
+	sg_init_one(mqrq->sg, mqrq->bounce_buf, buflen);
 
 	return 1;
 }
@@ -326,19 +389,19 @@ unsigned int mmc_queue_map_sg(struct mmc_queue *mq)
  * If writing, bounce the data to the buffer before the request
  * is sent to the host driver
  */
-void mmc_queue_bounce_pre(struct mmc_queue *mq)
+void mmc_queue_bounce_pre(struct mmc_queue_req *mqrq)
 {
 	unsigned long flags;
 
-	if (!mq->bounce_buf)
+	if (!mqrq->bounce_buf)
 		return;
 
-	if (rq_data_dir(mq->req) != WRITE)
+	if (rq_data_dir(mqrq->req) != WRITE)
 		return;
 
 	local_irq_save(flags);
-	sg_copy_to_buffer(mq->bounce_sg, mq->bounce_sg_len,
-		mq->bounce_buf, mq->sg[0].length);
+	sg_copy_to_buffer(mqrq->bounce_sg, mqrq->bounce_sg_len,
+		mqrq->bounce_buf, mqrq->sg[0].length);
 	local_irq_restore(flags);
 }
 
@@ -346,19 +409,19 @@ void mmc_queue_bounce_pre(struct mmc_queue *mq)
  * If reading, bounce the data from the buffer after the request
  * has been handled by the host driver
  */
-void mmc_queue_bounce_post(struct mmc_queue *mq)
+void mmc_queue_bounce_post(struct mmc_queue_req *mqrq)
 {
 	unsigned long flags;
 
-	if (!mq->bounce_buf)
+	if (!mqrq->bounce_buf)
 		return;
 
-	if (rq_data_dir(mq->req) != READ)
+	if (rq_data_dir(mqrq->req) != READ)
 		return;
 
 	local_irq_save(flags);
-	sg_copy_from_buffer(mq->bounce_sg, mq->bounce_sg_len,
-		mq->bounce_buf, mq->sg[0].length);
+	sg_copy_from_buffer(mqrq->bounce_sg, mqrq->bounce_sg_len,
+		mqrq->bounce_buf, mqrq->sg[0].length);
 	local_irq_restore(flags);
 }
 
@@ -296,26 +296,34 @@ static void mmc_wait_done(struct mmc_request *mrq)
 	complete(mrq->done_data);
 }
 
-/**
- *	mmc_wait_for_req - start a request and wait for completion
- *	@host: MMC host to start command
- *	@mrq: MMC request to start
- *
- *	Start a new MMC custom command request for a host, and wait
- *	for the command to complete. Does not attempt to parse the
- *	response.
- */
-void mmc_wait_for_req(struct mmc_host *host, struct mmc_request *mrq)
+static int __mmc_start_req(struct mmc_host *host, struct mmc_request *mrq)
 {
-	int ret;
-	DECLARE_COMPLETION_ONSTACK(complete);
-
-	mrq->done_data = &complete;
+	init_completion(&mrq->completion);
+	mrq->done_data = &mrq->completion;
 	mrq->done = mmc_wait_done;
 
+	/*
+	 * SET_BLOCK_COUNT is issued on its own right before the request,
+	 * so that hosts need not know about it.
+	 */
+	if (mrq->sbc) {
+		if (mmc_wait_for_cmd(host, mrq->sbc, 0)) {
+			mrq->cmd->error = mrq->sbc->error;
+			complete(&mrq->completion);
+			return mrq->sbc->error;
+		}
+	}
+
 	mmc_start_request(host, mrq);
+	return 0;
+}
+
+static void mmc_wait_for_req_done(struct mmc_host *host,
+				  struct mmc_request *mrq)
+{
+	int ret;
 
-	if (!wait_for_completion_timeout(&complete,
+	if (!wait_for_completion_timeout(&mrq->completion,
 		msecs_to_jiffies(10000))) {
 		host->ops->dump_regs(host);
 		dump_mmc_ios(host);
@@ -344,6 +352,100 @@ void mmc_wait_for_req(struct mmc_host *host, struct mmc_request *mrq)
 	}
 }
 
+static inline void mmc_pre_req(struct mmc_host *host, struct mmc_request *mrq,
+		 bool is_first_req)
+{
+	if (host->ops->pre_req)
+		host->ops->pre_req(host, mrq, is_first_req);
+}
+
+static inline void mmc_post_req(struct mmc_host *host, struct mmc_request *mrq,
+			 int err)
+{
+	if (host->ops->post_req)
+		host->ops->post_req(host, mrq, err);
+}
+
+/* A request whose CMD23 failed was cancelled, and post_req done, at start */
+static inline void mmc_post_done_req(struct mmc_host *host,
+				     struct mmc_request *mrq)
+{
+	if (!mrq->sbc || !mrq->sbc->error)
+		mmc_post_req(host, mrq, 0);
+}
+
+/**
+ *	mmc_start_req - start a non-blocking request
+ *	@host: MMC host to start command
+ *	@areq: async request to start, or NULL to only finish the active one
+ *	@error: out parameter, err_check result of the finished request
+ *
+ *	Start a new MMC request for a host once the currently active one,
+ *	if any, is done. The new request is prepared by the host before
+ *	waiting, so that the preparation overlaps the active transfer.
+ *
+ *	If the active request fails its err_check, @areq is not started
+ *	and the host is left idle; the caller may start it again later.
+ *
+ *	Returns the request that finished, or NULL if none was active.
+ */
+struct mmc_async_req *mmc_start_req(struct mmc_host *host,
+				    struct mmc_async_req *areq, int *error)
+{
+	struct mmc_async_req *data = host->areq;
+	int err = 0;
+
+	/* Prepare a new request */
+	if (areq)
+		mmc_pre_req(host, areq->mrq, !host->areq);
+
+	if (host->areq) {
+		mmc_wait_for_req_done(host, host->areq->mrq);
+		err = host->areq->err_check(host->card, host->areq);
+		if (err) {
+			mmc_post_done_req(host, host->areq->mrq);
+			/* Cancel the prepared request */
+			if (areq)
+				mmc_post_req(host, areq->mrq, -EINVAL);
+			areq = NULL;
+			goto out;
+		}
+	}
+
+	/* A request whose CMD23 failed never reached the host, cancel it */
+	if (areq && __mmc_start_req(host, areq->mrq))
+		mmc_post_req(host, areq->mrq, -EINVAL);
+
+	if (host->areq)
+		mmc_post_done_req(host, host->areq->mrq);
+
+out:
+	host->areq = areq;
+	if (error)
+		*error = err;
+
+	return data;
+}
+EXPORT_SYMBOL(mmc_start_req);
+
+/**
+ *	mmc_wait_for_req - start a request and wait for completion
+ *	@host: MMC host to start command
+ *	@mrq: MMC request to start
+ *
+ *	Start a new MMC custom command request for a host, and wait
+ *	for the command to complete. Does not attempt to parse the
+ *	response.
+ */
+void mmc_wait_for_req(struct mmc_host *host, struct mmc_request *mrq)
+{
+	/* Not prepared by the host, whatever the caller left in there */
+	if (mrq->data)
+		mrq->data->host_cookie = 0;
+
+	__mmc_start_req(host, mrq);
+	mmc_wait_for_req_done(host, mrq);
+}
 
 EXPORT_SYMBOL(mmc_wait_for_req);
 
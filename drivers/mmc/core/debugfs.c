@@ -247,6 +247,33 @@ static const struct file_operations mmc_dbg_ext_csd_fops = {
 	.release	= mmc_ext_csd_release,
 };
 
+static int mmc_wr_pack_stats_show(struct seq_file *s, void *data)
+{
+	struct mmc_card *card = s->private;
+	struct mmc_wr_pack_stats *stats = &card->wr_pack_stats;
+
+	seq_printf(s, "max packed writes:\t%u\n",
+			card->ext_csd.max_packed_writes);
+	seq_printf(s, "packed commands:\t%u\n", stats->packed_cmds);
+	seq_printf(s, "packed requests:\t%u\n", stats->packed_reqs);
+	seq_printf(s, "unpacked requests:\t%u\n", stats->unpacked_reqs);
+	seq_printf(s, "unpacked fallbacks:\t%u\n", stats->fallbacks);
+
+	return 0;
+}
+
+static int mmc_wr_pack_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mmc_wr_pack_stats_show, inode->i_private);
+}
+
+static const struct file_operations mmc_dbg_wr_pack_stats_fops = {
+	.open		= mmc_wr_pack_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 void mmc_add_card_debugfs(struct mmc_card *card)
 {
 	struct mmc_host	*host = card->host;
@@ -279,6 +306,11 @@ void mmc_add_card_debugfs(struct mmc_card *card)
 					&mmc_dbg_ext_csd_fops))
 			goto err;
 
+	if (mmc_card_mmc(card))
+		if (!debugfs_create_file("wr_pack_stats", S_IRUSR, root, card,
+					&mmc_dbg_wr_pack_stats_fops))
+			goto err;
+
 	return;
 
 err:
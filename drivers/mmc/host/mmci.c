@@ -597,30 +597,67 @@ static inline void mmci_disable_dma(struct mmci_host *host)
 	host->dma_enable = false;
 }
 
-static void mmci_dma_data_end(struct mmci_host *host)
+static struct dma_chan *mmci_dma_chan(struct mmci_host *host,
+				      struct mmc_data *data)
 {
-	struct mmc_data *data = host->data;
+	if (data->flags & MMC_DATA_READ)
+		return host->dma_rx_channel;
+	else
+		return host->dma_tx_channel;
+}
 
+static void mmci_dma_unmap(struct mmci_host *host, struct mmc_data *data)
+{
 	dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
 		     (data->flags & MMC_DATA_WRITE)
 		     ? DMA_TO_DEVICE : DMA_FROM_DEVICE);
+}
+
+/* Forgets a job that was prepared but not submitted, and its mapping */
+static void mmci_dma_drop_job(struct mmci_host *host,
+			      struct mmci_host_next *job)
+{
+	mmci_dma_unmap(host, job->data);
+	job->data->host_cookie = 0;
+	job->dma_desc = NULL;
+	job->data = NULL;
+}
+
+static void mmci_dma_terminate_chan(struct mmci_host *host,
+				    struct dma_chan *chan)
+{
+	struct mmci_host_next *next = &host->next_data;
+	struct mmci_host_next *cur = &host->dma_current;
+	bool drop_next = next->dma_desc && next->dma_desc->chan == chan;
+	bool drop_cur = cur->dma_desc && cur->dma_desc->chan == chan;
+
+	chan->device->device_control(chan, DMA_TERMINATE_ALL, 0);
+
+	/* Jobs prepared on the channel are released by terminating it */
+	if (drop_next)
+		mmci_dma_drop_job(host, next);
+	if (drop_cur)
+		mmci_dma_drop_job(host, cur);
+}
+
+static void mmci_dma_data_end(struct mmci_host *host)
+{
+	struct mmc_data *data = host->data;
+
+	/* Data prepared by mmci_pre_request() is unmapped on post_req */
+	if (!data->host_cookie)
+		mmci_dma_unmap(host, data);
 	host->dma_on_current_xfer = false;
 }
 
 static void mmci_dma_terminate(struct mmci_host *host)
 {
 	struct mmc_data *data = host->data;
-	struct dma_chan *chan;
 
 	dev_err(mmc_dev(host->mmc), "error during DMA transfer!\n");
-	if (data->flags & MMC_DATA_READ)
-		chan = host->dma_rx_channel;
-	else
-		chan = host->dma_tx_channel;
-	dma_unmap_sg(mmc_dev(host->mmc), data->sg, data->sg_len,
-		     (data->flags & MMC_DATA_WRITE)
-		     ? DMA_TO_DEVICE : DMA_FROM_DEVICE);
-	chan->device->device_control(chan, DMA_TERMINATE_ALL, 0);
+	if (!data->host_cookie)
+		mmci_dma_unmap(host, data);
+	mmci_dma_terminate_chan(host, mmci_dma_chan(host, data));
 	host->dma_on_current_xfer = false;
 }
 
@@ -664,44 +701,34 @@ static void mmci_dma_callback(void *arg)
 	spin_unlock_irqrestore(&host->lock, flags);
 }
 
-static int mmci_dma_start_data(struct mmci_host *host, unsigned int datactrl)
+/*
+ * Checks that the data can be transferred by DMA and sets up the channel
+ * configuration for it. Returns -EINVAL if PIO is to be used instead.
+ */
+static int mmci_dma_conf(struct mmci_host *host, struct mmc_data *data,
+			 struct dma_slave_config *conf)
 {
 	struct variant_data *variant = host->variant;
-	struct dma_slave_config conf = {
-		.src_addr = host->phybase + MMCIFIFO,
-		.dst_addr = host->phybase + MMCIFIFO,
-		.src_addr_width = DMA_SLAVE_BUSWIDTH_4_BYTES,
-		.dst_addr_width = DMA_SLAVE_BUSWIDTH_4_BYTES,
-		.src_maxburst = variant->fifohalfsize >> 2, /* # of words */
-		.dst_maxburst = variant->fifohalfsize >> 2, /* # of words */
-	};
-	struct mmc_data *data = host->data;
-	struct dma_chan *chan;
-	struct dma_device *device;
-	struct dma_async_tx_descriptor *desc;
 	int memory_addr_width = DMA_SLAVE_BUSWIDTH_4_BYTES;
 	int maxburst_mult = 0;
 	struct scatterlist *sg;
-	int nr_sg, i;
-	dma_cookie_t cookie;
-	unsigned int irqmask0;
-
-	if (data->flags & MMC_DATA_READ) {
-		conf.direction = DMA_FROM_DEVICE;
-		chan = host->dma_rx_channel;
-	} else {
-		conf.direction = DMA_TO_DEVICE;
-		chan = host->dma_tx_channel;
-	}
+	int i;
 
 	/* If there's no DMA channel, fall back to PIO */
-	if (!chan)
+	if (!mmci_dma_chan(host, data))
 		return -EINVAL;
 
 	/* If less than or equal to the fifo size, don't bother with DMA */
-	if (host->size <= variant->fifosize)
+	if (data->blksz * data->blocks <= variant->fifosize)
 		return -EINVAL;
 
+	conf->src_addr = host->phybase + MMCIFIFO;
+	conf->dst_addr = host->phybase + MMCIFIFO;
+	conf->src_addr_width = DMA_SLAVE_BUSWIDTH_4_BYTES;
+	conf->dst_addr_width = DMA_SLAVE_BUSWIDTH_4_BYTES;
+	conf->src_maxburst = variant->fifohalfsize >> 2; /* # of words */
+	conf->dst_maxburst = variant->fifohalfsize >> 2; /* # of words */
+
 	/*
 	 * Verfiy alignment of all the sg lists elements. Calculate
 	 * correct value for memory bus width value and adjust
@@ -732,24 +759,83 @@ static int mmci_dma_start_data(struct mmci_host *host, unsigned int datactrl)
 		}
 	}
 	if (data->flags & MMC_DATA_READ) {
-		conf.dst_addr_width = memory_addr_width;
-		conf.dst_maxburst = conf.src_maxburst << maxburst_mult;
+		conf->direction = DMA_FROM_DEVICE;
+		conf->dst_addr_width = memory_addr_width;
+		conf->dst_maxburst = conf->src_maxburst << maxburst_mult;
 	} else {
-		conf.src_addr_width = memory_addr_width;
-		conf.src_maxburst = conf.dst_maxburst << maxburst_mult;
+		conf->direction = DMA_TO_DEVICE;
+		conf->src_addr_width = memory_addr_width;
+		conf->src_maxburst = conf->dst_maxburst << maxburst_mult;
 	}
 
-	device = chan->device;
-	nr_sg = dma_map_sg(device->dev, data->sg, data->sg_len, conf.direction);
-	if (nr_sg == 0)
-		return -EINVAL;
+	return 0;
+}
+
+static struct dma_async_tx_descriptor *mmci_dma_prep_desc(
+		struct mmci_host *host, struct mmc_data *data,
+		struct dma_slave_config *conf, int nr_sg)
+{
+	struct dma_chan *chan = mmci_dma_chan(host, data);
+	struct dma_device *device = chan->device;
 
-	device->device_control(chan, DMA_SLAVE_CONFIG, (unsigned long) &conf);
-	desc = device->device_prep_slave_sg(chan, data->sg, nr_sg,
-					    conf.direction,
+	device->device_control(chan, DMA_SLAVE_CONFIG, (unsigned long) conf);
+	return device->device_prep_slave_sg(chan, data->sg, nr_sg,
+					    conf->direction,
 					    DMA_CTRL_ACK | DMA_PREP_INTERRUPT);
-	if (!desc)
-		goto unmap_exit;
+}
+
+/*
+ * Takes the DMA job prepared by mmci_pre_request() for a request about to
+ * be started. A job still held for the previous request, whose data phase
+ * never started, is dropped here while the channels are idle.
+ */
+static void mmci_get_next_data(struct mmci_host *host, struct mmc_data *data)
+{
+	struct mmci_host_next *next = &host->next_data;
+	struct mmci_host_next *cur = &host->dma_current;
+
+	if (cur->dma_desc)
+		mmci_dma_terminate_chan(host, cur->dma_desc->chan);
+
+	if (data && next->dma_desc && next->data == data) {
+		*cur = *next;
+		next->dma_desc = NULL;
+		next->data = NULL;
+	}
+}
+
+static int mmci_dma_start_data(struct mmci_host *host, unsigned int datactrl)
+{
+	struct variant_data *variant = host->variant;
+	struct mmci_host_next *cur = &host->dma_current;
+	struct mmc_data *data = host->data;
+	struct dma_async_tx_descriptor *desc;
+	struct dma_slave_config conf;
+	struct dma_chan *chan;
+	dma_cookie_t cookie;
+	unsigned int irqmask0;
+	int nr_sg;
+
+	if (cur->dma_desc && cur->data == data) {
+		desc = cur->dma_desc;
+		cur->dma_desc = NULL;
+		cur->data = NULL;
+	} else {
+		if (mmci_dma_conf(host, data, &conf))
+			return -EINVAL;
+
+		nr_sg = dma_map_sg(mmc_dev(host->mmc), data->sg,
+				   data->sg_len, conf.direction);
+		if (nr_sg == 0)
+			return -EINVAL;
+
+		desc = mmci_dma_prep_desc(host, data, &conf, nr_sg);
+		if (!desc) {
+			mmci_dma_unmap(host, data);
+			return -ENOMEM;
+		}
+	}
+	chan = desc->chan;
 
 	/* Setup dma callback function. */
 	desc->callback = mmci_dma_callback;
@@ -766,7 +852,7 @@ static int mmci_dma_start_data(struct mmci_host *host, unsigned int datactrl)
 		goto unmap_exit;
 
 	host->dma_on_current_xfer = true;
-	device->device_issue_pending(chan);
+	chan->device->device_issue_pending(chan);
 
 	datactrl |= variant->dmareg_enable | MCI_DPSM_DMAENABLE;
 
@@ -785,10 +871,88 @@ static int mmci_dma_start_data(struct mmci_host *host, unsigned int datactrl)
 	return 0;
 
 unmap_exit:
-	device->device_control(chan, DMA_TERMINATE_ALL, 0);
-	dma_unmap_sg(device->dev, data->sg, data->sg_len, conf.direction);
+	mmci_dma_terminate_chan(host, chan);
+	/* PIO is used instead, so the data must not stay mapped */
+	mmci_dma_unmap(host, data);
+	data->host_cookie = 0;
 	return -ENOMEM;
 }
+
+/*
+ * Maps the data of the next request and prepares its DMA job while the
+ * current request is still being transferred, rather than when its data
+ * phase starts with the host lock held.
+ */
+static void mmci_pre_request(struct mmc_host *mmc, struct mmc_request *mrq,
+			     bool is_first_req)
+{
+	struct mmci_host *host = mmc_priv(mmc);
+	struct mmci_host_next *next = &host->next_data;
+	struct mmc_data *data = mrq->data;
+	struct dma_async_tx_descriptor *desc;
+	struct dma_slave_config conf;
+	unsigned long flags;
+	int nr_sg;
+
+	if (!data || !host->dma_enable)
+		return;
+
+	/*
+	 * A shared channel is reconfigured for the direction of each job,
+	 * which must not happen under a running transfer.
+	 */
+	if (host->dma_rx_channel == host->dma_tx_channel)
+		return;
+
+	if (WARN_ON(data->host_cookie))
+		return;
+
+	if (mmci_dma_conf(host, data, &conf))
+		return;
+
+	nr_sg = dma_map_sg(mmc_dev(mmc), data->sg, data->sg_len,
+			   conf.direction);
+	if (nr_sg == 0)
+		return;
+
+	/* Error handling of the current request may terminate the channel */
+	spin_lock_irqsave(&host->lock, flags);
+	desc = NULL;
+	if (!next->dma_desc)
+		desc = mmci_dma_prep_desc(host, data, &conf, nr_sg);
+	if (desc) {
+		next->dma_desc = desc;
+		next->data = data;
+		data->host_cookie = 1;
+	}
+	spin_unlock_irqrestore(&host->lock, flags);
+
+	if (!desc)
+		mmci_dma_unmap(host, data);
+}
+
+static void mmci_post_request(struct mmc_host *mmc, struct mmc_request *mrq,
+			      int err)
+{
+	struct mmci_host *host = mmc_priv(mmc);
+	struct mmci_host_next *next = &host->next_data;
+	struct mmc_data *data = mrq->data;
+	unsigned long flags;
+
+	if (!data)
+		return;
+
+	/* A cancelled request was never started, release its job */
+	spin_lock_irqsave(&host->lock, flags);
+	if (err && next->dma_desc && next->data == data)
+		mmci_dma_terminate_chan(host, next->dma_desc->chan);
+	spin_unlock_irqrestore(&host->lock, flags);
+
+	if (data->host_cookie) {
+		mmci_dma_unmap(host, data);
+		data->host_cookie = 0;
+	}
+}
 #else
 /* Blank functions if the DMA engine is not available */
 static inline void mmci_setup_dma(struct mmci_host *host)
@@ -807,11 +971,19 @@ static inline void mmci_dma_terminate(struct mmci_host *host)
 {
 }
 
+static inline void mmci_get_next_data(struct mmci_host *host,
+		struct mmc_data *data)
+{
+}
+
 static inline int mmci_dma_start_data(struct mmci_host *host,
 		unsigned int datactrl)
 {
 	return -ENOSYS;
 }
+
+#define mmci_pre_request NULL
+#define mmci_post_request NULL
 #endif
 
 static void mmci_dataend_timeout(struct work_struct *work)
@@ -1456,6 +1628,8 @@ static void mmci_request(struct mmc_host *mmc, struct mmc_request *mrq)
 
 	spin_lock_irqsave(&host->lock, flags);
 
+	mmci_get_next_data(host, mrq->data);
+
 	host->mrq = mrq;
 
 	if (mrq->data && mrq->data->flags & MMC_DATA_READ)
@@ -1847,6 +2021,8 @@ static void mmci_abort_request(struct mmc_host *mmc)
 
 static const struct mmc_host_ops mmci_ops = {
 	.request	= mmci_request,
+	.pre_req	= mmci_pre_request,
+	.post_req	= mmci_post_request,
 	.set_ios	= mmci_set_ios,
 	.get_ro		= mmci_get_ro,
 	.get_cd		= mmci_get_cd,
@@ -164,6 +164,16 @@ struct variant_data;
 struct dma_chan;
 struct dma_async_tx_descriptor;
 
+/**
+ * struct mmci_host_next - DMA job prepared ahead of its data phase
+ * @dma_desc: the prepared job, NULL when none
+ * @data: the data the job is for, mapped for DMA
+ */
+struct mmci_host_next {
+	struct dma_async_tx_descriptor	*dma_desc;
+	struct mmc_data			*data;
+};
+
 struct mmci_host {
 	phys_addr_t		phybase;
 	void __iomem		*base;
@@ -220,6 +230,8 @@ struct mmci_host {
 #ifdef CONFIG_DMA_ENGINE
 	struct dma_chan		*dma_rx_channel;
 	struct dma_chan		*dma_tx_channel;
+	struct mmci_host_next	dma_current;	/* job of the current request */
+	struct mmci_host_next	next_data;	/* job of the next request */
 #endif
 
 #ifdef CONFIG_DEBUG_FS
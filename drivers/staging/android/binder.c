@@ -15,6 +15,7 @@
  *
  */
 
+#include <asm/atomic.h>
 #include <asm/cacheflush.h>
 #include <linux/fdtable.h>
 #include <linux/file.h>
@@ -28,26 +29,65 @@
 #include <linux/poll.h>
 #include <linux/debugfs.h>
 #include <linux/rbtree.h>
+#include <linux/rwsem.h>
 #include <linux/sched.h>
 #include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
 #include <linux/uaccess.h>
 #include <linux/vmalloc.h>
 
 #include "binder.h"
 
-static DEFINE_MUTEX(binder_lock);
+/*
+ * Locking, outermost first:
+ *
+ * binder_teardown_sem: held for writing while a proc is released, for
+ *   reading while debugfs dumps the state. Ioctls do not take it.
+ * binder_procs_lock: binder_procs.
+ * binder_context_mgr_lock: binder_context_mgr_node and _uid.
+ * proc->alloc_lock: the buffer allocator of proc, and whether its pages
+ *   are in use, on proc->reserve or on binder_lru.
+ * proc->outer_lock: the refs of proc and their counts and deaths.
+ * node->lock: node reference counts and state, node->refs and node->proc.
+ * proc->inner_lock: the threads and nodes of proc, the todo lists of proc
+ *   and its threads (also node->async_todo and delivered_death), thread
+ *   transaction stacks, looper state and return errors, the thread counts,
+ *   tmp_ref and is_dead of proc and its threads, tmp_refs of the nodes of
+ *   proc and the transaction of proc's buffers.
+ * t->lock: t->from, t->to_proc and t->to_thread. Cleared with the inner
+ *   lock of the thread's proc held as well, so either lock keeps them.
+ * binder_dead_nodes_lock: binder_dead_nodes and tmp_refs of dead nodes.
+ * binder_lru_lock: binder_lru and binder_lru_count.
+ *
+ * A proc or thread reached from another proc is kept by a tmp_ref, see
+ * binder_proc_dec_tmpref and binder_thread_dec_tmpref. The outer or inner
+ * lock of one proc is never taken while holding the same lock of another
+ * proc, and the mutexes are never taken under the spinlocks.
+ * binder_deferred_lock only covers its list and no other lock is taken
+ * while holding it. proc->files_lock covers proc->files and is taken
+ * without holding any other binder lock.
+ */
+static DECLARE_RWSEM(binder_teardown_sem);
+static DEFINE_MUTEX(binder_context_mgr_lock);
+static DEFINE_MUTEX(binder_procs_lock);
 static DEFINE_MUTEX(binder_deferred_lock);
+static DEFINE_SPINLOCK(binder_dead_nodes_lock);
+static DEFINE_SPINLOCK(binder_lru_lock);
 
 static HLIST_HEAD(binder_procs);
 static HLIST_HEAD(binder_deferred_list);
 static HLIST_HEAD(binder_dead_nodes);
 
+/* Mapped buffer pages that no buffer uses, least recently freed last */
+static LIST_HEAD(binder_lru);
+static int binder_lru_count;
+
 static struct dentry *binder_debugfs_dir_entry_root;
 static struct dentry *binder_debugfs_dir_entry_proc;
 static struct binder_node *binder_context_mgr_node;
 static uid_t binder_context_mgr_uid = -1;
-static int binder_last_id;
+static atomic_t binder_last_id;
 static struct workqueue_struct *binder_deferred_workqueue;
 
 #define BINDER_DEBUG_ENTRY(name) \
@@ -105,6 +145,10 @@ module_param_named(debug_mask, binder_debug_mask, uint, S_IWUSR | S_IRUGO);
 static int binder_debug_no_lock;
 module_param_named(proc_no_lock, binder_debug_no_lock, bool, S_IWUSR | S_IRUGO);
 
+/* Pages at the start of each buffer area that stay mapped once mapped */
+static int binder_reserve_pages = 8;
+module_param_named(reserve_pages, binder_reserve_pages, int, S_IWUSR | S_IRUGO);
+
 static DECLARE_WAIT_QUEUE_HEAD(binder_user_error_wait);
 static int binder_stop_on_user_error;
 
@@ -146,22 +190,22 @@ enum binder_stat_types {
 };
 
 struct binder_stats {
-	int br[_IOC_NR(BR_FAILED_REPLY) + 1];
-	int bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
-	int obj_created[BINDER_STAT_COUNT];
-	int obj_deleted[BINDER_STAT_COUNT];
+	atomic_t br[_IOC_NR(BR_FAILED_REPLY) + 1];
+	atomic_t bc[_IOC_NR(BC_DEAD_BINDER_DONE) + 1];
+	atomic_t obj_created[BINDER_STAT_COUNT];
+	atomic_t obj_deleted[BINDER_STAT_COUNT];
 };
 
 static struct binder_stats binder_stats;
 
 static inline void binder_stats_deleted(enum binder_stat_types type)
 {
-	binder_stats.obj_deleted[type]++;
+	atomic_inc(&binder_stats.obj_deleted[type]);
 }
 
 static inline void binder_stats_created(enum binder_stat_types type)
 {
-	binder_stats.obj_created[type]++;
+	atomic_inc(&binder_stats.obj_created[type]);
 }
 
 struct binder_transaction_log_entry {
@@ -177,24 +221,27 @@ struct binder_transaction_log_entry {
 	int offsets_size;
 };
 struct binder_transaction_log {
-	int next;
+	atomic_t cur; /* last entry handed out */
 	int full;
 	struct binder_transaction_log_entry entry[32];
 };
-static struct binder_transaction_log binder_transaction_log;
-static struct binder_transaction_log binder_transaction_log_failed;
+static struct binder_transaction_log binder_transaction_log = {
+	.cur = ATOMIC_INIT(-1),
+};
+static struct binder_transaction_log binder_transaction_log_failed = {
+	.cur = ATOMIC_INIT(-1),
+};
 
 static struct binder_transaction_log_entry *binder_transaction_log_add(
 	struct binder_transaction_log *log)
 {
 	struct binder_transaction_log_entry *e;
-	e = &log->entry[log->next];
-	memset(e, 0, sizeof(*e));
-	log->next++;
-	if (log->next == ARRAY_SIZE(log->entry)) {
-		log->next = 0;
+	unsigned int cur = atomic_inc_return(&log->cur);
+
+	if (cur >= ARRAY_SIZE(log->entry) - 1)
 		log->full = 1;
-	}
+	e = &log->entry[cur % ARRAY_SIZE(log->entry)];
+	memset(e, 0, sizeof(*e));
 	return e;
 }
 
@@ -212,6 +259,7 @@ struct binder_work {
 
 struct binder_node {
 	int debug_id;
+	spinlock_t lock;
 	struct binder_work work;
 	union {
 		struct rb_node rb_node;
@@ -222,15 +270,17 @@ struct binder_node {
 	int internal_strong_refs;
 	int local_weak_refs;
 	int local_strong_refs;
+	int tmp_refs; /* kernel references held across unlocked sections */
 	void __user *ptr;
 	void __user *cookie;
 	unsigned has_strong_ref:1;
 	unsigned pending_strong_ref:1;
 	unsigned has_weak_ref:1;
 	unsigned pending_weak_ref:1;
-	unsigned has_async_transaction:1;
 	unsigned accept_fds:1;
 	unsigned min_priority:8;
+	/* Protected by proc->inner_lock, not lock */
+	bool has_async_transaction;
 	struct list_head async_todo;
 };
 
@@ -277,10 +327,25 @@ enum binder_deferred_state {
 	BINDER_DEFERRED_PUT_FILES    = 0x01,
 	BINDER_DEFERRED_FLUSH        = 0x02,
 	BINDER_DEFERRED_RELEASE      = 0x04,
+	BINDER_DEFERRED_RESERVE      = 0x08,
+};
+
+/*
+ * A page of the buffer area is in use while page_ptr is set and lru is
+ * empty. Unused pages stay mapped on proc->reserve or binder_lru until
+ * they are needed again or binder_shrink reclaims them.
+ */
+struct binder_lru_page {
+	struct list_head lru;
+	struct page *page_ptr;
+	struct binder_proc *proc;
 };
 
 struct binder_proc {
 	struct hlist_node proc_node;
+	spinlock_t outer_lock;
+	spinlock_t inner_lock;
+	struct mutex alloc_lock;
 	struct rb_root threads;
 	struct rb_root nodes;
 	struct rb_root refs_by_desc;
@@ -288,6 +353,7 @@ struct binder_proc {
 	int pid;
 	struct vm_area_struct *vma;
 	struct task_struct *tsk;
+	struct mutex files_lock;
 	struct files_struct *files;
 	struct hlist_node deferred_work_node;
 	int deferred_work;
@@ -299,7 +365,9 @@ struct binder_proc {
 	struct rb_root allocated_buffers;
 	size_t free_async_space;
 
-	struct page **pages;
+	struct binder_lru_page *pages;
+	int reserve_pages;
+	struct list_head reserve;
 	size_t buffer_size;
 	uint32_t buffer_free;
 	struct list_head todo;
@@ -312,6 +380,8 @@ struct binder_proc {
 	int ready_threads;
 	long default_priority;
 	struct dentry *debugfs_entry;
+	int tmp_ref; /* kernel references held from outside the proc */
+	bool is_dead; /* released, freed once tmp_ref and threads are gone */
 };
 
 enum {
@@ -336,10 +406,13 @@ struct binder_thread {
 		/* we are also waiting on */
 	wait_queue_head_t wait;
 	struct binder_stats stats;
+	atomic_t tmp_ref; /* references held from transactions */
+	bool is_dead; /* exited, freed once tmp_ref drops to 0 */
 };
 
 struct binder_transaction {
 	int debug_id;
+	spinlock_t lock;
 	struct binder_work work;
 	struct binder_thread *from;
 	struct binder_transaction *from_parent;
@@ -607,6 +680,39 @@ static struct binder_buffer *binder_buffer_lookup(struct binder_proc *proc,
 	return NULL;
 }
 
+static void binder_lru_add_page(struct binder_proc *proc,
+				struct binder_lru_page *page)
+{
+	BUG_ON(!list_empty(&page->lru));
+	if (page - proc->pages < proc->reserve_pages) {
+		list_add(&page->lru, &proc->reserve);
+		return;
+	}
+	spin_lock(&binder_lru_lock);
+	list_add(&page->lru, &binder_lru);
+	binder_lru_count++;
+	spin_unlock(&binder_lru_lock);
+}
+
+static void binder_lru_del_page(struct binder_proc *proc,
+				struct binder_lru_page *page)
+{
+	BUG_ON(list_empty(&page->lru));
+	if (page - proc->pages < proc->reserve_pages) {
+		list_del_init(&page->lru);
+		return;
+	}
+	spin_lock(&binder_lru_lock);
+	list_del_init(&page->lru);
+	binder_lru_count--;
+	spin_unlock(&binder_lru_lock);
+}
+
+/*
+ * Pages that are still mapped from an earlier buffer are reused as they
+ * are, so only pages the shrinker took back are allocated and mapped.
+ * Freed pages stay mapped on proc->reserve or binder_lru.
+ */
 static int binder_update_page_range(struct binder_proc *proc, int allocate,
 				    void *start, void *end,
 				    struct vm_area_struct *vma)
@@ -614,8 +720,8 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	void *page_addr;
 	unsigned long user_page_addr;
 	struct vm_struct tmp_area;
-	struct page **page;
-	struct mm_struct *mm;
+	struct binder_lru_page *page;
+	struct mm_struct *mm = NULL;
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: %s pages %p-%p\n", proc->pid,
@@ -624,40 +730,42 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 	if (end <= start)
 		return 0;
 
-	if (vma)
-		mm = NULL;
-	else
-		mm = get_task_mm(proc->tsk);
-
-	if (mm) {
-		down_write(&mm->mmap_sem);
-		vma = proc->vma;
-	}
-
 	if (allocate == 0)
 		goto free_range;
 
-	if (vma == NULL) {
-		printk(KERN_ERR "binder: %d: binder_alloc_buf failed to "
-		       "map pages in userspace, no vma\n", proc->pid);
-		goto err_no_vma;
-	}
-
 	for (page_addr = start; page_addr < end; page_addr += PAGE_SIZE) {
 		int ret;
 		struct page **page_array_ptr;
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
 
-		BUG_ON(*page);
-		*page = alloc_page(GFP_KERNEL | __GFP_ZERO);
-		if (*page == NULL) {
+		if (page->page_ptr) {
+			binder_lru_del_page(proc, page);
+			continue;
+		}
+
+		if (vma == NULL) {
+			mm = get_task_mm(proc->tsk);
+			if (mm) {
+				down_write(&mm->mmap_sem);
+				vma = proc->vma;
+			}
+			if (vma == NULL) {
+				printk(KERN_ERR "binder: %d: binder_alloc_buf "
+				       "failed to map pages in userspace, "
+				       "no vma\n", proc->pid);
+				goto err_no_vma;
+			}
+		}
+
+		page->page_ptr = alloc_page(GFP_KERNEL | __GFP_ZERO);
+		if (page->page_ptr == NULL) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "for page at %p\n", proc->pid, page_addr);
 			goto err_alloc_page_failed;
 		}
 		tmp_area.addr = page_addr;
 		tmp_area.size = PAGE_SIZE + PAGE_SIZE /* guard page? */;
-		page_array_ptr = page;
+		page_array_ptr = &page->page_ptr;
 		ret = map_vm_area(&tmp_area, PAGE_KERNEL, &page_array_ptr);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
@@ -667,7 +775,7 @@ static int binder_update_page_range(struct binder_proc *proc, int allocate,
 		}
 		user_page_addr =
 			(uintptr_t)page_addr + proc->user_buffer_offset;
-		ret = vm_insert_page(vma, user_page_addr, page[0]);
+		ret = vm_insert_page(vma, user_page_addr, page->page_ptr);
 		if (ret) {
 			printk(KERN_ERR "binder: %d: binder_alloc_buf failed "
 			       "to map page at %lx in userspace\n",
@@ -686,18 +794,23 @@ free_range:
 	for (page_addr = end - PAGE_SIZE; page_addr >= start;
 	     page_addr -= PAGE_SIZE) {
 		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
-		if (vma)
-			zap_page_range(vma, (uintptr_t)page_addr +
-				proc->user_buffer_offset, PAGE_SIZE, NULL);
+		binder_lru_add_page(proc, page);
+	}
+	return 0;
+
 err_vm_insert_page_failed:
-		unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
 err_map_kernel_failed:
-		__free_page(*page);
-		*page = NULL;
+	__free_page(page->page_ptr);
+	page->page_ptr = NULL;
 err_alloc_page_failed:
-		;
-	}
 err_no_vma:
+	/* The pages we got so far stay mapped for the next buffer */
+	for (page_addr -= PAGE_SIZE; page_addr >= start;
+	     page_addr -= PAGE_SIZE) {
+		page = &proc->pages[(page_addr - proc->buffer) / PAGE_SIZE];
+		binder_lru_add_page(proc, page);
+	}
 	if (mm) {
 		up_write(&mm->mmap_sem);
 		mmput(mm);
@@ -705,9 +818,86 @@ err_no_vma:
 	return -ENOMEM;
 }
 
-static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
-					      size_t data_size,
-					      size_t offsets_size, int is_async)
+/*
+ * Unmaps and frees a page taken off binder_lru, with proc->alloc_lock
+ * held. Returns 0 if the user mapping could not be removed without
+ * blocking.
+ */
+static int binder_reclaim_page(struct binder_proc *proc,
+			       struct binder_lru_page *page)
+{
+	void *page_addr = proc->buffer + (page - proc->pages) * PAGE_SIZE;
+	struct mm_struct *mm;
+
+	/* proc->vma is only cleared, and never set again, once unmapped */
+	if (proc->vma) {
+		mm = get_task_mm(proc->tsk);
+		if (mm == NULL)
+			return 0;
+		if (!down_read_trylock(&mm->mmap_sem)) {
+			mmput(mm);
+			return 0;
+		}
+		if (proc->vma)
+			zap_page_range(proc->vma, (uintptr_t)page_addr +
+				proc->user_buffer_offset, PAGE_SIZE, NULL);
+		up_read(&mm->mmap_sem);
+		mmput(mm);
+	}
+
+	unmap_kernel_range((unsigned long)page_addr, PAGE_SIZE);
+	__free_page(page->page_ptr);
+	page->page_ptr = NULL;
+
+	return 1;
+}
+
+static int binder_shrink(struct shrinker *shrinker, int nr_to_scan,
+			 gfp_t gfp_mask)
+{
+	struct binder_lru_page *page;
+	struct binder_proc *proc;
+
+	if (nr_to_scan > 0) {
+		/*
+		 * We might be called from an allocation made under our locks.
+		 * A proc frees its pages with alloc_lock held, so it stays
+		 * valid while a page of it is reclaimed.
+		 */
+		spin_lock(&binder_lru_lock);
+		while (nr_to_scan-- > 0 && !list_empty(&binder_lru)) {
+			page = list_entry(binder_lru.prev,
+					  struct binder_lru_page, lru);
+			proc = page->proc;
+			if (!mutex_trylock(&proc->alloc_lock)) {
+				list_move(&page->lru, &binder_lru);
+				continue;
+			}
+			list_del_init(&page->lru);
+			binder_lru_count--;
+			spin_unlock(&binder_lru_lock);
+
+			if (!binder_reclaim_page(proc, page))
+				binder_lru_add_page(proc, page);
+			mutex_unlock(&proc->alloc_lock);
+
+			spin_lock(&binder_lru_lock);
+		}
+		spin_unlock(&binder_lru_lock);
+	}
+
+	return binder_lru_count;
+}
+
+static struct shrinker binder_shrinker = {
+	.shrink = binder_shrink,
+	.seeks = DEFAULT_SEEKS,
+};
+
+static struct binder_buffer *binder_alloc_buf_locked(struct binder_proc *proc,
+						     size_t data_size,
+						     size_t offsets_size,
+						     int is_async)
 {
 	struct rb_node *n = proc->free_buffers.rb_node;
 	struct binder_buffer *buffer;
@@ -715,6 +905,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	struct rb_node *best_fit = NULL;
 	void *has_page_addr;
 	void *end_page_addr;
+	void *reserve_end;
 	size_t size;
 
 	if (proc->vma == NULL) {
@@ -740,6 +931,21 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		return NULL;
 	}
 
+	/*
+	 * A buffer that fits in the reserve takes the lowest free space
+	 * there, so small transactions keep using pages that stay mapped.
+	 */
+	reserve_end = proc->buffer + proc->reserve_pages * PAGE_SIZE;
+	list_for_each_entry(buffer, &proc->buffers, entry) {
+		if ((void *)buffer->data + size > reserve_end)
+			break;
+		if (buffer->free && binder_buffer_size(proc, buffer) >= size) {
+			best_fit = &buffer->rb_node;
+			n = NULL;
+			break;
+		}
+	}
+
 	while (n) {
 		buffer = rb_entry(n, struct binder_buffer, rb_node);
 		BUG_ON(!buffer->free);
@@ -760,10 +966,8 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 		       "no address space\n", proc->pid, size);
 		return NULL;
 	}
-	if (n == NULL) {
-		buffer = rb_entry(best_fit, struct binder_buffer, rb_node);
-		buffer_size = binder_buffer_size(proc, buffer);
-	}
+	buffer = rb_entry(best_fit, struct binder_buffer, rb_node);
+	buffer_size = binder_buffer_size(proc, buffer);
 
 	binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
 		     "binder: %d: binder_alloc_buf size %zd got buff"
@@ -771,7 +975,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 
 	has_page_addr =
 		(void *)(((uintptr_t)buffer->data + buffer_size) & PAGE_MASK);
-	if (n == NULL) {
+	if (buffer_size != size) {
 		if (size + sizeof(struct binder_buffer) + 4 >= buffer_size)
 			buffer_size = size; /* no room for other buffers */
 		else
@@ -800,6 +1004,7 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	buffer->data_size = data_size;
 	buffer->offsets_size = offsets_size;
 	buffer->async_transaction = is_async;
+	buffer->allow_user_free = 0;
 	if (is_async) {
 		proc->free_async_space -= size + sizeof(struct binder_buffer);
 		binder_debug(BINDER_DEBUG_BUFFER_ALLOC_ASYNC,
@@ -811,6 +1016,19 @@ static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
 	return buffer;
 }
 
+static struct binder_buffer *binder_alloc_buf(struct binder_proc *proc,
+					      size_t data_size,
+					      size_t offsets_size, int is_async)
+{
+	struct binder_buffer *buffer;
+
+	mutex_lock(&proc->alloc_lock);
+	buffer = binder_alloc_buf_locked(proc, data_size, offsets_size,
+					 is_async);
+	mutex_unlock(&proc->alloc_lock);
+	return buffer;
+}
+
 static void *buffer_start_page(struct binder_buffer *buffer)
 {
 	return (void *)((uintptr_t)buffer & PAGE_MASK);
@@ -868,8 +1086,8 @@ static void binder_delete_free_buffer(struct binder_proc *proc,
 	}
 }
 
-static void binder_free_buf(struct binder_proc *proc,
-			    struct binder_buffer *buffer)
+static void binder_free_buf_locked(struct binder_proc *proc,
+				   struct binder_buffer *buffer)
 {
 	size_t size, buffer_size;
 
@@ -923,8 +1141,16 @@ static void binder_free_buf(struct binder_proc *proc,
 	binder_insert_free_buffer(proc, buffer);
 }
 
-static struct binder_node *binder_get_node(struct binder_proc *proc,
-					   void __user *ptr)
+static void binder_free_buf(struct binder_proc *proc,
+			    struct binder_buffer *buffer)
+{
+	mutex_lock(&proc->alloc_lock);
+	binder_free_buf_locked(proc, buffer);
+	mutex_unlock(&proc->alloc_lock);
+}
+
+static struct binder_node *binder_get_node_ilocked(struct binder_proc *proc,
+						   void __user *ptr)
 {
 	struct rb_node *n = proc->nodes.rb_node;
 	struct binder_node *node;
@@ -942,14 +1168,36 @@ static struct binder_node *binder_get_node(struct binder_proc *proc,
 	return NULL;
 }
 
+/* Returns the node with a tmp ref, dropped with binder_put_node */
+static struct binder_node *binder_get_node(struct binder_proc *proc,
+					   void __user *ptr)
+{
+	struct binder_node *node;
+
+	spin_lock(&proc->inner_lock);
+	node = binder_get_node_ilocked(proc, ptr);
+	if (node)
+		node->tmp_refs++;
+	spin_unlock(&proc->inner_lock);
+	return node;
+}
+
+/* Like binder_get_node, but creates the node if proc has none for ptr */
 static struct binder_node *binder_new_node(struct binder_proc *proc,
 					   void __user *ptr,
-					   void __user *cookie)
+					   void __user *cookie,
+					   unsigned long flags)
 {
 	struct rb_node **p = &proc->nodes.rb_node;
 	struct rb_node *parent = NULL;
 	struct binder_node *node;
+	struct binder_node *new_node;
+
+	new_node = kzalloc(sizeof(*new_node), GFP_KERNEL);
+	if (new_node == NULL)
+		return NULL;
 
+	spin_lock(&proc->inner_lock);
 	while (*p) {
 		parent = *p;
 		node = rb_entry(parent, struct binder_node, rb_node);
@@ -958,23 +1206,29 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 			p = &(*p)->rb_left;
 		else if (ptr > node->ptr)
 			p = &(*p)->rb_right;
-		else
-			return NULL;
+		else {
+			node->tmp_refs++;
+			spin_unlock(&proc->inner_lock);
+			kfree(new_node);
+			return node;
+		}
 	}
-
-	node = kzalloc(sizeof(*node), GFP_KERNEL);
-	if (node == NULL)
-		return NULL;
+	node = new_node;
 	binder_stats_created(BINDER_STAT_NODE);
-	rb_link_node(&node->rb_node, parent, p);
-	rb_insert_color(&node->rb_node, &proc->nodes);
-	node->debug_id = ++binder_last_id;
+	spin_lock_init(&node->lock);
+	node->debug_id = atomic_inc_return(&binder_last_id);
 	node->proc = proc;
 	node->ptr = ptr;
 	node->cookie = cookie;
+	node->min_priority = flags & FLAT_BINDER_FLAG_PRIORITY_MASK;
+	node->accept_fds = !!(flags & FLAT_BINDER_FLAG_ACCEPTS_FDS);
+	node->tmp_refs = 1;
 	node->work.type = BINDER_WORK_NODE;
 	INIT_LIST_HEAD(&node->work.entry);
 	INIT_LIST_HEAD(&node->async_todo);
+	rb_link_node(&node->rb_node, parent, p);
+	rb_insert_color(&node->rb_node, &proc->nodes);
+	spin_unlock(&proc->inner_lock);
 	binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 		     "binder: %d:%d node %d u%p c%p created\n",
 		     proc->pid, current->pid, node->debug_id,
@@ -982,9 +1236,70 @@ static struct binder_node *binder_new_node(struct binder_proc *proc,
 	return node;
 }
 
+/*
+ * The work entry, tree or list linkage and tmp_refs of a node belong to
+ * its owner: proc->inner_lock while the proc lives, binder_dead_nodes_lock
+ * after it died. Called with node->lock held, which keeps node->proc.
+ */
+static void binder_node_lock_owner(struct binder_node *node)
+{
+	if (node->proc)
+		spin_lock(&node->proc->inner_lock);
+	else
+		spin_lock(&binder_dead_nodes_lock);
+}
+
+static void binder_node_unlock_owner(struct binder_node *node)
+{
+	if (node->proc)
+		spin_unlock(&node->proc->inner_lock);
+	else
+		spin_unlock(&binder_dead_nodes_lock);
+}
+
+/*
+ * Called with node->lock and the owner lock held. Unlinks the node if
+ * nothing refers to it any more and returns 1, the caller then frees it.
+ */
+static int binder_try_unlink_node(struct binder_node *node)
+{
+	if (node->tmp_refs || !hlist_empty(&node->refs) ||
+	    node->local_strong_refs || node->local_weak_refs)
+		return 0;
+	if (node->proc && (node->has_strong_ref || node->has_weak_ref))
+		return 0;
+
+	list_del_init(&node->work.entry);
+	if (node->proc) {
+		rb_erase(&node->rb_node, &node->proc->nodes);
+		binder_debug(BINDER_DEBUG_INTERNAL_REFS,
+			     "binder: refless node %d deleted\n",
+			     node->debug_id);
+	} else {
+		hlist_del(&node->dead_node);
+		binder_debug(BINDER_DEBUG_INTERNAL_REFS,
+			     "binder: dead node %d deleted\n",
+			     node->debug_id);
+	}
+	return 1;
+}
+
+static void binder_free_node(struct binder_node *node)
+{
+	kfree(node);
+	binder_stats_deleted(BINDER_STAT_NODE);
+}
+
 static int binder_inc_node(struct binder_node *node, int strong, int internal,
 			   struct list_head *target_list)
 {
+	int lock_owner;
+	int ret = 0;
+
+	spin_lock(&node->lock);
+	lock_owner = target_list || (!strong && !node->has_weak_ref);
+	if (lock_owner)
+		binder_node_lock_owner(node);
 	if (strong) {
 		if (internal) {
 			if (target_list == NULL &&
@@ -993,7 +1308,8 @@ static int binder_inc_node(struct binder_node *node, int strong, int internal,
 			    node->has_strong_ref)) {
 				printk(KERN_ERR "binder: invalid inc strong "
 					"node for %d\n", node->debug_id);
-				return -EINVAL;
+				ret = -EINVAL;
+				goto out;
 			}
 			node->internal_strong_refs++;
 		} else
@@ -1009,16 +1325,25 @@ static int binder_inc_node(struct binder_node *node, int strong, int internal,
 			if (target_list == NULL) {
 				printk(KERN_ERR "binder: invalid inc weak node "
 					"for %d\n", node->debug_id);
-				return -EINVAL;
+				ret = -EINVAL;
+				goto out;
 			}
 			list_add_tail(&node->work.entry, target_list);
 		}
 	}
-	return 0;
+out:
+	if (lock_owner)
+		binder_node_unlock_owner(node);
+	spin_unlock(&node->lock);
+	return ret;
 }
 
-static int binder_dec_node(struct binder_node *node, int strong, int internal)
+/* Called with node->lock held, returns 1 if the caller must free node */
+static int binder_dec_node_nlocked(struct binder_node *node, int strong,
+				   int internal)
 {
+	int free_node = 0;
+
 	if (strong) {
 		if (internal)
 			node->internal_strong_refs--;
@@ -1032,32 +1357,53 @@ static int binder_dec_node(struct binder_node *node, int strong, int internal)
 		if (node->local_weak_refs || !hlist_empty(&node->refs))
 			return 0;
 	}
+	binder_node_lock_owner(node);
 	if (node->proc && (node->has_strong_ref || node->has_weak_ref)) {
 		if (list_empty(&node->work.entry)) {
 			list_add_tail(&node->work.entry, &node->proc->todo);
 			wake_up_interruptible(&node->proc->wait);
 		}
-	} else {
-		if (hlist_empty(&node->refs) && !node->local_strong_refs &&
-		    !node->local_weak_refs) {
-			list_del_init(&node->work.entry);
-			if (node->proc) {
-				rb_erase(&node->rb_node, &node->proc->nodes);
-				binder_debug(BINDER_DEBUG_INTERNAL_REFS,
-					     "binder: refless node %d deleted\n",
-					     node->debug_id);
-			} else {
-				hlist_del(&node->dead_node);
-				binder_debug(BINDER_DEBUG_INTERNAL_REFS,
-					     "binder: dead node %d deleted\n",
-					     node->debug_id);
-			}
-			kfree(node);
-			binder_stats_deleted(BINDER_STAT_NODE);
-		}
-	}
+	} else
+		free_node = binder_try_unlink_node(node);
+	binder_node_unlock_owner(node);
 
-	return 0;
+	return free_node;
+}
+
+static void binder_dec_node(struct binder_node *node, int strong, int internal)
+{
+	int free_node;
+
+	spin_lock(&node->lock);
+	free_node = binder_dec_node_nlocked(node, strong, internal);
+	spin_unlock(&node->lock);
+	if (free_node)
+		binder_free_node(node);
+}
+
+/* The caller must hold something that keeps node alive meanwhile */
+static void binder_inc_node_tmpref(struct binder_node *node)
+{
+	spin_lock(&node->lock);
+	binder_node_lock_owner(node);
+	node->tmp_refs++;
+	binder_node_unlock_owner(node);
+	spin_unlock(&node->lock);
+}
+
+static void binder_put_node(struct binder_node *node)
+{
+	int free_node;
+
+	spin_lock(&node->lock);
+	binder_node_lock_owner(node);
+	BUG_ON(node->tmp_refs <= 0);
+	node->tmp_refs--;
+	free_node = binder_try_unlink_node(node);
+	binder_node_unlock_owner(node);
+	spin_unlock(&node->lock);
+	if (free_node)
+		binder_free_node(node);
 }
 
 
@@ -1080,13 +1426,15 @@ static struct binder_ref *binder_get_ref(struct binder_proc *proc,
 	return NULL;
 }
 
-static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
-						  struct binder_node *node)
+/* Inserts new_ref if proc has no ref to node, unless new_ref is NULL */
+static struct binder_ref *binder_get_ref_for_node_olocked(
+	struct binder_proc *proc, struct binder_node *node,
+	struct binder_ref *new_ref)
 {
 	struct rb_node *n;
 	struct rb_node **p = &proc->refs_by_node.rb_node;
 	struct rb_node *parent = NULL;
-	struct binder_ref *ref, *new_ref;
+	struct binder_ref *ref;
 
 	while (*p) {
 		parent = *p;
@@ -1099,11 +1447,11 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 		else
 			return ref;
 	}
-	new_ref = kzalloc(sizeof(*ref), GFP_KERNEL);
-	if (new_ref == NULL)
+	/* A released proc gets no new refs, they would never be deleted */
+	if (new_ref == NULL || proc->is_dead)
 		return NULL;
 	binder_stats_created(BINDER_STAT_REF);
-	new_ref->debug_id = ++binder_last_id;
+	new_ref->debug_id = atomic_inc_return(&binder_last_id);
 	new_ref->proc = proc;
 	new_ref->node = node;
 	rb_link_node(&new_ref->rb_node_node, parent, p);
@@ -1132,7 +1480,9 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 	rb_link_node(&new_ref->rb_node_desc, parent, p);
 	rb_insert_color(&new_ref->rb_node_desc, &proc->refs_by_desc);
 	if (node) {
+		spin_lock(&node->lock);
 		hlist_add_head(&new_ref->node_entry, &node->refs);
+		spin_unlock(&node->lock);
 
 		binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 			     "binder: %d new ref %d desc %d for "
@@ -1147,25 +1497,60 @@ static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
 	return new_ref;
 }
 
+/*
+ * Called with proc->outer_lock held, which is dropped to allocate a new
+ * ref. The caller keeps node alive meanwhile.
+ */
+static struct binder_ref *binder_get_ref_for_node(struct binder_proc *proc,
+						  struct binder_node *node)
+{
+	struct binder_ref *ref;
+	struct binder_ref *new_ref;
+
+	ref = binder_get_ref_for_node_olocked(proc, node, NULL);
+	if (ref)
+		return ref;
+
+	spin_unlock(&proc->outer_lock);
+	new_ref = kzalloc(sizeof(*new_ref), GFP_KERNEL);
+	spin_lock(&proc->outer_lock);
+	if (new_ref == NULL)
+		return NULL;
+
+	ref = binder_get_ref_for_node_olocked(proc, node, new_ref);
+	if (ref != new_ref)
+		kfree(new_ref);
+	return ref;
+}
+
 static void binder_delete_ref(struct binder_ref *ref)
 {
+	struct binder_node *node = ref->node;
+	int free_node;
+
 	binder_debug(BINDER_DEBUG_INTERNAL_REFS,
 		     "binder: %d delete ref %d desc %d for "
 		     "node %d\n", ref->proc->pid, ref->debug_id,
-		     ref->desc, ref->node->debug_id);
+		     ref->desc, node->debug_id);
 
 	rb_erase(&ref->rb_node_desc, &ref->proc->refs_by_desc);
 	rb_erase(&ref->rb_node_node, &ref->proc->refs_by_node);
 	if (ref->strong)
-		binder_dec_node(ref->node, 1, 1);
+		binder_dec_node(node, 1, 1);
+	spin_lock(&node->lock);
 	hlist_del(&ref->node_entry);
-	binder_dec_node(ref->node, 0, 1);
+	free_node = binder_dec_node_nlocked(node, 0, 1);
+	spin_unlock(&node->lock);
+	if (free_node)
+		binder_free_node(node);
 	if (ref->death) {
 		binder_debug(BINDER_DEBUG_DEAD_BINDER,
 			     "binder: %d delete ref %d desc %d "
 			     "has death notification\n", ref->proc->pid,
 			     ref->debug_id, ref->desc);
+		spin_lock(&ref->proc->inner_lock);
 		list_del(&ref->death->work.entry);
+		spin_unlock(&ref->proc->inner_lock);
 		kfree(ref->death);
 		binder_stats_deleted(BINDER_STAT_DEATH);
 	}
@@ -1207,12 +1592,8 @@ static int binder_dec_ref(struct binder_ref *ref, int strong)
 			return -EINVAL;
 		}
 		ref->strong--;
-		if (ref->strong == 0) {
-			int ret;
-			ret = binder_dec_node(ref->node, strong, 1);
-			if (ret)
-				return ret;
-		}
+		if (ref->strong == 0)
+			binder_dec_node(ref->node, strong, 1);
 	} else {
 		if (ref->weak == 0) {
 			binder_user_error("binder: %d invalid dec weak, "
@@ -1228,19 +1609,201 @@ static int binder_dec_ref(struct binder_ref *ref, int strong)
 	return 0;
 }
 
-static void binder_pop_transaction(struct binder_thread *target_thread,
-				   struct binder_transaction *t)
+/*
+ * Frees a released proc once nothing refers to it any more, with the
+ * buffers that transactions to it held until then.
+ */
+static void binder_free_proc(struct binder_proc *proc)
 {
-	if (target_thread) {
-		BUG_ON(target_thread->transaction_stack != t);
-		BUG_ON(target_thread->transaction_stack->from != target_thread);
-		target_thread->transaction_stack =
-			target_thread->transaction_stack->from_parent;
-		t->from = NULL;
+	struct binder_transaction *t;
+	struct rb_node *n;
+	int buffers, page_count;
+
+	buffers = 0;
+	mutex_lock(&proc->alloc_lock);
+	while ((n = rb_first(&proc->allocated_buffers))) {
+		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer,
+							rb_node);
+		spin_lock(&proc->inner_lock);
+		t = buffer->transaction;
+		if (t) {
+			spin_lock(&t->lock);
+			t->buffer = NULL;
+			t->to_proc = NULL;
+			spin_unlock(&t->lock);
+			buffer->transaction = NULL;
+		}
+		spin_unlock(&proc->inner_lock);
+		if (t) {
+			printk(KERN_ERR "binder: release proc %d, "
+			       "transaction %d, not freed\n",
+			       proc->pid, t->debug_id);
+			/*BUG();*/
+		}
+		binder_free_buf_locked(proc, buffer);
+		buffers++;
+	}
+
+	page_count = 0;
+	if (proc->pages) {
+		int i;
+		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
+			struct binder_lru_page *page = &proc->pages[i];
+			void *page_addr = proc->buffer + i * PAGE_SIZE;
+
+			if (page->page_ptr == NULL)
+				continue;
+			if (list_empty(&page->lru))
+				binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
+					     "binder_release: %d: "
+					     "page %d at %p not freed\n",
+					     proc->pid, i,
+					     page_addr);
+			else
+				binder_lru_del_page(proc, page);
+			unmap_kernel_range((unsigned long)page_addr,
+				PAGE_SIZE);
+			__free_page(page->page_ptr);
+			page_count++;
+		}
+		kfree(proc->pages);
+		vfree(proc->buffer);
+	}
+	mutex_unlock(&proc->alloc_lock);
+
+	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
+		     "binder_release: %d buffers %d, pages %d\n",
+		     proc->pid, buffers, page_count);
+
+	put_task_struct(proc->tsk);
+	kfree(proc);
+	binder_stats_deleted(BINDER_STAT_PROC);
+}
+
+/* Drops a tmp_ref of proc and frees it if it was the last one of a dead proc */
+static void binder_proc_dec_tmpref(struct binder_proc *proc)
+{
+	spin_lock(&proc->inner_lock);
+	proc->tmp_ref--;
+	if (proc->is_dead && RB_EMPTY_ROOT(&proc->threads) &&
+	    !proc->tmp_ref) {
+		spin_unlock(&proc->inner_lock);
+		binder_free_proc(proc);
+		return;
+	}
+	spin_unlock(&proc->inner_lock);
+}
+
+/* A dead thread keeps a tmp_ref of its proc, dropped here */
+static void binder_free_thread(struct binder_thread *thread)
+{
+	struct binder_proc *proc = thread->proc;
+
+	kfree(thread);
+	binder_stats_deleted(BINDER_STAT_THREAD);
+	binder_proc_dec_tmpref(proc);
+}
+
+static void binder_thread_dec_tmpref(struct binder_thread *thread)
+{
+	struct binder_proc *proc = thread->proc;
+
+	spin_lock(&proc->inner_lock);
+	if (atomic_dec_and_test(&thread->tmp_ref) && thread->is_dead) {
+		spin_unlock(&proc->inner_lock);
+		binder_free_thread(thread);
+		return;
+	}
+	spin_unlock(&proc->inner_lock);
+}
+
+/* Returns the sender of t with a tmp_ref held, NULL once it exited */
+static struct binder_thread *binder_get_txn_from(struct binder_transaction *t)
+{
+	struct binder_thread *from;
+
+	spin_lock(&t->lock);
+	from = t->from;
+	if (from)
+		atomic_inc(&from->tmp_ref);
+	spin_unlock(&t->lock);
+	return from;
+}
+
+/*
+ * Like binder_get_txn_from, but also returns with the inner lock of the
+ * sender's proc held, unless the sender exited meanwhile.
+ */
+static struct binder_thread *binder_get_txn_from_and_acq_inner(
+	struct binder_transaction *t)
+{
+	struct binder_thread *from;
+
+	from = binder_get_txn_from(t);
+	if (from == NULL)
+		return NULL;
+	spin_lock(&from->proc->inner_lock);
+	if (t->from) {
+		BUG_ON(t->from != from);
+		return from;
+	}
+	spin_unlock(&from->proc->inner_lock);
+	binder_thread_dec_tmpref(from);
+	return NULL;
+}
+
+/* Returns the owner of node with a tmp_ref held, NULL once it died */
+static struct binder_proc *binder_get_node_proc(struct binder_node *node)
+{
+	struct binder_proc *proc;
+
+	spin_lock(&node->lock);
+	proc = node->proc;
+	if (proc) {
+		spin_lock(&proc->inner_lock);
+		proc->tmp_ref++;
+		spin_unlock(&proc->inner_lock);
+	}
+	spin_unlock(&node->lock);
+	return proc;
+}
+
+/*
+ * Records a write failure of thread. A failed reply may have posted an
+ * error meanwhile, it is kept in return_error2 to be returned first.
+ */
+static void binder_set_return_error(struct binder_thread *thread,
+				    uint32_t error_code)
+{
+	spin_lock(&thread->proc->inner_lock);
+	if (thread->return_error != BR_OK)
+		thread->return_error2 = thread->return_error;
+	thread->return_error = error_code;
+	spin_unlock(&thread->proc->inner_lock);
+}
+
+static void binder_pop_transaction_ilocked(struct binder_thread *target_thread,
+					   struct binder_transaction *t)
+{
+	BUG_ON(target_thread->transaction_stack != t);
+	BUG_ON(target_thread->transaction_stack->from != target_thread);
+	target_thread->transaction_stack =
+		target_thread->transaction_stack->from_parent;
+	spin_lock(&t->lock);
+	t->from = NULL;
+	spin_unlock(&t->lock);
+}
+
+static void binder_free_transaction(struct binder_transaction *t)
+{
+	struct binder_proc *target_proc = t->to_proc;
+
+	if (target_proc) {
+		spin_lock(&target_proc->inner_lock);
+		if (t->buffer)
+			t->buffer->transaction = NULL;
+		spin_unlock(&target_proc->inner_lock);
 	}
-	t->need_reply = 0;
-	if (t->buffer)
-		t->buffer->transaction = NULL;
 	kfree(t);
 	binder_stats_deleted(BINDER_STAT_TRANSACTION);
 }
@@ -1251,7 +1814,7 @@ static void binder_send_failed_reply(struct binder_transaction *t,
 	struct binder_thread *target_thread;
 	BUG_ON(t->flags & TF_ONE_WAY);
 	while (1) {
-		target_thread = t->from;
+		target_thread = binder_get_txn_from_and_acq_inner(t);
 		if (target_thread) {
 			if (target_thread->return_error != BR_OK &&
 			   target_thread->return_error2 == BR_OK) {
@@ -1266,16 +1829,20 @@ static void binder_send_failed_reply(struct binder_transaction *t,
 					      t->debug_id, target_thread->proc->pid,
 					      target_thread->pid);
 
-				binder_pop_transaction(target_thread, t);
+				binder_pop_transaction_ilocked(target_thread, t);
 				target_thread->return_error = error_code;
+				spin_unlock(&target_thread->proc->inner_lock);
+				binder_free_transaction(t);
 				wake_up_interruptible(&target_thread->wait);
 			} else {
+				spin_unlock(&target_thread->proc->inner_lock);
 				printk(KERN_ERR "binder: reply failed, target "
 					"thread, %d:%d, has error code %d "
 					"already\n", target_thread->proc->pid,
 					target_thread->pid,
 					target_thread->return_error);
 			}
+			binder_thread_dec_tmpref(target_thread);
 			return;
 		} else {
 			struct binder_transaction *next = t->from_parent;
@@ -1285,7 +1852,7 @@ static void binder_send_failed_reply(struct binder_transaction *t,
 				     "for transaction %d, target dead\n",
 				     t->debug_id);
 
-			binder_pop_transaction(target_thread, t);
+			binder_free_transaction(t);
 			if (next == NULL) {
 				binder_debug(BINDER_DEBUG_DEAD_BINDER,
 					     "binder: reply failed,"
@@ -1344,11 +1911,16 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 				     "        node %d u%p\n",
 				     node->debug_id, node->ptr);
 			binder_dec_node(node, fp->type == BINDER_TYPE_BINDER, 0);
+			binder_put_node(node);
 		} break;
 		case BINDER_TYPE_HANDLE:
 		case BINDER_TYPE_WEAK_HANDLE: {
-			struct binder_ref *ref = binder_get_ref(proc, fp->handle);
+			struct binder_ref *ref;
+
+			spin_lock(&proc->outer_lock);
+			ref = binder_get_ref(proc, fp->handle);
 			if (ref == NULL) {
+				spin_unlock(&proc->outer_lock);
 				printk(KERN_ERR "binder: transaction release %d"
 				       " bad handle %ld\n", debug_id,
 				       fp->handle);
@@ -1358,13 +1930,17 @@ static void binder_transaction_buffer_release(struct binder_proc *proc,
 				     "        ref %d desc %d (node %d)\n",
 				     ref->debug_id, ref->desc, ref->node->debug_id);
 			binder_dec_ref(ref, fp->type == BINDER_TYPE_HANDLE);
+			spin_unlock(&proc->outer_lock);
 		} break;
 
 		case BINDER_TYPE_FD:
 			binder_debug(BINDER_DEBUG_TRANSACTION,
 				     "        fd %ld\n", fp->handle);
-			if (failed_at)
+			if (failed_at) {
+				mutex_lock(&proc->files_lock);
 				task_close_fd(proc, fp->handle);
+				mutex_unlock(&proc->files_lock);
+			}
 			break;
 
 		default:
@@ -1382,7 +1958,7 @@ static void binder_transaction(struct binder_proc *proc,
 	struct binder_transaction *t;
 	struct binder_work *tcomplete;
 	size_t *offp, *off_end;
-	struct binder_proc *target_proc;
+	struct binder_proc *target_proc = NULL;
 	struct binder_thread *target_thread = NULL;
 	struct binder_node *target_node = NULL;
 	struct list_head *target_list;
@@ -1400,16 +1976,21 @@ static void binder_transaction(struct binder_proc *proc,
 	e->offsets_size = tr->offsets_size;
 
 	if (reply) {
+		long saved_priority;
+
+		spin_lock(&proc->inner_lock);
 		in_reply_to = thread->transaction_stack;
 		if (in_reply_to == NULL) {
+			spin_unlock(&proc->inner_lock);
 			binder_user_error("binder: %d:%d got reply transaction "
 					  "with no transaction stack\n",
 					  proc->pid, thread->pid);
 			return_error = BR_FAILED_REPLY;
 			goto err_empty_call_stack;
 		}
-		binder_set_nice(in_reply_to->saved_priority);
+		saved_priority = in_reply_to->saved_priority;
 		if (in_reply_to->to_thread != thread) {
+			spin_lock(&in_reply_to->lock);
 			binder_user_error("binder: %d:%d got reply transaction "
 				"with bad transaction stack,"
 				" transaction %d has target %d:%d\n",
@@ -1418,12 +1999,17 @@ static void binder_transaction(struct binder_proc *proc,
 				in_reply_to->to_proc->pid : 0,
 				in_reply_to->to_thread ?
 				in_reply_to->to_thread->pid : 0);
+			spin_unlock(&in_reply_to->lock);
+			spin_unlock(&proc->inner_lock);
+			binder_set_nice(saved_priority);
 			return_error = BR_FAILED_REPLY;
 			in_reply_to = NULL;
 			goto err_bad_call_stack;
 		}
 		thread->transaction_stack = in_reply_to->to_parent;
-		target_thread = in_reply_to->from;
+		spin_unlock(&proc->inner_lock);
+		binder_set_nice(saved_priority);
+		target_thread = binder_get_txn_from_and_acq_inner(in_reply_to);
 		if (target_thread == NULL) {
 			return_error = BR_DEAD_REPLY;
 			goto err_dead_binder;
@@ -1436,17 +2022,27 @@ static void binder_transaction(struct binder_proc *proc,
 				target_thread->transaction_stack ?
 				target_thread->transaction_stack->debug_id : 0,
 				in_reply_to->debug_id);
+			spin_unlock(&target_thread->proc->inner_lock);
 			return_error = BR_FAILED_REPLY;
 			in_reply_to = NULL;
-			target_thread = NULL;
 			goto err_dead_binder;
 		}
+		/* The thread keeps its proc, the ref is for the common exit */
 		target_proc = target_thread->proc;
+		target_proc->tmp_ref++;
+		spin_unlock(&target_proc->inner_lock);
 	} else {
+		/*
+		 * A strong local reference keeps the target node around, it
+		 * is handed over to the buffer once that is allocated.
+		 */
 		if (tr->target.handle) {
 			struct binder_ref *ref;
+
+			spin_lock(&proc->outer_lock);
 			ref = binder_get_ref(proc, tr->target.handle);
 			if (ref == NULL) {
+				spin_unlock(&proc->outer_lock);
 				binder_user_error("binder: %d:%d got "
 					"transaction to invalid handle\n",
 					proc->pid, thread->pid);
@@ -1454,23 +2050,33 @@ static void binder_transaction(struct binder_proc *proc,
 				goto err_invalid_target_handle;
 			}
 			target_node = ref->node;
+			binder_inc_node(target_node, 1, 0, NULL);
+			spin_unlock(&proc->outer_lock);
 		} else {
+			mutex_lock(&binder_context_mgr_lock);
 			target_node = binder_context_mgr_node;
+			if (target_node)
+				binder_inc_node(target_node, 1, 0, NULL);
+			mutex_unlock(&binder_context_mgr_lock);
 			if (target_node == NULL) {
 				return_error = BR_DEAD_REPLY;
 				goto err_no_context_mgr_node;
 			}
 		}
 		e->to_node = target_node->debug_id;
-		target_proc = target_node->proc;
+		target_proc = binder_get_node_proc(target_node);
 		if (target_proc == NULL) {
 			return_error = BR_DEAD_REPLY;
 			goto err_dead_binder;
 		}
+		spin_lock(&proc->inner_lock);
 		if (!(tr->flags & TF_ONE_WAY) && thread->transaction_stack) {
 			struct binder_transaction *tmp;
+			struct binder_transaction *found = NULL;
+
 			tmp = thread->transaction_stack;
 			if (tmp->to_thread != thread) {
+				spin_lock(&tmp->lock);
 				binder_user_error("binder: %d:%d got new "
 					"transaction with bad transaction stack"
 					", transaction %d has target %d:%d\n",
@@ -1478,15 +2084,23 @@ static void binder_transaction(struct binder_proc *proc,
 					tmp->to_proc ? tmp->to_proc->pid : 0,
 					tmp->to_thread ?
 					tmp->to_thread->pid : 0);
+				spin_unlock(&tmp->lock);
+				spin_unlock(&proc->inner_lock);
 				return_error = BR_FAILED_REPLY;
 				goto err_bad_call_stack;
 			}
+			/* The senders may exit meanwhile, t->lock keeps them */
 			while (tmp) {
+				spin_lock(&tmp->lock);
 				if (tmp->from && tmp->from->proc == target_proc)
-					target_thread = tmp->from;
+					found = tmp;
+				spin_unlock(&tmp->lock);
 				tmp = tmp->from_parent;
 			}
+			if (found)
+				target_thread = binder_get_txn_from(found);
 		}
+		spin_unlock(&proc->inner_lock);
 	}
 	if (target_thread) {
 		e->to_thread = target_thread->pid;
@@ -1505,6 +2119,7 @@ static void binder_transaction(struct binder_proc *proc,
 		goto err_alloc_t_failed;
 	}
 	binder_stats_created(BINDER_STAT_TRANSACTION);
+	spin_lock_init(&t->lock);
 
 	tcomplete = kzalloc(sizeof(*tcomplete), GFP_KERNEL);
 	if (tcomplete == NULL) {
@@ -1513,7 +2128,7 @@ static void binder_transaction(struct binder_proc *proc,
 	}
 	binder_stats_created(BINDER_STAT_TRANSACTION_COMPLETE);
 
-	t->debug_id = ++binder_last_id;
+	t->debug_id = atomic_inc_return(&binder_last_id);
 	e->debug_id = t->debug_id;
 
 	if (reply)
@@ -1549,12 +2164,10 @@ static void binder_transaction(struct binder_proc *proc,
 		return_error = BR_FAILED_REPLY;
 		goto err_binder_alloc_buf_failed;
 	}
-	t->buffer->allow_user_free = 0;
+	/* Not visible to the target until the transaction is queued */
 	t->buffer->debug_id = t->debug_id;
 	t->buffer->transaction = t;
 	t->buffer->target_node = target_node;
-	if (target_node)
-		binder_inc_node(target_node, 1, 0, NULL);
 
 	offp = (size_t *)(t->buffer->data + ALIGN(tr->data_size, sizeof(void *)));
 
@@ -1596,13 +2209,12 @@ static void binder_transaction(struct binder_proc *proc,
 			struct binder_ref *ref;
 			struct binder_node *node = binder_get_node(proc, fp->binder);
 			if (node == NULL) {
-				node = binder_new_node(proc, fp->binder, fp->cookie);
+				node = binder_new_node(proc, fp->binder,
+						       fp->cookie, fp->flags);
 				if (node == NULL) {
 					return_error = BR_FAILED_REPLY;
 					goto err_binder_new_node_failed;
 				}
-				node->min_priority = fp->flags & FLAT_BINDER_FLAG_PRIORITY_MASK;
-				node->accept_fds = !!(fp->flags & FLAT_BINDER_FLAG_ACCEPTS_FDS);
 			}
 			if (fp->cookie != node->cookie) {
 				binder_user_error("binder: %d:%d sending u%p "
@@ -1610,11 +2222,15 @@ static void binder_transaction(struct binder_proc *proc,
 					proc->pid, thread->pid,
 					fp->binder, node->debug_id,
 					fp->cookie, node->cookie);
+				binder_put_node(node);
 				return_error = BR_FAILED_REPLY;
 				goto err_binder_get_ref_for_node_failed;
 			}
+			spin_lock(&target_proc->outer_lock);
 			ref = binder_get_ref_for_node(target_proc, node);
 			if (ref == NULL) {
+				spin_unlock(&target_proc->outer_lock);
+				binder_put_node(node);
 				return_error = BR_FAILED_REPLY;
 				goto err_binder_get_ref_for_node_failed;
 			}
@@ -1630,11 +2246,18 @@ static void binder_transaction(struct binder_proc *proc,
 				     "        node %d u%p -> ref %d desc %d\n",
 				     node->debug_id, node->ptr, ref->debug_id,
 				     ref->desc);
+			spin_unlock(&target_proc->outer_lock);
+			binder_put_node(node);
 		} break;
 		case BINDER_TYPE_HANDLE:
 		case BINDER_TYPE_WEAK_HANDLE: {
-			struct binder_ref *ref = binder_get_ref(proc, fp->handle);
+			struct binder_ref *ref;
+			struct binder_node *node;
+
+			spin_lock(&proc->outer_lock);
+			ref = binder_get_ref(proc, fp->handle);
 			if (ref == NULL) {
+				spin_unlock(&proc->outer_lock);
 				binder_user_error("binder: %d:%d got "
 					"transaction with invalid "
 					"handle, %ld\n", proc->pid,
@@ -1642,31 +2265,45 @@ static void binder_transaction(struct binder_proc *proc,
 				return_error = BR_FAILED_REPLY;
 				goto err_binder_get_ref_failed;
 			}
-			if (ref->node->proc == target_proc) {
+			node = ref->node;
+			if (node->proc == target_proc) {
 				if (fp->type == BINDER_TYPE_HANDLE)
 					fp->type = BINDER_TYPE_BINDER;
 				else
 					fp->type = BINDER_TYPE_WEAK_BINDER;
-				fp->binder = ref->node->ptr;
-				fp->cookie = ref->node->cookie;
-				binder_inc_node(ref->node, fp->type == BINDER_TYPE_BINDER, 0, NULL);
+				fp->binder = node->ptr;
+				fp->cookie = node->cookie;
+				binder_inc_node(node, fp->type == BINDER_TYPE_BINDER, 0, NULL);
 				binder_debug(BINDER_DEBUG_TRANSACTION,
 					     "        ref %d desc %d -> node %d u%p\n",
-					     ref->debug_id, ref->desc, ref->node->debug_id,
-					     ref->node->ptr);
+					     ref->debug_id, ref->desc, node->debug_id,
+					     node->ptr);
+				spin_unlock(&proc->outer_lock);
 			} else {
 				struct binder_ref *new_ref;
-				new_ref = binder_get_ref_for_node(target_proc, ref->node);
+
+				binder_debug(BINDER_DEBUG_TRANSACTION,
+					     "        ref %d desc %d (node %d)\n",
+					     ref->debug_id, ref->desc,
+					     node->debug_id);
+				binder_inc_node_tmpref(node);
+				spin_unlock(&proc->outer_lock);
+
+				spin_lock(&target_proc->outer_lock);
+				new_ref = binder_get_ref_for_node(target_proc, node);
 				if (new_ref == NULL) {
+					spin_unlock(&target_proc->outer_lock);
+					binder_put_node(node);
 					return_error = BR_FAILED_REPLY;
 					goto err_binder_get_ref_for_node_failed;
 				}
 				fp->handle = new_ref->desc;
 				binder_inc_ref(new_ref, fp->type == BINDER_TYPE_HANDLE, NULL);
 				binder_debug(BINDER_DEBUG_TRANSACTION,
-					     "        ref %d desc %d -> ref %d desc %d (node %d)\n",
-					     ref->debug_id, ref->desc, new_ref->debug_id,
-					     new_ref->desc, ref->node->debug_id);
+					     "        -> ref %d desc %d\n",
+					     new_ref->debug_id, new_ref->desc);
+				spin_unlock(&target_proc->outer_lock);
+				binder_put_node(node);
 			}
 		} break;
 
@@ -1695,13 +2332,16 @@ static void binder_transaction(struct binder_proc *proc,
 				return_error = BR_FAILED_REPLY;
 				goto err_fget_failed;
 			}
+			mutex_lock(&target_proc->files_lock);
 			target_fd = task_get_unused_fd_flags(target_proc, O_CLOEXEC);
 			if (target_fd < 0) {
+				mutex_unlock(&target_proc->files_lock);
 				fput(file);
 				return_error = BR_FAILED_REPLY;
 				goto err_get_unused_fd_failed;
 			}
 			task_fd_install(target_proc, target_fd, file);
+			mutex_unlock(&target_proc->files_lock);
 			binder_debug(BINDER_DEBUG_TRANSACTION,
 				     "        fd %ld -> %d\n", fp->handle, target_fd);
 			/* TODO: fput? */
@@ -1716,14 +2356,35 @@ static void binder_transaction(struct binder_proc *proc,
 			goto err_bad_object_type;
 		}
 	}
+	t->work.type = BINDER_WORK_TRANSACTION;
+	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
+	spin_lock(&proc->inner_lock);
+	list_add_tail(&tcomplete->entry, &thread->todo);
+	if (!reply && !(t->flags & TF_ONE_WAY)) {
+		t->need_reply = 1;
+		t->from_parent = thread->transaction_stack;
+		thread->transaction_stack = t;
+	}
+	spin_unlock(&proc->inner_lock);
+
+	/* Once queued, t belongs to the target and may be gone any time */
+	spin_lock(&target_proc->inner_lock);
+	if (target_proc->is_dead ||
+	    (target_thread && target_thread->is_dead)) {
+		spin_unlock(&target_proc->inner_lock);
+		spin_lock(&proc->inner_lock);
+		list_del(&tcomplete->entry);
+		if (thread->transaction_stack == t)
+			thread->transaction_stack = t->from_parent;
+		spin_unlock(&proc->inner_lock);
+		return_error = BR_DEAD_REPLY;
+		goto err_dead_proc_or_thread;
+	}
 	if (reply) {
 		BUG_ON(t->buffer->async_transaction != 0);
-		binder_pop_transaction(target_thread, in_reply_to);
+		binder_pop_transaction_ilocked(target_thread, in_reply_to);
 	} else if (!(t->flags & TF_ONE_WAY)) {
 		BUG_ON(t->buffer->async_transaction != 0);
-		t->need_reply = 1;
-		t->from_parent = thread->transaction_stack;
-		thread->transaction_stack = t;
 	} else {
 		BUG_ON(target_node == NULL);
 		BUG_ON(t->buffer->async_transaction != 1);
@@ -1733,14 +2394,18 @@ static void binder_transaction(struct binder_proc *proc,
 		} else
 			target_node->has_async_transaction = 1;
 	}
-	t->work.type = BINDER_WORK_TRANSACTION;
 	list_add_tail(&t->work.entry, target_list);
-	tcomplete->type = BINDER_WORK_TRANSACTION_COMPLETE;
-	list_add_tail(&tcomplete->entry, &thread->todo);
+	spin_unlock(&target_proc->inner_lock);
 	if (target_wait)
 		wake_up_interruptible(target_wait);
+	if (reply)
+		binder_free_transaction(in_reply_to);
+	if (target_thread)
+		binder_thread_dec_tmpref(target_thread);
+	binder_proc_dec_tmpref(target_proc);
 	return;
 
+err_dead_proc_or_thread:
 err_get_unused_fd_failed:
 err_fget_failed:
 err_fd_not_allowed:
@@ -1751,6 +2416,8 @@ err_bad_object_type:
 err_bad_offset:
 err_copy_data_failed:
 	binder_transaction_buffer_release(target_proc, t->buffer, offp);
+	/* The buffer release dropped the reference on target_node */
+	target_node = NULL;
 	t->buffer->transaction = NULL;
 	binder_free_buf(target_proc, t->buffer);
 err_binder_alloc_buf_failed:
@@ -1765,6 +2432,13 @@ err_empty_call_stack:
 err_dead_binder:
 err_invalid_target_handle:
 err_no_context_mgr_node:
+	if (target_node)
+		binder_dec_node(target_node, 1, 0);
+	if (target_thread)
+		binder_thread_dec_tmpref(target_thread);
+	if (target_proc)
+		binder_proc_dec_tmpref(target_proc);
+
 	binder_debug(BINDER_DEBUG_FAILED_TRANSACTION,
 		     "binder: %d:%d transaction failed %d, size %zd-%zd\n",
 		     proc->pid, thread->pid, return_error,
@@ -1776,12 +2450,11 @@ err_no_context_mgr_node:
 		*fe = *e;
 	}
 
-	BUG_ON(thread->return_error != BR_OK);
 	if (in_reply_to) {
-		thread->return_error = BR_TRANSACTION_COMPLETE;
+		binder_set_return_error(thread, BR_TRANSACTION_COMPLETE);
 		binder_send_failed_reply(in_reply_to, return_error);
 	} else
-		thread->return_error = return_error;
+		binder_set_return_error(thread, return_error);
 }
 
 int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
@@ -1796,9 +2469,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			return -EFAULT;
 		ptr += sizeof(uint32_t);
 		if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.bc)) {
-			binder_stats.bc[_IOC_NR(cmd)]++;
-			proc->stats.bc[_IOC_NR(cmd)]++;
-			thread->stats.bc[_IOC_NR(cmd)]++;
+			atomic_inc(&binder_stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&proc->stats.bc[_IOC_NR(cmd)]);
+			atomic_inc(&thread->stats.bc[_IOC_NR(cmd)]);
 		}
 		switch (cmd) {
 		case BC_INCREFS:
@@ -1807,16 +2480,24 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 		case BC_DECREFS: {
 			uint32_t target;
 			struct binder_ref *ref;
+			struct binder_node *ctx_node = NULL;
 			const char *debug_string;
 
 			if (get_user(target, (uint32_t __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(uint32_t);
-			if (target == 0 && binder_context_mgr_node &&
+			if (target == 0 &&
 			    (cmd == BC_INCREFS || cmd == BC_ACQUIRE)) {
-				ref = binder_get_ref_for_node(proc,
-					       binder_context_mgr_node);
-				if (ref->desc != target) {
+				mutex_lock(&binder_context_mgr_lock);
+				ctx_node = binder_context_mgr_node;
+				if (ctx_node)
+					binder_inc_node_tmpref(ctx_node);
+				mutex_unlock(&binder_context_mgr_lock);
+			}
+			spin_lock(&proc->outer_lock);
+			if (ctx_node) {
+				ref = binder_get_ref_for_node(proc, ctx_node);
+				if (ref && ref->desc != target) {
 					binder_user_error("binder: %d:"
 						"%d tried to acquire "
 						"reference to desc 0, "
@@ -1827,6 +2508,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			} else
 				ref = binder_get_ref(proc, target);
 			if (ref == NULL) {
+				spin_unlock(&proc->outer_lock);
+				if (ctx_node)
+					binder_put_node(ctx_node);
 				binder_user_error("binder: %d:%d refcou"
 					"nt change on invalid ref %d\n",
 					proc->pid, thread->pid, target);
@@ -1835,26 +2519,41 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			switch (cmd) {
 			case BC_INCREFS:
 				debug_string = "IncRefs";
-				binder_inc_ref(ref, 0, NULL);
 				break;
 			case BC_ACQUIRE:
 				debug_string = "Acquire";
-				binder_inc_ref(ref, 1, NULL);
 				break;
 			case BC_RELEASE:
 				debug_string = "Release";
-				binder_dec_ref(ref, 1);
 				break;
 			case BC_DECREFS:
 			default:
 				debug_string = "DecRefs";
-				binder_dec_ref(ref, 0);
 				break;
 			}
+			/* Printed first, a release may delete ref */
 			binder_debug(BINDER_DEBUG_USER_REFS,
 				     "binder: %d:%d %s ref %d desc %d s %d w %d for node %d\n",
 				     proc->pid, thread->pid, debug_string, ref->debug_id,
 				     ref->desc, ref->strong, ref->weak, ref->node->debug_id);
+			switch (cmd) {
+			case BC_INCREFS:
+				binder_inc_ref(ref, 0, NULL);
+				break;
+			case BC_ACQUIRE:
+				binder_inc_ref(ref, 1, NULL);
+				break;
+			case BC_RELEASE:
+				binder_dec_ref(ref, 1);
+				break;
+			case BC_DECREFS:
+			default:
+				binder_dec_ref(ref, 0);
+				break;
+			}
+			spin_unlock(&proc->outer_lock);
+			if (ctx_node)
+				binder_put_node(ctx_node);
 			break;
 		}
 		case BC_INCREFS_DONE:
@@ -1888,8 +2587,10 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					"BC_INCREFS_DONE" : "BC_ACQUIRE_DONE",
 					node_ptr, node->debug_id,
 					cookie, node->cookie);
+				binder_put_node(node);
 				break;
 			}
+			spin_lock(&node->lock);
 			if (cmd == BC_ACQUIRE_DONE) {
 				if (node->pending_strong_ref == 0) {
 					binder_user_error("binder: %d:%d "
@@ -1897,6 +2598,8 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 						"no pending acquire request\n",
 						proc->pid, thread->pid,
 						node->debug_id);
+					spin_unlock(&node->lock);
+					binder_put_node(node);
 					break;
 				}
 				node->pending_strong_ref = 0;
@@ -1907,16 +2610,21 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 						"no pending increfs request\n",
 						proc->pid, thread->pid,
 						node->debug_id);
+					spin_unlock(&node->lock);
+					binder_put_node(node);
 					break;
 				}
 				node->pending_weak_ref = 0;
 			}
-			binder_dec_node(node, cmd == BC_ACQUIRE_DONE, 0);
+			/* Cannot free node, we hold a tmp ref */
+			binder_dec_node_nlocked(node, cmd == BC_ACQUIRE_DONE, 0);
 			binder_debug(BINDER_DEBUG_USER_REFS,
 				     "binder: %d:%d %s node %d ls %d lw %d\n",
 				     proc->pid, thread->pid,
 				     cmd == BC_INCREFS_DONE ? "BC_INCREFS_DONE" : "BC_ACQUIRE_DONE",
 				     node->debug_id, node->local_strong_refs, node->local_weak_refs);
+			spin_unlock(&node->lock);
+			binder_put_node(node);
 			break;
 		}
 		case BC_ATTEMPT_ACQUIRE:
@@ -1934,20 +2642,28 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				return -EFAULT;
 			ptr += sizeof(void *);
 
+			mutex_lock(&proc->alloc_lock);
 			buffer = binder_buffer_lookup(proc, data_ptr);
 			if (buffer == NULL) {
+				mutex_unlock(&proc->alloc_lock);
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p no match\n",
 					proc->pid, thread->pid, data_ptr);
 				break;
 			}
 			if (!buffer->allow_user_free) {
+				mutex_unlock(&proc->alloc_lock);
 				binder_user_error("binder: %d:%d "
 					"BC_FREE_BUFFER u%p matched "
 					"unreturned buffer\n",
 					proc->pid, thread->pid, data_ptr);
 				break;
 			}
+			/* Claim it, a second free of the same buffer fails */
+			buffer->allow_user_free = 0;
+			mutex_unlock(&proc->alloc_lock);
+
+			spin_lock(&proc->inner_lock);
 			binder_debug(BINDER_DEBUG_FREE_BUFFER,
 				     "binder: %d:%d BC_FREE_BUFFER u%p found buffer %d for %s transaction\n",
 				     proc->pid, thread->pid, data_ptr, buffer->debug_id,
@@ -1964,6 +2680,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				else
 					list_move_tail(buffer->target_node->async_todo.next, &thread->todo);
 			}
+			spin_unlock(&proc->inner_lock);
 			binder_transaction_buffer_release(proc, buffer, NULL);
 			binder_free_buf(proc, buffer);
 			break;
@@ -1984,6 +2701,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			binder_debug(BINDER_DEBUG_THREADS,
 				     "binder: %d:%d BC_REGISTER_LOOPER\n",
 				     proc->pid, thread->pid);
+			spin_lock(&proc->inner_lock);
 			if (thread->looper & BINDER_LOOPER_STATE_ENTERED) {
 				thread->looper |= BINDER_LOOPER_STATE_INVALID;
 				binder_user_error("binder: %d:%d ERROR:"
@@ -2001,11 +2719,13 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				proc->requested_threads_started++;
 			}
 			thread->looper |= BINDER_LOOPER_STATE_REGISTERED;
+			spin_unlock(&proc->inner_lock);
 			break;
 		case BC_ENTER_LOOPER:
 			binder_debug(BINDER_DEBUG_THREADS,
 				     "binder: %d:%d BC_ENTER_LOOPER\n",
 				     proc->pid, thread->pid);
+			spin_lock(&proc->inner_lock);
 			if (thread->looper & BINDER_LOOPER_STATE_REGISTERED) {
 				thread->looper |= BINDER_LOOPER_STATE_INVALID;
 				binder_user_error("binder: %d:%d ERROR:"
@@ -2014,12 +2734,15 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					proc->pid, thread->pid);
 			}
 			thread->looper |= BINDER_LOOPER_STATE_ENTERED;
+			spin_unlock(&proc->inner_lock);
 			break;
 		case BC_EXIT_LOOPER:
 			binder_debug(BINDER_DEBUG_THREADS,
 				     "binder: %d:%d BC_EXIT_LOOPER\n",
 				     proc->pid, thread->pid);
+			spin_lock(&proc->inner_lock);
 			thread->looper |= BINDER_LOOPER_STATE_EXITED;
+			spin_unlock(&proc->inner_lock);
 			break;
 
 		case BC_REQUEST_DEATH_NOTIFICATION:
@@ -2027,7 +2750,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			uint32_t target;
 			void __user *cookie;
 			struct binder_ref *ref;
-			struct binder_ref_death *death;
+			struct binder_ref_death *death = NULL;
 
 			if (get_user(target, (uint32_t __user *)ptr))
 				return -EFAULT;
@@ -2035,8 +2758,23 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 			if (get_user(cookie, (void __user * __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(void *);
+			if (cmd == BC_REQUEST_DEATH_NOTIFICATION) {
+				/* Allocated up front, outer_lock is a spinlock */
+				death = kzalloc(sizeof(*death), GFP_KERNEL);
+				if (death == NULL) {
+					binder_set_return_error(thread, BR_ERROR);
+					binder_debug(BINDER_DEBUG_FAILED_TRANSACTION,
+						     "binder: %d:%d "
+						     "BC_REQUEST_DEATH_NOTIFICATION failed\n",
+						     proc->pid, thread->pid);
+					break;
+				}
+			}
+			spin_lock(&proc->outer_lock);
 			ref = binder_get_ref(proc, target);
 			if (ref == NULL) {
+				spin_unlock(&proc->outer_lock);
+				kfree(death);
 				binder_user_error("binder: %d:%d %s "
 					"invalid ref %d\n",
 					proc->pid, thread->pid,
@@ -2058,6 +2796,8 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 
 			if (cmd == BC_REQUEST_DEATH_NOTIFICATION) {
 				if (ref->death) {
+					spin_unlock(&proc->outer_lock);
+					kfree(death);
 					binder_user_error("binder: %d:%"
 						"d BC_REQUEST_DEATH_NOTI"
 						"FICATION death notific"
@@ -2065,30 +2805,27 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 						proc->pid, thread->pid);
 					break;
 				}
-				death = kzalloc(sizeof(*death), GFP_KERNEL);
-				if (death == NULL) {
-					thread->return_error = BR_ERROR;
-					binder_debug(BINDER_DEBUG_FAILED_TRANSACTION,
-						     "binder: %d:%d "
-						     "BC_REQUEST_DEATH_NOTIFICATION failed\n",
-						     proc->pid, thread->pid);
-					break;
-				}
 				binder_stats_created(BINDER_STAT_DEATH);
 				INIT_LIST_HEAD(&death->work.entry);
 				death->cookie = cookie;
+				/* Ordered against the node dying by its lock */
+				spin_lock(&ref->node->lock);
 				ref->death = death;
 				if (ref->node->proc == NULL) {
 					ref->death->work.type = BINDER_WORK_DEAD_BINDER;
+					spin_lock(&proc->inner_lock);
 					if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED | BINDER_LOOPER_STATE_ENTERED)) {
 						list_add_tail(&ref->death->work.entry, &thread->todo);
 					} else {
 						list_add_tail(&ref->death->work.entry, &proc->todo);
 						wake_up_interruptible(&proc->wait);
 					}
+					spin_unlock(&proc->inner_lock);
 				}
+				spin_unlock(&ref->node->lock);
 			} else {
 				if (ref->death == NULL) {
+					spin_unlock(&proc->outer_lock);
 					binder_user_error("binder: %d:%"
 						"d BC_CLEAR_DEATH_NOTIFI"
 						"CATION death notificat"
@@ -2098,6 +2835,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				}
 				death = ref->death;
 				if (death->cookie != cookie) {
+					spin_unlock(&proc->outer_lock);
 					binder_user_error("binder: %d:%"
 						"d BC_CLEAR_DEATH_NOTIFI"
 						"CATION death notificat"
@@ -2107,7 +2845,10 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 						death->cookie, cookie);
 					break;
 				}
+				spin_lock(&ref->node->lock);
 				ref->death = NULL;
+				spin_unlock(&ref->node->lock);
+				spin_lock(&proc->inner_lock);
 				if (list_empty(&death->work.entry)) {
 					death->work.type = BINDER_WORK_CLEAR_DEATH_NOTIFICATION;
 					if (thread->looper & (BINDER_LOOPER_STATE_REGISTERED | BINDER_LOOPER_STATE_ENTERED)) {
@@ -2120,7 +2861,9 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					BUG_ON(death->work.type != BINDER_WORK_DEAD_BINDER);
 					death->work.type = BINDER_WORK_DEAD_BINDER_AND_CLEAR;
 				}
+				spin_unlock(&proc->inner_lock);
 			}
+			spin_unlock(&proc->outer_lock);
 		} break;
 		case BC_DEAD_BINDER_DONE: {
 			struct binder_work *w;
@@ -2130,6 +2873,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				return -EFAULT;
 
 			ptr += sizeof(void *);
+			spin_lock(&proc->inner_lock);
 			list_for_each_entry(w, &proc->delivered_death, entry) {
 				struct binder_ref_death *tmp_death = container_of(w, struct binder_ref_death, work);
 				if (tmp_death->cookie == cookie) {
@@ -2141,6 +2885,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 				     "binder: %d:%d BC_DEAD_BINDER_DONE %p found %p\n",
 				     proc->pid, thread->pid, cookie, death);
 			if (death == NULL) {
+				spin_unlock(&proc->inner_lock);
 				binder_user_error("binder: %d:%d BC_DEAD"
 					"_BINDER_DONE %p not found\n",
 					proc->pid, thread->pid, cookie);
@@ -2157,6 +2902,7 @@ int binder_thread_write(struct binder_proc *proc, struct binder_thread *thread,
 					wake_up_interruptible(&proc->wait);
 				}
 			}
+			spin_unlock(&proc->inner_lock);
 		} break;
 
 		default:
@@ -2173,9 +2919,9 @@ void binder_stat_br(struct binder_proc *proc, struct binder_thread *thread,
 		    uint32_t cmd)
 {
 	if (_IOC_NR(cmd) < ARRAY_SIZE(binder_stats.br)) {
-		binder_stats.br[_IOC_NR(cmd)]++;
-		proc->stats.br[_IOC_NR(cmd)]++;
-		thread->stats.br[_IOC_NR(cmd)]++;
+		atomic_inc(&binder_stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&proc->stats.br[_IOC_NR(cmd)]);
+		atomic_inc(&thread->stats.br[_IOC_NR(cmd)]);
 	}
 }
 
@@ -2202,6 +2948,7 @@ static int binder_thread_read(struct binder_proc *proc,
 
 	int ret = 0;
 	int wait_for_proc_work;
+	uint32_t looper;
 
 	if (*consumed == 0) {
 		if (put_user(BR_NOOP, (uint32_t __user *)ptr))
@@ -2210,22 +2957,33 @@ static int binder_thread_read(struct binder_proc *proc,
 	}
 
 retry:
+	spin_lock(&proc->inner_lock);
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 				list_empty(&thread->todo);
 
 	if (thread->return_error != BR_OK && ptr < end) {
-		if (thread->return_error2 != BR_OK) {
-			if (put_user(thread->return_error2, (uint32_t __user *)ptr))
+		uint32_t return_error = thread->return_error;
+		uint32_t return_error2 = thread->return_error2;
+
+		/* Taken while locked, a failed reply may post another one */
+		thread->return_error2 = BR_OK;
+		if (return_error2 != BR_OK &&
+		    ptr + 2 * sizeof(uint32_t) > end)
+			return_error = BR_OK; /* left for the next read */
+		else
+			thread->return_error = BR_OK;
+		spin_unlock(&proc->inner_lock);
+
+		if (return_error2 != BR_OK) {
+			if (put_user(return_error2, (uint32_t __user *)ptr))
+				return -EFAULT;
+			ptr += sizeof(uint32_t);
+		}
+		if (return_error != BR_OK) {
+			if (put_user(return_error, (uint32_t __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(uint32_t);
-			if (ptr == end)
-				goto done;
-			thread->return_error2 = BR_OK;
 		}
-		if (put_user(thread->return_error, (uint32_t __user *)ptr))
-			return -EFAULT;
-		ptr += sizeof(uint32_t);
-		thread->return_error = BR_OK;
 		goto done;
 	}
 
@@ -2233,14 +2991,15 @@ retry:
 	thread->looper |= BINDER_LOOPER_STATE_WAITING;
 	if (wait_for_proc_work)
 		proc->ready_threads++;
-	mutex_unlock(&binder_lock);
+	looper = thread->looper;
+	spin_unlock(&proc->inner_lock);
 	if (wait_for_proc_work) {
-		if (!(thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
-					BINDER_LOOPER_STATE_ENTERED))) {
+		if (!(looper & (BINDER_LOOPER_STATE_REGISTERED |
+				BINDER_LOOPER_STATE_ENTERED))) {
 			binder_user_error("binder: %d:%d ERROR: Thread waiting "
 				"for process work before calling BC_REGISTER_"
 				"LOOPER or BC_ENTER_LOOPER (state %x)\n",
-				proc->pid, thread->pid, thread->looper);
+				proc->pid, thread->pid, looper);
 			wait_event_interruptible(binder_user_error_wait,
 						 binder_stop_on_user_error < 2);
 		}
@@ -2257,10 +3016,11 @@ retry:
 		} else
 			ret = wait_event_interruptible(thread->wait, binder_has_thread_work(thread));
 	}
-	mutex_lock(&binder_lock);
+	spin_lock(&proc->inner_lock);
 	if (wait_for_proc_work)
 		proc->ready_threads--;
 	thread->looper &= ~BINDER_LOOPER_STATE_WAITING;
+	spin_unlock(&proc->inner_lock);
 
 	if (ret)
 		return ret;
@@ -2269,46 +3029,96 @@ retry:
 		uint32_t cmd;
 		struct binder_transaction_data tr;
 		struct binder_work *w;
+		struct list_head *list;
 		struct binder_transaction *t = NULL;
+		struct binder_thread *t_from;
+		struct binder_buffer *t_buffer;
+		void __user *death_cookie = NULL;
+		int work_type;
 
+		/*
+		 * Work is taken off its list while locked and handled after
+		 * unlocking, so no other reader can pick it up meanwhile.
+		 */
+		spin_lock(&proc->inner_lock);
 		if (!list_empty(&thread->todo))
-			w = list_first_entry(&thread->todo, struct binder_work, entry);
+			list = &thread->todo;
 		else if (!list_empty(&proc->todo) && wait_for_proc_work)
-			w = list_first_entry(&proc->todo, struct binder_work, entry);
+			list = &proc->todo;
 		else {
-			if (ptr - buffer == 4 && !(thread->looper & BINDER_LOOPER_STATE_NEED_RETURN)) /* no data added */
+			looper = thread->looper;
+			spin_unlock(&proc->inner_lock);
+			if (ptr - buffer == 4 && !(looper & BINDER_LOOPER_STATE_NEED_RETURN)) /* no data added */
 				goto retry;
 			break;
 		}
 
-		if (end - ptr < sizeof(tr) + 4)
+		if (end - ptr < sizeof(tr) + 4) {
+			spin_unlock(&proc->inner_lock);
 			break;
+		}
 
-		switch (w->type) {
+		w = list_first_entry(list, struct binder_work, entry);
+		list_del_init(&w->entry);
+		work_type = w->type;
+		switch (work_type) {
+		case BINDER_WORK_NODE:
+			container_of(w, struct binder_node, work)->tmp_refs++;
+			break;
+		case BINDER_WORK_DEAD_BINDER:
+		case BINDER_WORK_DEAD_BINDER_AND_CLEAR:
+		case BINDER_WORK_CLEAR_DEATH_NOTIFICATION: {
+			struct binder_ref_death *death;
+
+			death = container_of(w, struct binder_ref_death, work);
+			death_cookie = death->cookie;
+			if (w->type == BINDER_WORK_CLEAR_DEATH_NOTIFICATION)
+				cmd = BR_CLEAR_DEATH_NOTIFICATION_DONE;
+			else {
+				cmd = BR_DEAD_BINDER;
+				list_add(&w->entry, &proc->delivered_death);
+			}
+		} break;
+		}
+		spin_unlock(&proc->inner_lock);
+
+		switch (work_type) {
 		case BINDER_WORK_TRANSACTION: {
 			t = container_of(w, struct binder_transaction, work);
 		} break;
 		case BINDER_WORK_TRANSACTION_COMPLETE: {
 			cmd = BR_TRANSACTION_COMPLETE;
-			if (put_user(cmd, (uint32_t __user *)ptr))
+			if (put_user(cmd, (uint32_t __user *)ptr)) {
+				/* Keep the completion for the next read */
+				spin_lock(&proc->inner_lock);
+				list_add(&w->entry, list);
+				spin_unlock(&proc->inner_lock);
 				return -EFAULT;
+			}
 			ptr += sizeof(uint32_t);
 
+			kfree(w);
+			binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
+
 			binder_stat_br(proc, thread, cmd);
 			binder_debug(BINDER_DEBUG_TRANSACTION_COMPLETE,
 				     "binder: %d:%d BR_TRANSACTION_COMPLETE\n",
 				     proc->pid, thread->pid);
-
-			list_del(&w->entry);
-			kfree(w);
-			binder_stats_deleted(BINDER_STAT_TRANSACTION_COMPLETE);
 		} break;
 		case BINDER_WORK_NODE: {
 			struct binder_node *node = container_of(w, struct binder_node, work);
 			uint32_t cmd = BR_NOOP;
 			const char *cmd_name;
-			int strong = node->internal_strong_refs || node->local_strong_refs;
-			int weak = !hlist_empty(&node->refs) || node->local_weak_refs || strong;
+			void __user *node_ptr;
+			void __user *node_cookie;
+			int node_debug_id;
+			int strong, weak;
+			int free_node = 0;
+
+			spin_lock(&node->lock);
+			spin_lock(&proc->inner_lock);
+			strong = node->internal_strong_refs || node->local_strong_refs;
+			weak = !hlist_empty(&node->refs) || node->local_weak_refs || strong;
 			if (weak && !node->has_weak_ref) {
 				cmd = BR_INCREFS;
 				cmd_name = "BR_INCREFS";
@@ -2330,54 +3140,59 @@ retry:
 				cmd_name = "BR_DECREFS";
 				node->has_weak_ref = 0;
 			}
+			node_ptr = node->ptr;
+			node_cookie = node->cookie;
+			node_debug_id = node->debug_id;
+			node->tmp_refs--;
+			if (cmd != BR_NOOP) {
+				/* Back in front, for the next state change */
+				if (list_empty(&w->entry))
+					list_add(&w->entry, list);
+			} else if (!weak && !strong)
+				free_node = binder_try_unlink_node(node);
+			spin_unlock(&proc->inner_lock);
+			spin_unlock(&node->lock);
+			if (free_node)
+				binder_free_node(node);
+
 			if (cmd != BR_NOOP) {
 				if (put_user(cmd, (uint32_t __user *)ptr))
 					return -EFAULT;
 				ptr += sizeof(uint32_t);
-				if (put_user(node->ptr, (void * __user *)ptr))
+				if (put_user(node_ptr, (void * __user *)ptr))
 					return -EFAULT;
 				ptr += sizeof(void *);
-				if (put_user(node->cookie, (void * __user *)ptr))
+				if (put_user(node_cookie, (void * __user *)ptr))
 					return -EFAULT;
 				ptr += sizeof(void *);
 
 				binder_stat_br(proc, thread, cmd);
 				binder_debug(BINDER_DEBUG_USER_REFS,
 					     "binder: %d:%d %s %d u%p c%p\n",
-					     proc->pid, thread->pid, cmd_name, node->debug_id, node->ptr, node->cookie);
+					     proc->pid, thread->pid, cmd_name, node_debug_id, node_ptr, node_cookie);
+			} else if (free_node) {
+				binder_debug(BINDER_DEBUG_INTERNAL_REFS,
+					     "binder: %d:%d node %d u%p c%p deleted\n",
+					     proc->pid, thread->pid, node_debug_id,
+					     node_ptr, node_cookie);
 			} else {
-				list_del_init(&w->entry);
-				if (!weak && !strong) {
-					binder_debug(BINDER_DEBUG_INTERNAL_REFS,
-						     "binder: %d:%d node %d u%p c%p deleted\n",
-						     proc->pid, thread->pid, node->debug_id,
-						     node->ptr, node->cookie);
-					rb_erase(&node->rb_node, &proc->nodes);
-					kfree(node);
-					binder_stats_deleted(BINDER_STAT_NODE);
-				} else {
-					binder_debug(BINDER_DEBUG_INTERNAL_REFS,
-						     "binder: %d:%d node %d u%p c%p state unchanged\n",
-						     proc->pid, thread->pid, node->debug_id, node->ptr,
-						     node->cookie);
-				}
+				binder_debug(BINDER_DEBUG_INTERNAL_REFS,
+					     "binder: %d:%d node %d u%p c%p state unchanged\n",
+					     proc->pid, thread->pid, node_debug_id, node_ptr,
+					     node_cookie);
 			}
 		} break;
 		case BINDER_WORK_DEAD_BINDER:
 		case BINDER_WORK_DEAD_BINDER_AND_CLEAR:
 		case BINDER_WORK_CLEAR_DEATH_NOTIFICATION: {
-			struct binder_ref_death *death;
-			uint32_t cmd;
-
-			death = container_of(w, struct binder_ref_death, work);
-			if (w->type == BINDER_WORK_CLEAR_DEATH_NOTIFICATION)
-				cmd = BR_CLEAR_DEATH_NOTIFICATION_DONE;
-			else
-				cmd = BR_DEAD_BINDER;
+			if (cmd == BR_CLEAR_DEATH_NOTIFICATION_DONE) {
+				kfree(container_of(w, struct binder_ref_death, work));
+				binder_stats_deleted(BINDER_STAT_DEATH);
+			}
 			if (put_user(cmd, (uint32_t __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(uint32_t);
-			if (put_user(death->cookie, (void * __user *)ptr))
+			if (put_user(death_cookie, (void * __user *)ptr))
 				return -EFAULT;
 			ptr += sizeof(void *);
 			binder_debug(BINDER_DEBUG_DEATH_NOTIFICATION,
@@ -2386,14 +3201,8 @@ retry:
 				      cmd == BR_DEAD_BINDER ?
 				      "BR_DEAD_BINDER" :
 				      "BR_CLEAR_DEATH_NOTIFICATION_DONE",
-				      death->cookie);
+				      death_cookie);
 
-			if (w->type == BINDER_WORK_CLEAR_DEATH_NOTIFICATION) {
-				list_del(&w->entry);
-				kfree(death);
-				binder_stats_deleted(BINDER_STAT_DEATH);
-			} else
-				list_move(&w->entry, &proc->delivered_death);
 			if (cmd == BR_DEAD_BINDER)
 				goto done; /* DEAD_BINDER notifications can cause transactions */
 		} break;
@@ -2403,8 +3212,9 @@ retry:
 			continue;
 
 		BUG_ON(t->buffer == NULL);
-		if (t->buffer->target_node) {
-			struct binder_node *target_node = t->buffer->target_node;
+		t_buffer = t->buffer;
+		if (t_buffer->target_node) {
+			struct binder_node *target_node = t_buffer->target_node;
 			tr.target.ptr = target_node->ptr;
 			tr.cookie =  target_node->cookie;
 			t->saved_priority = task_nice(current);
@@ -2424,27 +3234,33 @@ retry:
 		tr.flags = t->flags;
 		tr.sender_euid = t->sender_euid;
 
-		if (t->from) {
-			struct task_struct *sender = t->from->proc->tsk;
+		t_from = binder_get_txn_from(t);
+		if (t_from) {
+			struct task_struct *sender = t_from->proc->tsk;
 			tr.sender_pid = task_tgid_nr_ns(sender,
 							current->nsproxy->pid_ns);
 		} else {
 			tr.sender_pid = 0;
 		}
 
-		tr.data_size = t->buffer->data_size;
-		tr.offsets_size = t->buffer->offsets_size;
-		tr.data.ptr.buffer = (void *)t->buffer->data +
+		tr.data_size = t_buffer->data_size;
+		tr.offsets_size = t_buffer->offsets_size;
+		tr.data.ptr.buffer = (void *)t_buffer->data +
 					proc->user_buffer_offset;
 		tr.data.ptr.offsets = tr.data.ptr.buffer +
-					ALIGN(t->buffer->data_size,
+					ALIGN(t_buffer->data_size,
 					    sizeof(void *));
 
-		if (put_user(cmd, (uint32_t __user *)ptr))
+		if (put_user(cmd, (uint32_t __user *)ptr) ||
+		    copy_to_user(ptr + sizeof(uint32_t), &tr, sizeof(tr))) {
+			spin_lock(&proc->inner_lock);
+			list_add(&t->work.entry, list);
+			spin_unlock(&proc->inner_lock);
+			if (t_from)
+				binder_thread_dec_tmpref(t_from);
 			return -EFAULT;
+		}
 		ptr += sizeof(uint32_t);
-		if (copy_to_user(ptr, &tr, sizeof(tr)))
-			return -EFAULT;
 		ptr += sizeof(tr);
 
 		binder_stat_br(proc, thread, cmd);
@@ -2454,49 +3270,63 @@ retry:
 			     proc->pid, thread->pid,
 			     (cmd == BR_TRANSACTION) ? "BR_TRANSACTION" :
 			     "BR_REPLY",
-			     t->debug_id, t->from ? t->from->proc->pid : 0,
-			     t->from ? t->from->pid : 0, cmd,
-			     t->buffer->data_size, t->buffer->offsets_size,
+			     t->debug_id, t_from ? t_from->proc->pid : 0,
+			     t_from ? t_from->pid : 0, cmd,
+			     t_buffer->data_size, t_buffer->offsets_size,
 			     tr.data.ptr.buffer, tr.data.ptr.offsets);
+		if (t_from)
+			binder_thread_dec_tmpref(t_from);
 
-		list_del(&t->work.entry);
-		t->buffer->allow_user_free = 1;
 		if (cmd == BR_TRANSACTION && !(t->flags & TF_ONE_WAY)) {
+			spin_lock(&proc->inner_lock);
 			t->to_parent = thread->transaction_stack;
+			spin_lock(&t->lock);
 			t->to_thread = thread;
+			spin_unlock(&t->lock);
 			thread->transaction_stack = t;
-		} else {
-			t->buffer->transaction = NULL;
-			kfree(t);
-			binder_stats_deleted(BINDER_STAT_TRANSACTION);
-		}
+			spin_unlock(&proc->inner_lock);
+		} else
+			binder_free_transaction(t);
+		mutex_lock(&proc->alloc_lock);
+		t_buffer->allow_user_free = 1;
+		mutex_unlock(&proc->alloc_lock);
 		break;
 	}
 
 done:
 
 	*consumed = ptr - buffer;
+	spin_lock(&proc->inner_lock);
 	if (proc->requested_threads + proc->ready_threads == 0 &&
 	    proc->requested_threads_started < proc->max_threads &&
 	    (thread->looper & (BINDER_LOOPER_STATE_REGISTERED |
 	     BINDER_LOOPER_STATE_ENTERED)) /* the user-space code fails to */
 	     /*spawn a new thread if we leave this out */) {
 		proc->requested_threads++;
+		spin_unlock(&proc->inner_lock);
 		binder_debug(BINDER_DEBUG_THREADS,
 			     "binder: %d:%d BR_SPAWN_LOOPER\n",
 			     proc->pid, thread->pid);
 		if (put_user(BR_SPAWN_LOOPER, (uint32_t __user *)buffer))
 			return -EFAULT;
-	}
+	} else
+		spin_unlock(&proc->inner_lock);
 	return 0;
 }
 
-static void binder_release_work(struct list_head *list)
+static void binder_release_work(struct binder_proc *proc,
+				struct list_head *list)
 {
 	struct binder_work *w;
-	while (!list_empty(list)) {
+	while (1) {
+		spin_lock(&proc->inner_lock);
+		if (list_empty(list)) {
+			spin_unlock(&proc->inner_lock);
+			break;
+		}
 		w = list_first_entry(list, struct binder_work, entry);
 		list_del_init(&w->entry);
+		spin_unlock(&proc->inner_lock);
 		switch (w->type) {
 		case BINDER_WORK_TRANSACTION: {
 			struct binder_transaction *t;
@@ -2516,7 +3346,8 @@ static void binder_release_work(struct list_head *list)
 
 }
 
-static struct binder_thread *binder_get_thread(struct binder_proc *proc)
+static struct binder_thread *binder_get_thread_ilocked(
+	struct binder_proc *proc, struct binder_thread *new_thread)
 {
 	struct binder_thread *thread = NULL;
 	struct rb_node *parent = NULL;
@@ -2531,38 +3362,68 @@ static struct binder_thread *binder_get_thread(struct binder_proc *proc)
 		else if (current->pid > thread->pid)
 			p = &(*p)->rb_right;
 		else
-			break;
+			return thread;
 	}
-	if (*p == NULL) {
-		thread = kzalloc(sizeof(*thread), GFP_KERNEL);
-		if (thread == NULL)
+	if (new_thread == NULL)
+		return NULL;
+	thread = new_thread;
+	binder_stats_created(BINDER_STAT_THREAD);
+	thread->proc = proc;
+	thread->pid = current->pid;
+	init_waitqueue_head(&thread->wait);
+	INIT_LIST_HEAD(&thread->todo);
+	rb_link_node(&thread->rb_node, parent, p);
+	rb_insert_color(&thread->rb_node, &proc->threads);
+	thread->looper |= BINDER_LOOPER_STATE_NEED_RETURN;
+	thread->return_error = BR_OK;
+	thread->return_error2 = BR_OK;
+	return thread;
+}
+
+static struct binder_thread *binder_get_thread(struct binder_proc *proc)
+{
+	struct binder_thread *thread;
+	struct binder_thread *new_thread;
+
+	spin_lock(&proc->inner_lock);
+	thread = binder_get_thread_ilocked(proc, NULL);
+	spin_unlock(&proc->inner_lock);
+	if (thread == NULL) {
+		new_thread = kzalloc(sizeof(*thread), GFP_KERNEL);
+		if (new_thread == NULL)
 			return NULL;
-		binder_stats_created(BINDER_STAT_THREAD);
-		thread->proc = proc;
-		thread->pid = current->pid;
-		init_waitqueue_head(&thread->wait);
-		INIT_LIST_HEAD(&thread->todo);
-		rb_link_node(&thread->rb_node, parent, p);
-		rb_insert_color(&thread->rb_node, &proc->threads);
-		thread->looper |= BINDER_LOOPER_STATE_NEED_RETURN;
-		thread->return_error = BR_OK;
-		thread->return_error2 = BR_OK;
+		spin_lock(&proc->inner_lock);
+		thread = binder_get_thread_ilocked(proc, new_thread);
+		spin_unlock(&proc->inner_lock);
+		if (thread != new_thread)
+			kfree(new_thread);
 	}
 	return thread;
 }
 
-static int binder_free_thread(struct binder_proc *proc,
-			      struct binder_thread *thread)
+/*
+ * Takes thread out of proc and its transactions. Others may still hold a
+ * tmp_ref of it, the last one frees it.
+ */
+static int binder_thread_release(struct binder_proc *proc,
+				 struct binder_thread *thread)
 {
 	struct binder_transaction *t;
 	struct binder_transaction *send_reply = NULL;
 	int active_transactions = 0;
 
+	spin_lock(&proc->inner_lock);
+	/* Held until the thread is off every list, the dead thread keeps proc */
+	atomic_inc(&thread->tmp_ref);
+	proc->tmp_ref++;
+	thread->is_dead = true;
 	rb_erase(&thread->rb_node, &proc->threads);
 	t = thread->transaction_stack;
 	if (t && t->to_thread == thread)
 		send_reply = t;
 	while (t) {
+		struct binder_transaction *next;
+
 		active_transactions++;
 		binder_debug(BINDER_DEBUG_DEAD_TRANSACTION,
 			     "binder: release %d:%d transaction %d "
@@ -2570,6 +3431,7 @@ static int binder_free_thread(struct binder_proc *proc,
 			     t->debug_id,
 			     (t->to_thread == thread) ? "in" : "out");
 
+		spin_lock(&t->lock);
 		if (t->to_thread == thread) {
 			t->to_proc = NULL;
 			t->to_thread = NULL;
@@ -2577,18 +3439,20 @@ static int binder_free_thread(struct binder_proc *proc,
 				t->buffer->transaction = NULL;
 				t->buffer = NULL;
 			}
-			t = t->to_parent;
+			next = t->to_parent;
 		} else if (t->from == thread) {
 			t->from = NULL;
-			t = t->from_parent;
+			next = t->from_parent;
 		} else
 			BUG();
+		spin_unlock(&t->lock);
+		t = next;
 	}
+	spin_unlock(&proc->inner_lock);
 	if (send_reply)
 		binder_send_failed_reply(send_reply, BR_DEAD_REPLY);
-	binder_release_work(&thread->todo);
-	kfree(thread);
-	binder_stats_deleted(BINDER_STAT_THREAD);
+	binder_release_work(proc, &thread->todo);
+	binder_thread_dec_tmpref(thread);
 	return active_transactions;
 }
 
@@ -2599,12 +3463,14 @@ static unsigned int binder_poll(struct file *filp,
 	struct binder_thread *thread = NULL;
 	int wait_for_proc_work;
 
-	mutex_lock(&binder_lock);
 	thread = binder_get_thread(proc);
+	if (thread == NULL)
+		return POLLERR;
 
+	spin_lock(&proc->inner_lock);
 	wait_for_proc_work = thread->transaction_stack == NULL &&
 		list_empty(&thread->todo) && thread->return_error == BR_OK;
-	mutex_unlock(&binder_lock);
+	spin_unlock(&proc->inner_lock);
 
 	if (wait_for_proc_work) {
 		if (binder_has_proc_work(proc, thread))
@@ -2622,6 +3488,46 @@ static unsigned int binder_poll(struct file *filp,
 	return 0;
 }
 
+static int binder_ioctl_set_ctx_mgr(struct binder_proc *proc)
+{
+	int ret = 0;
+	struct binder_node *node;
+
+	mutex_lock(&binder_context_mgr_lock);
+	if (binder_context_mgr_node != NULL) {
+		printk(KERN_ERR "binder: BINDER_SET_CONTEXT_MGR already set\n");
+		ret = -EBUSY;
+		goto out;
+	}
+	if (binder_context_mgr_uid != -1) {
+		if (binder_context_mgr_uid != current->cred->euid) {
+			printk(KERN_ERR "binder: BINDER_SET_"
+			       "CONTEXT_MGR bad uid %d != %d\n",
+			       current->cred->euid,
+			       binder_context_mgr_uid);
+			ret = -EPERM;
+			goto out;
+		}
+	} else
+		binder_context_mgr_uid = current->cred->euid;
+	node = binder_new_node(proc, NULL, NULL, 0);
+	if (node == NULL) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	spin_lock(&node->lock);
+	node->local_weak_refs++;
+	node->local_strong_refs++;
+	node->has_strong_ref = 1;
+	node->has_weak_ref = 1;
+	spin_unlock(&node->lock);
+	binder_context_mgr_node = node;
+	binder_put_node(node);
+out:
+	mutex_unlock(&binder_context_mgr_lock);
+	return ret;
+}
+
 static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 {
 	int ret;
@@ -2636,7 +3542,6 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	if (ret)
 		return ret;
 
-	mutex_lock(&binder_lock);
 	thread = binder_get_thread(proc);
 	if (thread == NULL) {
 		ret = -ENOMEM;
@@ -2688,43 +3593,27 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 		}
 		break;
 	}
-	case BINDER_SET_MAX_THREADS:
-		if (copy_from_user(&proc->max_threads, ubuf, sizeof(proc->max_threads))) {
+	case BINDER_SET_MAX_THREADS: {
+		int max_threads;
+
+		if (copy_from_user(&max_threads, ubuf, sizeof(max_threads))) {
 			ret = -EINVAL;
 			goto err;
 		}
+		spin_lock(&proc->inner_lock);
+		proc->max_threads = max_threads;
+		spin_unlock(&proc->inner_lock);
 		break;
+	}
 	case BINDER_SET_CONTEXT_MGR:
-		if (binder_context_mgr_node != NULL) {
-			printk(KERN_ERR "binder: BINDER_SET_CONTEXT_MGR already set\n");
-			ret = -EBUSY;
-			goto err;
-		}
-		if (binder_context_mgr_uid != -1) {
-			if (binder_context_mgr_uid != current->cred->euid) {
-				printk(KERN_ERR "binder: BINDER_SET_"
-				       "CONTEXT_MGR bad uid %d != %d\n",
-				       current->cred->euid,
-				       binder_context_mgr_uid);
-				ret = -EPERM;
-				goto err;
-			}
-		} else
-			binder_context_mgr_uid = current->cred->euid;
-		binder_context_mgr_node = binder_new_node(proc, NULL, NULL);
-		if (binder_context_mgr_node == NULL) {
-			ret = -ENOMEM;
+		ret = binder_ioctl_set_ctx_mgr(proc);
+		if (ret)
 			goto err;
-		}
-		binder_context_mgr_node->local_weak_refs++;
-		binder_context_mgr_node->local_strong_refs++;
-		binder_context_mgr_node->has_strong_ref = 1;
-		binder_context_mgr_node->has_weak_ref = 1;
 		break;
 	case BINDER_THREAD_EXIT:
 		binder_debug(BINDER_DEBUG_THREADS, "binder: %d:%d exit\n",
 			     proc->pid, thread->pid);
-		binder_free_thread(proc, thread);
+		binder_thread_release(proc, thread);
 		thread = NULL;
 		break;
 	case BINDER_VERSION:
@@ -2743,9 +3632,11 @@ static long binder_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
 	}
 	ret = 0;
 err:
-	if (thread)
+	if (thread) {
+		spin_lock(&proc->inner_lock);
 		thread->looper &= ~BINDER_LOOPER_STATE_NEED_RETURN;
-	mutex_unlock(&binder_lock);
+		spin_unlock(&proc->inner_lock);
+	}
 	wait_event_interruptible(binder_user_error_wait, binder_stop_on_user_error < 2);
 	if (ret && ret != -ERESTARTSYS)
 		printk(KERN_INFO "binder: %d:%d ioctl %x %lx returned %d\n", proc->pid, current->pid, cmd, arg, ret);
@@ -2787,6 +3678,8 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 	struct binder_proc *proc = filp->private_data;
 	const char *failure_string;
 	struct binder_buffer *buffer;
+	int npages;
+	int i;
 
 	if ((vma->vm_end - vma->vm_start) > SZ_4M)
 		vma->vm_end = vma->vm_start + SZ_4M;
@@ -2827,12 +3720,19 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 		}
 	}
 #endif
-	proc->pages = kzalloc(sizeof(proc->pages[0]) * ((vma->vm_end - vma->vm_start) / PAGE_SIZE), GFP_KERNEL);
+	npages = (vma->vm_end - vma->vm_start) / PAGE_SIZE;
+	proc->pages = kzalloc(sizeof(proc->pages[0]) * npages, GFP_KERNEL);
 	if (proc->pages == NULL) {
 		ret = -ENOMEM;
 		failure_string = "alloc page array";
 		goto err_alloc_pages_failed;
 	}
+	for (i = 0; i < npages; i++) {
+		INIT_LIST_HEAD(&proc->pages[i].lru);
+		proc->pages[i].proc = proc;
+	}
+	proc->reserve_pages = clamp(binder_reserve_pages, 0, npages);
+	INIT_LIST_HEAD(&proc->reserve);
 	proc->buffer_size = vma->vm_end - vma->vm_start;
 
 	vma->vm_ops = &binder_vm_ops;
@@ -2850,9 +3750,14 @@ static int binder_mmap(struct file *filp, struct vm_area_struct *vma)
 	binder_insert_free_buffer(proc, buffer);
 	proc->free_async_space = proc->buffer_size / 2;
 	barrier();
+	mutex_lock(&proc->files_lock);
 	proc->files = get_files_struct(current);
+	mutex_unlock(&proc->files_lock);
 	proc->vma = vma;
 
+	if (proc->reserve_pages > 1)
+		binder_defer_work(proc, BINDER_DEFERRED_RESERVE);
+
 	/*printk(KERN_INFO "binder_mmap: %d %lx-%lx maps %p\n",
 		 proc->pid, vma->vm_start, vma->vm_end, proc->buffer);*/
 	return 0;
@@ -2883,16 +3788,20 @@ static int binder_open(struct inode *nodp, struct file *filp)
 		return -ENOMEM;
 	get_task_struct(current);
 	proc->tsk = current;
+	spin_lock_init(&proc->outer_lock);
+	spin_lock_init(&proc->inner_lock);
+	mutex_init(&proc->alloc_lock);
+	mutex_init(&proc->files_lock);
 	INIT_LIST_HEAD(&proc->todo);
 	init_waitqueue_head(&proc->wait);
 	proc->default_priority = task_nice(current);
-	mutex_lock(&binder_lock);
 	binder_stats_created(BINDER_STAT_PROC);
-	hlist_add_head(&proc->proc_node, &binder_procs);
 	proc->pid = current->group_leader->pid;
 	INIT_LIST_HEAD(&proc->delivered_death);
 	filp->private_data = proc;
-	mutex_unlock(&binder_lock);
+	mutex_lock(&binder_procs_lock);
+	hlist_add_head(&proc->proc_node, &binder_procs);
+	mutex_unlock(&binder_procs_lock);
 
 	if (binder_debugfs_dir_entry_proc) {
 		char strbuf[11];
@@ -2917,6 +3826,8 @@ static void binder_deferred_flush(struct binder_proc *proc)
 {
 	struct rb_node *n;
 	int wake_count = 0;
+
+	spin_lock(&proc->inner_lock);
 	for (n = rb_first(&proc->threads); n != NULL; n = rb_next(n)) {
 		struct binder_thread *thread = rb_entry(n, struct binder_thread, rb_node);
 		thread->looper |= BINDER_LOOPER_STATE_NEED_RETURN;
@@ -2925,6 +3836,7 @@ static void binder_deferred_flush(struct binder_proc *proc)
 			wake_count++;
 		}
 	}
+	spin_unlock(&proc->inner_lock);
 	wake_up_interruptible_all(&proc->wait);
 
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
@@ -2941,30 +3853,99 @@ static int binder_release(struct inode *nodp, struct file *filp)
 	return 0;
 }
 
-static void binder_deferred_release(struct binder_proc *proc)
+/* Called with node->tmp_refs held, node already off proc->nodes */
+static int binder_node_release(struct binder_proc *proc,
+			       struct binder_node *node, int incoming_refs)
 {
 	struct hlist_node *pos;
-	struct binder_transaction *t;
+	struct binder_ref *ref;
+	int death = 0;
+
+	spin_lock(&node->lock);
+	spin_lock(&proc->inner_lock);
+	list_del_init(&node->work.entry);
+	node->tmp_refs--;
+	if (hlist_empty(&node->refs) && !node->tmp_refs) {
+		spin_unlock(&proc->inner_lock);
+		spin_unlock(&node->lock);
+		binder_free_node(node);
+		return incoming_refs;
+	}
+	spin_unlock(&proc->inner_lock);
+
+	spin_lock(&binder_dead_nodes_lock);
+	node->proc = NULL;
+	node->local_strong_refs = 0;
+	node->local_weak_refs = 0;
+	hlist_add_head(&node->dead_node, &binder_dead_nodes);
+	spin_unlock(&binder_dead_nodes_lock);
+
+	hlist_for_each_entry(ref, pos, &node->refs, node_entry) {
+		incoming_refs++;
+		if (ref->death) {
+			death++;
+			spin_lock(&ref->proc->inner_lock);
+			if (list_empty(&ref->death->work.entry)) {
+				ref->death->work.type = BINDER_WORK_DEAD_BINDER;
+				list_add_tail(&ref->death->work.entry, &ref->proc->todo);
+				wake_up_interruptible(&ref->proc->wait);
+			} else
+				BUG();
+			spin_unlock(&ref->proc->inner_lock);
+		}
+	}
+	spin_unlock(&node->lock);
+	binder_debug(BINDER_DEBUG_DEAD_BINDER,
+		     "binder: node %d now dead, "
+		     "refs %d, death %d\n", node->debug_id,
+		     incoming_refs, death);
+	return incoming_refs;
+}
+
+/*
+ * Called with binder_teardown_sem held for writing. Other procs may still
+ * hold tmp_refs of proc, the buffers and proc itself are freed with the
+ * last one.
+ */
+static void binder_deferred_release(struct binder_proc *proc)
+{
 	struct rb_node *n;
-	int threads, nodes, incoming_refs, outgoing_refs, buffers, active_transactions, page_count;
+	int threads, nodes, incoming_refs, outgoing_refs, active_transactions;
 
 	BUG_ON(proc->vma);
 	BUG_ON(proc->files);
 
+	mutex_lock(&binder_procs_lock);
 	hlist_del(&proc->proc_node);
+	mutex_unlock(&binder_procs_lock);
+
+	mutex_lock(&binder_context_mgr_lock);
 	if (binder_context_mgr_node && binder_context_mgr_node->proc == proc) {
 		binder_debug(BINDER_DEBUG_DEAD_BINDER,
 			     "binder_release: %d context_mgr_node gone\n",
 			     proc->pid);
 		binder_context_mgr_node = NULL;
 	}
+	mutex_unlock(&binder_context_mgr_lock);
+
+	/* No new work or refs from here on, see binder_transaction */
+	spin_lock(&proc->outer_lock);
+	spin_lock(&proc->inner_lock);
+	proc->tmp_ref++;
+	proc->is_dead = true;
+	spin_unlock(&proc->inner_lock);
+	spin_unlock(&proc->outer_lock);
 
 	threads = 0;
 	active_transactions = 0;
+	spin_lock(&proc->inner_lock);
 	while ((n = rb_first(&proc->threads))) {
 		struct binder_thread *thread = rb_entry(n, struct binder_thread, rb_node);
+
+		spin_unlock(&proc->inner_lock);
 		threads++;
-		active_transactions += binder_free_thread(proc, thread);
+		active_transactions += binder_thread_release(proc, thread);
+		spin_lock(&proc->inner_lock);
 	}
 	nodes = 0;
 	incoming_refs = 0;
@@ -2972,97 +3953,52 @@ static void binder_deferred_release(struct binder_proc *proc)
 		struct binder_node *node = rb_entry(n, struct binder_node, rb_node);
 
 		nodes++;
+		/* Keeps node while its locks are taken in order */
+		node->tmp_refs++;
 		rb_erase(&node->rb_node, &proc->nodes);
-		list_del_init(&node->work.entry);
-		if (hlist_empty(&node->refs)) {
-			kfree(node);
-			binder_stats_deleted(BINDER_STAT_NODE);
-		} else {
-			struct binder_ref *ref;
-			int death = 0;
-
-			node->proc = NULL;
-			node->local_strong_refs = 0;
-			node->local_weak_refs = 0;
-			hlist_add_head(&node->dead_node, &binder_dead_nodes);
-
-			hlist_for_each_entry(ref, pos, &node->refs, node_entry) {
-				incoming_refs++;
-				if (ref->death) {
-					death++;
-					if (list_empty(&ref->death->work.entry)) {
-						ref->death->work.type = BINDER_WORK_DEAD_BINDER;
-						list_add_tail(&ref->death->work.entry, &ref->proc->todo);
-						wake_up_interruptible(&ref->proc->wait);
-					} else
-						BUG();
-				}
-			}
-			binder_debug(BINDER_DEBUG_DEAD_BINDER,
-				     "binder: node %d now dead, "
-				     "refs %d, death %d\n", node->debug_id,
-				     incoming_refs, death);
-		}
+		spin_unlock(&proc->inner_lock);
+		incoming_refs = binder_node_release(proc, node, incoming_refs);
+		spin_lock(&proc->inner_lock);
 	}
+	spin_unlock(&proc->inner_lock);
+
 	outgoing_refs = 0;
+	spin_lock(&proc->outer_lock);
 	while ((n = rb_first(&proc->refs_by_desc))) {
 		struct binder_ref *ref = rb_entry(n, struct binder_ref,
 						  rb_node_desc);
 		outgoing_refs++;
 		binder_delete_ref(ref);
 	}
-	binder_release_work(&proc->todo);
-	buffers = 0;
-
-	while ((n = rb_first(&proc->allocated_buffers))) {
-		struct binder_buffer *buffer = rb_entry(n, struct binder_buffer,
-							rb_node);
-		t = buffer->transaction;
-		if (t) {
-			t->buffer = NULL;
-			buffer->transaction = NULL;
-			printk(KERN_ERR "binder: release proc %d, "
-			       "transaction %d, not freed\n",
-			       proc->pid, t->debug_id);
-			/*BUG();*/
-		}
-		binder_free_buf(proc, buffer);
-		buffers++;
-	}
-
-	binder_stats_deleted(BINDER_STAT_PROC);
-
-	page_count = 0;
-	if (proc->pages) {
-		int i;
-		for (i = 0; i < proc->buffer_size / PAGE_SIZE; i++) {
-			if (proc->pages[i]) {
-				void *page_addr = proc->buffer + i * PAGE_SIZE;
-				binder_debug(BINDER_DEBUG_BUFFER_ALLOC,
-					     "binder_release: %d: "
-					     "page %d at %p not freed\n",
-					     proc->pid, i,
-					     page_addr);
-				unmap_kernel_range((unsigned long)page_addr,
-					PAGE_SIZE);
-				__free_page(proc->pages[i]);
-				page_count++;
-			}
-		}
-		kfree(proc->pages);
-		vfree(proc->buffer);
-	}
-
-	put_task_struct(proc->tsk);
+	spin_unlock(&proc->outer_lock);
+	binder_release_work(proc, &proc->todo);
 
 	binder_debug(BINDER_DEBUG_OPEN_CLOSE,
 		     "binder_release: %d threads %d, nodes %d (ref %d), "
-		     "refs %d, active transactions %d, buffers %d, "
-		     "pages %d\n",
+		     "refs %d, active transactions %d\n",
 		     proc->pid, threads, nodes, incoming_refs, outgoing_refs,
-		     active_transactions, buffers, page_count);
+		     active_transactions);
 
-	kfree(proc);
+	binder_proc_dec_tmpref(proc);
+}
+
+/* Maps the reserve pages of proc that are not mapped yet */
+static void binder_deferred_reserve(struct binder_proc *proc)
+{
+	void *page_addr;
+	int i;
+
+	mutex_lock(&proc->alloc_lock);
+	for (i = 0; i < proc->reserve_pages && proc->vma; i++) {
+		if (proc->pages[i].page_ptr)
+			continue;
+		page_addr = proc->buffer + i * PAGE_SIZE;
+		if (binder_update_page_range(proc, 1, page_addr,
+					     page_addr + PAGE_SIZE, NULL))
+			break;
+		binder_lru_add_page(proc, &proc->pages[i]);
+	}
+	mutex_unlock(&proc->alloc_lock);
 }
 
 static void binder_deferred_func(struct work_struct *work)
@@ -3072,7 +4008,6 @@ static void binder_deferred_func(struct work_struct *work)
 
 	int defer;
 	do {
-		mutex_lock(&binder_lock);
 		mutex_lock(&binder_deferred_lock);
 		if (!hlist_empty(&binder_deferred_list)) {
 			proc = hlist_entry(binder_deferred_list.first,
@@ -3086,20 +4021,33 @@ static void binder_deferred_func(struct work_struct *work)
 		}
 		mutex_unlock(&binder_deferred_lock);
 
+		/*
+		 * Only this work frees procs, so proc stays valid here. Pages
+		 * are mapped without holding up the other procs.
+		 */
+		if ((defer & BINDER_DEFERRED_RESERVE) &&
+		    !(defer & BINDER_DEFERRED_RELEASE))
+			binder_deferred_reserve(proc);
+
 		files = NULL;
 		if (defer & BINDER_DEFERRED_PUT_FILES) {
+			mutex_lock(&proc->files_lock);
 			files = proc->files;
 			if (files)
 				proc->files = NULL;
+			mutex_unlock(&proc->files_lock);
 		}
 
 		if (defer & BINDER_DEFERRED_FLUSH)
 			binder_deferred_flush(proc);
 
-		if (defer & BINDER_DEFERRED_RELEASE)
-			binder_deferred_release(proc); /* frees proc */
+		/* Keeps the debugfs dumps off the proc while it goes away */
+		if (defer & BINDER_DEFERRED_RELEASE) {
+			down_write(&binder_teardown_sem);
+			binder_deferred_release(proc); /* may free proc */
+			up_write(&binder_teardown_sem);
+		}
 
-		mutex_unlock(&binder_lock);
 		if (files)
 			put_files_struct(files);
 	} while (proc);
@@ -3119,9 +4067,11 @@ binder_defer_work(struct binder_proc *proc, enum binder_deferred_state defer)
 	mutex_unlock(&binder_deferred_lock);
 }
 
+/* Called with the inner lock of a proc t is queued to or stacked on */
 static void print_binder_transaction(struct seq_file *m, const char *prefix,
 				     struct binder_transaction *t)
 {
+	spin_lock(&t->lock);
 	seq_printf(m,
 		   "%s %d: %p from %d:%d to %d:%d code %x flags %x pri %ld r%d",
 		   prefix, t->debug_id, t,
@@ -3130,6 +4080,7 @@ static void print_binder_transaction(struct seq_file *m, const char *prefix,
 		   t->to_proc ? t->to_proc->pid : 0,
 		   t->to_thread ? t->to_thread->pid : 0,
 		   t->code, t->flags, t->priority, t->need_reply);
+	spin_unlock(&t->lock);
 	if (t->buffer == NULL) {
 		seq_puts(m, " buffer free\n");
 		return;
@@ -3219,6 +4170,7 @@ static void print_binder_thread(struct seq_file *m,
 		m->count = start_pos;
 }
 
+/* Called with node->lock and the owner lock of node held */
 static void print_binder_node(struct seq_file *m, struct binder_node *node)
 {
 	struct binder_ref *ref;
@@ -3246,6 +4198,17 @@ static void print_binder_node(struct seq_file *m, struct binder_node *node)
 				  "    pending async transaction", w);
 }
 
+/* Takes the locks print_binder_node needs, node has a tmp ref */
+static void print_binder_node_tmpref(struct seq_file *m,
+				     struct binder_node *node)
+{
+	spin_lock(&node->lock);
+	binder_node_lock_owner(node);
+	print_binder_node(m, node);
+	binder_node_unlock_owner(node);
+	spin_unlock(&node->lock);
+}
+
 static void print_binder_ref(struct seq_file *m, struct binder_ref *ref)
 {
 	seq_printf(m, "  ref %d: desc %d %snode %d s %d w %d d %p\n",
@@ -3258,37 +4221,56 @@ static void print_binder_proc(struct seq_file *m,
 {
 	struct binder_work *w;
 	struct rb_node *n;
+	struct binder_node *last_node = NULL;
 	size_t start_pos = m->count;
 	size_t header_pos;
 
 	seq_printf(m, "proc %d\n", proc->pid);
 	header_pos = m->count;
 
+	spin_lock(&proc->inner_lock);
 	for (n = rb_first(&proc->threads); n != NULL; n = rb_next(n))
 		print_binder_thread(m, rb_entry(n, struct binder_thread,
 						rb_node), print_all);
+	/* A node with a tmp ref stays in the tree, the sem keeps proc */
 	for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n)) {
 		struct binder_node *node = rb_entry(n, struct binder_node,
 						    rb_node);
-		if (print_all || node->has_async_transaction)
-			print_binder_node(m, node);
+		if (!print_all && !node->has_async_transaction)
+			continue;
+		node->tmp_refs++;
+		spin_unlock(&proc->inner_lock);
+		if (last_node)
+			binder_put_node(last_node);
+		print_binder_node_tmpref(m, node);
+		last_node = node;
+		spin_lock(&proc->inner_lock);
 	}
+	spin_unlock(&proc->inner_lock);
+	if (last_node)
+		binder_put_node(last_node);
 	if (print_all) {
+		spin_lock(&proc->outer_lock);
 		for (n = rb_first(&proc->refs_by_desc);
 		     n != NULL;
 		     n = rb_next(n))
 			print_binder_ref(m, rb_entry(n, struct binder_ref,
 						     rb_node_desc));
+		spin_unlock(&proc->outer_lock);
 	}
+	mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		print_binder_buffer(m, "  buffer",
 				    rb_entry(n, struct binder_buffer, rb_node));
+	mutex_unlock(&proc->alloc_lock);
+	spin_lock(&proc->inner_lock);
 	list_for_each_entry(w, &proc->todo, entry)
 		print_binder_work(m, "  ", "  pending transaction", w);
 	list_for_each_entry(w, &proc->delivered_death, entry) {
 		seq_puts(m, "  has delivered dead binder\n");
 		break;
 	}
+	spin_unlock(&proc->inner_lock);
 	if (!print_all && m->count == header_pos)
 		m->count = start_pos;
 }
@@ -3352,17 +4334,21 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->bc) !=
 		     ARRAY_SIZE(binder_command_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->bc); i++) {
-		if (stats->bc[i])
+		int temp = atomic_read(&stats->bc[i]);
+
+		if (temp)
 			seq_printf(m, "%s%s: %d\n", prefix,
-				   binder_command_strings[i], stats->bc[i]);
+				   binder_command_strings[i], temp);
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->br) !=
 		     ARRAY_SIZE(binder_return_strings));
 	for (i = 0; i < ARRAY_SIZE(stats->br); i++) {
-		if (stats->br[i])
+		int temp = atomic_read(&stats->br[i]);
+
+		if (temp)
 			seq_printf(m, "%s%s: %d\n", prefix,
-				   binder_return_strings[i], stats->br[i]);
+				   binder_return_strings[i], temp);
 	}
 
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
@@ -3370,11 +4356,13 @@ static void print_binder_stats(struct seq_file *m, const char *prefix,
 	BUILD_BUG_ON(ARRAY_SIZE(stats->obj_created) !=
 		     ARRAY_SIZE(stats->obj_deleted));
 	for (i = 0; i < ARRAY_SIZE(stats->obj_created); i++) {
-		if (stats->obj_created[i] || stats->obj_deleted[i])
+		int created = atomic_read(&stats->obj_created[i]);
+		int deleted = atomic_read(&stats->obj_deleted[i]);
+
+		if (created || deleted)
 			seq_printf(m, "%s%s: active %d total %d\n", prefix,
 				binder_objstat_strings[i],
-				stats->obj_created[i] - stats->obj_deleted[i],
-				stats->obj_created[i]);
+				created - deleted, created);
 	}
 }
 
@@ -3386,6 +4374,7 @@ static void print_binder_proc_stats(struct seq_file *m,
 	int count, strong, weak;
 
 	seq_printf(m, "proc %d\n", proc->pid);
+	spin_lock(&proc->inner_lock);
 	count = 0;
 	for (n = rb_first(&proc->threads); n != NULL; n = rb_next(n))
 		count++;
@@ -3399,9 +4388,11 @@ static void print_binder_proc_stats(struct seq_file *m,
 	for (n = rb_first(&proc->nodes); n != NULL; n = rb_next(n))
 		count++;
 	seq_printf(m, "  nodes: %d\n", count);
+	spin_unlock(&proc->inner_lock);
 	count = 0;
 	strong = 0;
 	weak = 0;
+	spin_lock(&proc->outer_lock);
 	for (n = rb_first(&proc->refs_by_desc); n != NULL; n = rb_next(n)) {
 		struct binder_ref *ref = rb_entry(n, struct binder_ref,
 						  rb_node_desc);
@@ -3409,14 +4400,18 @@ static void print_binder_proc_stats(struct seq_file *m,
 		strong += ref->strong;
 		weak += ref->weak;
 	}
+	spin_unlock(&proc->outer_lock);
 	seq_printf(m, "  refs: %d s %d w %d\n", count, strong, weak);
 
 	count = 0;
+	mutex_lock(&proc->alloc_lock);
 	for (n = rb_first(&proc->allocated_buffers); n != NULL; n = rb_next(n))
 		count++;
+	mutex_unlock(&proc->alloc_lock);
 	seq_printf(m, "  buffers: %d\n", count);
 
 	count = 0;
+	spin_lock(&proc->inner_lock);
 	list_for_each_entry(w, &proc->todo, entry) {
 		switch (w->type) {
 		case BINDER_WORK_TRANSACTION:
@@ -3426,6 +4421,7 @@ static void print_binder_proc_stats(struct seq_file *m,
 			break;
 		}
 	}
+	spin_unlock(&proc->inner_lock);
 	seq_printf(m, "  pending transactions: %d\n", count);
 
 	print_binder_stats(m, "  ", &proc->stats);
@@ -3437,22 +4433,38 @@ static int binder_state_show(struct seq_file *m, void *unused)
 	struct binder_proc *proc;
 	struct hlist_node *pos;
 	struct binder_node *node;
+	struct binder_node *last_node = NULL;
 	int do_lock = !binder_debug_no_lock;
 
+	/* The read side keeps procs from being released during the dump */
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_read(&binder_teardown_sem);
+	mutex_lock(&binder_procs_lock);
 
 	seq_puts(m, "binder state:\n");
 
+	spin_lock(&binder_dead_nodes_lock);
 	if (!hlist_empty(&binder_dead_nodes))
 		seq_puts(m, "dead nodes:\n");
-	hlist_for_each_entry(node, pos, &binder_dead_nodes, dead_node)
-		print_binder_node(m, node);
+	hlist_for_each_entry(node, pos, &binder_dead_nodes, dead_node) {
+		/* A node with a tmp ref stays on the list */
+		node->tmp_refs++;
+		spin_unlock(&binder_dead_nodes_lock);
+		if (last_node)
+			binder_put_node(last_node);
+		print_binder_node_tmpref(m, node);
+		last_node = node;
+		spin_lock(&binder_dead_nodes_lock);
+	}
+	spin_unlock(&binder_dead_nodes_lock);
+	if (last_node)
+		binder_put_node(last_node);
 
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 1);
+	mutex_unlock(&binder_procs_lock);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_read(&binder_teardown_sem);
 	return 0;
 }
 
@@ -3462,8 +4474,10 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 	struct hlist_node *pos;
 	int do_lock = !binder_debug_no_lock;
 
+	/* The read side keeps procs from being released during the dump */
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_read(&binder_teardown_sem);
+	mutex_lock(&binder_procs_lock);
 
 	seq_puts(m, "binder stats:\n");
 
@@ -3471,8 +4485,9 @@ static int binder_stats_show(struct seq_file *m, void *unused)
 
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc_stats(m, proc);
+	mutex_unlock(&binder_procs_lock);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_read(&binder_teardown_sem);
 	return 0;
 }
 
@@ -3482,28 +4497,41 @@ static int binder_transactions_show(struct seq_file *m, void *unused)
 	struct hlist_node *pos;
 	int do_lock = !binder_debug_no_lock;
 
+	/* The read side keeps procs from being released during the dump */
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_read(&binder_teardown_sem);
+	mutex_lock(&binder_procs_lock);
 
 	seq_puts(m, "binder transactions:\n");
 	hlist_for_each_entry(proc, pos, &binder_procs, proc_node)
 		print_binder_proc(m, proc, 0);
+	mutex_unlock(&binder_procs_lock);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_read(&binder_teardown_sem);
 	return 0;
 }
 
 static int binder_proc_show(struct seq_file *m, void *unused)
 {
+	struct binder_proc *itr;
 	struct binder_proc *proc = m->private;
+	struct hlist_node *pos;
 	int do_lock = !binder_debug_no_lock;
 
 	if (do_lock)
-		mutex_lock(&binder_lock);
+		down_read(&binder_teardown_sem);
 	seq_puts(m, "binder proc state:\n");
-	print_binder_proc(m, proc, 1);
+	/* The file may outlive the proc, look it up among the live ones */
+	mutex_lock(&binder_procs_lock);
+	hlist_for_each_entry(itr, pos, &binder_procs, proc_node) {
+		if (itr == proc) {
+			print_binder_proc(m, proc, 1);
+			break;
+		}
+	}
+	mutex_unlock(&binder_procs_lock);
 	if (do_lock)
-		mutex_unlock(&binder_lock);
+		up_read(&binder_teardown_sem);
 	return 0;
 }
 
@@ -3521,13 +4549,16 @@ static void print_binder_transaction_log_entry(struct seq_file *m,
 static int binder_transaction_log_show(struct seq_file *m, void *unused)
 {
 	struct binder_transaction_log *log = m->private;
+	unsigned int next = (atomic_read(&log->cur) + 1) %
+				ARRAY_SIZE(log->entry);
 	int i;
 
+	/* Entries being written meanwhile may show up half filled in */
 	if (log->full) {
-		for (i = log->next; i < ARRAY_SIZE(log->entry); i++)
+		for (i = next; i < ARRAY_SIZE(log->entry); i++)
 			print_binder_transaction_log_entry(m, &log->entry[i]);
 	}
-	for (i = 0; i < log->next; i++)
+	for (i = 0; i < next; i++)
 		print_binder_transaction_log_entry(m, &log->entry[i]);
 	return 0;
 }
@@ -3566,6 +4597,7 @@ static int __init binder_init(void)
 		binder_debugfs_dir_entry_proc = debugfs_create_dir("proc",
 						 binder_debugfs_dir_entry_root);
 	ret = misc_register(&binder_miscdev);
+	register_shrinker(&binder_shrinker);
 	if (binder_debugfs_dir_entry_root) {
 		debugfs_create_file("state",
 				    S_IRUGO,
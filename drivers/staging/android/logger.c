@@ -20,6 +20,7 @@
 #include <linux/sched.h>
 #include <linux/module.h>
 #include <linux/fs.h>
+#include <linux/mm.h>
 #include <linux/miscdevice.h>
 #include <linux/uaccess.h>
 #include <linux/poll.h>
@@ -28,6 +29,7 @@
 #include "logger.h"
 
 #include <asm/ioctls.h>
+#include <asm/io.h>
 
 #ifdef CONFIG_SAMSUNG_PASS_PLATFORM_LOG_TO_KERNEL
 //{{ pass platform log to kernel - 1/3
@@ -117,6 +119,7 @@ struct logger_reader {
 	struct logger_log	*log;	/* associated log */
 	struct list_head	list;	/* entry in logger_log's list */
 	size_t			r_off;	/* current read head offset */
+	bool			batch;	/* read() returns all entries that fit */
 };
 
 /* logger_offset - returns index 'n' into the log via (optimized) modulus */
@@ -167,6 +170,37 @@ static __u32 get_entry_len(struct logger_log *log, size_t off)
 	return sizeof(struct logger_entry) + val;
 }
 
+/*
+ * get_readable_len - returns the length of the entries 'reader' has not read.
+ *
+ * Caller needs to hold log->mutex.
+ */
+static size_t get_readable_len(struct logger_log *log,
+			       struct logger_reader *reader)
+{
+	return logger_offset(log->w_off - reader->r_off);
+}
+
+/*
+ * get_batch_len - returns the length of the whole entries starting from 'off'
+ * that fit in 'count' bytes. The entry at 'off' must fit and be readable.
+ *
+ * Caller needs to hold log->mutex.
+ */
+static size_t get_batch_len(struct logger_log *log, size_t off, size_t count)
+{
+	size_t len = 0;
+
+	do {
+		size_t nr = get_entry_len(log, logger_offset(off + len));
+		if (len + nr > count)
+			break;
+		len += nr;
+	} while (logger_offset(off + len) != log->w_off);
+
+	return len;
+}
+
 /*
  * do_read_log_to_user - reads exactly 'count' bytes from 'log' into the
  * user-space buffer 'buf'. Returns 'count' on success.
@@ -209,10 +243,11 @@ static ssize_t do_read_log_to_user(struct logger_log *log,
  *
  * 	- O_NONBLOCK works
  * 	- If there are no log entries to read, blocks until log is written to
- * 	- Atomically reads exactly one log entry
+ * 	- Atomically reads exactly one log entry, or with LOGGER_SET_READ_BATCH
+ * 	  as many whole entries as fit in the read buffer
  *
- * Optimal read size is LOGGER_ENTRY_MAX_LEN. Will set errno to EINVAL if read
- * buffer is insufficient to hold next entry.
+ * Optimal read size is LOGGER_ENTRY_MAX_LEN, or the log size in batch mode.
+ * Will set errno to EINVAL if read buffer is insufficient to hold next entry.
  */
 static ssize_t logger_read(struct file *file, char __user *buf,
 			   size_t count, loff_t *pos)
@@ -264,7 +299,11 @@ start:
 		goto out;
 	}
 
-	/* get exactly one entry from the log */
+	/* in batch mode, take the following entries that fit as well */
+	if (reader->batch)
+		ret = get_batch_len(log, reader->r_off, count);
+
+	/* get whole entries only from the log */
 	ret = do_read_log_to_user(log, reader, buf, ret);
 
 out:
@@ -493,6 +532,7 @@ static int logger_open(struct inode *inode, struct file *file)
 			return -ENOMEM;
 
 		reader->log = log;
+		reader->batch = false;
 		INIT_LIST_HEAD(&reader->list);
 
 		mutex_lock(&log->mutex);
@@ -559,10 +599,75 @@ static unsigned int logger_poll(struct file *file, poll_table *wait)
 	return ret;
 }
 
+/*
+ * logger_mmap - the log's mmap file operation
+ *
+ * Maps the whole ring buffer read-only, so that a reader can consume entries
+ * in place and move its cursor with LOGGER_ADVANCE_CURSOR instead of copying
+ * them with read().
+ */
+static int logger_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct logger_reader *reader;
+	struct logger_log *log;
+
+	if (!(file->f_mode & FMODE_READ))
+		return -EBADF;
+
+	reader = file->private_data;
+	log = reader->log;
+
+	if (vma->vm_pgoff || vma->vm_end - vma->vm_start != log->size)
+		return -EINVAL;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+
+	return remap_pfn_range(vma, vma->vm_start,
+			       virt_to_phys(log->buffer) >> PAGE_SHIFT,
+			       log->size, vma->vm_page_prot);
+}
+
+/*
+ * advance_cursor - moves the read head of 'reader' past the 'cursor->len'
+ * bytes of entries read in place from 'cursor->off', and returns the new
+ * cursor in 'cursor'. Fails with ESTALE if the writer lapped the reader, as
+ * the entries read may have been overwritten.
+ *
+ * Caller needs to hold log->mutex.
+ */
+static long advance_cursor(struct logger_log *log,
+			   struct logger_reader *reader,
+			   struct logger_cursor *cursor)
+{
+	size_t len = 0;
+
+	if (cursor->off != reader->r_off)
+		return -ESTALE;
+
+	if (cursor->len > get_readable_len(log, reader))
+		return -EINVAL;
+
+	/* only ever leave the read head on an entry */
+	while (len < cursor->len)
+		len += get_entry_len(log, logger_offset(reader->r_off + len));
+	if (len != cursor->len)
+		return -EINVAL;
+
+	reader->r_off = logger_offset(reader->r_off + len);
+
+	cursor->off = reader->r_off;
+	cursor->len = get_readable_len(log, reader);
+
+	return 0;
+}
+
 static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 {
 	struct logger_log *log = file_get_log(file);
 	struct logger_reader *reader;
+	struct logger_cursor cursor;
 	long ret = -ENOTTY;
 
 	mutex_lock(&log->mutex);
@@ -577,10 +682,7 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 			break;
 		}
 		reader = file->private_data;
-		if (log->w_off >= reader->r_off)
-			ret = log->w_off - reader->r_off;
-		else
-			ret = (log->size - reader->r_off) + log->w_off;
+		ret = get_readable_len(log, reader);
 		break;
 	case LOGGER_GET_NEXT_ENTRY_LEN:
 		if (!(file->f_mode & FMODE_READ)) {
@@ -603,6 +705,43 @@ static long logger_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
 		log->head = log->w_off;
 		ret = 0;
 		break;
+	case LOGGER_SET_READ_BATCH:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		reader->batch = !!arg;
+		ret = 0;
+		break;
+	case LOGGER_GET_CURSOR:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		cursor.off = reader->r_off;
+		cursor.len = get_readable_len(log, reader);
+		ret = 0;
+		if (copy_to_user((void __user *)arg, &cursor, sizeof(cursor)))
+			ret = -EFAULT;
+		break;
+	case LOGGER_ADVANCE_CURSOR:
+		if (!(file->f_mode & FMODE_READ)) {
+			ret = -EBADF;
+			break;
+		}
+		reader = file->private_data;
+		if (copy_from_user(&cursor, (void __user *)arg,
+				   sizeof(cursor))) {
+			ret = -EFAULT;
+			break;
+		}
+		ret = advance_cursor(log, reader, &cursor);
+		if (!ret && copy_to_user((void __user *)arg, &cursor,
+					 sizeof(cursor)))
+			ret = -EFAULT;
+		break;
 	}
 
 	mutex_unlock(&log->mutex);
@@ -615,6 +754,7 @@ static const struct file_operations logger_fops = {
 	.read = logger_read,
 	.aio_write = logger_aio_write,
 	.poll = logger_poll,
+	.mmap = logger_mmap,
 	.unlocked_ioctl = logger_ioctl,
 	.compat_ioctl = logger_ioctl,
 	.open = logger_open,
@@ -623,11 +763,12 @@ static const struct file_operations logger_fops = {
 
 /*
  * Defines a log structure with name 'NAME' and a size of 'SIZE' bytes, which
- * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN, and less than
- * LONG_MAX minus LOGGER_ENTRY_MAX_LEN.
+ * must be a power of two, greater than LOGGER_ENTRY_MAX_LEN and PAGE_SIZE, and
+ * less than LONG_MAX minus LOGGER_ENTRY_MAX_LEN. The buffer is page aligned so
+ * that readers can mmap it.
  */
 #define DEFINE_LOGGER_DEVICE(VAR, NAME, SIZE) \
-static unsigned char _buf_ ## VAR[SIZE]; \
+static unsigned char _buf_ ## VAR[SIZE] __aligned(PAGE_SIZE); \
 static struct logger_log VAR = { \
 	.buffer = _buf_ ## VAR, \
 	.misc = { \
@@ -30,6 +30,15 @@ struct logger_entry {
 	char		msg[0];	/* the entry's payload */
 };
 
+/*
+ * The reader cursor of a log mapped with mmap(), as offsets into the mapping.
+ * The readable entries may wrap around the end of the log.
+ */
+struct logger_cursor {
+	__u32		off;	/* offset of the reader's next entry */
+	__u32		len;	/* length of the whole entries at off */
+};
+
 #define LOGGER_LOG_RADIO	"log_radio"	/* radio-related messages */
 #define LOGGER_LOG_EVENTS	"log_events"	/* system/hardware events */
 #define LOGGER_LOG_SYSTEM	"log_system"	/* system/framework messages */
@@ -45,5 +54,8 @@ struct logger_entry {
 #define LOGGER_GET_LOG_LEN		_IO(__LOGGERIO, 2) /* used log len */
 #define LOGGER_GET_NEXT_ENTRY_LEN	_IO(__LOGGERIO, 3) /* next entry len */
 #define LOGGER_FLUSH_LOG		_IO(__LOGGERIO, 4) /* flush log */
+#define LOGGER_SET_READ_BATCH		_IO(__LOGGERIO, 5) /* read many */
+#define LOGGER_GET_CURSOR		_IOR(__LOGGERIO, 6, struct logger_cursor)
+#define LOGGER_ADVANCE_CURSOR		_IOWR(__LOGGERIO, 7, struct logger_cursor)
 
 #endif /* _LINUX_LOGGER_H */
@@ -0,0 +1,173 @@
+/*
+ * LZF compressor used as fast ramzswap backend
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Stream format (compatible with liblzf):
+ *   000LLLLL <L+1 literal bytes>
+ *   LLLooooo oooooooo		back-reference, length L+2 (L = 1..6)
+ *   111ooooo LLLLLLLL oooooooo	back-reference, length L+9
+ * where the offset is (o + 1) bytes back from the current output.
+ *
+ * Compression ratio is lower than that of LZO but the decoder is a
+ * single tight loop with no state, which makes swap-in cheaper.
+ */
+
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/errno.h>
+
+#include "lzf.h"
+
+#define LZF_HSIZE	(1 << LZF_HLOG)
+#define LZF_MAX_LIT	(1 << 5)
+#define LZF_MAX_OFF	(1 << 13)
+#define LZF_MAX_REF	((1 << 8) + (1 << 3))
+
+static inline u32 lzf_hash(const unsigned char *p)
+{
+	u32 v = (p[0] << 16) | (p[1] << 8) | p[2];
+
+	return ((v >> (3 * 8 - LZF_HLOG)) - v * 5) & (LZF_HSIZE - 1);
+}
+
+int lzf_compress(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len, void *wrkmem)
+{
+	u32 *htab = wrkmem;
+	const unsigned char *ip = src;
+	const unsigned char *in_end = src + src_len;
+	unsigned char *op = dst;
+	int lit = 0;
+
+	memset(htab, 0, LZF_MEM_COMPRESS);
+
+	/* Reserve control byte of the first literal run */
+	op++;
+
+	while (ip + 2 < in_end) {
+		u32 h = lzf_hash(ip);
+		const unsigned char *ref = src + htab[h];
+		size_t off = ip - ref - 1;
+
+		htab[h] = ip - src;
+
+		if (ref < ip && off < LZF_MAX_OFF &&
+				ref[0] == ip[0] && ref[1] == ip[1] &&
+				ref[2] == ip[2]) {
+			size_t len = 3;
+			size_t maxlen = in_end - ip;
+
+			if (maxlen > LZF_MAX_REF)
+				maxlen = LZF_MAX_REF;
+
+			while (len < maxlen && ref[len] == ip[len])
+				len++;
+
+			/* Close the pending literal run (or drop its slot) */
+			if (lit)
+				op[-lit - 1] = lit - 1;
+			else
+				op--;
+
+			len -= 2;
+			if (len < 7) {
+				*op++ = (off >> 8) | (len << 5);
+			} else {
+				*op++ = (off >> 8) | (7 << 5);
+				*op++ = len - 7;
+			}
+			*op++ = off;
+
+			ip += len + 2;
+			lit = 0;
+			op++;
+			continue;
+		}
+
+		lit++;
+		*op++ = *ip++;
+		if (unlikely(lit == LZF_MAX_LIT)) {
+			op[-lit - 1] = lit - 1;
+			lit = 0;
+			op++;
+		}
+	}
+
+	while (ip < in_end) {
+		lit++;
+		*op++ = *ip++;
+		if (unlikely(lit == LZF_MAX_LIT)) {
+			op[-lit - 1] = lit - 1;
+			lit = 0;
+			op++;
+		}
+	}
+
+	if (lit)
+		op[-lit - 1] = lit - 1;
+	else
+		op--;
+
+	*dst_len = op - dst;
+	return 0;
+}
+
+int lzf_decompress(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len)
+{
+	const unsigned char *ip = src;
+	const unsigned char *in_end = src + src_len;
+	unsigned char *op = dst;
+	unsigned char *out_end = dst + *dst_len;
+
+	while (ip < in_end) {
+		unsigned int ctrl = *ip++;
+
+		if (ctrl < LZF_MAX_LIT) {
+			ctrl++;
+			if (unlikely(op + ctrl > out_end ||
+					ip + ctrl > in_end))
+				return -EINVAL;
+
+			memcpy(op, ip, ctrl);
+			op += ctrl;
+			ip += ctrl;
+		} else {
+			unsigned int len = ctrl >> 5;
+			const unsigned char *ref;
+
+			ref = op - ((ctrl & 0x1f) << 8) - 1;
+
+			if (len == 7) {
+				if (unlikely(ip >= in_end))
+					return -EINVAL;
+				len += *ip++;
+			}
+
+			if (unlikely(ip >= in_end))
+				return -EINVAL;
+			ref -= *ip++;
+			len += 2;
+
+			if (unlikely(op + len > out_end || ref < dst))
+				return -EINVAL;
+
+			if (op - ref >= len) {
+				memcpy(op, ref, len);
+				op += len;
+			} else {
+				do {
+					*op++ = *ref++;
+				} while (--len);
+			}
+		}
+	}
+
+	*dst_len = op - dst;
+	return 0;
+}
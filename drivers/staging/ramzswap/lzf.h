@@ -0,0 +1,30 @@
+/*
+ * LZF compressor used as fast ramzswap backend
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _LZF_H_
+#define _LZF_H_
+
+#include <linux/types.h>
+
+#define LZF_HLOG		12
+#define LZF_MEM_COMPRESS	((1 << LZF_HLOG) * sizeof(u32))
+
+/*
+ * Worst case output size for given input length. The destination
+ * buffer passed to lzf_compress() must be at least this large.
+ */
+#define lzf_worst_compress(x)	((x) + ((x) >> 5) + 1)
+
+int lzf_compress(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len, void *wrkmem);
+int lzf_decompress(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len);
+
+#endif
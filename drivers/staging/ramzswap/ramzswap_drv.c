@@ -23,21 +23,57 @@
 #include <linux/device.h>
 #include <linux/genhd.h>
 #include <linux/highmem.h>
+#include <linux/jhash.h>
 #include <linux/slab.h>
 #include <linux/lzo.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
 #include <linux/string.h>
 #include <linux/swap.h>
 #include <linux/swapops.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 
 #include "ramzswap_drv.h"
+#include "lzf.h"
 
 /* Globals */
 static int ramzswap_major;
 static struct ramzswap *devices;
+static struct kmem_cache *rzs_dedup_cache;
+static struct workqueue_struct *rzs_wb_wq;
 
 /* Module params (documentation at end) */
 static unsigned int num_devices;
+static char *backend = "lzo";
+
+static const struct rzs_backend rzs_backends[] = {
+	{
+		.name		= "lzo",
+		.workmem_size	= LZO1X_MEM_COMPRESS,
+		.compress	= lzo1x_1_compress,
+		.decompress	= lzo1x_decompress_safe,
+	},
+	{
+		/* lower ratio, cheaper decompression (swap-in) */
+		.name		= "lzf",
+		.workmem_size	= LZF_MEM_COMPRESS,
+		.compress	= lzf_compress,
+		.decompress	= lzf_decompress,
+	},
+};
+
+static const struct rzs_backend *rzs_find_backend(const char *name)
+{
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(rzs_backends); i++) {
+		if (!strcmp(rzs_backends[i].name, name))
+			return &rzs_backends[i];
+	}
+
+	return NULL;
+}
 
 static int rzs_test_flag(struct ramzswap *rzs, u32 index,
 			enum rzs_pageflags flag)
@@ -57,21 +93,121 @@ static void rzs_clear_flag(struct ramzswap *rzs, u32 index,
 	rzs->table[index].flags &= ~BIT(flag);
 }
 
-static int page_zero_filled(void *ptr)
+/*
+ * Check if the page consists of a single repeated word (e.g. all
+ * zeros or a fill pattern) and return that word in @element.
+ */
+static int page_same_filled(void *ptr, unsigned long *element)
 {
 	unsigned int pos;
 	unsigned long *page;
 
 	page = (unsigned long *)ptr;
 
-	for (pos = 0; pos != PAGE_SIZE / sizeof(*page); pos++) {
-		if (page[pos])
+	for (pos = 1; pos != PAGE_SIZE / sizeof(*page); pos++) {
+		if (page[pos] != page[0])
 			return 0;
 	}
 
+	*element = page[0];
 	return 1;
 }
 
+static struct hlist_head *rzs_dedup_bucket(struct ramzswap *rzs, u32 hash)
+{
+	return &rzs->dedup_table[hash & (RZS_DEDUP_BUCKETS - 1)];
+}
+
+/*
+ * Look for a stored object with the same compressed content. If one
+ * is found, take a reference to it and point table entry at it.
+ */
+static int rzs_dedup_get(struct ramzswap *rzs, u32 index,
+			const unsigned char *src, size_t clen, u32 hash)
+{
+	int found = 0;
+	unsigned char *cmem;
+	struct hlist_node *pos;
+	struct rzs_dedup_entry *entry;
+
+	spin_lock(&rzs->dedup_lock);
+	hlist_for_each_entry(entry, pos, rzs_dedup_bucket(rzs, hash), node) {
+		if (entry->hash != hash || entry->clen != clen)
+			continue;
+
+		cmem = zs_map_object(rzs->mem_pool, entry->handle, ZS_MM_RO);
+		found = !memcmp(cmem + sizeof(struct zobj_header), src, clen);
+		zs_unmap_object(rzs->mem_pool, entry->handle);
+
+		if (found) {
+			entry->refcount++;
+			rzs->table[index].handle = entry->handle;
+			break;
+		}
+	}
+	spin_unlock(&rzs->dedup_lock);
+
+	return found;
+}
+
+/*
+ * Add newly stored object to the dedup index. Failure to allocate
+ * an index entry is not fatal: the object is just never shared.
+ */
+static void rzs_dedup_add(struct ramzswap *rzs, unsigned long handle,
+			size_t clen, u32 hash)
+{
+	struct rzs_dedup_entry *entry;
+
+	entry = kmem_cache_alloc(rzs_dedup_cache, GFP_NOIO | __GFP_NOWARN);
+	if (unlikely(!entry))
+		return;
+
+	entry->handle = handle;
+	entry->clen = clen;
+	entry->hash = hash;
+	entry->refcount = 1;
+
+	spin_lock(&rzs->dedup_lock);
+	hlist_add_head(&entry->node, rzs_dedup_bucket(rzs, hash));
+	spin_unlock(&rzs->dedup_lock);
+}
+
+/*
+ * Drop a reference to the object. Returns the number of references
+ * left; the caller frees the object on zero.
+ */
+static u32 rzs_dedup_put(struct ramzswap *rzs, unsigned long handle,
+			u32 hash)
+{
+	u32 refcount = 0;
+	struct hlist_node *pos;
+	struct rzs_dedup_entry *entry;
+
+	spin_lock(&rzs->dedup_lock);
+	hlist_for_each_entry(entry, pos, rzs_dedup_bucket(rzs, hash), node) {
+		if (entry->handle != handle)
+			continue;
+
+		refcount = --entry->refcount;
+		if (!refcount) {
+			hlist_del(&entry->node);
+			kmem_cache_free(rzs_dedup_cache, entry);
+		}
+		break;
+	}
+	spin_unlock(&rzs->dedup_lock);
+
+	return refcount;
+}
+
+static int rzs_slot_used(struct ramzswap *rzs, u32 index)
+{
+	return rzs->table[index].page ||
+		rzs_test_flag(rzs, index, RZS_ZERO) ||
+		rzs_test_flag(rzs, index, RZS_BACKED);
+}
+
 static void ramzswap_set_disksize(struct ramzswap *rzs, size_t totalram_bytes)
 {
 	if (!rzs->disksize) {
@@ -119,14 +255,16 @@ static void ramzswap_ioctl_get_stats(struct ramzswap *rzs,
 			struct ramzswap_ioctl_stats *s)
 {
 	s->disksize = rzs->disksize;
+	strlcpy(s->backend, rzs->backend->name, sizeof(s->backend));
 
 #if defined(CONFIG_RAMZSWAP_STATS)
 	{
 	struct ramzswap_stats *rs = &rzs->stats;
 	size_t succ_writes, mem_used;
 	unsigned int good_compress_perc = 0, no_compress_perc = 0;
+	int i;
 
-	mem_used = xv_get_total_size_bytes(rzs->mem_pool)
+	mem_used = zs_get_total_size_bytes(rzs->mem_pool)
 			+ (rs->pages_expand << PAGE_SHIFT);
 	succ_writes = rzs_stat64_read(rzs, &rs->num_writes) -
 			rzs_stat64_read(rzs, &rs->failed_writes);
@@ -145,6 +283,14 @@ static void ramzswap_ioctl_get_stats(struct ramzswap *rzs,
 	s->invalid_io = rzs_stat64_read(rzs, &rs->invalid_io);
 	s->notify_free = rzs_stat64_read(rzs, &rs->notify_free);
 	s->pages_zero = rs->pages_zero;
+	s->pages_same = rs->pages_same;
+	s->pages_dedup = rs->pages_dedup;
+	s->dedup_hits = rzs_stat64_read(rzs, &rs->dedup_hits);
+	s->dedup_saved_size = rs->dedup_saved;
+	s->pages_backed = rs->pages_backed;
+	s->bd_reads = rzs_stat64_read(rzs, &rs->bd_reads);
+	s->bd_writes = rzs_stat64_read(rzs, &rs->bd_writes);
+	s->pages_compacted = rzs_stat64_read(rzs, &rs->pages_compacted);
 
 	s->good_compress_pct = good_compress_perc;
 	s->pages_expand_pct = no_compress_perc;
@@ -154,17 +300,40 @@ static void ramzswap_ioctl_get_stats(struct ramzswap *rzs,
 	s->orig_data_size = rs->pages_stored << PAGE_SHIFT;
 	s->compr_data_size = rs->compr_size;
 	s->mem_used_total = mem_used;
+
+	for (i = 0; i < RZS_NS_HIST_BUCKETS; i++) {
+		s->compr_ns_hist[i] =
+			rzs_stat64_read(rzs, &rs->compr_ns_hist[i]);
+		s->decompr_ns_hist[i] =
+			rzs_stat64_read(rzs, &rs->decompr_ns_hist[i]);
+	}
 	}
 #endif /* CONFIG_RAMZSWAP_STATS */
 }
 
-static void ramzswap_free_page(struct ramzswap *rzs, size_t index)
+/*
+ * Free the contents of a slot. Caller must hold wb_lock for writing.
+ */
+static void __ramzswap_free_page(struct ramzswap *rzs, size_t index)
 {
-	u32 clen;
-	void *obj;
+	u32 clen, hash;
+	unsigned long handle;
+	struct zobj_header *zheader;
 
 	struct page *page = rzs->table[index].page;
-	u32 offset = rzs->table[index].offset;
+
+	if (rzs_test_flag(rzs, index, RZS_BACKED)) {
+		rzs_clear_flag(rzs, index, RZS_BACKED);
+		rzs_stat_dec(&rzs->stats.pages_backed);
+		return;
+	}
+
+	if (rzs_test_flag(rzs, index, RZS_SAME)) {
+		rzs_clear_flag(rzs, index, RZS_SAME);
+		rzs_stat_dec(&rzs->stats.pages_same);
+		rzs->table[index].element = 0;
+		return;
+	}
 
 	if (unlikely(!page)) {
 		/*
@@ -180,35 +349,61 @@ static void ramzswap_free_page(struct ramzswap *rzs, size_t index)
 
 	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED))) {
 		clen = PAGE_SIZE;
-		__free_page(page);
+		/* Page under writeback is freed on its completion */
+		if (!rzs_test_flag(rzs, index, RZS_WB))
+			__free_page(page);
 		rzs_clear_flag(rzs, index, RZS_UNCOMPRESSED);
 		rzs_stat_dec(&rzs->stats.pages_expand);
 		goto out;
 	}
 
-	obj = kmap_atomic(page, KM_USER0) + offset;
-	clen = xv_get_object_size(obj) - sizeof(struct zobj_header);
-	kunmap_atomic(obj, KM_USER0);
+	handle = rzs->table[index].handle;
+	zheader = zs_map_object(rzs->mem_pool, handle, ZS_MM_RO);
+	hash = zheader->hash;
+	zs_unmap_object(rzs->mem_pool, handle);
+	clen = zs_get_object_size(rzs->mem_pool, handle) - sizeof(*zheader);
 
-	xv_free(rzs->mem_pool, page, offset);
 	if (clen <= PAGE_SIZE / 2)
 		rzs_stat_dec(&rzs->stats.good_compress);
 
+	if (rzs_dedup_put(rzs, handle, hash)) {
+		/* Object is still used by other slots */
+		rzs_stat_dec(&rzs->stats.pages_dedup);
+		rzs->stats.dedup_saved -= clen;
+		clen = 0;
+		goto out;
+	}
+
+	zs_free(rzs->mem_pool, handle);
+
 out:
 	rzs->stats.compr_size -= clen;
 	rzs_stat_dec(&rzs->stats.pages_stored);
 
+	rzs_clear_flag(rzs, index, RZS_WB);
+	rzs_clear_flag(rzs, index, RZS_IDLE);
 	rzs->table[index].page = NULL;
-	rzs->table[index].offset = 0;
 }
 
-static int handle_zero_page(struct bio *bio)
+static void ramzswap_free_page(struct ramzswap *rzs, size_t index)
 {
-	void *user_mem;
+	write_lock(&rzs->wb_lock);
+	__ramzswap_free_page(rzs, index);
+	write_unlock(&rzs->wb_lock);
+}
+
+static int handle_same_page(struct bio *bio, unsigned long element)
+{
+	unsigned int pos;
+	unsigned long *user_mem;
 	struct page *page = bio->bi_io_vec[0].bv_page;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	memset(user_mem, 0, PAGE_SIZE);
+	if (!element)
+		memset(user_mem, 0, PAGE_SIZE);
+	else
+		for (pos = 0; pos != PAGE_SIZE / sizeof(*user_mem); pos++)
+			user_mem[pos] = element;
 	kunmap_atomic(user_mem, KM_USER0);
 
 	flush_dcache_page(page);
@@ -228,8 +423,7 @@ static int handle_uncompressed_page(struct ramzswap *rzs, struct bio *bio)
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
-			rzs->table[index].offset;
+	cmem = kmap_atomic(rzs->table[index].page, KM_USER1);
 
 	memcpy(user_mem, cmem, PAGE_SIZE);
 	kunmap_atomic(user_mem, KM_USER0);
@@ -261,49 +455,60 @@ static int handle_ramzswap_fault(struct ramzswap *rzs, struct bio *bio)
 	return 0;
 }
 
-static int ramzswap_read(struct ramzswap *rzs, struct bio *bio)
+static int rzs_decompress_page(struct ramzswap *rzs, u32 index,
+			struct page *page)
 {
 	int ret;
-	u32 index;
 	size_t clen;
-	struct page *page;
+	u64 start;
 	struct zobj_header *zheader;
 	unsigned char *user_mem, *cmem;
 
-	rzs_stat64_inc(rzs, &rzs->stats.num_reads);
-
-	page = bio->bi_io_vec[0].bv_page;
-	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
-
-	if (rzs_test_flag(rzs, index, RZS_ZERO))
-		return handle_zero_page(bio);
-
-	/* Requested page is not present in compressed area */
-	if (!rzs->table[index].page)
-		return handle_ramzswap_fault(rzs, bio);
-
-	/* Page is stored uncompressed since it's incompressible */
-	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
-		return handle_uncompressed_page(rzs, bio);
+	unsigned long handle = rzs->table[index].handle;
 
 	user_mem = kmap_atomic(page, KM_USER0);
 	clen = PAGE_SIZE;
 
-	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
-			rzs->table[index].offset;
+	cmem = zs_map_object(rzs->mem_pool, handle, ZS_MM_RO);
 
-	ret = lzo1x_decompress_safe(
+	start = sched_clock();
+	ret = rzs->backend->decompress(
 		cmem + sizeof(*zheader),
-		xv_get_object_size(cmem) - sizeof(*zheader),
+		zs_get_object_size(rzs->mem_pool, handle) - sizeof(*zheader),
 		user_mem, &clen);
+	rzs_stat64_hist(rzs, rzs->stats.decompr_ns_hist,
+			sched_clock() - start);
 
+	zs_unmap_object(rzs->mem_pool, handle);
 	kunmap_atomic(user_mem, KM_USER0);
-	kunmap_atomic(cmem, KM_USER1);
 
 	/* should NEVER happen */
-	if (unlikely(ret != LZO_E_OK)) {
+	if (unlikely(ret))
 		pr_err("Decompression failed! err=%d, page=%u\n",
 			ret, index);
+
+	return ret;
+}
+
+static int __ramzswap_read(struct ramzswap *rzs, struct bio *bio, u32 index)
+{
+	struct page *page = bio->bi_io_vec[0].bv_page;
+
+	if (rzs_test_flag(rzs, index, RZS_ZERO))
+		return handle_same_page(bio, 0);
+
+	if (rzs_test_flag(rzs, index, RZS_SAME))
+		return handle_same_page(bio, rzs->table[index].element);
+
+	/* Requested page is not present in compressed area */
+	if (!rzs->table[index].page)
+		return handle_ramzswap_fault(rzs, bio);
+
+	/* Page is stored uncompressed since it's incompressible */
+	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
+		return handle_uncompressed_page(rzs, bio);
+
+	if (unlikely(rzs_decompress_page(rzs, index, page))) {
 		rzs_stat64_inc(rzs, &rzs->stats.failed_reads);
 		goto out;
 	}
@@ -319,13 +524,117 @@ out:
 	return 0;
 }
 
+static int ramzswap_read(struct ramzswap *rzs, struct bio *bio)
+{
+	int ret;
+	u32 index;
+
+	rzs_stat64_inc(rzs, &rzs->stats.num_reads);
+
+	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
+
+	/*
+	 * Keep writeback completion from freeing the in-memory copy
+	 * of this page while we are reading it.
+	 */
+	read_lock(&rzs->wb_lock);
+
+	/*
+	 * Page has been written back: remap the bio to the backing
+	 * device (same sector) and let the block layer resubmit it.
+	 */
+	if (rzs_test_flag(rzs, index, RZS_BACKED)) {
+		read_unlock(&rzs->wb_lock);
+		rzs_stat64_inc(rzs, &rzs->stats.bd_reads);
+		bio->bi_bdev = rzs->backing_bdev;
+		return 1;
+	}
+
+	rzs_clear_flag(rzs, index, RZS_IDLE);
+	ret = __ramzswap_read(rzs, bio, index);
+
+	read_unlock(&rzs->wb_lock);
+	return ret;
+}
+
+static struct rzs_cstream *rzs_cstream_get(struct ramzswap *rzs)
+{
+	struct rzs_cstream *strm;
+
+	strm = per_cpu_ptr(rzs->streams, raw_smp_processor_id());
+	mutex_lock(&strm->lock);
+
+	return strm;
+}
+
+static void rzs_cstream_put(struct rzs_cstream *strm)
+{
+	mutex_unlock(&strm->lock);
+}
+
+static void rzs_free_streams(struct ramzswap *rzs)
+{
+	int cpu;
+
+	if (!rzs->streams)
+		return;
+
+	for_each_possible_cpu(cpu) {
+		struct rzs_cstream *strm = per_cpu_ptr(rzs->streams, cpu);
+
+		kfree(strm->workmem);
+		free_pages((unsigned long)strm->buffer, 1);
+	}
+
+	free_percpu(rzs->streams);
+	rzs->streams = NULL;
+}
+
+static int rzs_alloc_streams(struct ramzswap *rzs)
+{
+	int cpu;
+
+	rzs->streams = alloc_percpu(struct rzs_cstream);
+	if (!rzs->streams)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		struct rzs_cstream *strm = per_cpu_ptr(rzs->streams, cpu);
+
+		mutex_init(&strm->lock);
+
+		strm->workmem = kzalloc(rzs->backend->workmem_size,
+					GFP_KERNEL);
+		if (!strm->workmem) {
+			pr_err("Error allocating compressor working memory!\n");
+			goto fail;
+		}
+
+		strm->buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
+		if (!strm->buffer) {
+			pr_err("Error allocating compressor buffer space\n");
+			goto fail;
+		}
+	}
+
+	return 0;
+
+fail:
+	rzs_free_streams(rzs);
+	return -ENOMEM;
+}
+
 static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 {
 	int ret;
-	u32 offset, index;
+	u32 index, hash = 0;
 	size_t clen;
+	unsigned long handle = 0;
+	u64 start;
+	unsigned long element;
 	struct zobj_header *zheader;
 	struct page *page, *page_store;
+	struct rzs_cstream *strm;
 	unsigned char *user_mem, *cmem, *src;
 
 	rzs_stat64_inc(rzs, &rzs->stats.num_writes);
@@ -333,34 +642,59 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 	page = bio->bi_io_vec[0].bv_page;
 	index = bio->bi_sector >> SECTORS_PER_PAGE_SHIFT;
 
-	src = rzs->compress_buffer;
+	/*
+	 * Swap may rewrite a slot without freeing it first. Drop the
+	 * old contents so that no (shared) object reference leaks.
+	 */
+	if (rzs_slot_used(rzs, index))
+		ramzswap_free_page(rzs, index);
 
-	mutex_lock(&rzs->lock);
+	/*
+	 * Compression runs outside of rzs->lock, using this CPU's
+	 * stream, so that both cores can compress at the same time.
+	 * rzs->lock only covers allocation and table update below.
+	 */
+	strm = rzs_cstream_get(rzs);
+	src = strm->buffer;
 
 	user_mem = kmap_atomic(page, KM_USER0);
-	if (page_zero_filled(user_mem)) {
+	if (page_same_filled(user_mem, &element)) {
 		kunmap_atomic(user_mem, KM_USER0);
+		rzs_cstream_put(strm);
+
+		mutex_lock(&rzs->lock);
+		if (!element) {
+			rzs_stat_inc(&rzs->stats.pages_zero);
+			rzs_set_flag(rzs, index, RZS_ZERO);
+		} else {
+			rzs_stat_inc(&rzs->stats.pages_same);
+			rzs->table[index].element = element;
+			rzs_set_flag(rzs, index, RZS_SAME);
+		}
 		mutex_unlock(&rzs->lock);
-		rzs_stat_inc(&rzs->stats.pages_zero);
-		rzs_set_flag(rzs, index, RZS_ZERO);
 
 		set_bit(BIO_UPTODATE, &bio->bi_flags);
 		bio_endio(bio, 0);
 		return 0;
 	}
 
-	ret = lzo1x_1_compress(user_mem, PAGE_SIZE, src, &clen,
-				rzs->compress_workmem);
+	start = sched_clock();
+	ret = rzs->backend->compress(user_mem, PAGE_SIZE, src, &clen,
+				strm->workmem);
+	rzs_stat64_hist(rzs, rzs->stats.compr_ns_hist,
+			sched_clock() - start);
 
 	kunmap_atomic(user_mem, KM_USER0);
 
-	if (unlikely(ret != LZO_E_OK)) {
-		mutex_unlock(&rzs->lock);
+	if (unlikely(ret)) {
+		rzs_cstream_put(strm);
 		pr_err("Compression failed! err=%d\n", ret);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
 		goto out;
 	}
 
+	mutex_lock(&rzs->lock);
+
 	/*
 	 * Page is incompressible. Store it as-is (uncompressed)
 	 * since we do not want to return too many swap write
@@ -371,58 +705,74 @@ static int ramzswap_write(struct ramzswap *rzs, struct bio *bio)
 		page_store = alloc_page(GFP_NOIO | __GFP_HIGHMEM);
 		if (unlikely(!page_store)) {
 			mutex_unlock(&rzs->lock);
+			rzs_cstream_put(strm);
 			pr_info("Error allocating memory for incompressible "
 				"page: %u\n", index);
 			rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
 			goto out;
 		}
 
-		offset = 0;
 		rzs_set_flag(rzs, index, RZS_UNCOMPRESSED);
 		rzs_stat_inc(&rzs->stats.pages_expand);
 		rzs->table[index].page = page_store;
+
+		/* Push incompressible pages out to the backing device */
+		if (rzs->backing_bdev &&
+				++rzs->wb_incompressible >= RZS_WB_BATCH) {
+			rzs->wb_incompressible = 0;
+			queue_work(rzs_wb_wq, &rzs->wb_work);
+		}
 		src = kmap_atomic(page, KM_USER0);
 		goto memstore;
 	}
 
-	if (xv_malloc(rzs->mem_pool, clen + sizeof(*zheader),
-			&rzs->table[index].page, &offset,
-			GFP_NOIO | __GFP_HIGHMEM)) {
+	hash = jhash(src, clen, 0);
+	if (rzs_dedup_get(rzs, index, src, clen, hash)) {
+		rzs->stats.dedup_saved += clen;
+		rzs_stat_inc(&rzs->stats.pages_dedup);
+		rzs_stat64_inc(rzs, &rzs->stats.dedup_hits);
+		goto stats;
+	}
+
+	handle = zs_malloc(rzs->mem_pool, clen + sizeof(*zheader),
+				GFP_NOIO | __GFP_HIGHMEM);
+	if (unlikely(!handle)) {
 		mutex_unlock(&rzs->lock);
+		rzs_cstream_put(strm);
 		pr_info("Error allocating memory for compressed "
 			"page: %u, size=%zu\n", index, clen);
 		rzs_stat64_inc(rzs, &rzs->stats.failed_writes);
 		goto out;
 	}
 
-memstore:
-	rzs->table[index].offset = offset;
-
-	cmem = kmap_atomic(rzs->table[index].page, KM_USER1) +
-			rzs->table[index].offset;
+	rzs->table[index].handle = handle;
 
-#if 0
-	/* Back-reference needed for memory defragmentation */
-	if (!rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)) {
+memstore:
+	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED))) {
+		cmem = kmap_atomic(rzs->table[index].page, KM_USER1);
+		memcpy(cmem, src, clen);
+		kunmap_atomic(cmem, KM_USER1);
+		kunmap_atomic(src, KM_USER0);
+	} else {
+		cmem = zs_map_object(rzs->mem_pool, handle, ZS_MM_WO);
 		zheader = (struct zobj_header *)cmem;
-		zheader->table_idx = index;
-		cmem += sizeof(*zheader);
-	}
-#endif
+		zheader->hash = hash;
+		memcpy(cmem + sizeof(*zheader), src, clen);
+		zs_unmap_object(rzs->mem_pool, handle);
 
-	memcpy(cmem, src, clen);
+		rzs_dedup_add(rzs, handle, clen, hash);
+	}
 
-	kunmap_atomic(cmem, KM_USER1);
-	if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
-		kunmap_atomic(src, KM_USER0);
+	rzs->stats.compr_size += clen;
 
+stats:
 	/* Update stats */
-	rzs->stats.compr_size += clen;
 	rzs_stat_inc(&rzs->stats.pages_stored);
 	if (clen <= PAGE_SIZE / 2)
 		rzs_stat_inc(&rzs->stats.good_compress);
 
 	mutex_unlock(&rzs->lock);
+	rzs_cstream_put(strm);
 
 	set_bit(BIO_UPTODATE, &bio->bi_flags);
 	bio_endio(bio, 0);
@@ -433,6 +783,260 @@ out:
 	return 0;
 }
 
+/*
+ * Writeback of incompressible and idle pages to the backing device.
+ *
+ * Slots are written to the same sector on the backing device as
+ * on the ramzswap device, in batches of up to RZS_WB_BATCH pages.
+ * Only one batch per device is in flight at any time.
+ */
+struct rzs_wb_batch {
+	int nr_pages;
+	int nr_bios;
+	u32 index[RZS_WB_BATCH];
+	struct page *page[RZS_WB_BATCH];
+	int bounce[RZS_WB_BATCH];	/* page is a decompressed copy */
+	struct bio *bio_of[RZS_WB_BATCH];
+	struct bio *bios[RZS_WB_BATCH];
+	atomic_t pending;
+	struct completion done;
+};
+
+static int rzs_wb_candidate(struct ramzswap *rzs, u32 index,
+			enum rzs_wb_mode mode)
+{
+	/* Slot 0 holds the swap header */
+	if (!index || !rzs->table[index].page ||
+			rzs_test_flag(rzs, index, RZS_SAME) ||
+			rzs_test_flag(rzs, index, RZS_WB))
+		return 0;
+
+	if (mode == RZS_WB_IDLE)
+		return rzs_test_flag(rzs, index, RZS_IDLE);
+
+	return rzs_test_flag(rzs, index, RZS_UNCOMPRESSED);
+}
+
+/*
+ * Mark up to RZS_WB_BATCH candidate slots, starting at *index, as
+ * being under writeback. Uncompressed pages are written directly;
+ * the others are decompressed into a bounce page later.
+ */
+static void rzs_wb_select(struct ramzswap *rzs, struct rzs_wb_batch *wb,
+			u32 *index, enum rzs_wb_mode mode)
+{
+	u32 num_pages = rzs->disksize >> PAGE_SHIFT;
+
+	wb->nr_pages = 0;
+
+	mutex_lock(&rzs->lock);
+	write_lock(&rzs->wb_lock);
+	for (; *index < num_pages && wb->nr_pages < RZS_WB_BATCH; (*index)++) {
+		int n = wb->nr_pages;
+
+		if (!rzs_wb_candidate(rzs, *index, mode))
+			continue;
+
+		rzs_set_flag(rzs, *index, RZS_WB);
+		wb->index[n] = *index;
+		wb->bounce[n] = !rzs_test_flag(rzs, *index, RZS_UNCOMPRESSED);
+		wb->page[n] = wb->bounce[n] ? NULL : rzs->table[*index].page;
+		wb->nr_pages++;
+	}
+	write_unlock(&rzs->wb_lock);
+	mutex_unlock(&rzs->lock);
+}
+
+static void rzs_wb_fill_bounce(struct ramzswap *rzs, struct rzs_wb_batch *wb)
+{
+	int i, ret;
+	struct page *page;
+
+	for (i = 0; i < wb->nr_pages; i++) {
+		u32 index = wb->index[i];
+
+		if (!wb->bounce[i])
+			continue;
+
+		page = alloc_page(GFP_NOIO | __GFP_HIGHMEM | __GFP_NOWARN);
+
+		ret = -ENOMEM;
+		read_lock(&rzs->wb_lock);
+		/* Slot may have been freed since it was selected */
+		if (page && rzs_test_flag(rzs, index, RZS_WB))
+			ret = rzs_decompress_page(rzs, index, page);
+		read_unlock(&rzs->wb_lock);
+
+		if (likely(!ret)) {
+			wb->page[i] = page;
+			continue;
+		}
+
+		if (page)
+			__free_page(page);
+
+		write_lock(&rzs->wb_lock);
+		rzs_clear_flag(rzs, index, RZS_WB);
+		write_unlock(&rzs->wb_lock);
+	}
+}
+
+static void rzs_wb_end_io(struct bio *bio, int err)
+{
+	struct rzs_wb_batch *wb = bio->bi_private;
+
+	if (atomic_dec_and_test(&wb->pending))
+		complete(&wb->done);
+}
+
+/*
+ * Build one bio per run of contiguous slots, submit them all and
+ * wait for the whole batch to complete.
+ */
+static void rzs_wb_submit(struct ramzswap *rzs, struct rzs_wb_batch *wb)
+{
+	int i;
+	u32 last = 0;
+	struct bio *bio = NULL;
+
+	wb->nr_bios = 0;
+
+	for (i = 0; i < wb->nr_pages; i++) {
+		if (!wb->page[i])
+			continue;
+
+		if (!bio || wb->index[i] != last + 1 ||
+			!bio_add_page(bio, wb->page[i], PAGE_SIZE, 0)) {
+
+			bio = bio_alloc(GFP_NOIO, RZS_WB_BATCH - i);
+			bio->bi_bdev = rzs->backing_bdev;
+			bio->bi_sector = (sector_t)wb->index[i] <<
+						SECTORS_PER_PAGE_SHIFT;
+			bio->bi_end_io = rzs_wb_end_io;
+			bio->bi_private = wb;
+			bio_add_page(bio, wb->page[i], PAGE_SIZE, 0);
+
+			wb->bios[wb->nr_bios++] = bio;
+		}
+		wb->bio_of[i] = bio;
+		last = wb->index[i];
+	}
+
+	if (!wb->nr_bios)
+		return;
+
+	init_completion(&wb->done);
+	atomic_set(&wb->pending, wb->nr_bios);
+
+	for (i = 0; i < wb->nr_bios; i++)
+		submit_bio(WRITE, wb->bios[i]);
+
+	wait_for_completion(&wb->done);
+}
+
+/*
+ * Drop the in-memory copy of slots which made it to the backing
+ * device. Slots freed while under writeback leave their page to us.
+ */
+static void rzs_wb_complete(struct ramzswap *rzs, struct rzs_wb_batch *wb)
+{
+	int i;
+
+	mutex_lock(&rzs->lock);
+	write_lock(&rzs->wb_lock);
+	for (i = 0; i < wb->nr_pages; i++) {
+		u32 index = wb->index[i];
+		struct page *page = wb->page[i];
+		int uptodate;
+
+		if (!page)
+			continue;
+
+		if (!rzs_test_flag(rzs, index, RZS_WB)) {
+			__free_page(page);
+			continue;
+		}
+
+		rzs_clear_flag(rzs, index, RZS_WB);
+		uptodate = test_bit(BIO_UPTODATE, &wb->bio_of[i]->bi_flags);
+
+		if (uptodate) {
+			__ramzswap_free_page(rzs, index);
+			rzs_set_flag(rzs, index, RZS_BACKED);
+			rzs_stat_inc(&rzs->stats.pages_backed);
+			rzs_stat64_inc(rzs, &rzs->stats.bd_writes);
+		}
+
+		if (wb->bounce[i])
+			__free_page(page);
+	}
+	write_unlock(&rzs->wb_lock);
+	mutex_unlock(&rzs->lock);
+
+	for (i = 0; i < wb->nr_bios; i++)
+		bio_put(wb->bios[i]);
+}
+
+static void rzs_writeback(struct ramzswap *rzs, enum rzs_wb_mode mode)
+{
+	u32 index = 0;
+	struct rzs_wb_batch *wb;
+
+	wb = kmalloc(sizeof(*wb), GFP_NOIO);
+	if (!wb)
+		return;
+
+	mutex_lock(&rzs->wb_mutex);
+	while (rzs->init_done) {
+		rzs_wb_select(rzs, wb, &index, mode);
+		if (!wb->nr_pages)
+			break;
+
+		rzs_wb_fill_bounce(rzs, wb);
+		rzs_wb_submit(rzs, wb);
+		rzs_wb_complete(rzs, wb);
+	}
+	mutex_unlock(&rzs->wb_mutex);
+
+	kfree(wb);
+}
+
+static void rzs_wb_work(struct work_struct *work)
+{
+	struct ramzswap *rzs = container_of(work, struct ramzswap, wb_work);
+
+	rzs_writeback(rzs, RZS_WB_INCOMPRESSIBLE);
+}
+
+/*
+ * Write back slots which were not accessed since the previous call,
+ * then mark all slots still in memory as idle for the next one.
+ */
+static void rzs_writeback_idle(struct ramzswap *rzs)
+{
+	size_t index;
+
+	rzs_writeback(rzs, RZS_WB_IDLE);
+
+	mutex_lock(&rzs->lock);
+	write_lock(&rzs->wb_lock);
+	for (index = 0; index < rzs->disksize >> PAGE_SHIFT; index++) {
+		if (rzs->table[index].page &&
+				!rzs_test_flag(rzs, index, RZS_SAME))
+			rzs_set_flag(rzs, index, RZS_IDLE);
+	}
+	write_unlock(&rzs->wb_lock);
+	mutex_unlock(&rzs->lock);
+}
+
+static void rzs_wb_idle_work(struct work_struct *work)
+{
+	struct ramzswap *rzs = container_of(work, struct ramzswap,
+						wb_idle_work);
+
+	rzs_writeback_idle(rzs);
+}
+
 /*
  * Check if request is within bounds and page aligned.
  */
@@ -491,40 +1095,66 @@ static void reset_device(struct ramzswap *rzs)
 	/* Do not accept any new I/O request */
 	rzs->init_done = 0;
 
-	/* Free various per-device buffers */
-	kfree(rzs->compress_workmem);
-	free_pages((unsigned long)rzs->compress_buffer, 1);
+	/* Wait for writeback in progress */
+	cancel_work_sync(&rzs->wb_work);
+	cancel_work_sync(&rzs->wb_idle_work);
+	mutex_lock(&rzs->wb_mutex);
+	mutex_unlock(&rzs->wb_mutex);
 
-	rzs->compress_workmem = NULL;
-	rzs->compress_buffer = NULL;
+	/* Free various per-device buffers */
+	rzs_free_streams(rzs);
 
 	/* Free all pages that are still in this ramzswap device */
-	for (index = 0; index < rzs->disksize >> PAGE_SHIFT; index++) {
-		struct page *page;
-		u16 offset;
-
-		page = rzs->table[index].page;
-		offset = rzs->table[index].offset;
-
-		if (!page)
-			continue;
-
-		if (unlikely(rzs_test_flag(rzs, index, RZS_UNCOMPRESSED)))
-			__free_page(page);
-		else
-			xv_free(rzs->mem_pool, page, offset);
+	for (index = 0; rzs->table &&
+			index < rzs->disksize >> PAGE_SHIFT; index++) {
+		if (rzs_slot_used(rzs, index))
+			ramzswap_free_page(rzs, index);
 	}
 
 	vfree(rzs->table);
 	rzs->table = NULL;
 
-	xv_destroy_pool(rzs->mem_pool);
-	rzs->mem_pool = NULL;
+	vfree(rzs->dedup_table);
+	rzs->dedup_table = NULL;
+
+	if (rzs->mem_pool) {
+		unregister_shrinker(&rzs->shrinker);
+		zs_destroy_pool(rzs->mem_pool);
+		rzs->mem_pool = NULL;
+	}
 
 	/* Reset stats */
 	memset(&rzs->stats, 0, sizeof(rzs->stats));
 
+	if (rzs->backing_bdev) {
+		close_bdev_exclusive(rzs->backing_bdev,
+					FMODE_READ | FMODE_WRITE);
+		rzs->backing_bdev = NULL;
+	}
+	rzs->wb_incompressible = 0;
+
 	rzs->disksize = 0;
+	rzs->backend = NULL;
+}
+
+/*
+ * Under memory pressure, compact the pool to give back pages
+ * freed up by swap slot frees.
+ */
+static int ramzswap_shrink(struct shrinker *shrinker, int nr_to_scan,
+			gfp_t gfp_mask)
+{
+	struct ramzswap *rzs = container_of(shrinker, struct ramzswap,
+						shrinker);
+
+	if (nr_to_scan) {
+		unsigned long freed;
+
+		freed = zs_compact(rzs->mem_pool, nr_to_scan);
+		rzs_stat64_add(rzs, &rzs->stats.pages_compacted, freed);
+	}
+
+	return zs_compactable_pages(rzs->mem_pool);
 }
 
 static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
@@ -539,21 +1169,31 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 		return -EBUSY;
 	}
 
+	if (rzs->backing_bdev) {
+		size_t backing_size = i_size_read(rzs->backing_bdev->bd_inode);
+
+		/* Slots map 1:1 to sectors of the backing device */
+		if (!rzs->disksize || rzs->disksize > backing_size) {
+			pr_info("Using backing device size: %zu kB\n",
+				backing_size >> 10);
+			rzs->disksize = backing_size;
+		}
+	}
+
 	ramzswap_set_disksize(rzs, totalram_pages << PAGE_SHIFT);
 
-	rzs->compress_workmem = kzalloc(LZO1X_MEM_COMPRESS, GFP_KERNEL);
-	if (!rzs->compress_workmem) {
-		pr_err("Error allocating compressor working memory!\n");
-		ret = -ENOMEM;
-		goto fail;
+	if (!rzs->backend) {
+		rzs->backend = rzs_find_backend(backend);
+		if (!rzs->backend) {
+			pr_warning("Invalid backend: %s, using %s\n",
+				backend, rzs_backends[0].name);
+			rzs->backend = &rzs_backends[0];
+		}
 	}
 
-	rzs->compress_buffer = (void *)__get_free_pages(__GFP_ZERO, 1);
-	if (!rzs->compress_buffer) {
-		pr_err("Error allocating compressor buffer space\n");
-		ret = -ENOMEM;
+	ret = rzs_alloc_streams(rzs);
+	if (ret)
 		goto fail;
-	}
 
 	num_pages = rzs->disksize >> PAGE_SHIFT;
 	rzs->table = vmalloc(num_pages * sizeof(*rzs->table));
@@ -566,6 +1206,16 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 	}
 	memset(rzs->table, 0, num_pages * sizeof(*rzs->table));
 
+	rzs->dedup_table = vmalloc(RZS_DEDUP_BUCKETS *
+				sizeof(*rzs->dedup_table));
+	if (!rzs->dedup_table) {
+		pr_err("Error allocating ramzswap dedup table\n");
+		ret = -ENOMEM;
+		goto fail;
+	}
+	memset(rzs->dedup_table, 0,
+		RZS_DEDUP_BUCKETS * sizeof(*rzs->dedup_table));
+
 	page = alloc_page(__GFP_ZERO);
 	if (!page) {
 		pr_err("Error allocating swap header page\n");
@@ -584,13 +1234,17 @@ static int ramzswap_ioctl_init_device(struct ramzswap *rzs)
 	/* ramzswap devices sort of resembles non-rotational disks */
 	queue_flag_set_unlocked(QUEUE_FLAG_NONROT, rzs->disk->queue);
 
-	rzs->mem_pool = xv_create_pool();
+	rzs->mem_pool = zs_create_pool(rzs->disk->disk_name);
 	if (!rzs->mem_pool) {
 		pr_err("Error creating memory pool\n");
 		ret = -ENOMEM;
 		goto fail;
 	}
 
+	rzs->shrinker.shrink = ramzswap_shrink;
+	rzs->shrinker.seeks = DEFAULT_SEEKS;
+	register_shrinker(&rzs->shrinker);
+
 	rzs->init_done = 1;
 
 	pr_debug("Initialization done!\n");
@@ -634,6 +1288,67 @@ static int ramzswap_ioctl(struct block_device *bdev, fmode_t mode,
 		pr_info("Disk size set to %zu kB\n", disksize_kb);
 		break;
 
+	case RZSIO_SET_BACKEND:
+	{
+		char name[RZS_BACKEND_NAME_LEN];
+		const struct rzs_backend *b;
+
+		if (rzs->init_done) {
+			ret = -EBUSY;
+			goto out;
+		}
+		if (copy_from_user(name, (void *)arg, sizeof(name))) {
+			ret = -EFAULT;
+			goto out;
+		}
+		name[sizeof(name) - 1] = '\0';
+		b = rzs_find_backend(name);
+		if (!b) {
+			ret = -EINVAL;
+			goto out;
+		}
+		rzs->backend = b;
+		pr_info("Backend set to %s\n", b->name);
+		break;
+	}
+
+	case RZSIO_SET_BACKING_SWAP:
+	{
+		char name[RZS_BACKING_NAME_LEN];
+		struct block_device *backing;
+
+		if (rzs->init_done) {
+			ret = -EBUSY;
+			goto out;
+		}
+		if (copy_from_user(name, (void *)arg, sizeof(name))) {
+			ret = -EFAULT;
+			goto out;
+		}
+		name[sizeof(name) - 1] = '\0';
+		backing = open_bdev_exclusive(name, FMODE_READ | FMODE_WRITE,
+						rzs);
+		if (IS_ERR(backing)) {
+			pr_err("Error opening backing device: %s\n", name);
+			ret = PTR_ERR(backing);
+			goto out;
+		}
+		if (rzs->backing_bdev)
+			close_bdev_exclusive(rzs->backing_bdev,
+						FMODE_READ | FMODE_WRITE);
+		rzs->backing_bdev = backing;
+		pr_info("Backing device set to %s\n", name);
+		break;
+	}
+
+	case RZSIO_WRITEBACK_IDLE:
+		if (!rzs->init_done || !rzs->backing_bdev) {
+			ret = -ENOTTY;
+			goto out;
+		}
+		queue_work(rzs_wb_wq, &rzs->wb_idle_work);
+		break;
+
 	case RZSIO_GET_STATS:
 	{
 		struct ramzswap_ioctl_stats *stats;
@@ -704,7 +1419,12 @@ static int create_device(struct ramzswap *rzs, int device_id)
 	int ret = 0;
 
 	mutex_init(&rzs->lock);
+	spin_lock_init(&rzs->dedup_lock);
 	spin_lock_init(&rzs->stat64_lock);
+	mutex_init(&rzs->wb_mutex);
+	rwlock_init(&rzs->wb_lock);
+	INIT_WORK(&rzs->wb_work, rzs_wb_work);
+	INIT_WORK(&rzs->wb_idle_work, rzs_wb_idle_work);
 
 	rzs->queue = blk_alloc_queue(GFP_KERNEL);
 	if (!rzs->queue) {
@@ -770,11 +1490,27 @@ static int __init ramzswap_init(void)
 		goto out;
 	}
 
+	ret = zs_init();
+	if (ret)
+		goto out;
+
+	rzs_dedup_cache = KMEM_CACHE(rzs_dedup_entry, 0);
+	if (!rzs_dedup_cache) {
+		ret = -ENOMEM;
+		goto zs_exit;
+	}
+
+	rzs_wb_wq = create_singlethread_workqueue("ramzswap_wb");
+	if (!rzs_wb_wq) {
+		ret = -ENOMEM;
+		goto destroy_cache;
+	}
+
 	ramzswap_major = register_blkdev(0, "ramzswap");
 	if (ramzswap_major <= 0) {
 		pr_warning("Unable to get major number\n");
 		ret = -EBUSY;
-		goto out;
+		goto destroy_wq;
 	}
 
 	if (!num_devices) {
@@ -803,6 +1539,12 @@ free_devices:
 		destroy_device(&devices[--dev_id]);
 unregister:
 	unregister_blkdev(ramzswap_major, "ramzswap");
+destroy_wq:
+	destroy_workqueue(rzs_wb_wq);
+destroy_cache:
+	kmem_cache_destroy(rzs_dedup_cache);
+zs_exit:
+	zs_exit();
 out:
 	return ret;
 }
@@ -816,18 +1558,23 @@ static void __exit ramzswap_exit(void)
 		rzs = &devices[i];
 
 		destroy_device(rzs);
-		if (rzs->init_done)
+		if (rzs->init_done || rzs->backing_bdev)
 			reset_device(rzs);
 	}
 
 	unregister_blkdev(ramzswap_major, "ramzswap");
 
 	kfree(devices);
+	destroy_workqueue(rzs_wb_wq);
+	kmem_cache_destroy(rzs_dedup_cache);
+	zs_exit();
 	pr_debug("Cleanup done!\n");
 }
 
 module_param(num_devices, uint, 0);
 MODULE_PARM_DESC(num_devices, "Number of ramzswap devices");
+module_param(backend, charp, 0);
+MODULE_PARM_DESC(backend, "Default compression backend (lzo, lzf)");
 
 module_init(ramzswap_init);
 module_exit(ramzswap_exit);
@@ -15,11 +15,14 @@
 #ifndef _RAMZSWAP_DRV_H_
 #define _RAMZSWAP_DRV_H_
 
+#include <linux/list.h>
 #include <linux/spinlock.h>
+#include <linux/mm.h>
 #include <linux/mutex.h>
+#include <linux/workqueue.h>
 
 #include "ramzswap_ioctl.h"
-#include "xvmalloc.h"
+#include "zsmalloc.h"
 
 /*
  * Some arbitrary value. This is just to catch
@@ -30,13 +33,13 @@ static const unsigned max_num_devices = 32;
 /*
  * Stored at beginning of each compressed object.
  *
- * It stores back-reference to table entry which points to this
- * object. This is required to support memory defragmentation.
+ * The content hash lets a slot free find the object's entry in the
+ * dedup index. No back-reference to the table entry is needed for
+ * memory defragmentation: table entries hold zsmalloc handles, which
+ * stay valid when compaction moves the object.
  */
 struct zobj_header {
-#if 0
-	u32 table_idx;
-#endif
+	u32 hash;
 };
 
 /*-- Configurable parameters */
@@ -50,10 +53,22 @@ static const unsigned default_disksize_perc_ram = 25;
  */
 static const unsigned max_zpage_size = PAGE_SIZE / 4 * 3;
 
+/*
+ * Number of buckets in the per-device index of stored objects
+ * used to share identical compressed pages. Must be a power of 2.
+ */
+#define RZS_DEDUP_BUCKETS	4096
+
+/*
+ * Max no. of pages written to the backing device in one batch.
+ * Incompressible pages are written back once this many accumulate.
+ */
+#define RZS_WB_BATCH		32
+
 /*
  * NOTE: max_zpage_size must be less than or equal to:
- *   XV_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
- * otherwise, xv_malloc() would always return failure.
+ *   ZS_MAX_ALLOC_SIZE - sizeof(struct zobj_header)
+ * otherwise, zs_malloc() would always return failure.
  */
 
 /*-- End of configurable params */
@@ -71,26 +86,72 @@ enum rzs_pageflags {
 	/* Page consists entirely of zeros */
 	RZS_ZERO,
 
+	/* Page is a single repeated word, kept in table[].element */
+	RZS_SAME,
+
+	/* Page was not accessed since the last idle writeback pass */
+	RZS_IDLE,
+
+	/* Page is being written to the backing device */
+	RZS_WB,
+
+	/* Page lives on the backing device only */
+	RZS_BACKED,
+
 	__NR_RZS_PAGEFLAGS,
 };
 
 /*-- Data structures */
 
+/*
+ * Compression backend. Chosen before RZSIO_INIT (RZSIO_SET_BACKEND or
+ * the 'backend' module param) and fixed until the device is reset.
+ * Both callbacks return 0 on success.
+ */
+struct rzs_backend {
+	const char *name;
+	size_t workmem_size;
+	int (*compress)(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len, void *wrkmem);
+	int (*decompress)(const unsigned char *src, size_t src_len,
+			unsigned char *dst, size_t *dst_len);
+};
+
 /*
  * Allocated for each swap slot, indexed by page no.
  * These table entries must fit exactly in a page.
  */
 struct table {
-	struct page *page;
-	u16 offset;
-	u8 count;	/* object ref count (not yet used) */
+	union {
+		struct page *page;	/* RZS_UNCOMPRESSED pages */
+		unsigned long handle;	/* zsmalloc object */
+		unsigned long element;	/* RZS_SAME pages */
+	};
 	u8 flags;
 } __attribute__((aligned(4)));
 
+/*
+ * Index entry for each stored compressed object. Slots holding an
+ * identical page share the object; it is freed with the last one.
+ */
+struct rzs_dedup_entry {
+	struct hlist_node node;
+	unsigned long handle;
+	u16 clen;
+	u32 hash;
+	u32 refcount;
+};
+
+enum rzs_wb_mode {
+	RZS_WB_INCOMPRESSIBLE,
+	RZS_WB_IDLE,
+};
+
 struct ramzswap_stats {
 	/* basic stats */
 	size_t compr_size;	/* compressed size of pages stored -
 				 * needed to enforce memlimit */
+	size_t dedup_saved;	/* bytes not allocated due to sharing */
 	/* more stats */
 #if defined(CONFIG_RAMZSWAP_STATS)
 	u64 num_reads;		/* failed + successful */
@@ -100,22 +161,55 @@ struct ramzswap_stats {
 	u64 invalid_io;		/* non-swap I/O requests */
 	u64 notify_free;	/* no. of swap slot free notifications */
 	u32 pages_zero;		/* no. of zero filled pages */
+	u32 pages_same;		/* no. of single-value filled pages */
+	u32 pages_dedup;	/* no. of pages sharing a stored object */
+	u64 dedup_hits;		/* no. of writes matching a stored object */
 	u32 pages_stored;	/* no. of pages currently stored */
 	u32 good_compress;	/* % of pages with compression ratio<=50% */
 	u32 pages_expand;	/* % of incompressible pages */
+	u32 pages_backed;	/* no. of pages on backing device */
+	u64 bd_reads;		/* reads redirected to backing device */
+	u64 bd_writes;		/* pages written to backing device */
+	u64 pages_compacted;	/* pages freed by pool compaction */
+	u64 compr_ns_hist[RZS_NS_HIST_BUCKETS];
+	u64 decompr_ns_hist[RZS_NS_HIST_BUCKETS];
 #endif
 };
 
+/*
+ * Compression stream: compressor working memory and destination
+ * buffer. One is allocated per possible CPU so that writes issued
+ * on different CPUs can compress in parallel. The mutex serializes
+ * tasks which pick the same stream (e.g. after being migrated).
+ */
+struct rzs_cstream {
+	struct mutex lock;
+	void *workmem;
+	void *buffer;
+};
+
 struct ramzswap {
-	struct xv_pool *mem_pool;
-	void *compress_workmem;
-	void *compress_buffer;
+	struct zs_pool *mem_pool;
+	struct shrinker shrinker;	/* compacts mem_pool */
+	const struct rzs_backend *backend;
+	struct rzs_cstream *streams;	/* per-cpu */
 	struct table *table;
+	struct hlist_head *dedup_table;
+	spinlock_t dedup_lock;	/* protect dedup_table and its entries */
 	spinlock_t stat64_lock;	/* protect 64-bit stats */
-	struct mutex lock;
+	struct mutex lock;	/* protect mem_pool and table */
 	struct request_queue *queue;
 	struct gendisk *disk;
 	int init_done;
+
+	/* Writeback to (optional) backing device */
+	struct block_device *backing_bdev;
+	rwlock_t wb_lock;	/* protect slot flags against writeback */
+	struct mutex wb_mutex;	/* one writeback batch at a time */
+	struct work_struct wb_work;
+	struct work_struct wb_idle_work;
+	u32 wb_incompressible;	/* incompressible pages since last batch */
+
 	/*
 	 * This is limit on amount of *uncompressed* worth of data
 	 * we can hold. When backing swap device is provided, it is
@@ -147,6 +241,13 @@ static void rzs_stat64_inc(struct ramzswap *rzs, u64 *v)
 	spin_unlock(&rzs->stat64_lock);
 }
 
+static void rzs_stat64_add(struct ramzswap *rzs, u64 *v, u64 val)
+{
+	spin_lock(&rzs->stat64_lock);
+	*v = *v + val;
+	spin_unlock(&rzs->stat64_lock);
+}
+
 static u64 rzs_stat64_read(struct ramzswap *rzs, u64 *v)
 {
 	u64 val;
@@ -157,11 +258,25 @@ static u64 rzs_stat64_read(struct ramzswap *rzs, u64 *v)
 
 	return val;
 }
+
+static void rzs_stat64_hist(struct ramzswap *rzs, u64 *hist, u64 ns)
+{
+	int bucket = fls64(ns >> 8);
+
+	if (bucket >= RZS_NS_HIST_BUCKETS)
+		bucket = RZS_NS_HIST_BUCKETS - 1;
+
+	spin_lock(&rzs->stat64_lock);
+	hist[bucket]++;
+	spin_unlock(&rzs->stat64_lock);
+}
 #else
 #define rzs_stat_inc(v)
 #define rzs_stat_dec(v)
 #define rzs_stat64_inc(r, v)
+#define rzs_stat64_add(r, v, val)
 #define rzs_stat64_read(r, v)
+#define rzs_stat64_hist(r, h, ns)
 #endif /* CONFIG_RAMZSWAP_STATS */
 
 #endif
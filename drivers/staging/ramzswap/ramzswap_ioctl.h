@@ -15,6 +15,17 @@
 #ifndef _RAMZSWAP_IOCTL_H_
 #define _RAMZSWAP_IOCTL_H_
 
+#define RZS_BACKEND_NAME_LEN	16
+#define RZS_BACKING_NAME_LEN	64
+
+/*
+ * Buckets of the per-page compression/decompression time histograms.
+ * Bucket 0 counts operations which took less than 256ns, bucket n
+ * those which took [2^(n+7), 2^(n+8)) ns. The last bucket also counts
+ * anything slower.
+ */
+#define RZS_NS_HIST_BUCKETS	16
+
 struct ramzswap_ioctl_stats {
 	u64 disksize;		/* user specified or equal to backing swap
 				 * size (if present) */
@@ -32,11 +43,25 @@ struct ramzswap_ioctl_stats {
 	u64 orig_data_size;
 	u64 compr_data_size;
 	u64 mem_used_total;
+	char backend[RZS_BACKEND_NAME_LEN];	/* compression backend */
+	u64 compr_ns_hist[RZS_NS_HIST_BUCKETS];
+	u64 decompr_ns_hist[RZS_NS_HIST_BUCKETS];
+	u32 pages_same;		/* no. of single-value filled pages */
+	u32 pages_dedup;	/* no. of pages sharing a stored object */
+	u64 dedup_hits;		/* no. of writes matching a stored object */
+	u64 dedup_saved_size;	/* bytes saved by sharing objects */
+	u32 pages_backed;	/* no. of pages on backing device */
+	u64 bd_reads;		/* reads redirected to backing device */
+	u64 bd_writes;		/* pages written to backing device */
+	u64 pages_compacted;	/* pages freed by pool compaction */
 } __attribute__ ((packed, aligned(4)));
 
 #define RZSIO_SET_DISKSIZE_KB	_IOW('z', 0, size_t)
 #define RZSIO_GET_STATS		_IOR('z', 1, struct ramzswap_ioctl_stats)
 #define RZSIO_INIT		_IO('z', 2)
 #define RZSIO_RESET		_IO('z', 3)
+#define RZSIO_SET_BACKEND	_IOW('z', 4, char[RZS_BACKEND_NAME_LEN])
+#define RZSIO_SET_BACKING_SWAP	_IOW('z', 5, char[RZS_BACKING_NAME_LEN])
+#define RZSIO_WRITEBACK_IDLE	_IO('z', 6)
 
 #endif
@@ -0,0 +1,606 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ *
+ * Objects are grouped in size classes ZS_SIZE_CLASS_DELTA bytes apart.
+ * Each class allocates "zspages": groups of up to ZS_MAX_PAGES_PER_ZSPAGE
+ * 0-order pages in which objects of that class are packed back to back,
+ * possibly straddling page boundaries. Since objects are only reached
+ * through handles, the objects of a sparsely used zspage can be moved
+ * into other zspages of the same class (compaction) to free whole pages.
+ */
+
+#include <linux/bitops.h>
+#include <linux/debugfs.h>
+#include <linux/errno.h>
+#include <linux/highmem.h>
+#include <linux/init.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/seq_file.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "zsmalloc.h"
+#include "zsmalloc_int.h"
+
+static struct kmem_cache *zs_handle_cache;
+static struct dentry *zs_debugfs_root;
+static const struct file_operations zs_stats_fops;
+
+static int get_size_class_index(size_t size)
+{
+	if (size <= ZS_MIN_ALLOC_SIZE)
+		return 0;
+
+	return DIV_ROUND_UP(size - ZS_MIN_ALLOC_SIZE, ZS_SIZE_CLASS_DELTA);
+}
+
+/*
+ * Find the no. of pages per zspage which wastes the least space
+ * (at the end of the zspage) for objects of given size.
+ */
+static int get_pages_per_zspage(u32 size)
+{
+	int i, best = 1, max_usedpc = 0;
+
+	for (i = 1; i <= ZS_MAX_PAGES_PER_ZSPAGE; i++) {
+		u32 zspage_size = i * PAGE_SIZE;
+		int usedpc;
+
+		usedpc = (zspage_size - zspage_size % size) * 100 /
+				zspage_size;
+		if (usedpc > max_usedpc) {
+			max_usedpc = usedpc;
+			best = i;
+		}
+	}
+
+	return best;
+}
+
+/*
+ * Copy len bytes between buf and the zspage, starting at byte off
+ * of the zspage. Uses KM_USER1 kmap slot.
+ */
+static void zs_copy_obj(struct zspage *zspage, unsigned long off,
+			void *buf, size_t len, int to_zspage)
+{
+	while (len) {
+		unsigned long page_off = off & ~PAGE_MASK;
+		size_t n = min_t(size_t, len, PAGE_SIZE - page_off);
+		unsigned char *kaddr;
+
+		kaddr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT],
+					KM_USER1);
+		if (to_zspage)
+			memcpy(kaddr + page_off, buf, n);
+		else
+			memcpy(buf, kaddr + page_off, n);
+		kunmap_atomic(kaddr, KM_USER1);
+
+		buf += n;
+		off += n;
+		len -= n;
+	}
+}
+
+static struct zspage *alloc_zspage(struct zs_pool *pool,
+			struct size_class *class, gfp_t flags)
+{
+	int i;
+	struct zspage *zspage;
+
+	zspage = kzalloc(sizeof(*zspage) + class->objs_per_zspage *
+				sizeof(zspage->objs[0]),
+			flags & ~__GFP_HIGHMEM);
+	if (!zspage)
+		return NULL;
+
+	for (i = 0; i < class->pages_per_zspage; i++) {
+		zspage->pages[i] = alloc_page(flags);
+		if (!zspage->pages[i])
+			goto fail;
+	}
+
+	INIT_LIST_HEAD(&zspage->list);
+	zspage->class = class;
+	atomic_add(class->pages_per_zspage, &pool->pages_allocated);
+
+	return zspage;
+
+fail:
+	while (i--)
+		__free_page(zspage->pages[i]);
+	kfree(zspage);
+	return NULL;
+}
+
+static void free_zspage(struct zs_pool *pool, struct zspage *zspage)
+{
+	int i;
+	struct size_class *class = zspage->class;
+
+	for (i = 0; i < class->pages_per_zspage; i++)
+		__free_page(zspage->pages[i]);
+
+	atomic_sub(class->pages_per_zspage, &pool->pages_allocated);
+	kfree(zspage);
+}
+
+static int zspage_get_free_idx(struct zspage *zspage)
+{
+	int i, idx = zspage->free_hint;
+	int nr = zspage->class->objs_per_zspage;
+
+	for (i = 0; i < nr; i++) {
+		if (!zspage->objs[idx])
+			return idx;
+		if (++idx == nr)
+			idx = 0;
+	}
+
+	BUG();
+	return -1;
+}
+
+/*
+ * Put handle into a free slot of the zspage. Moves the zspage to
+ * class full list if no free slot is left. Class lock must be held.
+ */
+static void zspage_add_obj(struct zspage *zspage, struct zs_handle *handle)
+{
+	struct size_class *class = zspage->class;
+	int idx = zspage_get_free_idx(zspage);
+
+	zspage->objs[idx] = handle;
+	zspage->inuse++;
+	zspage->free_hint = idx + 1 < class->objs_per_zspage ? idx + 1 : 0;
+
+	handle->zspage = zspage;
+	handle->idx = idx;
+
+	if (zspage->inuse == class->objs_per_zspage)
+		list_move(&zspage->list, &class->full);
+}
+
+struct zs_pool *zs_create_pool(const char *name)
+{
+	int i, cpu;
+	struct zs_pool *pool;
+
+	pool = kzalloc(sizeof(*pool), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+
+	strlcpy(pool->name, name, sizeof(pool->name));
+	rwlock_init(&pool->migrate_lock);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->classes[i];
+
+		spin_lock_init(&class->lock);
+		INIT_LIST_HEAD(&class->partial);
+		INIT_LIST_HEAD(&class->full);
+
+		class->size = ZS_MIN_ALLOC_SIZE + i * ZS_SIZE_CLASS_DELTA;
+		class->pages_per_zspage = get_pages_per_zspage(class->size);
+		class->objs_per_zspage = class->pages_per_zspage *
+						PAGE_SIZE / class->size;
+	}
+
+	pool->map_area = alloc_percpu(struct zs_map_area);
+	if (!pool->map_area)
+		goto fail;
+
+	for_each_possible_cpu(cpu) {
+		struct zs_map_area *area = per_cpu_ptr(pool->map_area, cpu);
+
+		area->buf = kmalloc(ZS_MAX_ALLOC_SIZE, GFP_KERNEL);
+		if (!area->buf)
+			goto fail;
+	}
+
+	if (zs_debugfs_root)
+		pool->debugfs_file = debugfs_create_file(pool->name, S_IRUGO,
+					zs_debugfs_root, pool, &zs_stats_fops);
+
+	return pool;
+
+fail:
+	zs_destroy_pool(pool);
+	return NULL;
+}
+
+void zs_destroy_pool(struct zs_pool *pool)
+{
+	int i, cpu;
+	struct zspage *zspage, *tmp;
+
+	debugfs_remove(pool->debugfs_file);
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->classes[i];
+
+		if (class->objs_inuse)
+			pr_info("zsmalloc: %s: %u objects of size %u "
+				"not freed\n", pool->name,
+				class->objs_inuse, class->size);
+
+		list_for_each_entry_safe(zspage, tmp, &class->partial, list)
+			free_zspage(pool, zspage);
+		list_for_each_entry_safe(zspage, tmp, &class->full, list)
+			free_zspage(pool, zspage);
+	}
+
+	if (pool->map_area) {
+		for_each_possible_cpu(cpu)
+			kfree(per_cpu_ptr(pool->map_area, cpu)->buf);
+		free_percpu(pool->map_area);
+	}
+
+	kfree(pool);
+}
+
+/**
+ * zs_malloc - Allocate object of given size from pool.
+ * @pool: pool to allocate from
+ * @size: size of object to allocate
+ * @flags: gfp flags for pages backing the pool
+ *
+ * On success, handle to the allocated object is returned,
+ * otherwise 0. Objects are accessed using zs_map_object().
+ */
+unsigned long zs_malloc(struct zs_pool *pool, size_t size, gfp_t flags)
+{
+	struct zs_handle *handle;
+	struct size_class *class;
+	struct zspage *zspage;
+
+	if (unlikely(!size || size > ZS_MAX_ALLOC_SIZE))
+		return 0;
+
+	class = &pool->classes[get_size_class_index(size)];
+
+	handle = kmem_cache_alloc(zs_handle_cache, flags & ~__GFP_HIGHMEM);
+	if (!handle)
+		return 0;
+	handle->size = size;
+
+	spin_lock(&class->lock);
+	if (list_empty(&class->partial)) {
+		spin_unlock(&class->lock);
+
+		zspage = alloc_zspage(pool, class, flags);
+		if (unlikely(!zspage)) {
+			kmem_cache_free(zs_handle_cache, handle);
+			return 0;
+		}
+
+		spin_lock(&class->lock);
+		list_add(&zspage->list, &class->partial);
+		class->zspages++;
+	}
+
+	/* Fill the most recently added zspage first */
+	zspage = list_first_entry(&class->partial, struct zspage, list);
+	zspage_add_obj(zspage, handle);
+
+	class->objs_inuse++;
+	class->bytes_inuse += size;
+	spin_unlock(&class->lock);
+
+	return (unsigned long)handle;
+}
+
+void zs_free(struct zs_pool *pool, unsigned long obj)
+{
+	struct zs_handle *handle = (struct zs_handle *)obj;
+	struct size_class *class;
+	struct zspage *zspage;
+	int was_full, empty;
+
+	class = &pool->classes[get_size_class_index(handle->size)];
+
+	/* Class lock keeps compaction from moving the object */
+	spin_lock(&class->lock);
+	zspage = handle->zspage;
+	was_full = zspage->inuse == class->objs_per_zspage;
+
+	zspage->objs[handle->idx] = NULL;
+	zspage->inuse--;
+	zspage->free_hint = handle->idx;
+
+	class->objs_inuse--;
+	class->bytes_inuse -= handle->size;
+
+	empty = !zspage->inuse;
+	if (empty) {
+		list_del(&zspage->list);
+		class->zspages--;
+	} else if (was_full) {
+		list_move(&zspage->list, &class->partial);
+	}
+	spin_unlock(&class->lock);
+
+	if (empty)
+		free_zspage(pool, zspage);
+
+	kmem_cache_free(zs_handle_cache, handle);
+}
+
+/**
+ * zs_map_object - Get a dereferencable pointer to an object.
+ * @pool: pool the object belongs to
+ * @obj: handle returned by zs_malloc()
+ * @mm: ZS_MM_RO/WO tell if the object needs to be read in and/or
+ *	written back when it spans two pages.
+ *
+ * Runs with preemption disabled until zs_unmap_object(), and only
+ * one object can be mapped per cpu at a time. KM_USER1 kmap slot is
+ * used; callers may use KM_USER0 for their own mappings meanwhile.
+ */
+void *zs_map_object(struct zs_pool *pool, unsigned long obj,
+			enum zs_mapmode mm)
+{
+	struct zs_handle *handle = (struct zs_handle *)obj;
+	struct zs_map_area *area;
+	struct zspage *zspage;
+	unsigned long off;
+
+	read_lock(&pool->migrate_lock);
+	area = per_cpu_ptr(pool->map_area, get_cpu());
+
+	zspage = handle->zspage;
+	off = (unsigned long)handle->idx * zspage->class->size;
+
+	area->handle = handle;
+	area->mm = mm;
+
+	if ((off & ~PAGE_MASK) + handle->size <= PAGE_SIZE) {
+		area->kaddr = kmap_atomic(zspage->pages[off >> PAGE_SHIFT],
+					KM_USER1);
+		return area->kaddr + (off & ~PAGE_MASK);
+	}
+
+	/* Object spans two pages: work on a copy */
+	area->kaddr = NULL;
+	if (mm != ZS_MM_WO)
+		zs_copy_obj(zspage, off, area->buf, handle->size, 0);
+
+	return area->buf;
+}
+
+void zs_unmap_object(struct zs_pool *pool, unsigned long obj)
+{
+	struct zs_handle *handle = (struct zs_handle *)obj;
+	struct zs_map_area *area;
+	struct zspage *zspage;
+	unsigned long off;
+
+	area = per_cpu_ptr(pool->map_area, smp_processor_id());
+
+	if (area->kaddr) {
+		kunmap_atomic(area->kaddr, KM_USER1);
+		area->kaddr = NULL;
+	} else if (area->mm != ZS_MM_RO) {
+		zspage = handle->zspage;
+		off = (unsigned long)handle->idx * zspage->class->size;
+		zs_copy_obj(zspage, off, area->buf, handle->size, 1);
+	}
+
+	put_cpu();
+	read_unlock(&pool->migrate_lock);
+}
+
+size_t zs_get_object_size(struct zs_pool *pool, unsigned long obj)
+{
+	return ((struct zs_handle *)obj)->size;
+}
+
+/*
+ * Returns total memory used by allocator (userdata + metadata)
+ */
+u64 zs_get_total_size_bytes(struct zs_pool *pool)
+{
+	return (u64)atomic_read(&pool->pages_allocated) << PAGE_SHIFT;
+}
+
+static unsigned long class_compactable_pages(struct size_class *class)
+{
+	u32 free_objs;
+
+	free_objs = class->zspages * class->objs_per_zspage -
+			class->objs_inuse;
+
+	return free_objs / class->objs_per_zspage * class->pages_per_zspage;
+}
+
+/*
+ * Estimate no. of pages which compaction could free
+ */
+unsigned long zs_compactable_pages(struct zs_pool *pool)
+{
+	int i;
+	unsigned long pages = 0;
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++)
+		pages += class_compactable_pages(&pool->classes[i]);
+
+	return pages;
+}
+
+static struct zspage *find_most_used_zspage(struct size_class *class)
+{
+	struct zspage *zspage, *best = NULL;
+
+	list_for_each_entry(zspage, &class->partial, list) {
+		if (!best || zspage->inuse > best->inuse)
+			best = zspage;
+	}
+
+	return best;
+}
+
+/*
+ * Move all objects of the least used zspage of the class into the
+ * most used ones and free it. Returns no. of pages freed (0 if the
+ * objects do not fit in the free slots of other zspages).
+ */
+static int compact_one_zspage(struct zs_pool *pool, struct size_class *class)
+{
+	int i;
+	u32 free_objs = 0;
+	char *buf;
+	struct zspage *zspage, *src = NULL, *dst = NULL;
+
+	write_lock(&pool->migrate_lock);
+	spin_lock(&class->lock);
+
+	list_for_each_entry(zspage, &class->partial, list) {
+		free_objs += class->objs_per_zspage - zspage->inuse;
+		if (!src || zspage->inuse < src->inuse)
+			src = zspage;
+	}
+
+	if (!src || src->inuse >
+			free_objs - (class->objs_per_zspage - src->inuse)) {
+		spin_unlock(&class->lock);
+		write_unlock(&pool->migrate_lock);
+		return 0;
+	}
+
+	list_del(&src->list);
+	buf = per_cpu_ptr(pool->map_area, smp_processor_id())->buf;
+
+	for (i = 0; i < class->objs_per_zspage; i++) {
+		struct zs_handle *handle = src->objs[i];
+
+		if (!handle)
+			continue;
+
+		if (!dst || dst->inuse == class->objs_per_zspage)
+			dst = find_most_used_zspage(class);
+
+		zs_copy_obj(src, i * class->size, buf, handle->size, 0);
+		zspage_add_obj(dst, handle);
+		zs_copy_obj(dst, handle->idx * class->size, buf,
+				handle->size, 1);
+
+		src->objs[i] = NULL;
+	}
+	class->zspages--;
+
+	spin_unlock(&class->lock);
+	write_unlock(&pool->migrate_lock);
+
+	free_zspage(pool, src);
+
+	return class->pages_per_zspage;
+}
+
+/**
+ * zs_compact - Free pages by migrating objects out of sparse zspages
+ * @pool: pool to compact
+ * @nr_pages: stop once this many pages have been freed
+ *
+ * Returns no. of pages freed.
+ */
+unsigned long zs_compact(struct zs_pool *pool, unsigned long nr_pages)
+{
+	int i, freed;
+	unsigned long total = 0;
+
+	for (i = ZS_SIZE_CLASSES - 1; i >= 0 && total < nr_pages; i--) {
+		struct size_class *class = &pool->classes[i];
+
+		while (total < nr_pages && class_compactable_pages(class)) {
+			freed = compact_one_zspage(pool, class);
+			if (!freed)
+				break;
+			total += freed;
+			cond_resched();
+		}
+	}
+
+	return total;
+}
+
+static int zs_stats_show(struct seq_file *s, void *v)
+{
+	int i;
+	struct zs_pool *pool = s->private;
+	u64 total_alloc = 0, total_used = 0;
+
+	seq_printf(s, "%5s %5s %6s %5s %8s %10s %12s %12s\n",
+		"class", "size", "pages", "objs", "zspages", "objs_used",
+		"allocated", "used");
+
+	for (i = 0; i < ZS_SIZE_CLASSES; i++) {
+		struct size_class *class = &pool->classes[i];
+		u32 zspages, objs_inuse;
+		u64 alloc, used;
+
+		spin_lock(&class->lock);
+		zspages = class->zspages;
+		objs_inuse = class->objs_inuse;
+		used = class->bytes_inuse;
+		spin_unlock(&class->lock);
+
+		if (!zspages)
+			continue;
+
+		alloc = (u64)zspages * class->pages_per_zspage << PAGE_SHIFT;
+		total_alloc += alloc;
+		total_used += used;
+
+		seq_printf(s, "%5d %5u %6u %5u %8u %10u %12llu %12llu\n",
+			i, class->size, class->pages_per_zspage,
+			class->objs_per_zspage, zspages, objs_inuse,
+			alloc, used);
+	}
+
+	seq_printf(s, "total allocated: %llu used: %llu compactable "
+		"pages: %lu\n", total_alloc, total_used,
+		zs_compactable_pages(pool));
+
+	return 0;
+}
+
+static int zs_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, zs_stats_show, inode->i_private);
+}
+
+static const struct file_operations zs_stats_fops = {
+	.owner = THIS_MODULE,
+	.open = zs_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+int zs_init(void)
+{
+	zs_handle_cache = KMEM_CACHE(zs_handle, 0);
+	if (!zs_handle_cache)
+		return -ENOMEM;
+
+	zs_debugfs_root = debugfs_create_dir("zsmalloc", NULL);
+	if (IS_ERR(zs_debugfs_root))
+		zs_debugfs_root = NULL;
+
+	return 0;
+}
+
+void zs_exit(void)
+{
+	debugfs_remove(zs_debugfs_root);
+	kmem_cache_destroy(zs_handle_cache);
+}
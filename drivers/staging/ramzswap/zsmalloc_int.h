@@ -0,0 +1,101 @@
+/*
+ * zsmalloc memory allocator
+ *
+ * This code is released using a dual license strategy: BSD/GPL
+ * You can choose the licence that better fits your requirements.
+ *
+ * Released under the terms of 3-clause BSD License
+ * Released under the terms of GNU General Public License Version 2.0
+ */
+
+#ifndef _ZS_MALLOC_INT_H_
+#define _ZS_MALLOC_INT_H_
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/types.h>
+
+#include "zsmalloc.h"
+
+/* User configurable params */
+
+/* Size classes are separated by this many bytes */
+#define ZS_SIZE_CLASS_DELTA	32
+#define ZS_MIN_ALLOC_SIZE	32
+#define ZS_MAX_ALLOC_SIZE	PAGE_SIZE
+
+/*
+ * Max no. of 0-order pages making up a zspage. Objects of a class
+ * are packed back to back across all pages of a zspage, so larger
+ * zspages waste less space at page ends.
+ */
+#define ZS_MAX_PAGES_PER_ZSPAGE	4
+
+/* End of user params */
+
+#define ZS_SIZE_CLASSES	((ZS_MAX_ALLOC_SIZE - ZS_MIN_ALLOC_SIZE) \
+				/ ZS_SIZE_CLASS_DELTA + 1)
+
+struct zspage;
+
+/*
+ * Handles given to users point to one of these. The location of an
+ * object may change when its zspage is compacted; the handle does not.
+ */
+struct zs_handle {
+	struct zspage *zspage;
+	u16 idx;		/* object no. within zspage */
+	u16 size;		/* size requested in zs_malloc() */
+};
+
+struct zspage {
+	struct list_head list;		/* in class partial/full list */
+	struct size_class *class;
+	u16 inuse;			/* no. of allocated objects */
+	u16 free_hint;			/* where to look for a free slot */
+	struct page *pages[ZS_MAX_PAGES_PER_ZSPAGE];
+	struct zs_handle *objs[0];	/* NULL for free slots */
+};
+
+struct size_class {
+	spinlock_t lock;
+	u32 size;
+	u16 pages_per_zspage;
+	u16 objs_per_zspage;
+
+	struct list_head partial;	/* zspages with free slots */
+	struct list_head full;
+
+	/* stats */
+	u32 zspages;
+	u32 objs_inuse;
+	u64 bytes_inuse;		/* sum of requested sizes */
+};
+
+/* Per-cpu state of the object currently mapped on that cpu */
+struct zs_map_area {
+	char *buf;		/* copy of objects spanning two pages */
+	void *kaddr;		/* kmap address if not using buf */
+	struct zs_handle *handle;
+	enum zs_mapmode mm;
+};
+
+struct zs_pool {
+	char name[32];
+	struct size_class classes[ZS_SIZE_CLASSES];
+
+	/*
+	 * Held for reading while an object is mapped and for writing
+	 * while compaction moves objects around.
+	 */
+	rwlock_t migrate_lock;
+
+	struct zs_map_area *map_area;	/* per-cpu */
+	struct dentry *debugfs_file;
+
+	/* stats */
+	atomic_t pages_allocated;
+};
+
+#endif
@@ -29,6 +29,7 @@
 #include <linux/debugfs.h>
 #endif
 #include <asm/cacheflush.h>
+#include <asm/div64.h>
 #include <linux/smp.h>
 #include <linux/dma-mapping.h>
 #include <linux/sched.h>
@@ -37,6 +38,7 @@
 
 #include "b2r2_internal.h"
 #include "b2r2_node_split.h"
+#include "b2r2_node_cache.h"
 #include "b2r2_generic.h"
 #include "b2r2_mem_alloc.h"
 #include "b2r2_profiler_socket.h"
@@ -124,6 +126,28 @@ static unsigned long stat_n_in_open;
  * stat_n_in_release - Number of clients currently in b2r2_blt_release
  */
 static unsigned long stat_n_in_release;
+/**
+ * stat_n_node_cache_hits - Number of requests that reused a cached node list
+ */
+static unsigned long stat_n_node_cache_hits;
+/**
+ * stat_n_node_cache_misses - Number of requests that built their node list
+ */
+static unsigned long stat_n_node_cache_misses;
+/**
+ * stat_setup_nsec_hit - Total CPU time spent setting up the node lists of
+ *                       requests that hit the node list cache
+ */
+static u64 stat_setup_nsec_hit;
+/**
+ * stat_setup_nsec_miss - Total CPU time spent setting up the node lists of
+ *                        requests that missed the node list cache
+ */
+static u64 stat_setup_nsec_miss;
+/**
+ * stat_setup_nsec_max - Longest node list setup time of a request
+ */
+static u32 stat_setup_nsec_max;
 
 /* Debug file system support */
 #ifdef CONFIG_DEBUG_FS
@@ -142,19 +166,49 @@ static int sprintf_req(struct b2r2_blt_request *request, char *buf, int size);
 /* Local functions */
 static void inc_stat(unsigned long *stat);
 static void dec_stat(unsigned long *stat);
+static void add_setup_stat(bool cache_hit, u32 nsec);
 static int b2r2_blt_synch(struct b2r2_blt_instance *instance,
 			int request_id);
 static int b2r2_blt_query_cap(struct b2r2_blt_instance *instance,
 			struct b2r2_blt_query_cap *query_cap);
+static int create_request(struct b2r2_blt_instance *instance,
+		struct b2r2_blt_req __user *user_req,
+		struct b2r2_blt_request **request_out);
+static int b2r2_blt_batch(struct b2r2_blt_instance *instance,
+		struct b2r2_blt_batch_req *batch_req);
+static int b2r2_blt_fenced(struct b2r2_blt_instance *instance,
+		struct b2r2_blt_fence_req *fence_req);
+static struct b2r2_core_job *request_job(struct b2r2_blt_request *request);
 
 #ifndef CONFIG_B2R2_GENERIC_ONLY
 static int b2r2_blt(struct b2r2_blt_instance *instance,
 		struct b2r2_blt_request *request);
+static int prepare_request(struct b2r2_blt_request *request,
+		struct b2r2_blt_batch *batch);
+static void unresolve_request_bufs(struct b2r2_blt_request *request);
+static void sync_request_bufs(struct b2r2_blt_request *request);
+static void release_nodes(struct b2r2_blt_request *request);
+static void in_fence_signaled(struct hwmem_fence_waiter *waiter,
+		int status);
+static void in_fence_work(struct work_struct *work);
+static void cancel_fenced_request(struct b2r2_blt_request *request);
+static void cancel_fence_waits(struct b2r2_blt_instance *instance);
 
 static void job_callback(struct b2r2_core_job *job);
 static void job_release(struct b2r2_core_job *job);
 static int job_acquire_resources(struct b2r2_core_job *job, bool atomic);
 static void job_release_resources(struct b2r2_core_job *job, bool atomic);
+
+static int add_to_batch(struct b2r2_blt_batch **batch,
+		struct b2r2_blt_request *request);
+static int submit_batch(struct b2r2_blt_batch *batch);
+static void cancel_batch(struct b2r2_blt_batch *batch);
+static void batch_job_callback(struct b2r2_core_job *job);
+static void batch_job_release(struct b2r2_core_job *job);
+static int batch_job_acquire_resources(struct b2r2_core_job *job,
+		bool atomic);
+static void batch_job_release_resources(struct b2r2_core_job *job,
+		bool atomic);
 #endif
 
 #ifdef CONFIG_B2R2_GENERIC
@@ -190,6 +244,15 @@ static int resolve_hwmem(struct b2r2_blt_img *img,
 			struct b2r2_blt_rect *rect_2b_used, bool is_dst,
 				struct b2r2_resolved_buf *resolved_buf);
 static void unresolve_hwmem(struct b2r2_resolved_buf *resolved_buf);
+#ifndef CONFIG_B2R2_GENERIC_ONLY
+static int resolve_batch_buf(struct b2r2_blt_batch *batch,
+		struct b2r2_blt_img *img, struct b2r2_blt_rect *rect_2b_used,
+		bool is_dst, struct b2r2_resolved_buf *resolved);
+static int resolve_shared_hwmem(struct b2r2_blt_img *img,
+		struct b2r2_blt_rect *rect_2b_used, bool is_dst,
+		struct b2r2_resolved_buf *owner,
+		struct b2r2_resolved_buf *resolved_buf);
+#endif
 
 /**
  * struct sync_args - Data for clean/flush
@@ -286,6 +349,7 @@ static int b2r2_blt_open(struct inode *inode, struct file *filp)
 	mutex_init(&instance->lock);
 	init_waitqueue_head(&instance->report_list_waitq);
 	init_waitqueue_head(&instance->synch_done_waitq);
+	INIT_LIST_HEAD(&instance->fence_wait_list);
 
 	/*
 	 * Remember the instance so that we can retrieve it in
@@ -335,6 +399,11 @@ static int b2r2_blt_release(struct inode *inode, struct file *filp)
 		b2r2_log_warn("%s: %d active requests\n",
 			__func__, instance->no_of_active_requests);
 
+#ifndef CONFIG_B2R2_GENERIC_ONLY
+		/* Requests that have not been added to B2R2 yet */
+		cancel_fence_waits(instance);
+#endif
+
 		/* Find and cancel all jobs belonging to us */
 		job = b2r2_core_job_find_first_with_tag((int) instance);
 		while (job) {
@@ -362,7 +431,7 @@ static int b2r2_blt_release(struct inode *inode, struct file *filp)
 		 * This release matches the addref when the job was put into
 		 * the report list
 		 */
-		b2r2_core_job_release(&request->job, __func__);
+		b2r2_core_job_release(request_job(request), __func__);
 		mutex_lock(&instance->lock);
 	}
 	mutex_unlock(&instance->lock);
@@ -375,6 +444,337 @@ static int b2r2_blt_release(struct inode *inode, struct file *filp)
 	return 0;
 }
 
+/**
+ * create_request - Allocates a request and fills it in from user space
+ *
+ * @instance: The B2R2 BLT instance
+ * @user_req: User space pointer to the request
+ * @request_out: Receives the new request
+ *
+ * Returns 0 if OK else negative error code
+ */
+static int create_request(struct b2r2_blt_instance *instance,
+		struct b2r2_blt_req __user *user_req,
+		struct b2r2_blt_request **request_out)
+{
+	struct b2r2_blt_request *request =
+		kmalloc(sizeof(*request), GFP_KERNEL);
+	if (!request) {
+		b2r2_log_err("%s: Failed to alloc mem\n",
+			__func__);
+		return -ENOMEM;
+	}
+
+	/* Initialize the structure */
+	memset(request, 0, sizeof(*request));
+	INIT_LIST_HEAD(&request->list);
+	request->instance = instance;
+
+	/*
+	 * The user request is a sub structure of the
+	 * kernel request structure.
+	 */
+
+	/* Get the user data */
+	if (copy_from_user(&request->user_req, user_req,
+			sizeof(request->user_req))) {
+		b2r2_log_err(
+			"%s: copy_from_user failed\n",
+			__func__);
+		kfree(request);
+		return -EFAULT;
+	}
+
+	if (!b2r2_validate_user_req(&request->user_req)) {
+		kfree(request);
+		return -EINVAL;
+	}
+
+	request->profile = is_profiler_registered_approx();
+
+	/*
+	 * If the user specified a color look-up table,
+	 * make a copy that the HW can use.
+	 */
+	if ((request->user_req.flags &
+			B2R2_BLT_FLAG_CLUT_COLOR_CORRECTION) != 0) {
+		request->clut = dma_alloc_coherent(b2r2_blt_device(),
+			CLUT_SIZE, &(request->clut_phys_addr),
+			GFP_DMA | GFP_KERNEL);
+		if (request->clut == NULL) {
+			b2r2_log_err("%s CLUT allocation failed.\n",
+				__func__);
+			kfree(request);
+			return -ENOMEM;
+		}
+
+		if (copy_from_user(request->clut,
+				request->user_req.clut, CLUT_SIZE)) {
+			b2r2_log_err("%s: CLUT copy_from_user failed\n",
+				__func__);
+			dma_free_coherent(b2r2_blt_device(), CLUT_SIZE,
+				request->clut, request->clut_phys_addr);
+			request->clut = NULL;
+			request->clut_phys_addr = 0;
+			kfree(request);
+			return -EFAULT;
+		}
+	}
+
+	*request_out = request;
+
+	return 0;
+}
+
+/**
+ * request_job - Returns the job holding the references for a request
+ *
+ * @request: The request
+ */
+static struct b2r2_core_job *request_job(struct b2r2_blt_request *request)
+{
+	if (request->batch != NULL)
+		return &request->batch->job;
+
+	return &request->job;
+}
+
+/**
+ * b2r2_blt_batch - Implementation of the B2R2 batch blit request
+ *
+ * @instance: The B2R2 BLT instance
+ * @batch_req: The batch as supplied from user space
+ *
+ * Consecutive requests with an optimized path are collected into one
+ * batch job. A request without an optimized path ends the current batch
+ * and is performed on its own, so the requests execute in array order.
+ *
+ * Returns the request id of the last job added if >= 0, else a negative
+ * error code.
+ */
+static int b2r2_blt_batch(struct b2r2_blt_instance *instance,
+		struct b2r2_blt_batch_req *batch_req)
+{
+	int ret = 0;
+	int request_id = 0;
+	u32 i;
+#ifndef CONFIG_B2R2_GENERIC_ONLY
+	struct b2r2_blt_batch *batch = NULL;
+#endif
+
+	b2r2_log_info("%s, count=%u\n", __func__, batch_req->count);
+
+	if (batch_req->count == 0 ||
+			batch_req->count > B2R2_BLT_MAX_BATCH_COUNT)
+		return -EINVAL;
+
+	/* Wait here if synch is ongoing */
+	ret = wait_event_interruptible(instance->synch_done_waitq,
+				!is_synching(instance));
+	if (ret) {
+		b2r2_log_warn(
+			"%s: Sync wait interrupted, %d\n",
+			__func__, ret);
+		return -EAGAIN;
+	}
+
+	for (i = 0; i < batch_req->count; i++) {
+		struct b2r2_blt_request *request;
+
+		ret = create_request(instance, &batch_req->reqs[i], &request);
+		if (ret < 0)
+			goto request_failed;
+
+#ifdef CONFIG_B2R2_GENERIC_ONLY
+		ret = b2r2_generic_blt(instance, request);
+		if (ret < 0)
+			goto request_failed;
+		request_id = ret;
+#else
+		ret = add_to_batch(&batch, request);
+#ifdef CONFIG_B2R2_GENERIC_FALLBACK
+		if (ret == -ENOSYS) {
+			b2r2_log_info("%s: Request %d going generic.\n",
+				__func__, i);
+
+			ret = create_request(instance, &batch_req->reqs[i],
+					&request);
+			if (ret < 0)
+				goto request_failed;
+
+			ret = b2r2_generic_blt(instance, request);
+			if (ret >= 0)
+				request_id = ret;
+		}
+#endif /* CONFIG_B2R2_GENERIC_FALLBACK */
+		if (ret < 0)
+			goto request_failed;
+#endif /* CONFIG_B2R2_GENERIC_ONLY */
+	}
+
+#ifndef CONFIG_B2R2_GENERIC_ONLY
+	if (batch != NULL && batch->request_count > 0)
+		request_id = submit_batch(batch);
+	else
+		kfree(batch);
+#endif
+
+	return request_id;
+
+request_failed:
+#ifndef CONFIG_B2R2_GENERIC_ONLY
+	if (batch != NULL)
+		cancel_batch(batch);
+#endif
+	b2r2_log_warn("%s: Request %u failed with error %d\n",
+		__func__, i, ret);
+
+	return ret;
+}
+
+#ifdef CONFIG_B2R2_GENERIC
+/**
+ * generic_blt_fenced - Performs a fenced request using the generic path
+ *
+ * @instance: The B2R2 BLT instance
+ * @user_req: User space pointer to the request
+ * @in_fence: Fence to wait for before starting, or NULL
+ *
+ * The generic path is not asynchronous, the input fence is waited for
+ * here and the request is done when this function returns.
+ *
+ * Returns the request id if >= 0, else a negative error code
+ */
+static int generic_blt_fenced(struct b2r2_blt_instance *instance,
+		struct b2r2_blt_req __user *user_req,
+		struct hwmem_fence *in_fence)
+{
+	struct b2r2_blt_request *request;
+	int ret;
+
+	if (in_fence != NULL) {
+		ret = hwmem_fence_wait(in_fence, MAX_SCHEDULE_TIMEOUT);
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = create_request(instance, user_req, &request);
+	if (ret < 0)
+		return ret;
+
+	request->user_req.flags &= ~B2R2_BLT_FLAG_ASYNCH;
+
+	return b2r2_generic_blt(instance, request);
+}
+#endif
+
+/**
+ * b2r2_blt_fenced - Implementation of the B2R2 fenced blit request
+ *
+ * @instance: The B2R2 BLT instance
+ * @fence_req: The fenced request as supplied from user space, the output
+ *             fence is filled in
+ *
+ * Returns the request id if >= 0, else a negative error code
+ */
+static int b2r2_blt_fenced(struct b2r2_blt_instance *instance,
+		struct b2r2_blt_fence_req *fence_req)
+{
+	int ret;
+	int fd;
+	struct hwmem_fence *in_fence = NULL;
+	struct hwmem_fence *out_fence;
+	struct file *out_file;
+#ifndef CONFIG_B2R2_GENERIC_ONLY
+	struct b2r2_blt_request *request;
+#endif
+
+	if (fence_req->in_fence >= 0) {
+		in_fence = hwmem_fence_get_by_fd(fence_req->in_fence);
+		if (IS_ERR(in_fence))
+			return PTR_ERR(in_fence);
+
+		/* No point in starting if the source will never be ready */
+		ret = hwmem_fence_status(in_fence);
+		if (ret < 0)
+			goto in_fence_failed;
+	}
+
+	out_fence = hwmem_fence_create();
+	if (IS_ERR(out_fence)) {
+		ret = PTR_ERR(out_fence);
+		goto in_fence_failed;
+	}
+
+	/*
+	 * Get the output fence fd ready first, nothing may fail once the
+	 * request has been queued
+	 */
+	fd = get_unused_fd_flags(O_CLOEXEC);
+	if (fd < 0) {
+		ret = fd;
+		goto get_fd_failed;
+	}
+	out_file = hwmem_fence_get_file(out_fence);
+	if (IS_ERR(out_file)) {
+		ret = PTR_ERR(out_file);
+		goto get_file_failed;
+	}
+
+#ifdef CONFIG_B2R2_GENERIC_ONLY
+	ret = generic_blt_fenced(instance, fence_req->req, in_fence);
+	if (ret >= 0)
+		hwmem_fence_signal(out_fence, 0);
+#else
+	ret = create_request(instance, fence_req->req, &request);
+	if (ret < 0)
+		goto request_failed;
+
+	/* The fences signal completion, never block the caller */
+	request->user_req.flags |= B2R2_BLT_FLAG_ASYNCH;
+
+	if (in_fence != NULL) {
+		hwmem_fence_get(in_fence);
+		request->in_fence = in_fence;
+		request->in_fence_waiter.func = in_fence_signaled;
+		INIT_WORK(&request->in_fence_work, in_fence_work);
+	}
+	hwmem_fence_get(out_fence);
+	request->out_fence = out_fence;
+
+	ret = b2r2_blt(instance, request);
+
+#ifdef CONFIG_B2R2_GENERIC_FALLBACK
+	if (ret == -ENOSYS) {
+		b2r2_log_info("%s: Going generic.\n", __func__);
+
+		ret = generic_blt_fenced(instance, fence_req->req, in_fence);
+		if (ret >= 0)
+			hwmem_fence_signal(out_fence, 0);
+	}
+#endif /* CONFIG_B2R2_GENERIC_FALLBACK */
+#endif /* CONFIG_B2R2_GENERIC_ONLY */
+	if (ret < 0)
+		goto request_failed;
+
+	fd_install(fd, out_file);
+	fence_req->out_fence = fd;
+	goto out;
+
+request_failed:
+	fput(out_file);
+get_file_failed:
+	put_unused_fd(fd);
+get_fd_failed:
+out:
+	hwmem_fence_put(out_fence);
+in_fence_failed:
+	if (in_fence != NULL)
+		hwmem_fence_put(in_fence);
+
+	return ret;
+}
+
 /**
  * b2r2_blt_ioctl - This routine implements b2r2_blt ioctl interface
  *
@@ -402,69 +802,12 @@ static long b2r2_blt_ioctl(struct file *file,
 		/* This is the "blit" command */
 
 		/* arg is user pointer to struct b2r2_blt_request */
-		struct b2r2_blt_request *request =
-			kmalloc(sizeof(*request), GFP_KERNEL);
-		if (!request) {
-			b2r2_log_err("%s: Failed to alloc mem\n",
-				__func__);
-			return -ENOMEM;
-		}
-
-		/* Initialize the structure */
-		memset(request, 0, sizeof(*request));
-		INIT_LIST_HEAD(&request->list);
-		request->instance = instance;
-
-		/*
-		 * The user request is a sub structure of the
-		 * kernel request structure.
-		 */
-
-		/* Get the user data */
-		if (copy_from_user(&request->user_req, (void *)arg,
-				sizeof(request->user_req))) {
-			b2r2_log_err(
-				"%s: copy_from_user failed\n",
-				__func__);
-			kfree(request);
-			return -EFAULT;
-		}
-
-		if (!b2r2_validate_user_req(&request->user_req)) {
-			kfree(request);
-			return -EINVAL;
-		}
-
-		request->profile = is_profiler_registered_approx();
-
-		/*
-		 * If the user specified a color look-up table,
-		 * make a copy that the HW can use.
-		 */
-		if ((request->user_req.flags &
-				B2R2_BLT_FLAG_CLUT_COLOR_CORRECTION) != 0) {
-			request->clut = dma_alloc_coherent(b2r2_blt_device(),
-				CLUT_SIZE, &(request->clut_phys_addr),
-				GFP_DMA | GFP_KERNEL);
-			if (request->clut == NULL) {
-				b2r2_log_err("%s CLUT allocation failed.\n",
-					__func__);
-				kfree(request);
-				return -ENOMEM;
-			}
+		struct b2r2_blt_request *request;
 
-			if (copy_from_user(request->clut,
-					request->user_req.clut, CLUT_SIZE)) {
-				b2r2_log_err("%s: CLUT copy_from_user failed\n",
-					__func__);
-				dma_free_coherent(b2r2_blt_device(), CLUT_SIZE,
-					request->clut, request->clut_phys_addr);
-				request->clut = NULL;
-				request->clut_phys_addr = 0;
-				kfree(request);
-				return -EFAULT;
-			}
-		}
+		ret = create_request(instance, (struct b2r2_blt_req *)arg,
+				&request);
+		if (ret < 0)
+			return ret;
 
 		/* Perform the blit */
 
@@ -481,75 +824,64 @@ static long b2r2_blt_ioctl(struct file *file,
 		if (ret == -ENOSYS) {
 			struct b2r2_blt_request *request_gen;
 			b2r2_log_info("b2r2_blt=%d Going generic.\n", ret);
-			request_gen = kmalloc(sizeof(*request_gen), GFP_KERNEL);
-			if (!request_gen) {
-				b2r2_log_err("%s: Failed to alloc mem for "
-					"request_gen\n", __func__);
-				return -ENOMEM;
-			}
 
-			/* Initialize the structure */
-			memset(request_gen, 0, sizeof(*request_gen));
-			INIT_LIST_HEAD(&request_gen->list);
-			request_gen->instance = instance;
+			ret = create_request(instance,
+					(struct b2r2_blt_req *)arg,
+					&request_gen);
+			if (ret < 0)
+				return ret;
 
-			/*
-			 * The user request is a sub structure of the
-			 * kernel request structure.
-			 */
+			ret = b2r2_generic_blt(instance, request_gen);
+			b2r2_log_info("\nb2r2_generic_blt=%d Generic done.\n",
+				ret);
+		}
+#endif /* CONFIG_B2R2_GENERIC_FALLBACK */
 
-			/* Get the user data */
-			if (copy_from_user(&request_gen->user_req, (void *)arg,
-				sizeof(request_gen->user_req))) {
-					b2r2_log_err(
-						"%s: copy_from_user failed\n",
-						__func__);
-					kfree(request_gen);
-					return -EFAULT;
-			}
+		break;
+	}
 
-			/*
-			 * If the user specified a color look-up table,
-			 * make a copy that the HW can use.
-			 */
-			if ((request_gen->user_req.flags &
-					B2R2_BLT_FLAG_CLUT_COLOR_CORRECTION)
-					!= 0) {
-				request_gen->clut =
-					dma_alloc_coherent(b2r2_blt_device(),
-					CLUT_SIZE,
-					&(request_gen->clut_phys_addr),
-					GFP_DMA | GFP_KERNEL);
-				if (request_gen->clut == NULL) {
-					b2r2_log_err("%s CLUT allocation "
-						"failed.\n", __func__);
-					kfree(request_gen);
-					return -ENOMEM;
-				}
+	case B2R2_BLT_BATCH_IOC: {
+		/* This is the "batch blit" command */
 
-				if (copy_from_user(request_gen->clut,
-						request_gen->user_req.clut,
-						CLUT_SIZE)) {
-					b2r2_log_err("%s: CLUT copy_from_user "
-						"failed\n", __func__);
-					dma_free_coherent(b2r2_blt_device(),
-						CLUT_SIZE, request_gen->clut,
-						request_gen->clut_phys_addr);
-					request_gen->clut = NULL;
-					request_gen->clut_phys_addr = 0;
-					kfree(request_gen);
-					return -EFAULT;
-				}
-			}
+		/* arg is user pointer to struct b2r2_blt_batch_req */
+		struct b2r2_blt_batch_req batch_req;
+
+		if (copy_from_user(&batch_req, (void *)arg,
+				sizeof(batch_req))) {
+			b2r2_log_err(
+				"%s: copy_from_user failed\n",
+				__func__);
+			return -EFAULT;
+		}
 
-			request_gen->profile = is_profiler_registered_approx();
+		ret = b2r2_blt_batch(instance, &batch_req);
+		break;
+	}
 
-			ret = b2r2_generic_blt(instance, request_gen);
-			b2r2_log_info("\nb2r2_generic_blt=%d Generic done.\n",
-				ret);
+	case B2R2_BLT_FENCE_IOC: {
+		/* This is the "fenced blit" command */
+
+		/* arg is user pointer to struct b2r2_blt_fence_req */
+		struct b2r2_blt_fence_req fence_req;
+
+		if (copy_from_user(&fence_req, (void *)arg,
+				sizeof(fence_req))) {
+			b2r2_log_err(
+				"%s: copy_from_user failed\n",
+				__func__);
+			return -EFAULT;
 		}
-#endif /* CONFIG_B2R2_GENERIC_FALLBACK */
 
+		ret = b2r2_blt_fenced(instance, &fence_req);
+		if (ret < 0)
+			break;
+
+		if (copy_to_user((void *)arg, &fence_req,
+				sizeof(fence_req))) {
+			b2r2_log_err("%s: copy_to_user failed\n",
+				__func__);
+			return -EFAULT;
+		}
 		break;
 	}
 
@@ -727,7 +1059,7 @@ static ssize_t b2r2_blt_read(struct file *filp, char __user *buf, size_t count,
 		 * Release matching the addref when the job was put into
 		 * the report list
 		 */
-		b2r2_core_job_release(&request->job, __func__);
+		b2r2_core_job_release(request_job(request), __func__);
 
 	return count;
 }
@@ -765,10 +1097,8 @@ static int b2r2_blt(struct b2r2_blt_instance *instance,
 		struct b2r2_blt_request *request)
 {
 	int ret = 0;
-	struct b2r2_blt_rect actual_dst_rect;
 	int request_id = 0;
 	struct b2r2_node *last_node = request->first_node;
-	int node_count;
 
 	u32 thread_runtime_at_start = 0;
 
@@ -825,12 +1155,171 @@ static int b2r2_blt(struct b2r2_blt_instance *instance,
 
 	dec_stat(&stat_n_in_blt_synch);
 
-	/* Resolve the buffers */
+	/* Resolve the buffers and build the B2R2 node list */
+	ret = prepare_request(request, NULL);
+	if (ret < 0)
+		goto prepare_failed;
 
-	/* Source buffer */
-	ret = resolve_buf(&request->user_req.src_img,
-		&request->user_req.src_rect, false, &request->src_resolved);
-	if (ret < 0) {
+	/* Exit here if dry run */
+	if (request->user_req.flags & B2R2_BLT_FLAG_DRY_RUN)
+		goto exit_dry_run;
+
+	/* Configure the request */
+	last_node = request->first_node;
+	while (last_node && last_node->next)
+		last_node = last_node->next;
+
+	request->job.tag = (int) instance;
+	request->job.prio = request->user_req.prio;
+	request->job.first_node_address =
+		request->first_node->physical_address;
+	request->job.last_node_address =
+		last_node->physical_address;
+	request->job.callback = job_callback;
+	request->job.release = job_release;
+	request->job.acquire_resources = job_acquire_resources;
+	request->job.release_resources = job_release_resources;
+
+	/* Synchronize memory occupied by the buffers */
+	sync_request_bufs(request);
+
+#ifdef CONFIG_DEBUG_FS
+	/* Remember latest request for debugfs */
+	debugfs_latest_request = *request;
+#endif
+
+	/* Submit the job */
+	b2r2_log_info("%s: Submitting job\n", __func__);
+
+	inc_stat(&stat_n_in_blt_add);
+
+	if (request->profile)
+		request->nsec_active_in_cpu =
+			(s32)((u32)task_sched_runtime(current) -
+					thread_runtime_at_start);
+
+	mutex_lock(&instance->lock);
+
+	if (request->in_fence != NULL) {
+		/* Add the job once the source buffers are ready */
+		if (hwmem_fence_add_waiter(request->in_fence,
+				&request->in_fence_waiter) == 0) {
+			list_add_tail(&request->list,
+				&instance->fence_wait_list);
+			instance->no_of_active_requests++;
+			mutex_unlock(&instance->lock);
+
+			dec_stat(&stat_n_in_blt_add);
+			dec_stat(&stat_n_in_blt);
+
+			return 0;
+		}
+
+		ret = hwmem_fence_status(request->in_fence);
+		if (ret < 0) {
+			mutex_unlock(&instance->lock);
+			dec_stat(&stat_n_in_blt_add);
+			goto job_add_failed;
+		}
+	}
+
+	/* Add the job to b2r2_core */
+	request_id = b2r2_core_job_add(&request->job);
+	request->request_id = request_id;
+
+	dec_stat(&stat_n_in_blt_add);
+
+	if (request_id < 0) {
+		b2r2_log_warn("%s: Failed to add job, ret = %d\n",
+			__func__, request_id);
+		ret = request_id;
+		mutex_unlock(&instance->lock);
+		goto job_add_failed;
+	}
+
+	inc_stat(&stat_n_jobs_added);
+
+	instance->no_of_active_requests++;
+	mutex_unlock(&instance->lock);
+
+	/* Wait for the job to be done if synchronous */
+	if ((request->user_req.flags & B2R2_BLT_FLAG_ASYNCH) == 0) {
+		b2r2_log_info("%s: Synchronous, waiting\n",
+			__func__);
+
+		inc_stat(&stat_n_in_blt_wait);
+
+		ret = b2r2_core_job_wait(&request->job);
+
+		dec_stat(&stat_n_in_blt_wait);
+
+		if (ret < 0 && ret != -ENOENT)
+			b2r2_log_warn(
+				"%s: Failed to wait job, ret = %d\n",
+				__func__, ret);
+		else
+			b2r2_log_info(
+				"%s: Synchronous wait done\n", __func__);
+		ret = 0;
+	}
+
+	/*
+	 * Release matching the addref in b2r2_core_job_add,
+	 * the request must not be accessed after this call
+	 */
+	b2r2_core_job_release(&request->job, __func__);
+
+	dec_stat(&stat_n_in_blt);
+
+	return ret >= 0 ? request_id : ret;
+
+job_add_failed:
+exit_dry_run:
+	unresolve_request_bufs(request);
+prepare_failed:
+synch_interrupted:
+	/* The caller signals the fence itself when it goes generic */
+	if (ret == -ENOSYS && request->out_fence != NULL) {
+		hwmem_fence_put(request->out_fence);
+		request->out_fence = NULL;
+	}
+	job_release(&request->job);
+	dec_stat(&stat_n_jobs_released);
+	if ((request->user_req.flags & B2R2_BLT_FLAG_DRY_RUN) == 0 || ret)
+		b2r2_log_warn(
+			"%s returns with error %d\n", __func__, ret);
+
+	dec_stat(&stat_n_in_blt);
+
+	return ret;
+}
+
+/**
+ * prepare_request - Resolves the buffers of a request and builds its
+ *                   B2R2 node list
+ *
+ * @request: The request
+ * @batch: The batch the request will be added to, or NULL. Hwmem
+ *         buffers already resolved by requests in the batch are shared
+ *         instead of being resolved again.
+ *
+ * Returns 0 if OK, -ENOSYS if there is no optimized path for the request
+ * or another negative error code. The buffers are unresolved on error.
+ */
+static int prepare_request(struct b2r2_blt_request *request,
+		struct b2r2_blt_batch *batch)
+{
+	int ret;
+	struct b2r2_blt_rect actual_dst_rect;
+	int node_count;
+	u32 setup_start;
+
+	/* Resolve the buffers */
+
+	/* Source buffer */
+	ret = resolve_batch_buf(batch, &request->user_req.src_img,
+		&request->user_req.src_rect, false, &request->src_resolved);
+	if (ret < 0) {
 		b2r2_log_warn(
 			"%s: Resolve src buf failed, %d\n",
 			__func__, ret);
@@ -839,7 +1328,7 @@ static int b2r2_blt(struct b2r2_blt_instance *instance,
 	}
 
 	/* Source mask buffer */
-	ret = resolve_buf(&request->user_req.src_mask,
+	ret = resolve_batch_buf(batch, &request->user_req.src_mask,
 			&request->user_req.src_rect, false,
 			&request->src_mask_resolved);
 	if (ret < 0) {
@@ -852,8 +1341,8 @@ static int b2r2_blt(struct b2r2_blt_instance *instance,
 
 	/* Destination buffer */
 	get_actual_dst_rect(&request->user_req, &actual_dst_rect);
-	ret = resolve_buf(&request->user_req.dst_img, &actual_dst_rect,
-			true, &request->dst_resolved);
+	ret = resolve_batch_buf(batch, &request->user_req.dst_img,
+			&actual_dst_rect, true, &request->dst_resolved);
 	if (ret < 0) {
 		b2r2_log_warn(
 			"%s: Resolve dst buf failed, %d\n",
@@ -881,6 +1370,15 @@ static int b2r2_blt(struct b2r2_blt_instance *instance,
 		request->dst_resolved.file_virtual_start,
 		request->dst_resolved.file_len);
 
+	setup_start = b2r2_get_curr_nsec();
+
+	/* Reuse the node list of an earlier request of the same shape */
+	if (b2r2_node_cache_get(request)) {
+		request->nodes_configured = true;
+		add_setup_stat(true, b2r2_get_curr_nsec() - setup_start);
+		return 0;
+	}
+
 	/* Calculate the number of nodes (and resources) needed for this job */
 	ret = b2r2_node_split_analyze(request, MAX_TMP_BUF_SIZE,
 			&node_count, &request->bufs, &request->buf_count,
@@ -922,10 +1420,16 @@ static int b2r2_blt(struct b2r2_blt_instance *instance,
 		b2r2_log_warn(
 			"%s: Failed to allocate nodes, ret = %d\n",
 			__func__, ret);
+		ret = -ENOMEM;
 		goto generate_nodes_failed;
 	}
 #else
 	ret = b2r2_node_alloc(node_count, &(request->first_node));
+	if (ret < 0 || request->first_node == NULL) {
+		/* The node heap may be held by cached node lists */
+		b2r2_node_cache_flush();
+		ret = b2r2_node_alloc(node_count, &(request->first_node));
+	}
 	if (ret < 0 || request->first_node == NULL) {
 		b2r2_log_warn(
 			"%s: Failed to allocate nodes, ret = %d\n",
@@ -945,28 +1449,48 @@ static int b2r2_blt(struct b2r2_blt_instance *instance,
 		goto generate_nodes_failed;
 	}
 
-	/* Exit here if dry run */
-	if (request->user_req.flags & B2R2_BLT_FLAG_DRY_RUN)
-		goto exit_dry_run;
+	request->nodes_configured = true;
+	add_setup_stat(false, b2r2_get_curr_nsec() - setup_start);
 
-	/* Configure the request */
-	last_node = request->first_node;
-	while (last_node && last_node->next)
-		last_node = last_node->next;
+	return 0;
 
-	request->job.tag = (int) instance;
-	request->job.prio = request->user_req.prio;
-	request->job.first_node_address =
-		request->first_node->physical_address;
-	request->job.last_node_address =
-		last_node->physical_address;
-	request->job.callback = job_callback;
-	request->job.release = job_release;
-	request->job.acquire_resources = job_acquire_resources;
-	request->job.release_resources = job_release_resources;
+no_optimized_path:
+generate_nodes_failed:
+	unresolve_buf(&request->user_req.dst_img.buf,
+		&request->dst_resolved);
+resolve_dst_buf_failed:
+	unresolve_buf(&request->user_req.src_mask.buf,
+		&request->src_mask_resolved);
+resolve_src_mask_buf_failed:
+	unresolve_buf(&request->user_req.src_img.buf,
+		&request->src_resolved);
+resolve_src_buf_failed:
+	return ret;
+}
 
-	/* Synchronize memory occupied by the buffers */
+/**
+ * unresolve_request_bufs - Unresolves all buffers of a request
+ *
+ * @request: The request
+ */
+static void unresolve_request_bufs(struct b2r2_blt_request *request)
+{
+	unresolve_buf(&request->user_req.src_img.buf,
+		&request->src_resolved);
+	unresolve_buf(&request->user_req.src_mask.buf,
+		&request->src_mask_resolved);
+	unresolve_buf(&request->user_req.dst_img.buf,
+		&request->dst_resolved);
+}
 
+/**
+ * sync_request_bufs - Synchronizes the memory occupied by the buffers
+ *                     of a request
+ *
+ * @request: The request
+ */
+static void sync_request_bufs(struct b2r2_blt_request *request)
+{
 	/* Source buffer */
 	if (!(request->user_req.flags &
 				B2R2_BLT_FLAG_SRC_NO_CACHE_FLUSH) &&
@@ -1002,51 +1526,549 @@ static int b2r2_blt(struct b2r2_blt_instance *instance,
 			&request->dst_resolved,
 			true, /*is_dst*/
 			&request->user_req.dst_rect);
+}
 
-#ifdef CONFIG_DEBUG_FS
-	/* Remember latest request for debugfs */
-	debugfs_latest_request = *request;
-#endif
-
-	/* Submit the job */
-	b2r2_log_info("%s: Submitting job\n", __func__);
-
-	inc_stat(&stat_n_in_blt_add);
+/**
+ * complete_request - Finishes a request whose job is done or cancelled
+ *
+ * @request: The request
+ * @job: The job executing the request, gets a reference if the request
+ *       is put in the report list
+ */
+static void complete_request(struct b2r2_blt_request *request,
+		struct b2r2_core_job *job)
+{
+	/* Unresolve the buffers */
+	unresolve_request_bufs(request);
 
-	if (request->profile)
-		request->nsec_active_in_cpu =
-			(s32)((u32)task_sched_runtime(current) -
-					thread_runtime_at_start);
+	/* Move to report list if the job shall be reported */
+	/* FIXME: Use a smaller struct? */
+	mutex_lock(&request->instance->lock);
+	if (request->user_req.flags & B2R2_BLT_FLAG_REPORT_WHEN_DONE) {
+		/* Move job to report list */
+		list_add_tail(&request->list,
+			&request->instance->report_list);
+		inc_stat(&stat_n_jobs_in_report_list);
 
-	mutex_lock(&instance->lock);
+		/* Wake up poll */
+		wake_up_interruptible(
+			&request->instance->report_list_waitq);
 
-	/* Add the job to b2r2_core */
-	request_id = b2r2_core_job_add(&request->job);
-	request->request_id = request_id;
+		/* Add a reference because we put the job in the report list */
+		b2r2_core_job_addref(job, __func__);
+	}
+	mutex_unlock(&request->instance->lock);
 
-	dec_stat(&stat_n_in_blt_add);
+#ifdef CONFIG_DEBUG_FS
+	/* Dump job if cancelled */
+	if (job->job_state == B2R2_CORE_JOB_CANCELED) {
+		char *Buf = kmalloc(sizeof(char) * 4096, GFP_KERNEL);
 
-	if (request_id < 0) {
-		b2r2_log_warn("%s: Failed to add job, ret = %d\n",
-			__func__, request_id);
-		ret = request_id;
-		mutex_unlock(&instance->lock);
-		goto job_add_failed;
+		b2r2_log_info("%s: Job cancelled:\n", __func__);
+		if (Buf != NULL) {
+			sprintf_req(request, Buf, sizeof(char) * 4096);
+			b2r2_log_info("%s", Buf);
+			kfree(Buf);
+		} else {
+			b2r2_log_info("Unable to print the request. "
+					"Message buffer allocation failed.\n");
+		}
 	}
+#endif
 
-	inc_stat(&stat_n_jobs_added);
+	if (request->profile) {
+		request->total_time_nsec =
+			(s32)(b2r2_get_curr_nsec() - request->start_time_nsec);
+		b2r2_call_profiler_blt_done(request);
+	}
 
-	instance->no_of_active_requests++;
-	mutex_unlock(&instance->lock);
+	if (request->out_fence != NULL)
+		hwmem_fence_signal(request->out_fence,
+			job->job_state == B2R2_CORE_JOB_CANCELED ?
+				-ECANCELED : 0);
+}
 
-	/* Wait for the job to be done if synchronous */
-	if ((request->user_req.flags & B2R2_BLT_FLAG_ASYNCH) == 0) {
-		b2r2_log_info("%s: Synchronous, waiting\n",
-			__func__);
+/**
+ * dec_active_requests - Decreases the number of active requests and wakes
+ *                       up synching threads if it reaches zero
+ *
+ * @instance: The B2R2 BLT instance
+ */
+static void dec_active_requests(struct b2r2_blt_instance *instance)
+{
+	mutex_lock(&instance->lock);
+	BUG_ON(instance->no_of_active_requests == 0);
+	instance->no_of_active_requests--;
+	if (instance->synching &&
+	instance->no_of_active_requests == 0) {
+		instance->synching = false;
+		/* Wake up all syncing */
+
+		wake_up_interruptible_all(
+			&instance->synch_done_waitq);
+	}
+	mutex_unlock(&instance->lock);
+}
+
+/**
+ * Called when job is done or cancelled
+ *
+ * @job: The job
+ */
+static void job_callback(struct b2r2_core_job *job)
+{
+	struct b2r2_blt_request *request =
+		container_of(job, struct b2r2_blt_request, job);
+
+	if (b2r2_blt_device())
+		b2r2_log_info("%s\n", __func__);
+
+	/* Local addref / release within this func */
+	b2r2_core_job_addref(job, __func__);
+
+	complete_request(request, job);
+	dec_active_requests(request->instance);
+
+	/* Local addref / release within this func */
+	b2r2_core_job_release(job, __func__);
+}
+
+/**
+ * Called when job should be released (free memory etc.)
+ *
+ * @job: The job
+ */
+static void job_release(struct b2r2_core_job *job)
+{
+	struct b2r2_blt_request *request =
+		container_of(job, struct b2r2_blt_request, job);
+
+	inc_stat(&stat_n_jobs_released);
+
+	b2r2_log_info("%s, first_node=%p, ref_count=%d\n",
+		__func__, request->first_node, request->job.ref_count);
+
+	if (request->first_node)
+		release_nodes(request);
+
+	b2r2_node_split_cancel(&request->node_split_job);
+
+	if (request->in_fence != NULL)
+		hwmem_fence_put(request->in_fence);
+
+	/* No effect if the request was completed */
+	if (request->out_fence != NULL) {
+		hwmem_fence_signal(request->out_fence, -ECANCELED);
+		hwmem_fence_put(request->out_fence);
+	}
+
+	/* Release memory for the request */
+	if (request->clut != NULL) {
+		dma_free_coherent(b2r2_blt_device(), CLUT_SIZE, request->clut,
+				request->clut_phys_addr);
+		request->clut = NULL;
+		request->clut_phys_addr = 0;
+	}
+	kfree(request);
+}
+
+/**
+ * in_fence_signaled - Called when the input fence of a request waiting in
+ *                     the fence wait list is signaled
+ *
+ * @waiter: The fence waiter of the request
+ * @status: Fence status
+ *
+ * May be called in atomic context, the job is added from a work.
+ */
+static void in_fence_signaled(struct hwmem_fence_waiter *waiter, int status)
+{
+	struct b2r2_blt_request *request =
+		container_of(waiter, struct b2r2_blt_request, in_fence_waiter);
+
+	request->in_fence_status = status;
+	schedule_work(&request->in_fence_work);
+}
+
+/**
+ * in_fence_work - Adds the job of a request whose input fence has been
+ *                 signaled
+ *
+ * @work: The fence work of the request
+ */
+static void in_fence_work(struct work_struct *work)
+{
+	struct b2r2_blt_request *request =
+		container_of(work, struct b2r2_blt_request, in_fence_work);
+	struct b2r2_blt_instance *instance = request->instance;
+	int ret;
+
+	b2r2_log_info("%s, status=%d\n", __func__, request->in_fence_status);
+
+	if (request->in_fence_status < 0) {
+		mutex_lock(&instance->lock);
+		list_del_init(&request->list);
+		mutex_unlock(&instance->lock);
+
+		cancel_fenced_request(request);
+		return;
+	}
+
+	mutex_lock(&instance->lock);
+	list_del_init(&request->list);
+
+	ret = b2r2_core_job_add(&request->job);
+	request->request_id = ret;
+	mutex_unlock(&instance->lock);
+
+	if (ret < 0) {
+		b2r2_log_warn("%s: Failed to add job, ret = %d\n",
+			__func__, ret);
+		cancel_fenced_request(request);
+		return;
+	}
+
+	inc_stat(&stat_n_jobs_added);
+
+	/* Release matching the addref in b2r2_core_job_add */
+	b2r2_core_job_release(&request->job, __func__);
+}
+
+/**
+ * cancel_fenced_request - Cancels a request that was never added to B2R2
+ *                         because its input fence failed
+ *
+ * @request: The request, freed by this function
+ */
+static void cancel_fenced_request(struct b2r2_blt_request *request)
+{
+	b2r2_log_info("%s\n", __func__);
+
+	unresolve_request_bufs(request);
+	dec_active_requests(request->instance);
+
+	/* Signals the output fence with an error */
+	job_release(&request->job);
+	dec_stat(&stat_n_jobs_released);
+}
+
+/**
+ * cancel_fence_waits - Cancels all requests of an instance still waiting
+ *                      for their input fence
+ *
+ * @instance: The B2R2 BLT instance
+ *
+ * Requests whose fence is signaled meanwhile are added to B2R2 as usual.
+ */
+static void cancel_fence_waits(struct b2r2_blt_instance *instance)
+{
+	mutex_lock(&instance->lock);
+	while (!list_empty(&instance->fence_wait_list)) {
+		struct b2r2_blt_request *request = list_first_entry(
+			&instance->fence_wait_list,
+			struct b2r2_blt_request,
+			list);
+		list_del_init(&request->list);
+		mutex_unlock(&instance->lock);
+
+		/*
+		 * If the waiter has been called the work is queued or has
+		 * run, in which case it owns the request.
+		 */
+		if (hwmem_fence_remove_waiter(request->in_fence,
+				&request->in_fence_waiter) ||
+				cancel_work_sync(&request->in_fence_work))
+			cancel_fenced_request(request);
+
+		mutex_lock(&instance->lock);
+	}
+	mutex_unlock(&instance->lock);
+}
+
+/**
+ * assign_tmp_bufs - Assigns the temporary buffers to a request
+ *
+ * @request: The request
+ *
+ * The caller must have checked that the temporary buffers are free.
+ */
+static int assign_tmp_bufs(struct b2r2_blt_request *request)
+{
+	int i;
+
+	if (request->buf_count > MAX_TMP_BUFS_NEEDED) {
+		b2r2_log_err("%s: request->buf_count > MAX_TMP_BUFS_NEEDED\n",
+								__func__);
+		return -ENOMSG;
+	}
+
+	for (i = 0; i < request->buf_count; i++) {
+		if (tmp_bufs[i].buf.size < request->bufs[i].size) {
+			b2r2_log_err("%s: tmp_bufs[i].buf.size < "
+					"request->bufs[i].size\n",
+								__func__);
+			return -ENOMSG;
+		}
+
+		tmp_bufs[i].in_use = true;
+		request->bufs[i].phys_addr = tmp_bufs[i].buf.phys_addr;
+		request->bufs[i].virt_addr = tmp_bufs[i].buf.virt_addr;
+
+		b2r2_log_info("%s: phys=%p, virt=%p\n",
+			__func__, (void *)request->bufs[i].phys_addr,
+			request->bufs[i].virt_addr);
+	}
+
+	return b2r2_node_split_assign_buffers(&request->node_split_job,
+				request->first_node, request->bufs,
+				request->buf_count);
+}
+
+/**
+ * Tells the job to try to allocate the resources needed to execute the job.
+ * Called just before execution of a job.
+ *
+ * @job: The job
+ * @atomic: true if called from atomic (i.e. interrupt) context. If function
+ *          can't allocate in atomic context it should return error, it
+ *          will then be called later from non-atomic context.
+ */
+static int job_acquire_resources(struct b2r2_core_job *job, bool atomic)
+{
+	struct b2r2_blt_request *request =
+		container_of(job, struct b2r2_blt_request, job);
+	int ret;
+	int i;
+
+	b2r2_log_info("%s\n", __func__);
+
+	if (request->buf_count == 0)
+		return 0;
+
+	/*
+	 * 1 to 1 mapping between request temp buffers and temp buffers
+	 * (request temp buf 0 is always temp buf 0, request temp buf 1 is
+	 * always temp buf 1 and so on) to avoid starvation of jobs that
+	 * require multiple temp buffers. Not optimal in terms of memory
+	 * usage but we avoid get into a situation where lower prio jobs can
+	 * delay higher prio jobs that require more temp buffers.
+	 */
+	if (tmp_bufs[0].in_use)
+		return -EAGAIN;
 
+	ret = assign_tmp_bufs(request);
+	if (ret < 0) {
+		for (i = 0; i < MAX_TMP_BUFS_NEEDED; i++)
+			tmp_bufs[i].in_use = false;
+	}
+
+	return ret;
+}
+
+/**
+ * Tells the job to free the resources needed to execute the job.
+ * Called after execution of a job.
+ *
+ * @job: The job
+ * @atomic: true if called from atomic (i.e. interrupt) context. If function
+ *          can't allocate in atomic context it should return error, it
+ *          will then be called later from non-atomic context.
+ */
+static void job_release_resources(struct b2r2_core_job *job, bool atomic)
+{
+	struct b2r2_blt_request *request =
+		container_of(job, struct b2r2_blt_request, job);
+	int i;
+
+	b2r2_log_info("%s\n", __func__);
+
+	/* Free any temporary buffers */
+	for (i = 0; i < request->buf_count; i++) {
+
+		b2r2_log_info("%s: freeing %d bytes\n",
+			__func__, request->bufs[i].size);
+		tmp_bufs[i].in_use = false;
+		/* Keep the size, the node list cache needs it */
+		request->bufs[i].phys_addr = 0;
+		request->bufs[i].virt_addr = NULL;
+	}
+	request->buf_count = 0;
+
+	/* Early release of nodes */
+	if (!atomic && request->first_node)
+		release_nodes(request);
+}
+
+/**
+ * release_nodes - Gives the node list of a request to the node list cache,
+ *                 or frees it if the cache does not take it
+ *
+ * @request: The request
+ */
+static void release_nodes(struct b2r2_blt_request *request)
+{
+	b2r2_debug_job_done(request->first_node);
+
+	if (!b2r2_node_cache_put(request)) {
+#ifdef B2R2_USE_NODE_GEN
+		b2r2_blt_free_nodes(request->first_node);
+#else
+		b2r2_node_free(request->first_node);
+#endif
+	}
+	request->first_node = NULL;
+}
+
+/**
+ * add_to_batch - Prepares a request and adds it to a batch
+ *
+ * @batch: The batch, allocated if NULL. If the request has no optimized
+ *         path the batch is submitted and set to NULL, so that the
+ *         request can be performed after the requests before it.
+ * @request: The request, freed on error
+ *
+ * Returns 0 if OK, -ENOSYS if there is no optimized path for the request
+ * or another negative error code.
+ */
+static int add_to_batch(struct b2r2_blt_batch **batch,
+		struct b2r2_blt_request *request)
+{
+	int ret;
+
+	if (*batch == NULL) {
+		*batch = kzalloc(sizeof(**batch), GFP_KERNEL);
+		if (*batch == NULL) {
+			b2r2_log_err("%s: Failed to alloc mem\n", __func__);
+			job_release(&request->job);
+			dec_stat(&stat_n_jobs_released);
+			return -ENOMEM;
+		}
+		(*batch)->instance = request->instance;
+	}
+
+	if (request->profile)
+		request->start_time_nsec = b2r2_get_curr_nsec();
+
+	ret = prepare_request(request, *batch);
+	if (ret < 0) {
+		job_release(&request->job);
+		dec_stat(&stat_n_jobs_released);
+
+		if (ret == -ENOSYS && (*batch)->request_count > 0) {
+			int request_id = submit_batch(*batch);
+
+			*batch = NULL;
+			if (request_id < 0)
+				ret = request_id;
+		}
+
+		return ret;
+	}
+
+	if (request->user_req.flags & B2R2_BLT_FLAG_DRY_RUN) {
+		unresolve_request_bufs(request);
+		job_release(&request->job);
+		dec_stat(&stat_n_jobs_released);
+		return 0;
+	}
+
+	request->batch = *batch;
+	(*batch)->requests[(*batch)->request_count++] = request;
+
+	return 0;
+}
+
+/**
+ * submit_batch - Chains the node lists of a batch and adds it to b2r2_core
+ *
+ * @batch: The batch, must not be accessed after this call
+ *
+ * Returns the request id of the batch if >= 0, else a negative error code
+ */
+static int submit_batch(struct b2r2_blt_batch *batch)
+{
+	struct b2r2_blt_instance *instance = batch->instance;
+	struct b2r2_node *last_node = NULL;
+	bool synchronous = false;
+	int request_id;
+	int ret;
+	u32 i;
+
+	b2r2_log_info("%s: %d requests\n", __func__, batch->request_count);
+
+	batch->job.prio = batch->requests[0]->user_req.prio;
+
+	for (i = 0; i < batch->request_count; i++) {
+		struct b2r2_blt_request *request = batch->requests[i];
+
+		/*
+		 * Chain the node list to the one of the previous request.
+		 * All nodes reload every register group (CIC is 0x7ffff), so
+		 * no state leaks from one request to the next.
+		 */
+		if (last_node != NULL)
+			last_node->node.GROUP0.B2R2_NIP =
+				request->first_node->physical_address;
+
+		last_node = request->first_node;
+		while (last_node->next)
+			last_node = last_node->next;
+
+		if (request->user_req.prio > batch->job.prio)
+			batch->job.prio = request->user_req.prio;
+
+		if ((request->user_req.flags & B2R2_BLT_FLAG_ASYNCH) == 0)
+			synchronous = true;
+
+		/* Synchronize memory occupied by the buffers */
+		sync_request_bufs(request);
+	}
+
+	batch->job.tag = (int) instance;
+	batch->job.first_node_address =
+		batch->requests[0]->first_node->physical_address;
+	batch->job.last_node_address = last_node->physical_address;
+	batch->job.callback = batch_job_callback;
+	batch->job.release = batch_job_release;
+	batch->job.acquire_resources = batch_job_acquire_resources;
+	batch->job.release_resources = batch_job_release_resources;
+
+#ifdef CONFIG_DEBUG_FS
+	/* Remember latest request for debugfs */
+	debugfs_latest_request = *batch->requests[batch->request_count - 1];
+#endif
+
+	/* Submit the job */
+	inc_stat(&stat_n_in_blt_add);
+
+	mutex_lock(&instance->lock);
+
+	/* Add the job to b2r2_core */
+	request_id = b2r2_core_job_add(&batch->job);
+
+	dec_stat(&stat_n_in_blt_add);
+
+	if (request_id < 0) {
+		b2r2_log_warn("%s: Failed to add job, ret = %d\n",
+			__func__, request_id);
+		mutex_unlock(&instance->lock);
+		cancel_batch(batch);
+		return request_id;
+	}
+
+	for (i = 0; i < batch->request_count; i++) {
+		batch->requests[i]->request_id = request_id;
+		inc_stat(&stat_n_jobs_added);
+	}
+
+	instance->no_of_active_requests++;
+	mutex_unlock(&instance->lock);
+
+	/* Wait for the job to be done if synchronous */
+	if (synchronous) {
 		inc_stat(&stat_n_in_blt_wait);
 
-		ret = b2r2_core_job_wait(&request->job);
+		ret = b2r2_core_job_wait(&batch->job);
 
 		dec_stat(&stat_n_in_blt_wait);
 
@@ -1054,56 +2076,45 @@ static int b2r2_blt(struct b2r2_blt_instance *instance,
 			b2r2_log_warn(
 				"%s: Failed to wait job, ret = %d\n",
 				__func__, ret);
-		else
-			b2r2_log_info(
-				"%s: Synchronous wait done\n", __func__);
-		ret = 0;
 	}
 
 	/*
 	 * Release matching the addref in b2r2_core_job_add,
-	 * the request must not be accessed after this call
+	 * the batch must not be accessed after this call
 	 */
-	b2r2_core_job_release(&request->job, __func__);
-
-	dec_stat(&stat_n_in_blt);
-
-	return ret >= 0 ? request_id : ret;
+	b2r2_core_job_release(&batch->job, __func__);
 
-job_add_failed:
-exit_dry_run:
-no_optimized_path:
-generate_nodes_failed:
-	unresolve_buf(&request->user_req.dst_img.buf,
-		&request->dst_resolved);
-resolve_dst_buf_failed:
-	unresolve_buf(&request->user_req.src_mask.buf,
-		&request->src_mask_resolved);
-resolve_src_mask_buf_failed:
-	unresolve_buf(&request->user_req.src_img.buf,
-		&request->src_resolved);
-resolve_src_buf_failed:
-synch_interrupted:
-	job_release(&request->job);
-	dec_stat(&stat_n_jobs_released);
-	if ((request->user_req.flags & B2R2_BLT_FLAG_DRY_RUN) == 0 || ret)
-		b2r2_log_warn(
-			"%s returns with error %d\n", __func__, ret);
+	return request_id;
+}
 
-	dec_stat(&stat_n_in_blt);
+/**
+ * cancel_batch - Releases a batch that has not been submitted
+ *
+ * @batch: The batch
+ */
+static void cancel_batch(struct b2r2_blt_batch *batch)
+{
+	u32 i;
 
-	return ret;
+	for (i = 0; i < batch->request_count; i++) {
+		unresolve_request_bufs(batch->requests[i]);
+		job_release(&batch->requests[i]->job);
+		dec_stat(&stat_n_jobs_released);
+	}
+
+	kfree(batch);
 }
 
 /**
- * Called when job is done or cancelled
+ * Called when batch job is done or cancelled
  *
- * @job: The job
+ * @job: The batch job
  */
-static void job_callback(struct b2r2_core_job *job)
+static void batch_job_callback(struct b2r2_core_job *job)
 {
-	struct b2r2_blt_request *request =
-		container_of(job, struct b2r2_blt_request, job);
+	struct b2r2_blt_batch *batch =
+		container_of(job, struct b2r2_blt_batch, job);
+	u32 i;
 
 	if (b2r2_blt_device())
 		b2r2_log_info("%s\n", __func__);
@@ -1111,168 +2122,64 @@ static void job_callback(struct b2r2_core_job *job)
 	/* Local addref / release within this func */
 	b2r2_core_job_addref(job, __func__);
 
-	/* Unresolve the buffers */
-	unresolve_buf(&request->user_req.src_img.buf,
-		&request->src_resolved);
-	unresolve_buf(&request->user_req.src_mask.buf,
-		&request->src_mask_resolved);
-	unresolve_buf(&request->user_req.dst_img.buf,
-		&request->dst_resolved);
-
-	/* Move to report list if the job shall be reported */
-	/* FIXME: Use a smaller struct? */
-	mutex_lock(&request->instance->lock);
-	if (request->user_req.flags & B2R2_BLT_FLAG_REPORT_WHEN_DONE) {
-		/* Move job to report list */
-		list_add_tail(&request->list,
-			&request->instance->report_list);
-		inc_stat(&stat_n_jobs_in_report_list);
-
-		/* Wake up poll */
-		wake_up_interruptible(
-			&request->instance->report_list_waitq);
-
-		/* Add a reference because we put the job in the report list */
-		b2r2_core_job_addref(job, __func__);
-	}
-
-	/*
-	 * Decrease number of active requests and wake up
-	 * synching threads if active requests reaches zero
-	 */
-	BUG_ON(request->instance->no_of_active_requests == 0);
-	request->instance->no_of_active_requests--;
-	if (request->instance->synching &&
-	request->instance->no_of_active_requests == 0) {
-		request->instance->synching = false;
-		/* Wake up all syncing */
-
-		wake_up_interruptible_all(
-			&request->instance->synch_done_waitq);
-	}
-	mutex_unlock(&request->instance->lock);
-
-#ifdef CONFIG_DEBUG_FS
-	/* Dump job if cancelled */
-	if (job->job_state == B2R2_CORE_JOB_CANCELED) {
-		char *Buf = kmalloc(sizeof(char) * 4096, GFP_KERNEL);
-
-		b2r2_log_info("%s: Job cancelled:\n", __func__);
-		if (Buf != NULL) {
-			sprintf_req(request, Buf, sizeof(char) * 4096);
-			b2r2_log_info("%s", Buf);
-			kfree(Buf);
-		} else {
-			b2r2_log_info("Unable to print the request. "
-					"Message buffer allocation failed.\n");
-		}
-	}
-#endif
+	for (i = 0; i < batch->request_count; i++)
+		complete_request(batch->requests[i], job);
 
-	if (request->profile) {
-		request->total_time_nsec =
-			(s32)(b2r2_get_curr_nsec() - request->start_time_nsec);
-		b2r2_call_profiler_blt_done(request);
-	}
+	/* The batch was counted as one active request */
+	dec_active_requests(batch->instance);
 
 	/* Local addref / release within this func */
 	b2r2_core_job_release(job, __func__);
 }
 
 /**
- * Called when job should be released (free memory etc.)
+ * Called when batch job should be released (free memory etc.)
  *
- * @job: The job
+ * @job: The batch job
  */
-static void job_release(struct b2r2_core_job *job)
+static void batch_job_release(struct b2r2_core_job *job)
 {
-	struct b2r2_blt_request *request =
-		container_of(job, struct b2r2_blt_request, job);
+	struct b2r2_blt_batch *batch =
+		container_of(job, struct b2r2_blt_batch, job);
+	u32 i;
 
-	inc_stat(&stat_n_jobs_released);
-
-	b2r2_log_info("%s, first_node=%p, ref_count=%d\n",
-		__func__, request->first_node, request->job.ref_count);
-
-	b2r2_node_split_cancel(&request->node_split_job);
-
-	if (request->first_node) {
-		b2r2_debug_job_done(request->first_node);
-#ifdef B2R2_USE_NODE_GEN
-		b2r2_blt_free_nodes(request->first_node);
-#else
-		b2r2_node_free(request->first_node);
-#endif
-	}
+	for (i = 0; i < batch->request_count; i++)
+		job_release(&batch->requests[i]->job);
 
-	/* Release memory for the request */
-	if (request->clut != NULL) {
-		dma_free_coherent(b2r2_blt_device(), CLUT_SIZE, request->clut,
-				request->clut_phys_addr);
-		request->clut = NULL;
-		request->clut_phys_addr = 0;
-	}
-	kfree(request);
+	kfree(batch);
 }
 
 /**
- * Tells the job to try to allocate the resources needed to execute the job.
- * Called just before execution of a job.
+ * Tells the batch job to try to allocate the resources needed to execute
+ * the job. Called just before execution of a job.
  *
- * @job: The job
- * @atomic: true if called from atomic (i.e. interrupt) context. If function
- *          can't allocate in atomic context it should return error, it
- *          will then be called later from non-atomic context.
+ * @job: The batch job
+ * @atomic: true if called from atomic (i.e. interrupt) context.
+ *
+ * The requests of a batch are executed one after the other, so they can
+ * all use the same temporary buffers.
  */
-static int job_acquire_resources(struct b2r2_core_job *job, bool atomic)
+static int batch_job_acquire_resources(struct b2r2_core_job *job, bool atomic)
 {
-	struct b2r2_blt_request *request =
-		container_of(job, struct b2r2_blt_request, job);
+	struct b2r2_blt_batch *batch =
+		container_of(job, struct b2r2_blt_batch, job);
+	bool needs_bufs = false;
 	int ret;
-	int i;
+	u32 i;
 
 	b2r2_log_info("%s\n", __func__);
 
-	if (request->buf_count == 0)
-		return 0;
+	for (i = 0; i < batch->request_count; i++)
+		needs_bufs |= batch->requests[i]->buf_count > 0;
 
-	if (request->buf_count > MAX_TMP_BUFS_NEEDED) {
-		b2r2_log_err("%s: request->buf_count > MAX_TMP_BUFS_NEEDED\n",
-								__func__);
-		return -ENOMSG;
-	}
+	if (!needs_bufs)
+		return 0;
 
-	/*
-	 * 1 to 1 mapping between request temp buffers and temp buffers
-	 * (request temp buf 0 is always temp buf 0, request temp buf 1 is
-	 * always temp buf 1 and so on) to avoid starvation of jobs that
-	 * require multiple temp buffers. Not optimal in terms of memory
-	 * usage but we avoid get into a situation where lower prio jobs can
-	 * delay higher prio jobs that require more temp buffers.
-	 */
 	if (tmp_bufs[0].in_use)
 		return -EAGAIN;
 
-	for (i = 0; i < request->buf_count; i++) {
-		if (tmp_bufs[i].buf.size < request->bufs[i].size) {
-			b2r2_log_err("%s: tmp_bufs[i].buf.size < "
-					"request->bufs[i].size\n",
-								__func__);
-			ret = -ENOMSG;
-			goto error;
-		}
-
-		tmp_bufs[i].in_use = true;
-		request->bufs[i].phys_addr = tmp_bufs[i].buf.phys_addr;
-		request->bufs[i].virt_addr = tmp_bufs[i].buf.virt_addr;
-
-		b2r2_log_info("%s: phys=%p, virt=%p\n",
-			__func__, (void *)request->bufs[i].phys_addr,
-			request->bufs[i].virt_addr);
-
-		ret = b2r2_node_split_assign_buffers(&request->node_split_job,
-					request->first_node, request->bufs,
-					request->buf_count);
+	for (i = 0; i < batch->request_count; i++) {
+		ret = assign_tmp_bufs(batch->requests[i]);
 		if (ret < 0)
 			goto error;
 	}
@@ -1280,53 +2187,28 @@ static int job_acquire_resources(struct b2r2_core_job *job, bool atomic)
 	return 0;
 
 error:
-	for (i = 0; i < request->buf_count; i++)
+	for (i = 0; i < MAX_TMP_BUFS_NEEDED; i++)
 		tmp_bufs[i].in_use = false;
 
 	return ret;
 }
 
 /**
- * Tells the job to free the resources needed to execute the job.
+ * Tells the batch job to free the resources needed to execute the job.
  * Called after execution of a job.
  *
- * @job: The job
- * @atomic: true if called from atomic (i.e. interrupt) context. If function
- *          can't allocate in atomic context it should return error, it
- *          will then be called later from non-atomic context.
+ * @job: The batch job
+ * @atomic: true if called from atomic (i.e. interrupt) context.
  */
-static void job_release_resources(struct b2r2_core_job *job, bool atomic)
+static void batch_job_release_resources(struct b2r2_core_job *job,
+		bool atomic)
 {
-	struct b2r2_blt_request *request =
-		container_of(job, struct b2r2_blt_request, job);
-	int i;
-
-	b2r2_log_info("%s\n", __func__);
-
-	/* Free any temporary buffers */
-	for (i = 0; i < request->buf_count; i++) {
+	struct b2r2_blt_batch *batch =
+		container_of(job, struct b2r2_blt_batch, job);
+	u32 i;
 
-		b2r2_log_info("%s: freeing %d bytes\n",
-			__func__, request->bufs[i].size);
-		tmp_bufs[i].in_use = false;
-		memset(&request->bufs[i], 0, sizeof(request->bufs[i]));
-	}
-	request->buf_count = 0;
-
-	/*
-	 * Early release of nodes
-	 * FIXME: If nodes are to be reused we don't want to release here
-	 */
-	if (!atomic && request->first_node) {
-		b2r2_debug_job_done(request->first_node);
-
-#ifdef B2R2_USE_NODE_GEN
-		b2r2_blt_free_nodes(request->first_node);
-#else
-		b2r2_node_free(request->first_node);
-#endif
-		request->first_node = NULL;
-	}
+	for (i = 0; i < batch->request_count; i++)
+		job_release_resources(&batch->requests[i]->job, atomic);
 }
 
 #endif /* !CONFIG_B2R2_GENERIC_ONLY */
@@ -2380,6 +3262,127 @@ static void unresolve_hwmem(struct b2r2_resolved_buf *resolved_buf)
 	hwmem_release(resolved_buf->hwmem_alloc);
 }
 
+#ifndef CONFIG_B2R2_GENERIC_ONLY
+/**
+ * resolve_shared_hwmem() - Resolves a hwmem buffer already resolved by an
+ *                          earlier request in the same batch
+ *
+ * @img: The image specification as supplied from user space
+ * @rect_2b_used: The part of the image b2r2 will use.
+ * @is_dst: true if the buffer is a destination buffer
+ * @owner: The resolved buffer of the earlier request
+ * @resolved_buf: Gathered information about the buffer
+ *
+ * The alloc stays pinned and referenced by @owner until the batch is done,
+ * only the access check and the domain switch are done again.
+ */
+static int resolve_shared_hwmem(struct b2r2_blt_img *img,
+		struct b2r2_blt_rect *rect_2b_used,
+		bool is_dst,
+		struct b2r2_resolved_buf *owner,
+		struct b2r2_resolved_buf *resolved_buf)
+{
+	int return_value;
+	enum hwmem_mem_type mem_type;
+	enum hwmem_access access;
+	enum hwmem_access required_access;
+	struct hwmem_region region;
+
+	*resolved_buf = *owner;
+	resolved_buf->shared = true;
+
+	hwmem_get_info(resolved_buf->hwmem_alloc, &resolved_buf->file_len,
+			&mem_type, &access);
+
+	required_access = (is_dst ? HWMEM_ACCESS_WRITE : HWMEM_ACCESS_READ) |
+							HWMEM_ACCESS_IMPORT;
+	if ((required_access & access) != required_access) {
+		b2r2_log_info("%s: Insufficient access to hwmem buffer.\n",
+				__func__);
+		return_value = -EACCES;
+		goto failed;
+	}
+
+	if (resolved_buf->file_len <
+			img->buf.offset + (__u32)b2r2_get_img_size(img)) {
+		b2r2_log_info("%s: Hwmem buffer too small.\n", __func__);
+		return_value = -EINVAL;
+		goto failed;
+	}
+
+	set_up_hwmem_region(img, rect_2b_used, &region);
+	return_value = hwmem_set_domain(resolved_buf->hwmem_alloc,
+				required_access, HWMEM_DOMAIN_SYNC, &region);
+	if (return_value < 0) {
+		b2r2_log_info("%s: hwmem_set_domain failed, "
+				"error code: %i\n", __func__, return_value);
+		goto failed;
+	}
+
+	resolved_buf->physical_address =
+			resolved_buf->file_physical_start + img->buf.offset;
+
+	return 0;
+
+failed:
+	memset(resolved_buf, 0, sizeof(*resolved_buf));
+	return return_value;
+}
+
+/**
+ * resolve_batch_buf() - Resolves a buffer of a request that is added to
+ *                       a batch
+ *
+ * @batch: The batch, or NULL if the request is not batched
+ * @img: The image specification as supplied from user space
+ * @rect_2b_used: The part of the image b2r2 will use.
+ * @is_dst: true if the buffer is a destination buffer
+ * @resolved: Gathered information about the buffer
+ *
+ * Hwmem buffers used by an earlier request in the batch are shared with
+ * that request instead of being looked up and pinned again.
+ *
+ * Returns 0 if OK else negative error code
+ */
+static int resolve_batch_buf(struct b2r2_blt_batch *batch,
+		struct b2r2_blt_img *img, struct b2r2_blt_rect *rect_2b_used,
+		bool is_dst, struct b2r2_resolved_buf *resolved)
+{
+	u32 i;
+
+	if (batch == NULL ||
+			img->buf.type != B2R2_BLT_PTR_HWMEM_BUF_NAME_OFFSET)
+		return resolve_buf(img, rect_2b_used, is_dst, resolved);
+
+	for (i = 0; i < batch->request_count; i++) {
+		struct b2r2_blt_request *prev = batch->requests[i];
+		struct b2r2_blt_img *prev_imgs[] = {
+			&prev->user_req.src_img,
+			&prev->user_req.src_mask,
+			&prev->user_req.dst_img,
+		};
+		struct b2r2_resolved_buf *prev_resolved[] = {
+			&prev->src_resolved,
+			&prev->src_mask_resolved,
+			&prev->dst_resolved,
+		};
+		int j;
+
+		for (j = 0; j < ARRAY_SIZE(prev_imgs); j++) {
+			if (prev_imgs[j]->buf.type ==
+					B2R2_BLT_PTR_HWMEM_BUF_NAME_OFFSET &&
+					prev_imgs[j]->buf.hwmem_buf_name ==
+						img->buf.hwmem_buf_name &&
+					prev_resolved[j]->hwmem_alloc != NULL)
+				return resolve_shared_hwmem(img, rect_2b_used,
+					is_dst, prev_resolved[j], resolved);
+		}
+	}
+
+	return resolve_buf(img, rect_2b_used, is_dst, resolved);
+}
+#endif /* !CONFIG_B2R2_GENERIC_ONLY */
+
 /**
  * unresolve_buf() - Must be called after resolve_buf
  *
@@ -2391,6 +3394,10 @@ static void unresolve_hwmem(struct b2r2_resolved_buf *resolved_buf)
 static void unresolve_buf(struct b2r2_blt_buf *buf,
 			struct b2r2_resolved_buf *resolved)
 {
+	/* Released by the request owning the buffer */
+	if (resolved->shared)
+		return;
+
 #ifdef CONFIG_ANDROID_PMEM
 	if (resolved->is_pmem && resolved->filep)
 		put_pmem_file(resolved->filep);
@@ -2749,6 +3756,27 @@ static void inc_stat(unsigned long *stat)
 	mutex_unlock(&stat_lock);
 }
 
+/**
+ * add_setup_stat() - Accounts the node list setup time of a request
+ *
+ * @cache_hit: true if the node list was taken from the node list cache
+ * @nsec: CPU time spent setting up the node list
+ */
+static void add_setup_stat(bool cache_hit, u32 nsec)
+{
+	mutex_lock(&stat_lock);
+	if (cache_hit) {
+		stat_n_node_cache_hits++;
+		stat_setup_nsec_hit += nsec;
+	} else {
+		stat_n_node_cache_misses++;
+		stat_setup_nsec_miss += nsec;
+	}
+	if (nsec > stat_setup_nsec_max)
+		stat_setup_nsec_max = nsec;
+	mutex_unlock(&stat_lock);
+}
+
 /**
  * inc_stat() - Spin lock protected decrement of statistics variable
  *
@@ -3146,6 +4174,31 @@ static int debugfs_b2r2_blt_stat_read(struct file *filp, char __user *buf,
 			stat_n_in_synch_job);
 	dev_size += sprintf(Buf + dev_size, "Clients in query_cap: %lu\n",
 			stat_n_in_query_cap);
+	{
+		unsigned long lookups =
+			stat_n_node_cache_hits + stat_n_node_cache_misses;
+		u64 avg_hit = stat_setup_nsec_hit;
+		u64 avg_miss = stat_setup_nsec_miss;
+
+		if (stat_n_node_cache_hits)
+			do_div(avg_hit, stat_n_node_cache_hits);
+		if (stat_n_node_cache_misses)
+			do_div(avg_miss, stat_n_node_cache_misses);
+
+		dev_size += sprintf(Buf + dev_size,
+				"Node cache hits: %lu misses: %lu "
+				"hit rate: %lu%%\n",
+				stat_n_node_cache_hits,
+				stat_n_node_cache_misses,
+				lookups ? stat_n_node_cache_hits * 100 /
+					lookups : 0);
+		dev_size += sprintf(Buf + dev_size,
+				"Setup time (ns) hit avg: %llu "
+				"miss avg: %llu max: %u\n",
+				(unsigned long long)avg_hit,
+				(unsigned long long)avg_miss,
+				stat_setup_nsec_max);
+	}
 	mutex_unlock(&stat_lock);
 
 	/* No more to read if offset != 0 */
@@ -3306,6 +4359,7 @@ void b2r2_blt_module_exit(void)
 #endif
 	if (b2r2_blt_dev) {
 		b2r2_log_info("%s\n", __func__);
+		b2r2_node_cache_flush();
 		b2r2_mem_exit();
 		destroy_tmp_bufs();
 		b2r2_blt_dev = NULL;
@@ -48,6 +48,7 @@
 #include <linux/regulator/consumer.h>
 #include <linux/slab.h>
 #include <linux/err.h>
+#include <asm/div64.h>
 
 #include "b2r2_core.h"
 #include "b2r2_global.h"
@@ -220,6 +221,14 @@ struct addref_release {
  * @stat_n_jobs_removed: Number of jobs removed (statistics)
  * @stat_n_jobs_in_prio_list: Number of jobs in prio list (statistics)
  *
+ * @queue_last_tag: Tag of the last job dispatched on each queue, used to
+ *                  alternate between clients sharing a queue
+ * @queue_start_time: Time when the active job of each queue was dispatched
+ * @stat_n_queue_jobs: Number of jobs dispatched per queue (statistics)
+ * @stat_queue_busy_nsec: Time each queue has had an active job (statistics)
+ * @stat_n_fair_picks: Number of jobs dispatched ahead of an older job from
+ *                     the client that last used the queue (statistics)
+ *
  * @debugfs_root_dir: Root directory for B2R2 debugfs
  *
  * @ar: Circular array of addref / release debug structs
@@ -265,6 +274,13 @@ struct b2r2_core {
 
 	unsigned long    stat_n_jobs_in_prio_list;
 
+	/* Per queue scheduling state and statistics */
+	int              queue_last_tag[B2R2_CORE_QUEUE_NO_OF];
+	u32              queue_start_time[B2R2_CORE_QUEUE_NO_OF];
+	unsigned long    stat_n_queue_jobs[B2R2_CORE_QUEUE_NO_OF];
+	u64              stat_queue_busy_nsec[B2R2_CORE_QUEUE_NO_OF];
+	unsigned long    stat_n_fair_picks;
+
 #ifdef CONFIG_DEBUG_FS
 	struct dentry *debugfs_root_dir;
 	struct dentry *debugfs_regs_dir;
@@ -320,6 +336,7 @@ static int domain_enable(void);
 static void domain_disable(void);
 
 static void stop_queue(enum b2r2_core_queue queue);
+static void remove_active_job(enum b2r2_core_queue queue);
 
 #ifdef HANDLE_TIMEOUTED_JOBS
 static void printk_regs(void);
@@ -687,8 +704,8 @@ static bool cancel_job(struct b2r2_core_job *job)
 				if (b2r2_core.active_jobs[i] == job) {
 					stop_queue((enum b2r2_core_queue)i);
 					stop_hw_timer(job);
-					b2r2_core.active_jobs[i] = NULL;
-					b2r2_core.n_active_jobs--;
+					remove_active_job(
+						(enum b2r2_core_queue)i);
 					found_job = true;
 					job_was_active = true;
 				}
@@ -953,8 +970,8 @@ static void timeout_work_function(struct work_struct *ptr)
 				if (job) {
 					stop_hw_timer(job);
 
-					b2r2_core.active_jobs[i] = NULL;
-					b2r2_core.n_active_jobs--;
+					remove_active_job(
+						(enum b2r2_core_queue)i);
 					list_add_tail(&job->list,
 						      &job_list);
 				}
@@ -1217,72 +1234,133 @@ static void insert_into_prio_list(struct b2r2_core_job *job)
 }
 
 /**
- * check_prio_list() - Checks if the first job(s) in the prio list can
- *                     be dispatched to B2R2
+ * remove_active_job() - Removes the active job from a B2R2 queue
+ *
+ * @queue: Queue to clear
+ *
+ * b2r2_core.lock must be held
+ */
+static void remove_active_job(enum b2r2_core_queue queue)
+{
+	/* Wraps after ~4 s, longer jobs are killed by the timeout anyway */
+	b2r2_core.stat_queue_busy_nsec[queue] +=
+		(u32)(b2r2_get_curr_nsec() - b2r2_core.queue_start_time[queue]);
+
+	b2r2_core.active_jobs[queue] = NULL;
+	b2r2_core.n_active_jobs--;
+}
+
+/**
+ * pick_job_for_queue() - Finds the job to dispatch next on a B2R2 queue
+ *
+ * @queue: Queue to find a job for
+ *
+ * Only jobs of the highest waiting priority for the queue are considered.
+ * Among those, the oldest job from another client than the one that last
+ * used the queue is preferred so that one client cannot starve the others.
+ * A client's own jobs are never reordered.
+ *
+ * Returns the job or NULL if no job is waiting for the queue
+ *
+ * b2r2_core.lock must be held
+ */
+static struct b2r2_core_job *pick_job_for_queue(enum b2r2_core_queue queue)
+{
+	struct b2r2_core_job *job;
+	struct b2r2_core_job *first = NULL;
+
+	list_for_each_entry(job, &b2r2_core.prio_queue, list) {
+		if (job->queue != queue)
+			continue;
+
+		if (first == NULL) {
+			first = job;
+			if (job->tag != b2r2_core.queue_last_tag[queue])
+				break;
+			continue;
+		}
+
+		/* The list is sorted, no more jobs of the same priority */
+		if (job->prio != first->prio)
+			break;
+
+		if (job->tag != first->tag) {
+			b2r2_core.stat_n_fair_picks++;
+			return job;
+		}
+	}
+
+	return first;
+}
+
+/**
+ * check_prio_list() - Dispatches waiting jobs from the prio list to every
+ *                     idle B2R2 queue
  *
  * @atomic: true if in atomic context (i.e. interrupt context)
  *
+ * A job that cannot be dispatched (its queue is busy or it cannot get its
+ * resources) does not block jobs waiting for other queues.
+ *
  * b2r2_core.lock must be held
  */
 static void check_prio_list(bool atomic)
 {
-	bool dispatched_job;
+	int queue;
 	int n_dispatched = 0;
 
-	/* Do we have anything in our prio list? */
-	do {
-		dispatched_job = false;
-		if (!list_empty(&b2r2_core.prio_queue)) {
-			/* The first job waiting */
-			struct b2r2_core_job *job =
-				list_first_entry(&b2r2_core.prio_queue,
-						 struct b2r2_core_job,
-						 list);
-
-			/* Is the B2R2 queue available? */
-			if (b2r2_core.active_jobs[job->queue] == NULL) {
-				/* Can we acquire resources? */
-				if (!job->acquire_resources ||
-				    job->acquire_resources(job, atomic) == 0) {
-					/* Ok to dispatch job */
-
-					/* Remove from list */
-					list_del_init(&job->list);
-
-					/* The job is now active */
-					b2r2_core.active_jobs[job->queue] = job;
-					b2r2_core.n_active_jobs++;
-					job->jiffies = jiffies;
-					b2r2_core.jiffies_last_active =
-						jiffies;
-
-					/* Kick off B2R2 */
-					trigger_job(job);
-
-					dispatched_job = true;
-					n_dispatched++;
+	for (queue = 0; queue < B2R2_NUM_APPLICATIONS_QUEUES; queue++) {
+		struct b2r2_core_job *job;
 
-#ifdef HANDLE_TIMEOUTED_JOBS
-					/* Check in one half second
-					   if it hangs */
-					queue_delayed_work(
-						b2r2_core.work_queue,
-						&b2r2_core.timeout_work,
-						HZ/2);
-#endif
-				} else {
-					/* No resources */
-					if (!atomic &&
-					    b2r2_core.n_active_jobs == 0) {
-						b2r2_log_warn(
-							"%s: No resource",
-							__func__);
-						cancel_job(job);
-					}
-				}
+		if (list_empty(&b2r2_core.prio_queue))
+			break;
+
+		/* Is the B2R2 queue available? */
+		if (b2r2_core.active_jobs[queue] != NULL)
+			continue;
+
+		job = pick_job_for_queue((enum b2r2_core_queue)queue);
+		if (job == NULL)
+			continue;
+
+		/* Can we acquire resources? */
+		if (job->acquire_resources &&
+		    job->acquire_resources(job, atomic) != 0) {
+			/* No resources, leave the queue idle for now so
+			   that the job keeps its place in line */
+			if (!atomic && b2r2_core.n_active_jobs == 0) {
+				b2r2_log_warn("%s: No resource", __func__);
+				cancel_job(job);
 			}
+			continue;
 		}
-	} while (dispatched_job);
+
+		/* Ok to dispatch job */
+
+		/* Remove from list */
+		list_del_init(&job->list);
+
+		/* The job is now active */
+		b2r2_core.active_jobs[queue] = job;
+		b2r2_core.n_active_jobs++;
+		b2r2_core.queue_last_tag[queue] = job->tag;
+		b2r2_core.queue_start_time[queue] = b2r2_get_curr_nsec();
+		b2r2_core.stat_n_queue_jobs[queue]++;
+		job->jiffies = jiffies;
+		b2r2_core.jiffies_last_active = jiffies;
+
+		/* Kick off B2R2 */
+		trigger_job(job);
+
+		n_dispatched++;
+	}
+
+#ifdef HANDLE_TIMEOUTED_JOBS
+	/* Check in one half second if it hangs */
+	if (n_dispatched)
+		queue_delayed_work(b2r2_core.work_queue,
+				   &b2r2_core.timeout_work, HZ/2);
+#endif
 
 	b2r2_core.stat_n_jobs_in_prio_list -= n_dispatched;
 }
@@ -1579,8 +1657,7 @@ static void handle_queue_event(enum b2r2_core_queue queue)
 
 		/* Remove from queue */
 		BUG_ON(b2r2_core.n_active_jobs == 0);
-		b2r2_core.active_jobs[queue] = NULL;
-		b2r2_core.n_active_jobs--;
+		remove_active_job(queue);
 	}
 
 	if (!job) {
@@ -2119,6 +2196,17 @@ static int debugfs_b2r2_stat_read(struct file *filp, char __user *buf,
 	for (i = 0; i < ARRAY_SIZE(b2r2_core.active_jobs); i++)
 		dev_size += sprintf(Buf + dev_size, "Job in queue %d: %p\n",
 				    i, b2r2_core.active_jobs[i]);
+	for (i = 0; i < B2R2_NUM_APPLICATIONS_QUEUES; i++) {
+		u64 busy_usec = b2r2_core.stat_queue_busy_nsec[i];
+
+		do_div(busy_usec, 1000);
+		dev_size += sprintf(Buf + dev_size,
+				    "Queue %d: %lu jobs, busy %llu us\n",
+				    i, b2r2_core.stat_n_queue_jobs[i],
+				    (unsigned long long)busy_usec);
+	}
+	dev_size += sprintf(Buf + dev_size, "Fair picks: %lu\n",
+			    b2r2_core.stat_n_fair_picks);
 	dev_size += sprintf(Buf + dev_size, "Clock requests: %lu\n",
 			    b2r2_core.clock_request_count);
 
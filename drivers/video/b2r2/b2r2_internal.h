@@ -13,7 +13,8 @@
 #ifndef _LINUX_DRIVERS_VIDEO_B2R2_INTERNAL_H_
 #define _LINUX_DRIVERS_VIDEO_B2R2_INTERNAL_H_
 
-
+#include <linux/workqueue.h>
+#include <linux/hwmem.h>
 #include <video/b2r2_blt.h>
 
 #include "b2r2_core.h"
@@ -46,6 +47,8 @@ struct device *b2r2_blt_device(void);
  *                         in callback.
  * @synching: true if any client is waiting for b2r2_blt_synch(0)
  * @synch_done_waitq: Wait queue to handle synching on request_id 0
+ * @fence_wait_list: Requests waiting for their input fence before being
+ *                   added to B2R2
  */
 struct b2r2_blt_instance {
 	struct mutex lock;
@@ -58,6 +61,8 @@ struct b2r2_blt_instance {
 	u32 no_of_active_requests;
 	bool synching;
 	wait_queue_head_t synch_done_waitq;
+
+	struct list_head fence_wait_list;
 };
 
 /**
@@ -97,6 +102,8 @@ struct b2r2_node {
  * @file_physical_start: Physical address of file start
  * @file_virtual_start: Virtual address of file start
  * @file_len: File len
+ * @shared: true if @hwmem_alloc is owned by an earlier request in the
+ *          same batch and must not be released through this buffer
  *
  */
 struct b2r2_resolved_buf {
@@ -104,6 +111,7 @@ struct b2r2_resolved_buf {
 	void                 *virtual_address;
 	bool                  is_pmem;
 	struct hwmem_alloc   *hwmem_alloc;
+	bool                  shared;
 	/* Data for validation below */
 	struct file          *filep;
 	u32                   file_physical_start;
@@ -295,16 +303,35 @@ struct b2r2_node_split_job {
  * @src_mask_resolved: Calculated info about the source mask buffer
  * @dst_resolved: Calculated info about the destination buffer
  * @profile: True if the blit shall be profiled, false otherwise
+ * @batch: The batch the request is executed in, NULL if the request is
+ *         executed by its own job
+ * @nodes_configured: true if the node list is built and may be given to
+ *                    the node list cache when the request is released
+ * @in_fence: Fence to wait for before the job is added, or NULL
+ * @in_fence_waiter: Callback for @in_fence
+ * @in_fence_status: Status that @in_fence was signaled with
+ * @in_fence_work: Adds the job, or cancels the request, once @in_fence
+ *                 has been signaled
+ * @out_fence: Fence to signal when the request is done, or NULL
  */
 struct b2r2_blt_request {
 	struct b2r2_blt_instance   *instance;
 	struct list_head           list;
 	struct b2r2_blt_req        user_req;
 	struct b2r2_core_job       job;
+	struct b2r2_blt_batch      *batch;
 	struct b2r2_node_split_job node_split_job;
 	struct b2r2_node           *first_node;
+	bool                       nodes_configured;
 	int                        request_id;
 
+	/* Fences */
+	struct hwmem_fence         *in_fence;
+	struct hwmem_fence_waiter  in_fence_waiter;
+	int                        in_fence_status;
+	struct work_struct         in_fence_work;
+	struct hwmem_fence         *out_fence;
+
 	/* Resolved buffer addresses */
 	struct b2r2_resolved_buf src_resolved;
 	struct b2r2_resolved_buf src_mask_resolved;
@@ -327,6 +354,22 @@ struct b2r2_blt_request {
 	s32 total_time_nsec;
 };
 
+/**
+ * struct b2r2_blt_batch - Several blit requests executed as one B2R2 job
+ *
+ * @job: The B2R2 job, executing the chained node lists of all requests.
+ *       Holds the references for all requests in the batch.
+ * @instance: Back pointer to the instance structure
+ * @request_count: Number of requests in @requests
+ * @requests: The requests, in execution order
+ */
+struct b2r2_blt_batch {
+	struct b2r2_core_job       job;
+	struct b2r2_blt_instance   *instance;
+	u32                        request_count;
+	struct b2r2_blt_request    *requests[B2R2_BLT_MAX_BATCH_COUNT];
+};
+
 /* FIXME: The functions below should be removed when we are
    switching to the new Robert Lind allocator */
 
@@ -0,0 +1,313 @@
+/*
+ * Copyright (C) ST-Ericsson SA 2010
+ *
+ * ST-Ericsson B2R2 node list cache
+ *
+ * A composition typically repeats the same blits, with the same geometry,
+ * formats and flags, every frame. Instead of analyzing and splitting such
+ * requests again, the node list of a finished request is kept and reused
+ * for the next request of the same shape. Only the addresses of the
+ * source, source mask and destination buffers differ between the two, and
+ * these are moved by the difference between the old and the new buffer
+ * start.
+ *
+ * License terms: GNU General Public License (GPL), version 2.
+ */
+
+#include "b2r2_node_cache.h"
+
+#include "b2r2_internal.h"
+#include "b2r2_mem_alloc.h"
+#include "b2r2_utils.h"
+
+#include <video/b2r2_blt.h>
+
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+
+/* Max number of node lists in the cache */
+#define NODE_CACHE_SIZE 16
+
+/* Number of buffers per request: source, source mask and destination */
+#define NODE_CACHE_NBR_BUFS 3
+
+/* Flags that do not change the node list of a request */
+#define NODE_CACHE_IGNORED_FLAGS (B2R2_BLT_FLAG_ASYNCH | \
+		B2R2_BLT_FLAG_DRY_RUN | \
+		B2R2_BLT_FLAG_INHERIT_PRIO | \
+		B2R2_BLT_FLAG_SRC_NO_CACHE_FLUSH | \
+		B2R2_BLT_FLAG_SRC_MASK_NO_CACHE_FLUSH | \
+		B2R2_BLT_FLAG_DST_NO_CACHE_FLUSH | \
+		B2R2_BLT_FLAG_REPORT_WHEN_DONE | \
+		B2R2_BLT_FLAG_REPORT_PERFORMANCE)
+
+/**
+ * struct buf_range - Physical memory used by a buffer of a request
+ *
+ * @start: Physical start address
+ * @size: Size in bytes, 0 if the buffer is not used
+ */
+struct buf_range {
+	u32 start;
+	u32 size;
+};
+
+/**
+ * struct node_cache_entry - A cached node list
+ *
+ * @list: List item in the cache, most recently used first
+ * @key: The request the node list was built for, with everything that
+ *       does not affect the node list cleared
+ * @node_split_job: The node split job of the request
+ * @first_node: The node list
+ * @ranges: The buffers the addresses in the node list point into
+ */
+struct node_cache_entry {
+	struct list_head list;
+	struct b2r2_blt_req key;
+	struct b2r2_node_split_job node_split_job;
+	struct b2r2_node *first_node;
+	struct buf_range ranges[NODE_CACHE_NBR_BUFS];
+};
+
+static LIST_HEAD(node_cache);
+static u32 node_cache_count;
+static DEFINE_SPINLOCK(node_cache_lock);
+
+static void free_nodes(struct b2r2_node *first_node)
+{
+#ifdef B2R2_USE_NODE_GEN
+	b2r2_blt_free_nodes(first_node);
+#else
+	b2r2_node_free(first_node);
+#endif
+}
+
+static bool is_cacheable(const struct b2r2_blt_req *req)
+{
+	/* The look-up table is a per request copy */
+	return (req->flags & B2R2_BLT_FLAG_CLUT_COLOR_CORRECTION) == 0;
+}
+
+static void copy_img_shape(const struct b2r2_blt_img *img,
+		struct b2r2_blt_img *shape)
+{
+	shape->fmt = img->fmt;
+	shape->buf.type = img->buf.type;
+	shape->width = img->width;
+	shape->height = img->height;
+	shape->pitch = img->pitch;
+}
+
+static void make_key(const struct b2r2_blt_req *req, struct b2r2_blt_req *key)
+{
+	/* Cleared so that padding compares equal too */
+	memset(key, 0, sizeof(*key));
+
+	key->flags = req->flags & ~NODE_CACHE_IGNORED_FLAGS;
+	key->transform = req->transform;
+	copy_img_shape(&req->src_img, &key->src_img);
+	copy_img_shape(&req->src_mask, &key->src_mask);
+	key->src_rect = req->src_rect;
+	key->src_color = req->src_color;
+	copy_img_shape(&req->dst_img, &key->dst_img);
+	key->dst_rect = req->dst_rect;
+	key->dst_clip_rect = req->dst_clip_rect;
+	key->dst_color = req->dst_color;
+	key->global_alpha = req->global_alpha;
+}
+
+static void get_range(struct b2r2_blt_img *img,
+		struct b2r2_resolved_buf *resolved, struct buf_range *range)
+{
+	if (img->buf.type == B2R2_BLT_PTR_NONE) {
+		range->start = 0;
+		range->size = 0;
+	} else {
+		range->start = resolved->physical_address;
+		range->size = (u32)b2r2_get_img_size(img);
+	}
+}
+
+static void get_ranges(struct b2r2_blt_request *req,
+		struct buf_range ranges[NODE_CACHE_NBR_BUFS])
+{
+	get_range(&req->user_req.src_img, &req->src_resolved, &ranges[0]);
+	get_range(&req->user_req.src_mask, &req->src_mask_resolved,
+			&ranges[1]);
+	get_range(&req->user_req.dst_img, &req->dst_resolved, &ranges[2]);
+}
+
+static bool ranges_overlap(const struct buf_range *a,
+		const struct buf_range *b)
+{
+	return a->size != 0 && b->size != 0 &&
+			a->start < b->start + b->size &&
+			b->start < a->start + a->size;
+}
+
+static void relocate(u32 *addr, const struct buf_range *from,
+		const struct buf_range *to)
+{
+	int i;
+
+	for (i = 0; i < NODE_CACHE_NBR_BUFS; i++) {
+		if (from[i].size != 0 && *addr >= from[i].start &&
+				*addr - from[i].start < from[i].size) {
+			*addr = *addr - from[i].start + to[i].start;
+			return;
+		}
+	}
+}
+
+static void relocate_split_buf(struct b2r2_node_split_buf *buf,
+		const struct buf_range *from, const struct buf_range *to)
+{
+	relocate(&buf->addr, from, to);
+	relocate(&buf->chroma_addr, from, to);
+	relocate(&buf->chroma_cr_addr, from, to);
+}
+
+static void relocate_nodes(struct b2r2_node *node,
+		const struct buf_range *from, const struct buf_range *to)
+{
+	while (node != NULL) {
+		/* Temporary buffers are assigned before each execution */
+		if (!node->dst_tmp_index)
+			relocate(&node->node.GROUP1.B2R2_TBA, from, to);
+		if (!node->src_tmp_index || node->src_index != 1)
+			relocate(&node->node.GROUP3.B2R2_SBA, from, to);
+		if (!node->src_tmp_index || node->src_index != 2)
+			relocate(&node->node.GROUP4.B2R2_SBA, from, to);
+		if (!node->src_tmp_index || node->src_index != 3)
+			relocate(&node->node.GROUP5.B2R2_SBA, from, to);
+
+		node = node->next;
+	}
+}
+
+bool b2r2_node_cache_get(struct b2r2_blt_request *req)
+{
+	struct node_cache_entry *entry;
+	struct b2r2_blt_req key;
+	struct buf_range ranges[NODE_CACHE_NBR_BUFS];
+	unsigned long flags;
+	bool found = false;
+
+	if (!is_cacheable(&req->user_req))
+		return false;
+
+	make_key(&req->user_req, &key);
+
+	spin_lock_irqsave(&node_cache_lock, flags);
+	list_for_each_entry(entry, &node_cache, list) {
+		if (memcmp(&entry->key, &key, sizeof(key)) == 0) {
+			list_del(&entry->list);
+			node_cache_count--;
+			found = true;
+			break;
+		}
+	}
+	spin_unlock_irqrestore(&node_cache_lock, flags);
+
+	if (!found)
+		return false;
+
+	get_ranges(req, ranges);
+	relocate_nodes(entry->first_node, entry->ranges, ranges);
+	relocate_split_buf(&entry->node_split_job.src, entry->ranges, ranges);
+	relocate_split_buf(&entry->node_split_job.dst, entry->ranges, ranges);
+
+	req->node_split_job = entry->node_split_job;
+	req->first_node = entry->first_node;
+	req->buf_count = req->node_split_job.buf_count;
+	if (req->buf_count > 0)
+		req->bufs = &req->node_split_job.work_bufs[0];
+
+	kfree(entry);
+
+	return true;
+}
+
+bool b2r2_node_cache_put(struct b2r2_blt_request *req)
+{
+	struct node_cache_entry *entry;
+	struct node_cache_entry *evicted = NULL;
+	struct b2r2_node *last_node;
+	unsigned long flags;
+	int i;
+	int j;
+
+	if (!req->nodes_configured || req->first_node == NULL ||
+			!is_cacheable(&req->user_req))
+		return false;
+
+	entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+	if (entry == NULL)
+		return false;
+
+	/*
+	 * Addresses are moved to the new buffers by looking at which buffer
+	 * they point into, which is ambiguous if the buffers overlap.
+	 */
+	get_ranges(req, entry->ranges);
+	for (i = 0; i < NODE_CACHE_NBR_BUFS; i++) {
+		for (j = i + 1; j < NODE_CACHE_NBR_BUFS; j++) {
+			if (ranges_overlap(&entry->ranges[i],
+					&entry->ranges[j])) {
+				kfree(entry);
+				return false;
+			}
+		}
+	}
+
+	make_key(&req->user_req, &entry->key);
+	entry->node_split_job = req->node_split_job;
+	entry->first_node = req->first_node;
+
+	/* A batch may have chained the list to the one of another request */
+	last_node = entry->first_node;
+	while (last_node->next != NULL)
+		last_node = last_node->next;
+	last_node->node.GROUP0.B2R2_NIP = 0;
+
+	spin_lock_irqsave(&node_cache_lock, flags);
+	list_add(&entry->list, &node_cache);
+	if (++node_cache_count > NODE_CACHE_SIZE) {
+		evicted = list_entry(node_cache.prev,
+				struct node_cache_entry, list);
+		list_del(&evicted->list);
+		node_cache_count--;
+	}
+	spin_unlock_irqrestore(&node_cache_lock, flags);
+
+	if (evicted != NULL) {
+		free_nodes(evicted->first_node);
+		kfree(evicted);
+	}
+
+	req->first_node = NULL;
+
+	return true;
+}
+
+void b2r2_node_cache_flush(void)
+{
+	struct node_cache_entry *entry;
+	struct node_cache_entry *tmp;
+	unsigned long flags;
+	LIST_HEAD(entries);
+
+	spin_lock_irqsave(&node_cache_lock, flags);
+	list_splice_init(&node_cache, &entries);
+	node_cache_count = 0;
+	spin_unlock_irqrestore(&node_cache_lock, flags);
+
+	list_for_each_entry_safe(entry, tmp, &entries, list) {
+		free_nodes(entry->first_node);
+		kfree(entry);
+	}
+}
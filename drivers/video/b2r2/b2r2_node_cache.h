@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) ST-Ericsson SA 2010
+ *
+ * ST-Ericsson B2R2 node list cache
+ *
+ * License terms: GNU General Public License (GPL), version 2.
+ */
+
+#ifndef _LINUX_DRIVERS_VIDEO_B2R2_NODE_CACHE_H_
+#define _LINUX_DRIVERS_VIDEO_B2R2_NODE_CACHE_H_
+
+#include "b2r2_internal.h"
+
+/**
+ * b2r2_node_cache_get() - Takes a node list built for an earlier request
+ *                         of the same shape from the cache
+ *
+ * @req: The request, with resolved buffers
+ *
+ * On a hit the node list and the node split job of @req are set up from
+ * the cached ones, with the buffer addresses moved to the buffers of @req.
+ *
+ * Returns true on a cache hit.
+ */
+bool b2r2_node_cache_get(struct b2r2_blt_request *req);
+
+/**
+ * b2r2_node_cache_put() - Gives the node list of a finished request to
+ *                         the cache
+ *
+ * @req: The request, must no longer be executed by B2R2
+ *
+ * Returns true if the cache took the node list. req->first_node is then
+ * set to NULL. If false is returned the caller must free the nodes.
+ */
+bool b2r2_node_cache_put(struct b2r2_blt_request *req);
+
+/**
+ * b2r2_node_cache_flush() - Frees all node lists in the cache
+ */
+void b2r2_node_cache_flush(void);
+
+#endif /* _LINUX_DRIVERS_VIDEO_B2R2_NODE_CACHE_H_ */
@@ -657,6 +657,7 @@ static int __devinit ws2401_probe(struct mcde_display_device *ddev)
 
 	ddev->prepare_for_update = NULL;
 	ddev->update = ws2401_update;
+	ddev->update_async = NULL;
 	ddev->try_video_mode = ws2401_try_video_mode;
 	ddev->set_video_mode = ws2401_set_video_mode;
 
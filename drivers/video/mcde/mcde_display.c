@@ -17,6 +17,10 @@
 /*temp*/
 #include <linux/delay.h>
 
+static int mcde_display_prepare_for_update_default(
+					struct mcde_display_device *ddev,
+					u16 x, u16 y, u16 w, u16 h);
+
 static void mcde_display_get_native_resolution_default(
 	struct mcde_display_device *ddev, u16 *x_res, u16 *y_res)
 {
@@ -253,6 +257,7 @@ static inline bool mcde_display_get_synchronized_update_default(
 static int mcde_display_apply_config_default(struct mcde_display_device *ddev)
 {
 	int ret;
+	bool partial;
 
 	ret = mcde_chnl_enable_synchronized_update(ddev->chnl_state,
 		ddev->synchronized_update);
@@ -264,6 +269,17 @@ static int mcde_display_apply_config_default(struct mcde_display_device *ddev)
 		return ret;
 	}
 
+	/*
+	 * Only the invalidated area of command mode panels is sent. The
+	 * channel then sets the panel window instead of prepare_for_update.
+	 */
+	partial = ddev->prepare_for_update ==
+				mcde_display_prepare_for_update_default &&
+				ddev->rotation == MCDE_DISPLAY_ROT_0;
+	ddev->partial_update =
+		!mcde_chnl_enable_partial_update(ddev->chnl_state, partial) &&
+		partial;
+
 	if (!ddev->update_flags)
 		return 0;
 
@@ -288,7 +304,13 @@ static int mcde_display_invalidate_area_default(
 					struct mcde_rectangle *area)
 {
 	dev_vdbg(&ddev->dev, "%s\n", __func__);
-	if (area) {
+	if (area && (ddev->update_area.w == 0 || ddev->update_area.h == 0)) {
+		ddev->update_area = *area;
+		ddev->update_area.w = min((u16) ddev->video_mode.xres,
+					(u16) ddev->update_area.w);
+		ddev->update_area.h = min((u16) ddev->video_mode.yres,
+					(u16) ddev->update_area.h);
+	} else if (area) {
 		/* take union of rects */
 		u16 t;
 		t = min(ddev->update_area.x, area->x);
@@ -308,6 +330,11 @@ static int mcde_display_invalidate_area_default(
 					(u16) ddev->update_area.w);
 		ddev->update_area.h = min((u16) ddev->video_mode.yres,
 					(u16) ddev->update_area.h);
+	} else if (ddev->partial_update) {
+		ddev->update_area.x = 0;
+		ddev->update_area.y = 0;
+		ddev->update_area.w = 0;
+		ddev->update_area.h = 0;
 	} else {
 		ddev->update_area.x = 0;
 		ddev->update_area.y = 0;
@@ -329,14 +356,23 @@ static int mcde_display_invalidate_area_default(
 	return 0;
 }
 
-static int mcde_display_update_default(struct mcde_display_device *ddev,
-							bool tripple_buffer)
+/* An asynchronous channel update is issued if seq is not NULL */
+static int display_update(struct mcde_display_device *ddev,
+					bool tripple_buffer, u32 *seq)
 {
 	int ret = 0;
-
-	/* TODO: Dirty */
-	if (ddev->prepare_for_update) {
-		/* TODO: Send dirty rectangle */
+	struct mcde_rectangle area = ddev->update_area;
+
+	if (ddev->partial_update) {
+		/* The panel memory is only known to be valid once it is on */
+		if (area.w == 0 || area.h == 0 || ddev->first_update ||
+				ddev->power_mode != MCDE_DISPLAY_PM_ON) {
+			area.x = 0;
+			area.y = 0;
+			area.w = ddev->video_mode.xres;
+			area.h = ddev->video_mode.yres;
+		}
+	} else if (ddev->prepare_for_update) {
 		ret = ddev->prepare_for_update(ddev, 0, 0,
 			ddev->native_x_res, ddev->native_y_res);
 		if (ret < 0) {
@@ -345,8 +381,10 @@ static int mcde_display_update_default(struct mcde_display_device *ddev,
 			return ret;
 		}
 	}
-	/* TODO: Calculate & set update rect */
-	ret = mcde_chnl_update(ddev->chnl_state, &ddev->update_area,
+	if (seq)
+		ret = mcde_chnl_update_async(ddev->chnl_state, &area, seq);
+	else
+		ret = mcde_chnl_update(ddev->chnl_state, &area,
 							tripple_buffer);
 	if (ret < 0) {
 		dev_warn(&ddev->dev, "%s:Failed to update channel\n", __func__);
@@ -370,6 +408,18 @@ static int mcde_display_update_default(struct mcde_display_device *ddev,
 	return 0;
 }
 
+static int mcde_display_update_default(struct mcde_display_device *ddev,
+							bool tripple_buffer)
+{
+	return display_update(ddev, tripple_buffer, NULL);
+}
+
+static int mcde_display_update_async_default(struct mcde_display_device *ddev,
+									u32 *seq)
+{
+	return display_update(ddev, false, seq);
+}
+
 static int mcde_display_prepare_for_update_default(
 					struct mcde_display_device *ddev,
 					u16 x, u16 y, u16 w, u16 h)
@@ -425,6 +475,7 @@ void mcde_display_init_device(struct mcde_display_device *ddev)
 	ddev->apply_config = mcde_display_apply_config_default;
 	ddev->invalidate_area = mcde_display_invalidate_area_default;
 	ddev->update = mcde_display_update_default;
+	ddev->update_async = mcde_display_update_async_default;
 	ddev->prepare_for_update = mcde_display_prepare_for_update_default;
 	ddev->on_first_update = mcde_display_on_first_update_default;
 
@@ -13,15 +13,23 @@
 #include <linux/device.h>
 #include <linux/err.h>
 #include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/workqueue.h>
+#include <linux/hwmem.h>
 
 #include <video/mcde_dss.h>
 
 #define to_overlay(x) container_of(x, struct mcde_overlay, kobj)
 
+/* Every DENSITY_CHECK:th pixel of every DENSITY_CHECK:th line is checked */
+#define DENSITY_CHECK 16
+
 void overlay_release(struct kobject *kobj)
 {
 	struct mcde_overlay *ovly = to_overlay(kobj);
 
+	if (ovly->fence)
+		hwmem_fence_put(ovly->fence);
 	kfree(ovly);
 }
 
@@ -29,6 +37,7 @@ struct kobj_type ovly_type = {
 	.release = overlay_release,
 };
 
+/* Called with display_lock held */
 static int apply_overlay(struct mcde_overlay *ovly,
 				struct mcde_overlay_info *info, bool force)
 {
@@ -38,9 +47,7 @@ static int apply_overlay(struct mcde_overlay *ovly,
 		 * add offset
 		 */
 		struct mcde_rectangle dirty = info->dirty;
-		mutex_lock(&ovly->ddev->display_lock);
 		ret = ovly->ddev->invalidate_area(ovly->ddev, &dirty);
-		mutex_unlock(&ovly->ddev->display_lock);
 	}
 
 	if (ovly->info.paddr != info->paddr || force)
@@ -67,6 +74,112 @@ static int apply_overlay(struct mcde_overlay *ovly,
 	return ret;
 }
 
+/*
+ * Called with display_lock held. Takes the pending fenced update off the
+ * overlay and returns its fence, for the caller to put after unlocking.
+ */
+static struct hwmem_fence *take_fenced_update(struct mcde_overlay *ovly)
+{
+	struct hwmem_fence *fence = ovly->fence;
+
+	/* If the waiter was already called, the work finds no fence */
+	if (fence)
+		hwmem_fence_remove_waiter(fence, &ovly->fence_waiter);
+	ovly->fence = NULL;
+
+	return fence;
+}
+
+static void drop_fenced_update(struct mcde_overlay *ovly)
+{
+	struct hwmem_fence *fence;
+
+	mutex_lock(&ovly->ddev->display_lock);
+	fence = take_fenced_update(ovly);
+	mutex_unlock(&ovly->ddev->display_lock);
+
+	if (fence)
+		hwmem_fence_put(fence);
+	cancel_work_sync(&ovly->fence_work);
+}
+
+/*
+ * Asynchronous if seq is not NULL. Displays without update_async are
+ * updated synchronously and report seq 0. Called with display_lock held.
+ */
+static int update_overlay(struct mcde_overlay *ovly, bool tripple_buffer,
+								u32 *seq)
+{
+	int ret;
+	dev_vdbg(&ovly->ddev->dev, "Overlay update, chnl=%d\n",
+							ovly->ddev->chnl_id);
+
+	if (!ovly->state || !ovly->ddev->update || !ovly->ddev->invalidate_area)
+		return -EINVAL;
+
+	if (seq)
+		*seq = 0;
+
+	/* Do not perform an update if power mode is off */
+	if (ovly->ddev->get_power_mode(ovly->ddev) == MCDE_DISPLAY_PM_OFF)
+		return 0;
+
+	if (seq && ovly->ddev->update_async)
+		ret = ovly->ddev->update_async(ovly->ddev, seq);
+	else
+		ret = ovly->ddev->update(ovly->ddev, tripple_buffer);
+	if (ret)
+		return ret;
+
+	return ovly->ddev->invalidate_area(ovly->ddev, NULL);
+}
+
+/* Atomic context, see struct hwmem_fence_waiter */
+static void overlay_fence_signaled(struct hwmem_fence_waiter *waiter,
+								int status)
+{
+	struct mcde_overlay *ovly = container_of(waiter, struct mcde_overlay,
+								fence_waiter);
+
+	schedule_work(&ovly->fence_work);
+}
+
+static void overlay_fence_work(struct work_struct *work)
+{
+	struct mcde_overlay *ovly = container_of(work, struct mcde_overlay,
+								fence_work);
+	struct mcde_overlay_fence_listener *listener;
+	struct hwmem_fence *fence;
+	u32 seq = 0;
+	int ret;
+
+	mutex_lock(&ovly->ddev->display_lock);
+	fence = ovly->fence;
+	/* Replaced or dropped since the waiter was called */
+	if (fence == NULL || hwmem_fence_status(fence) > 0) {
+		mutex_unlock(&ovly->ddev->display_lock);
+		return;
+	}
+	ovly->fence = NULL;
+	listener = ovly->fence_listener;
+
+	ret = hwmem_fence_status(fence);
+	if (ret) {
+		/* Keep showing the previous buffer rather than a torn one */
+		dev_warn(&ovly->ddev->dev, "Buffer not ready (%d), dropped\n",
+									ret);
+	} else if (ovly->state) {
+		apply_overlay(ovly, &ovly->fence_info, false);
+		ret = update_overlay(ovly, false, &seq);
+	} else {
+		ret = -EINVAL;
+	}
+	mutex_unlock(&ovly->ddev->display_lock);
+
+	hwmem_fence_put(fence);
+	listener->fence_done(listener, seq, ret);
+}
+
 /* MCDE DSS operations */
 
 int mcde_dss_open_channel(struct mcde_display_device *ddev)
@@ -197,6 +310,10 @@ struct mcde_overlay *mcde_dss_create_overlay(struct mcde_display_device *ddev,
 	mutex_unlock(&ddev->display_lock);
 	ovly->info = *info;
 	ovly->ddev = ddev;
+	ovly->fence_waiter.func = overlay_fence_signaled;
+	INIT_WORK(&ovly->fence_work, overlay_fence_work);
+	spin_lock_init(&ovly->check_lock);
+	mcde_dss_overlay_written(ovly, NULL);
 
 	return ovly;
 }
@@ -205,6 +322,7 @@ EXPORT_SYMBOL(mcde_dss_create_overlay);
 void mcde_dss_destroy_overlay(struct mcde_overlay *ovly)
 {
 	list_del(&ovly->list);
+	drop_fenced_update(ovly);
 	if (ovly->state)
 		mcde_dss_disable_overlay(ovly);
 	kobject_put(&ovly->kobj);
@@ -230,7 +348,9 @@ int mcde_dss_enable_overlay(struct mcde_overlay *ovly)
 		ovly->state = state;
 	}
 
+	mutex_lock(&ovly->ddev->display_lock);
 	apply_overlay(ovly, &ovly->info, true);
+	mutex_unlock(&ovly->ddev->display_lock);
 
 	dev_vdbg(&ovly->ddev->dev, "Overlay enabled, chnl=%d\n",
 							ovly->ddev->chnl_id);
@@ -241,14 +361,29 @@ EXPORT_SYMBOL(mcde_dss_enable_overlay);
 int mcde_dss_apply_overlay(struct mcde_overlay *ovly,
 						struct mcde_overlay_info *info)
 {
+	struct hwmem_fence *fence;
+	int ret;
+
 	if (info == NULL)
 		info = &ovly->info;
-	return apply_overlay(ovly, info, false);
+
+	mutex_lock(&ovly->ddev->display_lock);
+	/* The buffer applied now replaces the one waiting for its fence */
+	fence = take_fenced_update(ovly);
+	ret = apply_overlay(ovly, info, false);
+	mutex_unlock(&ovly->ddev->display_lock);
+
+	if (fence)
+		hwmem_fence_put(fence);
+
+	return ret;
 }
 EXPORT_SYMBOL(mcde_dss_apply_overlay);
 
 void mcde_dss_disable_overlay(struct mcde_overlay *ovly)
 {
+	drop_fenced_update(ovly);
+
 	if (!ovly->state)
 		return;
 
@@ -264,31 +399,185 @@ EXPORT_SYMBOL(mcde_dss_disable_overlay);
 int mcde_dss_update_overlay(struct mcde_overlay *ovly, bool tripple_buffer)
 {
 	int ret;
-	dev_vdbg(&ovly->ddev->dev, "Overlay update, chnl=%d\n",
-							ovly->ddev->chnl_id);
 
-	if (!ovly->state || !ovly->ddev->update || !ovly->ddev->invalidate_area)
+	mutex_lock(&ovly->ddev->display_lock);
+	ret = update_overlay(ovly, tripple_buffer, NULL);
+	mutex_unlock(&ovly->ddev->display_lock);
+
+	return ret;
+}
+EXPORT_SYMBOL(mcde_dss_update_overlay);
+
+int mcde_dss_update_overlay_async(struct mcde_overlay *ovly, u32 *seq)
+{
+	int ret;
+
+	mutex_lock(&ovly->ddev->display_lock);
+	ret = update_overlay(ovly, false, seq);
+	mutex_unlock(&ovly->ddev->display_lock);
+
+	return ret;
+}
+EXPORT_SYMBOL(mcde_dss_update_overlay_async);
+
+int mcde_dss_update_overlay_fenced(struct mcde_overlay *ovly,
+	struct mcde_overlay_info *info, struct hwmem_fence *fence,
+	struct mcde_overlay_fence_listener *listener)
+{
+	struct hwmem_fence *old;
+
+	if (!ovly->state)
 		return -EINVAL;
 
+	hwmem_fence_get(fence);
+
 	mutex_lock(&ovly->ddev->display_lock);
-	/* Do not perform an update if power mode is off */
-	if (ovly->ddev->get_power_mode(ovly->ddev) == MCDE_DISPLAY_PM_OFF) {
-		ret = 0;
-		goto power_mode_off;
+	old = take_fenced_update(ovly);
+	ovly->fence = fence;
+	ovly->fence_info = *info;
+	ovly->fence_listener = listener;
+	/* Signaled already, the work does the update right away */
+	if (hwmem_fence_add_waiter(fence, &ovly->fence_waiter))
+		schedule_work(&ovly->fence_work);
+	mutex_unlock(&ovly->ddev->display_lock);
+
+	if (old)
+		hwmem_fence_put(old);
+
+	return 0;
+}
+EXPORT_SYMBOL(mcde_dss_update_overlay_fenced);
+
+int mcde_dss_add_frame_listener(struct mcde_display_device *ddev,
+			struct mcde_chnl_frame_listener *listener)
+{
+	if (!ddev->chnl_state)
+		return -EINVAL;
+
+	mcde_chnl_add_frame_listener(ddev->chnl_state, listener);
+	return 0;
+}
+EXPORT_SYMBOL(mcde_dss_add_frame_listener);
+
+void mcde_dss_remove_frame_listener(struct mcde_display_device *ddev,
+			struct mcde_chnl_frame_listener *listener)
+{
+	if (ddev->chnl_state)
+		mcde_chnl_remove_frame_listener(ddev->chnl_state, listener);
+}
+EXPORT_SYMBOL(mcde_dss_remove_frame_listener);
+
+void mcde_dss_overlay_written(struct mcde_overlay *ovly,
+	struct mcde_rectangle *area)
+{
+	unsigned long flags;
+	struct mcde_rectangle *r = &ovly->check_area;
+
+	spin_lock_irqsave(&ovly->check_lock, flags);
+	if (!area || r->w == 0 || r->h == 0) {
+		r->x = area ? area->x : 0;
+		r->y = area ? area->y : 0;
+		r->w = area ? area->w : ovly->info.w;
+		r->h = area ? area->h : ovly->info.h;
+	} else {
+		u16 x2 = max(r->x + r->w, area->x + area->w);
+		u16 y2 = max(r->y + r->h, area->y + area->h);
+
+		r->x = min(r->x, area->x);
+		r->y = min(r->y, area->y);
+		r->w = x2 - r->x;
+		r->h = y2 - r->y;
 	}
+	ovly->check_changed = true;
+	spin_unlock_irqrestore(&ovly->check_lock, flags);
+}
+EXPORT_SYMBOL(mcde_dss_overlay_written);
 
-	ret = ovly->ddev->update(ovly->ddev, tripple_buffer);
-	if (ret)
-		goto update_failed;
+/*
+ * Returns the first line of area that is not transparent or black, or the
+ * line below area if there is none. The sampled words of a line are or:ed
+ * together and tested once.
+ */
+static u16 find_opaque_line(struct mcde_overlay_info *info,
+						struct mcde_rectangle *area)
+{
+	u32 mask;
+	u16 x0 = ALIGN(area->x, DENSITY_CHECK);
+	u16 y = ALIGN(area->y, DENSITY_CHECK);
+	u16 x2 = min_t(u16, area->x + area->w, info->w);
+	u16 y2 = min_t(u16, area->y + area->h, info->h);
+
+	switch (info->fmt) {
+	case MCDE_OVLYPIXFMT_RGBX8888:
+	case MCDE_OVLYPIXFMT_RGBA8888:
+		mask = 0x00ffffff;
+		break;
+	case MCDE_OVLYPIXFMT_RGB565:
+		mask = 0xffff;
+		break;
+	default:
+		return area->y;
+	}
 
-	ret = ovly->ddev->invalidate_area(ovly->ddev, NULL);
+	for (; y < y2; y += DENSITY_CHECK) {
+		u8 *line = (u8 *)info->vaddr + y * info->stride;
+		u32 acc = 0;
+		u16 x;
+
+		if (mask == 0xffff) {
+			for (x = x0; x < x2; x += DENSITY_CHECK)
+				acc |= ((u16 *)line)[x];
+		} else {
+			for (x = x0; x < x2; x += DENSITY_CHECK)
+				acc |= ((u32 *)line)[x];
+		}
+		if (acc & mask)
+			return y;
+	}
 
-power_mode_off:
-update_failed:
-	mutex_unlock(&ovly->ddev->display_lock);
-	return ret;
+	return area->y + area->h;
 }
-EXPORT_SYMBOL(mcde_dss_update_overlay);
+
+bool mcde_dss_overlay_is_transparent(struct mcde_overlay *ovly)
+{
+	unsigned long flags;
+	struct mcde_rectangle area;
+	bool transparent;
+	u16 y;
+
+	spin_lock_irqsave(&ovly->check_lock, flags);
+	if (!ovly->check_changed) {
+		transparent = ovly->transparent;
+		spin_unlock_irqrestore(&ovly->check_lock, flags);
+		return transparent;
+	}
+	area = ovly->check_area;
+	ovly->check_changed = false;
+	spin_unlock_irqrestore(&ovly->check_lock, flags);
+
+	if (!ovly->info.vaddr)
+		return false;
+
+	y = area.y;
+	if (area.w && area.h)
+		y = find_opaque_line(&ovly->info, &area);
+	transparent = y >= area.y + area.h;
+
+	/*
+	 * Lines above the first opaque one are known to be transparent now,
+	 * unless the overlay was written meanwhile.
+	 */
+	spin_lock_irqsave(&ovly->check_lock, flags);
+	if (!ovly->check_changed) {
+		ovly->check_area.h -= min_t(u16, y - area.y, area.h);
+		ovly->check_area.y = min_t(u16, y, area.y + area.h);
+	}
+	ovly->transparent = transparent;
+	spin_unlock_irqrestore(&ovly->check_lock, flags);
+
+	return transparent;
+}
+EXPORT_SYMBOL(mcde_dss_overlay_is_transparent);
 
 void mcde_dss_get_overlay_info(struct mcde_overlay *ovly,
 				struct mcde_overlay_info *info) {
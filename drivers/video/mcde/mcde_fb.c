@@ -15,9 +15,11 @@
 #include <linux/fb.h>
 #include <linux/mm.h>
 #include <linux/dma-mapping.h>
+#include <linux/sched.h>
 
 #include <linux/hwmem.h>
 #include <linux/io.h>
+#include <linux/uaccess.h>
 
 #include <linux/console.h>
 
@@ -368,18 +370,18 @@ static void init_fb(struct fb_info *fbi)
 	fbi->flags = FBINFO_HWACCEL_DISABLED;
 	fbi->fbops = &fb_ops;
 	fbi->pseudo_palette = &mfb->pseudo_palette[0];
+	mfb->fbi = fbi;
 }
 
-static void get_ovly_info(struct fb_info *fbi, struct mcde_overlay *ovly,
-	struct mcde_overlay_info *info)
+static void get_ovly_info_at(struct fb_info *fbi, struct mcde_overlay *ovly,
+	u32 yoffset, struct mcde_overlay_info *info)
 {
 	struct mcde_fb *mfb = to_mcde_fb(fbi);
 
 	memset(info, 0, sizeof(*info));
-	info->paddr = fbi->fix.smem_start +
-		fbi->fix.line_length * fbi->var.yoffset;
+	info->paddr = fbi->fix.smem_start + fbi->fix.line_length * yoffset;
 	info->vaddr = (u32 *)(fbi->screen_base +
-		fbi->fix.line_length * fbi->var.yoffset);
+		fbi->fix.line_length * yoffset);
 	/* TODO: move mem check to check_var/pan_display */
 	if (info->paddr + fbi->fix.line_length * fbi->var.yres >
 		fbi->fix.smem_start + fbi->fix.smem_len) {
@@ -409,6 +411,12 @@ static void get_ovly_info(struct fb_info *fbi, struct mcde_overlay *ovly,
 	info->dirty.h = fbi->var.yres;
 }
 
+static void get_ovly_info(struct fb_info *fbi, struct mcde_overlay *ovly,
+	struct mcde_overlay_info *info)
+{
+	get_ovly_info_at(fbi, ovly, fbi->var.yoffset, info);
+}
+
 void vmode_to_var(struct mcde_video_mode *video_mode,
 	struct fb_var_screeninfo *var)
 {
@@ -583,6 +591,7 @@ static int apply_var(struct fb_info *fbi, struct mcde_display_device *ddev)
 
 		get_ovly_info(fbi, ovly, &info);
 		(void) mcde_dss_apply_overlay(ovly, &info);
+		mcde_dss_overlay_written(ovly, NULL);
 
 		num_buffers = var->yres_virtual / var->yres;
 		mcde_dss_update_overlay(ovly, num_buffers == 3);
@@ -591,6 +600,164 @@ static int apply_var(struct fb_info *fbi, struct mcde_display_device *ddev)
 	return 0;
 }
 
+/* Flip queue */
+
+/* Called with flip_lock held */
+static void flip_retire(struct mcde_fb *mfb, int status)
+{
+	struct mcde_fb_flip *flip = &mfb->flips[mfb->flip_head];
+
+	mfb->last_flip.id = flip->id;
+	mfb->last_flip.yoffset = flip->yoffset;
+	mfb->last_flip.queue_ns = ktime_to_ns(flip->queue);
+	mfb->last_flip.latch_ns = ktime_to_ns(flip->latch);
+	/* Frame done time, zero if the flip never reached the display */
+	mfb->last_flip.scanout_ns = status || !flip->seq ? 0 :
+						ktime_to_ns(ktime_get());
+
+	mfb->flip_head = (mfb->flip_head + 1) % MCDE_FB_FLIP_QUEUE_DEPTH;
+	mfb->flip_count--;
+	mfb->flip_submitted = false;
+	if (mfb->flip_count)
+		schedule_work(&mfb->flip_work);
+	wake_up_all(&mfb->flip_waitq);
+}
+
+/* Interrupt context, the frame of update seq (and earlier) is displayed */
+static void flip_frame_done(struct mcde_chnl_frame_listener *listener,
+							u32 seq, int status)
+{
+	struct mcde_fb *mfb = container_of(listener, struct mcde_fb,
+								flip_listener);
+	unsigned long flags;
+
+	spin_lock_irqsave(&mfb->flip_lock, flags);
+	mfb->flip_done_seq = seq;
+	if (mfb->flip_submitted &&
+			(s32)(seq - mfb->flips[mfb->flip_head].seq) >= 0)
+		flip_retire(mfb, status);
+	spin_unlock_irqrestore(&mfb->flip_lock, flags);
+}
+
+static void flip_work_function(struct work_struct *work)
+{
+	struct mcde_fb *mfb = container_of(work, struct mcde_fb, flip_work);
+	struct mcde_fb_flip *flip;
+	unsigned long flags;
+	u32 yoffset;
+	u32 seq = 0;
+	int ret = 0;
+	int i;
+
+	spin_lock_irqsave(&mfb->flip_lock, flags);
+	if (mfb->flip_submitted || !mfb->flip_count) {
+		spin_unlock_irqrestore(&mfb->flip_lock, flags);
+		return;
+	}
+	yoffset = mfb->flips[mfb->flip_head].yoffset;
+	spin_unlock_irqrestore(&mfb->flip_lock, flags);
+
+	for (i = 0; i < mfb->num_ovlys; i++) {
+		struct mcde_overlay *ovly = mfb->ovlys[i];
+		struct mcde_overlay_info info;
+
+		get_ovly_info_at(mfb->fbi, ovly, yoffset, &info);
+		(void) mcde_dss_apply_overlay(ovly, &info);
+		mcde_dss_overlay_written(ovly, NULL);
+		ret = mcde_dss_update_overlay_async(ovly, &seq);
+		if (ret)
+			break;
+	}
+
+	spin_lock_irqsave(&mfb->flip_lock, flags);
+	flip = &mfb->flips[mfb->flip_head];
+	flip->seq = seq;
+	flip->latch = ktime_get();
+	mfb->flip_submitted = true;
+	/*
+	 * No frame done event follows a failed update or one skipped because
+	 * the display is off, and the event may already have been seen.
+	 */
+	if (ret || !seq || (s32)(mfb->flip_done_seq - seq) >= 0)
+		flip_retire(mfb, ret);
+	spin_unlock_irqrestore(&mfb->flip_lock, flags);
+}
+
+static bool flip_queue_below(struct mcde_fb *mfb, int count)
+{
+	unsigned long flags;
+	bool below;
+
+	spin_lock_irqsave(&mfb->flip_lock, flags);
+	below = mfb->flip_count < count;
+	spin_unlock_irqrestore(&mfb->flip_lock, flags);
+
+	return below;
+}
+
+/* Waits until all queued flips are displayed */
+static void flip_drain(struct mcde_fb *mfb)
+{
+	if (mfb->flip_listener_added)
+		wait_event(mfb->flip_waitq, flip_queue_below(mfb, 1));
+}
+
+/*
+ * Queues a flip to yoffset. With n buffers, n - 2 flips may be queued ahead
+ * of the display while one buffer is drawn. Double buffering therefore waits
+ * for the flip to reach the display, like the synchronous update does.
+ */
+static int flip_queue(struct fb_info *fbi, u32 yoffset)
+{
+	struct mcde_fb *mfb = to_mcde_fb(fbi);
+	struct mcde_fb_flip *flip;
+	unsigned long flags;
+	int max_ahead;
+
+	max_ahead = fbi->var.yres_virtual / fbi->var.yres - 2;
+	max_ahead = clamp(max_ahead, 0, MCDE_FB_FLIP_QUEUE_DEPTH - 1);
+
+	/* Only pan_display queues, so a free slot stays free */
+	if (wait_event_interruptible(mfb->flip_waitq,
+			flip_queue_below(mfb, MCDE_FB_FLIP_QUEUE_DEPTH)))
+		return -ERESTARTSYS;
+
+	spin_lock_irqsave(&mfb->flip_lock, flags);
+	flip = &mfb->flips[(mfb->flip_head + mfb->flip_count) %
+						MCDE_FB_FLIP_QUEUE_DEPTH];
+	flip->id = ++mfb->flip_id;
+	flip->yoffset = yoffset;
+	flip->seq = 0;
+	flip->queue = ktime_get();
+	flip->latch = ktime_set(0, 0);
+	mfb->flip_count++;
+	if (!mfb->flip_submitted)
+		schedule_work(&mfb->flip_work);
+	spin_unlock_irqrestore(&mfb->flip_lock, flags);
+
+	/* The flip is queued, a signal only stops the wait for the display */
+	(void) wait_event_interruptible(mfb->flip_waitq,
+				flip_queue_below(mfb, max_ahead + 1));
+
+	return 0;
+}
+
+static int get_flip_times(struct fb_info *fbi, void __user *arg)
+{
+	struct mcde_fb *mfb = to_mcde_fb(fbi);
+	struct mcde_flip_times times;
+	unsigned long flags;
+
+	spin_lock_irqsave(&mfb->flip_lock, flags);
+	times = mfb->last_flip;
+	spin_unlock_irqrestore(&mfb->flip_lock, flags);
+
+	if (copy_to_user(arg, &times, sizeof(times)))
+		return -EFAULT;
+
+	return 0;
+}
+
 /* FB ops */
 
 static int mcde_fb_open(struct fb_info *fbi, int user)
@@ -626,6 +793,8 @@ static int mcde_fb_set_par(struct fb_info *fbi)
 
 	dev_vdbg(fbi->dev, "%s\n", __func__);
 
+	flip_drain(mfb);
+
 	if (mfb->ovlys[0]->state == NULL) {
 		printk(KERN_INFO "%s() - Enable fb %p\n",
 			__func__,
@@ -672,6 +841,7 @@ static int mcde_fb_blank(int blank, struct fb_info *fbi)
 static int mcde_fb_pan_display(struct fb_var_screeninfo *var,
 	struct fb_info *fbi)
 {
+	struct mcde_fb *mfb = to_mcde_fb(fbi);
 	struct mcde_display_device *ddev;
 	dev_vdbg(fbi->dev, "%s\n", __func__);
 
@@ -679,14 +849,26 @@ static int mcde_fb_pan_display(struct fb_var_screeninfo *var,
 					var->yoffset == fbi->var.yoffset)
 		return 0;
 
-	fbi->var.xoffset = var->xoffset;
-	fbi->var.yoffset = var->yoffset;
 	ddev = fb_to_display(fbi);
 	if (!ddev) {
 		printk(KERN_ERR "mcde_fb_check_var failed !ddev\n");
 		return -ENODEV;
 	}
 
+	if (mfb->flip_listener_added && ddev->update_async) {
+		int ret = flip_queue(fbi, var->yoffset);
+
+		if (ret)
+			return ret;
+		ddev->check_transparency = 60;
+		fbi->var.xoffset = var->xoffset;
+		fbi->var.yoffset = var->yoffset;
+		return 0;
+	}
+
+	fbi->var.xoffset = var->xoffset;
+	fbi->var.yoffset = var->yoffset;
+
 	return apply_var(fbi, ddev);
 }
 
@@ -695,6 +877,84 @@ static void mcde_fb_rotate(struct fb_info *fbi, int rotate)
 	dev_vdbg(fbi->dev, "%s\n", __func__);
 }
 
+/* Sends only the changed area of the visible buffer, if the display can */
+static int update_area(struct fb_info *fbi, void __user *arg)
+{
+	struct mcde_fb *mfb = to_mcde_fb(fbi);
+	struct mcde_update_area area;
+	int i;
+	int ret = 0;
+
+	if (copy_from_user(&area, arg, sizeof(area)))
+		return -EFAULT;
+
+	flip_drain(mfb);
+
+	if (area.w == 0 || area.h == 0 ||
+				area.x + area.w > fbi->var.xres ||
+				area.y + area.h > fbi->var.yres)
+		return -EINVAL;
+
+	for (i = 0; i < mfb->num_ovlys; i++) {
+		struct mcde_overlay *ovly = mfb->ovlys[i];
+		struct mcde_overlay_info info;
+
+		get_ovly_info(fbi, ovly, &info);
+		info.dirty.x = area.x;
+		info.dirty.y = area.y;
+		info.dirty.w = area.w;
+		info.dirty.h = area.h;
+		(void) mcde_dss_apply_overlay(ovly, &info);
+		mcde_dss_overlay_written(ovly, &info.dirty);
+		ret = mcde_dss_update_overlay(ovly, false);
+		if (ret)
+			break;
+	}
+
+	return ret;
+}
+
+/* Drawing done by the kernel is tracked for the transparency check */
+static void fb_written(struct fb_info *fbi)
+{
+	struct mcde_fb *mfb = to_mcde_fb(fbi);
+	int i;
+
+	for (i = 0; i < mfb->num_ovlys; i++)
+		mcde_dss_overlay_written(mfb->ovlys[i], NULL);
+}
+
+static ssize_t mcde_fb_write(struct fb_info *fbi, const char __user *buf,
+						size_t count, loff_t *ppos)
+{
+	ssize_t ret = fb_sys_write(fbi, buf, count, ppos);
+
+	if (ret > 0)
+		fb_written(fbi);
+	return ret;
+}
+
+static void mcde_fb_fillrect(struct fb_info *fbi,
+					const struct fb_fillrect *rect)
+{
+	sys_fillrect(fbi, rect);
+	fb_written(fbi);
+}
+
+static void mcde_fb_copyarea(struct fb_info *fbi,
+					const struct fb_copyarea *area)
+{
+	sys_copyarea(fbi, area);
+	fb_written(fbi);
+}
+
+static void mcde_fb_imageblit(struct fb_info *fbi,
+					const struct fb_image *image)
+{
+	sys_imageblit(fbi, image);
+	fb_written(fbi);
+}
+
 static int mcde_fb_ioctl(struct fb_info *fbi, unsigned int cmd,
 							 unsigned long arg)
 {
@@ -702,6 +962,10 @@ static int mcde_fb_ioctl(struct fb_info *fbi, unsigned int cmd,
 
 	if (cmd == MCDE_GET_BUFFER_NAME_IOC)
 		return mfb->alloc_name;
+	if (cmd == MCDE_UPDATE_AREA_IOC)
+		return update_area(fbi, (void __user *)arg);
+	if (cmd == MCDE_GET_FLIP_TIMES_IOC)
+		return get_flip_times(fbi, (void __user *)arg);
 
 	return -EINVAL;
 }
@@ -712,10 +976,10 @@ static struct fb_ops fb_ops = {
 	.fb_open        = mcde_fb_open,
 	.fb_release     = mcde_fb_release,
 	.fb_read        = fb_sys_read,
-	.fb_write       = fb_sys_write,
-	.fb_fillrect    = sys_fillrect,
-	.fb_copyarea    = sys_copyarea,
-	.fb_imageblit   = sys_imageblit,
+	.fb_write       = mcde_fb_write,
+	.fb_fillrect    = mcde_fb_fillrect,
+	.fb_copyarea    = mcde_fb_copyarea,
+	.fb_imageblit   = mcde_fb_imageblit,
 	.fb_check_var   = mcde_fb_check_var,
 	.fb_set_par     = mcde_fb_set_par,
 	.fb_blank       = mcde_fb_blank,
@@ -750,6 +1014,10 @@ struct fb_info *mcde_fb_create(struct mcde_display_device *ddev,
 	}
 	init_fb(fbi);
 	mfb = to_mcde_fb(fbi);
+	spin_lock_init(&mfb->flip_lock);
+	init_waitqueue_head(&mfb->flip_waitq);
+	INIT_WORK(&mfb->flip_work, flip_work_function);
+	mfb->flip_listener.frame_done = flip_frame_done;
 
 	ret = mcde_dss_open_channel(ddev);
 	if (ret)
@@ -791,6 +1059,10 @@ struct fb_info *mcde_fb_create(struct mcde_display_device *ddev,
 
 	ddev->fbi = fbi;
 
+	/* Without frame done events pans are synchronous */
+	mfb->flip_listener_added =
+		!mcde_dss_add_frame_listener(ddev, &mfb->flip_listener);
+
 
 //{{ Mark for GetLog - 2/2
 	frame_buf_mark.p_fb= (void*)fbi->fix.smem_start ;
@@ -850,10 +1122,17 @@ void mcde_fb_destroy(struct mcde_display_device *dev)
 
 	dev_vdbg(&dev->dev, "%s\n", __func__);
 
+	mfb = to_mcde_fb(dev->fbi);
+	if (mfb->flip_listener_added) {
+		flip_drain(mfb);
+		cancel_work_sync(&mfb->flip_work);
+		mcde_dss_remove_frame_listener(dev, &mfb->flip_listener);
+		mfb->flip_listener_added = false;
+	}
+
 	mcde_dss_disable_display(dev);
 	mcde_dss_close_channel(dev);
 
-	mfb = to_mcde_fb(dev->fbi);
 	for (i = 0; i < mfb->num_ovlys; i++) {
 		if (mfb->ovlys[i])
 			mcde_dss_destroy_overlay(mfb->ovlys[i]);
@@ -25,6 +25,9 @@
 #include <linux/slab.h>
 #include <linux/jiffies.h>
 #include <linux/workqueue.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <asm/div64.h>
 
 #include <video/mcde.h>
 #include <mach/prcmu.h>
@@ -67,6 +70,8 @@ static void dsi_te_poll_set_timer(struct mcde_chnl_state *chnl,
 		unsigned int timeout);
 static void dsi_te_timer_function(unsigned long value);
 static int wait_for_vcmp(struct mcde_chnl_state *chnl);
+static int dsi_dcs_write(struct mcde_chnl_state *chnl, u8 cmd, u8 *data,
+								int len);
 static void probe_hw(void);
 static void wait_for_flow_disabled(struct mcde_chnl_state *chnl);
 static void mcde_underflow_handler(void);
@@ -114,6 +119,10 @@ static struct work_struct mcde_underflow_work;
 static struct workqueue_struct *mcde_underflow_workqueue;
 static u8 dsi_pll_is_enabled;
 
+#ifdef CONFIG_DEBUG_FS
+static struct dentry *mcde_debugfs_dir;
+#endif
+
 static struct mutex mcde_hw_lock;
 static inline void mcde_lock(const char *func, int line)
 {
@@ -371,6 +380,36 @@ struct mcde_chnl_state {
 
 	bool formatter_updated;
 	bool esram_is_enabled;
+
+	/*
+	 * Asynchronous updates. The newest update is latched in the pending
+	 * slot and written by async_work once the frame in flight (applied
+	 * but not yet done) has been completed by VCMP.
+	 */
+	spinlock_t async_lock;
+	struct work_struct async_work;
+	bool async_pending;
+	struct mcde_rectangle async_area;
+	u32 async_seq;
+	u32 async_applied_seq;
+	u32 async_done_seq;
+	struct list_head frame_listeners;
+
+	/*
+	 * Partial updates of DSI command mode panels. The channel then owns
+	 * the column/page address window of the panel, win is the window of
+	 * the last transfer.
+	 */
+	bool partial_update;
+	bool partial_active;
+	struct mcde_rectangle win;
+
+	/* Transfer stats, updated at VCMP under async_lock */
+	u64 tx_bytes;
+	u32 tx_frames;
+	unsigned long tx_window_start;
+	u64 tx_window_bytes;
+	u64 tx_bytes_per_sec;
 };
 
 static struct mcde_chnl_state *channels;
@@ -891,6 +930,44 @@ static struct mcde_chnl_state *find_channel_by_dsilink(int link)
 	return NULL;
 }
 
+/* Called with async_lock held */
+static void chnl_async_done(struct mcde_chnl_state *chnl, u32 seq,
+								int status)
+{
+	struct mcde_chnl_frame_listener *listener;
+
+	chnl->async_applied_seq = seq;
+	chnl->async_done_seq = seq;
+	list_for_each_entry(listener, &chnl->frame_listeners, list)
+		listener->frame_done(listener, seq, status);
+}
+
+/* Called with async_lock held, once per transferred frame */
+static void chnl_account_tx(struct mcde_chnl_state *chnl)
+{
+	u32 bytes = ((u32)chnl->regs.ppl * chnl->regs.lpf * chnl->regs.bpp) >> 3;
+	unsigned long now = jiffies;
+
+	chnl->tx_bytes += bytes;
+	chnl->tx_frames++;
+
+	if (time_after(now, chnl->tx_window_start + HZ)) {
+		u64 rate = chnl->tx_window_bytes * HZ;
+
+		do_div(rate, now - chnl->tx_window_start);
+		chnl->tx_bytes_per_sec = rate;
+		chnl->tx_window_start = now;
+		chnl->tx_window_bytes = 0;
+	}
+	chnl->tx_window_bytes += bytes;
+}
+
+static inline bool chnl_async_busy(struct mcde_chnl_state *chnl)
+{
+	return ACCESS_ONCE(chnl->async_applied_seq) !=
+					ACCESS_ONCE(chnl->async_done_seq);
+}
+
 static inline void mcde_handle_vcmp(struct mcde_chnl_state *chnl)
 {
 	if (!chnl->vcmp_per_field ||
@@ -898,6 +975,12 @@ static inline void mcde_handle_vcmp(struct mcde_chnl_state *chnl)
 		atomic_inc(&chnl->vcmp_cnt);
 		if (chnl->state == CHNLSTATE_STOPPING)
 			set_channel_state_atomic(chnl, CHNLSTATE_STOPPED);
+
+		spin_lock(&chnl->async_lock);
+		chnl_account_tx(chnl);
+		if (chnl_async_busy(chnl))
+			chnl_async_done(chnl, chnl->async_applied_seq, 0);
+		spin_unlock(&chnl->async_lock);
 		wake_up_all(&chnl->vcmp_waitq);
 
 		if (chnl->port.update_auto_trig &&
@@ -1496,6 +1579,7 @@ static void update_overlay_registers(struct mcde_chnl_state *chnl,
 	u32 tmrgn = (regs->cropy + update_y) * stride;
 	u32 ppl = regs->ppl - update_x;
 	u32 lpf = regs->lpf - update_y;
+	bool enabled = regs->enabled;
 	s32 ljinc = stride;
 	u32 pixelfetchwtrmrklevel;
 	u8  nr_of_bufs = 1;
@@ -1528,6 +1612,33 @@ static void update_overlay_registers(struct mcde_chnl_state *chnl,
 		opp_requested = false;
 	}
 
+	if (chnl->partial_active) {
+		/*
+		 * Fetch only the part of the overlay inside the update window
+		 * and place it relative to the window.
+		 */
+		u16 x0 = max_t(u16, update_x, regs->xpos);
+		u16 y0 = max_t(u16, update_y, regs->ypos);
+		u16 x1 = min_t(u16, update_x + update_w, regs->xpos + regs->ppl);
+		u16 y1 = min_t(u16, update_y + update_h, regs->ypos + regs->lpf);
+
+		if (x1 <= x0 || y1 <= y0) {
+			enabled = false;
+			x1 = x0 + 1;
+			y1 = y0 + 1;
+		}
+		lmrgn = (regs->cropx + x0 - regs->xpos) * regs->bits_per_pixel;
+		tmrgn = (regs->cropy + y0 - regs->ypos) * stride;
+		ppl = x1 - x0;
+		lpf = y1 - y0;
+
+		mcde_wreg(MCDE_OVL0COMP + idx * MCDE_OVL0COMP_GROUPOFFSET,
+			MCDE_OVL0COMP_XPOS(x0 - update_x) |
+			MCDE_OVL0COMP_CH_ID(regs->ch_id) |
+			MCDE_OVL0COMP_YPOS(y0 - update_y) |
+			MCDE_OVL0COMP_Z(regs->z));
+	}
+
 	if (rotation == MCDE_DISPLAY_ROT_180_CCW) {
 		ljinc = -ljinc;
 		tmrgn += stride * (regs->lpf - 1) / 8;
@@ -1602,7 +1713,7 @@ static void update_overlay_registers(struct mcde_chnl_state *chnl,
 		MCDE_EXTSRC0CR_FS_DIV_DISABLE(false) |
 		MCDE_EXTSRC0CR_FORCE_FS_DIV(false));
 	mcde_wreg(MCDE_OVL0CR + idx * MCDE_OVL0CR_GROUPOFFSET,
-		MCDE_OVL0CR_OVLEN(regs->enabled) |
+		MCDE_OVL0CR_OVLEN(enabled) |
 	MCDE_OVL0CR_COLCCTRL(regs->col_conv) |
 		MCDE_OVL0CR_CKEYGEN(false) |
 		MCDE_OVL0CR_ALPHAPMEN(false) |
@@ -1957,8 +2068,15 @@ void update_channel_registers(enum mcde_chnl chnl_id, struct chnl_regs *regs,
 		else
 			fidx = 2 * port->link + port->ifc;
 
-		screen_ppl = video_mode->xres;
-		screen_lpf = video_mode->yres;
+		/* A command mode frame is only the update window */
+		if (port->mode == MCDE_PORTMODE_CMD &&
+						!video_mode->interlaced) {
+			screen_ppl = regs->ppl;
+			screen_lpf = regs->lpf;
+		} else {
+			screen_ppl = video_mode->xres;
+			screen_lpf = video_mode->yres;
+		}
 
 		if (screen_ppl == SCREEN_PPL_HIGH) {
 			pkt_div = (screen_ppl - 1) /
@@ -2114,7 +2232,10 @@ static int enable_mcde_hw(void)
 }
 
 /* DSI */
-int mcde_dsi_dcs_write(struct mcde_chnl_state *chnl, u8 cmd, u8* data, int len)
+
+/* Called with mcde_hw_lock held */
+static int dsi_dcs_write(struct mcde_chnl_state *chnl, u8 cmd, u8 *data,
+								int len)
 {
 	int i;
 	u32 wrdat[4] = { 0, 0, 0, 0 };
@@ -2129,12 +2250,8 @@ int mcde_dsi_dcs_write(struct mcde_chnl_state *chnl, u8 cmd, u8* data, int len)
 	if (len > MCDE_MAX_DCS_WRITE || chnl->port.type != MCDE_PORTTYPE_DSI)
 		return -EINVAL;
 
-	mcde_lock(__func__, __LINE__);
-
-	if (enable_mcde_hw()) {
-		mcde_unlock(__func__, __LINE__);
+	if (enable_mcde_hw())
 		return -EINVAL;
-	}
 	if (!chnl->formatter_updated)
 		(void)update_channel_static_registers(chnl);
 
@@ -2182,9 +2299,18 @@ int mcde_dsi_dcs_write(struct mcde_chnl_state *chnl, u8 cmd, u8* data, int len)
 
 	set_channel_state_atomic(chnl, CHNLSTATE_IDLE);
 
+	return 0;
+}
+
+int mcde_dsi_dcs_write(struct mcde_chnl_state *chnl, u8 cmd, u8* data, int len)
+{
+	int ret;
+
+	mcde_lock(__func__, __LINE__);
+	ret = dsi_dcs_write(chnl, cmd, data, len);
 	mcde_unlock(__func__, __LINE__);
 
-	return 0;
+	return ret;
 }
 
 int mcde_dsi_dcs_read(struct mcde_chnl_state *chnl, u8 cmd, u8* data, int *len)
@@ -2495,10 +2621,10 @@ static void setup_channel(struct mcde_chnl_state *chnl)
 }
 
 static void chnl_update_continous(struct mcde_chnl_state *chnl,
-						bool tripple_buffer)
+						bool tripple_buffer, bool async)
 {
 	if (chnl->state == CHNLSTATE_RUNNING) {
-		if (!tripple_buffer)
+		if (!tripple_buffer && !async)
 			wait_for_vcmp(chnl);
 		return;
 	}
@@ -2569,26 +2695,108 @@ static void chnl_update_overlay(struct mcde_chnl_state *chnl,
 	}
 }
 
+static void chnl_mark_overlays_dirty(struct mcde_chnl_state *chnl)
+{
+	if (chnl->ovly0 && chnl->ovly0->inuse)
+		chnl->ovly0->regs.dirty = true;
+	if (chnl->ovly1 && chnl->ovly1->inuse)
+		chnl->ovly1->regs.dirty = true;
+}
+
+static bool chnl_partial_capable(struct mcde_chnl_state *chnl)
+{
+	return chnl->port.type == MCDE_PORTTYPE_DSI &&
+		chnl->port.mode == MCDE_PORTMODE_CMD &&
+		!chnl->regs.roten && !chnl->vmode.interlaced;
+}
+
+/*
+ * Clips area to the screen and moves the channel and the panel column/page
+ * address window to it. Only the window is then sent over the link.
+ */
+static int chnl_update_window(struct mcde_chnl_state *chnl,
+						struct mcde_rectangle *area)
+{
+	u16 xres = chnl->vmode.xres;
+	u16 yres = chnl->vmode.yres;
+	u8 params[8];
+	int ret;
+
+	if (area->x >= xres || area->y >= yres)
+		return -EINVAL;
+	area->w = min_t(u16, area->w, xres - area->x);
+	area->h = min_t(u16, area->h, yres - area->y);
+
+	/* Overlay positions are window relative while partial */
+	if (chnl->partial_active || area->w != xres || area->h != yres)
+		chnl_mark_overlays_dirty(chnl);
+	chnl->partial_active = area->w != xres || area->h != yres;
+
+	if (!memcmp(&chnl->win, area, sizeof(*area)))
+		return 0;
+
+	params[0] = area->x >> 8;
+	params[1] = area->x & 0xff;
+	params[2] = (area->x + area->w - 1) >> 8;
+	params[3] = (area->x + area->w - 1) & 0xff;
+	params[4] = area->y >> 8;
+	params[5] = area->y & 0xff;
+	params[6] = (area->y + area->h - 1) >> 8;
+	params[7] = (area->y + area->h - 1) & 0xff;
+
+	ret = dsi_dcs_write(chnl, DCS_CMD_SET_COLUMN_ADDRESS, &params[0], 4);
+	if (!ret)
+		ret = dsi_dcs_write(chnl, DCS_CMD_SET_PAGE_ADDRESS,
+								&params[4], 4);
+	if (ret) {
+		/* Unknown panel window, resend it next time */
+		memset(&chnl->win, 0, sizeof(chnl->win));
+		return ret;
+	}
+
+	chnl->win = *area;
+	chnl->regs.dirty = true;
+
+	return 0;
+}
+
+/*
+ * Asynchronous updates (async) never wait for VCMP, async_work has already
+ * waited for the previous frame before calling this.
+ */
 static int _mcde_chnl_update(struct mcde_chnl_state *chnl,
 					struct mcde_rectangle *update_area,
-					bool tripple_buffer)
+					bool tripple_buffer, bool async)
 {
+	struct mcde_rectangle area;
+	int ret;
+
 	dev_vdbg(&mcde_dev->dev, "%s\n", __func__);
 
-	/* TODO: lock & make wait->trig async */
 	if (!chnl->enabled || !update_area
 			|| (update_area->w == 0 && update_area->h == 0)) {
 		return -EINVAL;
 	}
+	area = *update_area;
 
-	if (chnl->port.update_auto_trig && tripple_buffer)
+	if (chnl->port.update_auto_trig && tripple_buffer && !async)
 		wait_for_vcmp(chnl);
 
-	chnl->regs.x   = update_area->x;
-	chnl->regs.y   = update_area->y;
-	/* TODO Crop against video_mode.xres and video_mode.yres */
-	chnl->regs.ppl = update_area->w;
-	chnl->regs.lpf = update_area->h;
+	if (chnl->partial_update && chnl_partial_capable(chnl)) {
+		ret = chnl_update_window(chnl, &area);
+		if (ret < 0)
+			return ret;
+	} else if (chnl->partial_active) {
+		/* Back to full frames, the caller owns the panel window */
+		chnl->partial_active = false;
+		chnl->regs.dirty = true;
+		chnl_mark_overlays_dirty(chnl);
+	}
+
+	chnl->regs.x   = area.x;
+	chnl->regs.y   = area.y;
+	chnl->regs.ppl = area.w;
+	chnl->regs.lpf = area.h;
 	if (chnl->port.type == MCDE_PORTTYPE_DPI &&
 						chnl->port.phy.dpi.tv_mode) {
 		/* subtract border */
@@ -2603,7 +2811,7 @@ static int _mcde_chnl_update(struct mcde_chnl_state *chnl,
 	chnl_update_overlay(chnl, chnl->ovly1);
 
 	if (chnl->port.update_auto_trig)
-		chnl_update_continous(chnl, tripple_buffer);
+		chnl_update_continous(chnl, tripple_buffer, async);
 	else
 		chnl_update_non_continous(chnl);
 
@@ -2749,6 +2957,31 @@ int mcde_chnl_enable_synchronized_update(struct mcde_chnl_state *chnl,
 	return 0;
 }
 
+/*
+ * With partial updates the update area of DSI command mode channels is the
+ * only part sent to the panel, the channel sets the panel column/page
+ * address window itself.
+ */
+int mcde_chnl_enable_partial_update(struct mcde_chnl_state *chnl,
+								bool enable)
+{
+	dev_vdbg(&mcde_dev->dev, "%s\n", __func__);
+
+	if (!chnl->reserved || chnl->port.type != MCDE_PORTTYPE_DSI ||
+				chnl->port.mode != MCDE_PORTMODE_CMD)
+		return -EINVAL;
+
+	mcde_lock(__func__, __LINE__);
+	if (chnl->partial_update != enable) {
+		chnl->partial_update = enable;
+		/* The panel window is unknown, resend it */
+		memset(&chnl->win, 0, sizeof(chnl->win));
+	}
+	mcde_unlock(__func__, __LINE__);
+
+	return 0;
+}
+
 int mcde_chnl_set_power_mode(struct mcde_chnl_state *chnl,
 				enum mcde_display_power_mode power_mode)
 {
@@ -2782,6 +3015,23 @@ int mcde_chnl_apply(struct mcde_chnl_state *chnl)
 	return ret;
 }
 
+/* Called with mcde_hw_lock held */
+static int chnl_update(struct mcde_chnl_state *chnl,
+			struct mcde_rectangle *update_area,
+			bool tripple_buffer, bool async)
+{
+	enable_mcde_hw();
+	if (!chnl->formatter_updated)
+		(void)update_channel_static_registers(chnl);
+
+	if (chnl->regs.roten && !chnl->esram_is_enabled) {
+		WARN_ON_ONCE(regulator_enable(regulator_esram_epod));
+		chnl->esram_is_enabled = true;
+	}
+
+	return _mcde_chnl_update(chnl, update_area, tripple_buffer, async);
+}
+
 int mcde_chnl_update(struct mcde_chnl_state *chnl,
 					struct mcde_rectangle *update_area,
 					bool tripple_buffer)
@@ -2793,28 +3043,136 @@ int mcde_chnl_update(struct mcde_chnl_state *chnl,
 		return -EINVAL;
 
 	mcde_lock(__func__, __LINE__);
-	enable_mcde_hw();
-	if (!chnl->formatter_updated)
-		(void)update_channel_static_registers(chnl);
+	ret = chnl_update(chnl, update_area, tripple_buffer, false);
+	mcde_unlock(__func__, __LINE__);
 
-	if (chnl->regs.roten && !chnl->esram_is_enabled) {
-		WARN_ON_ONCE(regulator_enable(regulator_esram_epod));
-		chnl->esram_is_enabled = true;
-	}
+	dev_vdbg(&mcde_dev->dev, "%s exit with ret %d\n", __func__, ret);
+
+	return ret;
+}
+
+static void chnl_async_work_function(struct work_struct *ptr)
+{
+	struct mcde_chnl_state *chnl = container_of(ptr,
+					struct mcde_chnl_state, async_work);
+	struct mcde_rectangle area;
+	unsigned long flags;
+	u32 seq;
+	int ret;
 
-	ret = _mcde_chnl_update(chnl, update_area, tripple_buffer);
+	/* Only one frame in flight, the next one is written at its VCMP */
+	if (!wait_event_timeout(chnl->vcmp_waitq, !chnl_async_busy(chnl),
+					msecs_to_jiffies(CHNL_TIMEOUT))) {
+		dev_warn(&mcde_dev->dev, "Frame done timeout, chnl=%d\n",
+								chnl->id);
+		spin_lock_irqsave(&chnl->async_lock, flags);
+		if (chnl_async_busy(chnl))
+			chnl_async_done(chnl, chnl->async_applied_seq,
+								-ETIMEDOUT);
+		spin_unlock_irqrestore(&chnl->async_lock, flags);
+	}
+
+	spin_lock_irqsave(&chnl->async_lock, flags);
+	if (!chnl->async_pending) {
+		spin_unlock_irqrestore(&chnl->async_lock, flags);
+		return;
+	}
+	area = chnl->async_area;
+	seq = chnl->async_seq;
+	chnl->async_pending = false;
+	spin_unlock_irqrestore(&chnl->async_lock, flags);
 
+	mcde_lock(__func__, __LINE__);
+	ret = chnl_update(chnl, &area, false, true);
 	mcde_unlock(__func__, __LINE__);
 
-	dev_vdbg(&mcde_dev->dev, "%s exit with ret %d\n", __func__, ret);
+	/*
+	 * The frame is applied after the registers are written, a VCMP in
+	 * between only delays the frame done event by one frame.
+	 */
+	spin_lock_irqsave(&chnl->async_lock, flags);
+	if (ret < 0)
+		chnl_async_done(chnl, seq, ret);
+	else
+		chnl->async_applied_seq = seq;
+	spin_unlock_irqrestore(&chnl->async_lock, flags);
 
-	return ret;
+	dev_vdbg(&mcde_dev->dev, "%s seq=%u ret=%d\n", __func__, seq, ret);
+}
+
+/*
+ * Like mcde_chnl_update but returns without waiting for the hardware. An
+ * update issued while the previous frame is still in flight replaces any
+ * other pending update (the areas are merged). *seq identifies the update
+ * in the frame done events of the channel listeners.
+ */
+int mcde_chnl_update_async(struct mcde_chnl_state *chnl,
+			struct mcde_rectangle *update_area, u32 *seq)
+{
+	unsigned long flags;
+	struct mcde_rectangle *area = &chnl->async_area;
+
+	dev_vdbg(&mcde_dev->dev, "%s\n", __func__);
+
+	if (!chnl->reserved || !update_area ||
+			(update_area->w == 0 && update_area->h == 0))
+		return -EINVAL;
+
+	spin_lock_irqsave(&chnl->async_lock, flags);
+	if (chnl->async_pending) {
+		u16 x2 = max(area->x + area->w, update_area->x + update_area->w);
+		u16 y2 = max(area->y + area->h, update_area->y + update_area->h);
+
+		area->x = min(area->x, update_area->x);
+		area->y = min(area->y, update_area->y);
+		area->w = x2 - area->x;
+		area->h = y2 - area->y;
+	} else {
+		*area = *update_area;
+		chnl->async_pending = true;
+	}
+	*seq = ++chnl->async_seq;
+	spin_unlock_irqrestore(&chnl->async_lock, flags);
+
+	schedule_work(&chnl->async_work);
+
+	return 0;
+}
+
+void mcde_chnl_add_frame_listener(struct mcde_chnl_state *chnl,
+			struct mcde_chnl_frame_listener *listener)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&chnl->async_lock, flags);
+	list_add_tail(&listener->list, &chnl->frame_listeners);
+	spin_unlock_irqrestore(&chnl->async_lock, flags);
+}
+
+void mcde_chnl_remove_frame_listener(struct mcde_chnl_state *chnl,
+			struct mcde_chnl_frame_listener *listener)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&chnl->async_lock, flags);
+	list_del_init(&listener->list);
+	spin_unlock_irqrestore(&chnl->async_lock, flags);
 }
 
 void mcde_chnl_put(struct mcde_chnl_state *chnl)
 {
+	unsigned long flags;
+
 	dev_vdbg(&mcde_dev->dev, "%s\n", __func__);
 
+	/* Nobody may wait for frames of a channel that is going away */
+	cancel_work_sync(&chnl->async_work);
+	spin_lock_irqsave(&chnl->async_lock, flags);
+	chnl->async_pending = false;
+	if (chnl->async_done_seq != chnl->async_seq)
+		chnl_async_done(chnl, chnl->async_seq, -ECANCELED);
+	spin_unlock_irqrestore(&chnl->async_lock, flags);
+
 	if (chnl->enabled) {
 		stop_channel(chnl);
 		cancel_delayed_work(&hw_timeout_work);
@@ -3248,6 +3606,9 @@ static void probe_hw(void)
 
 		init_waitqueue_head(&channels[i].state_waitq);
 		init_waitqueue_head(&channels[i].vcmp_waitq);
+		spin_lock_init(&channels[i].async_lock);
+		INIT_WORK(&channels[i].async_work, chnl_async_work_function);
+		INIT_LIST_HEAD(&channels[i].frame_listeners);
 		init_timer(&channels[i].auto_sync_timer);
 		channels[i].auto_sync_timer.function =
 					watchdog_auto_sync_timer_function;
@@ -3310,6 +3671,72 @@ suspend_failed:
 	return;
 }
 
+#ifdef CONFIG_DEBUG_FS
+static int tx_stats_show(struct seq_file *m, void *v)
+{
+	int i;
+
+	seq_printf(m, "chnl        bytes   frames  bytes/s\n");
+	for (i = 0; i < num_channels; i++) {
+		struct mcde_chnl_state *chnl = &channels[i];
+		unsigned long flags;
+		unsigned long now = jiffies;
+		u64 bytes;
+		u64 rate;
+		u32 frames;
+
+		spin_lock_irqsave(&chnl->async_lock, flags);
+		bytes = chnl->tx_bytes;
+		frames = chnl->tx_frames;
+		rate = chnl->tx_bytes_per_sec;
+		/* Nothing sent for a while, the last window is stale */
+		if (time_after(now, chnl->tx_window_start + 2 * HZ)) {
+			rate = chnl->tx_window_bytes * HZ;
+			do_div(rate, now - chnl->tx_window_start);
+		}
+		spin_unlock_irqrestore(&chnl->async_lock, flags);
+
+		seq_printf(m, "%-4d %12llu %8u %8llu\n", i,
+				(unsigned long long)bytes, frames,
+				(unsigned long long)rate);
+	}
+
+	return 0;
+}
+
+static int tx_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, tx_stats_show, inode->i_private);
+}
+
+static const struct file_operations tx_stats_fops = {
+	.open = tx_stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static void mcde_debugfs_init(void)
+{
+	mcde_debugfs_dir = debugfs_create_dir("mcde", NULL);
+	if (IS_ERR_OR_NULL(mcde_debugfs_dir)) {
+		mcde_debugfs_dir = NULL;
+		return;
+	}
+	debugfs_create_file("tx_stats", 0444, mcde_debugfs_dir, NULL,
+							&tx_stats_fops);
+}
+
+static void mcde_debugfs_exit(void)
+{
+	debugfs_remove_recursive(mcde_debugfs_dir);
+	mcde_debugfs_dir = NULL;
+}
+#else
+static inline void mcde_debugfs_init(void) {}
+static inline void mcde_debugfs_exit(void) {}
+#endif
+
 static int __devinit mcde_probe(struct platform_device *pdev)
 {
 	int ret = 0;
@@ -3476,6 +3903,9 @@ static int __devinit mcde_probe(struct platform_device *pdev)
 
 		init_waitqueue_head(&channels[i].state_waitq);
 		init_waitqueue_head(&channels[i].vcmp_waitq);
+		spin_lock_init(&channels[i].async_lock);
+		INIT_WORK(&channels[i].async_work, chnl_async_work_function);
+		INIT_LIST_HEAD(&channels[i].frame_listeners);
 		init_timer(&channels[i].auto_sync_timer);
 		channels[i].auto_sync_timer.function =
 					watchdog_auto_sync_timer_function;
@@ -3497,6 +3927,8 @@ static int __devinit mcde_probe(struct platform_device *pdev)
 		goto failed_request_irq;
 	}
 
+	mcde_debugfs_init();
+
 	return 0;
 
 failed_hardware_version:
@@ -3535,6 +3967,8 @@ static int __devexit mcde_remove(struct platform_device *pdev)
 {
 	struct mcde_chnl_state *chnl = &channels[0];
 
+	mcde_debugfs_exit();
+
 	for (; chnl < &channels[num_channels]; chnl++) {
 		if (del_timer(&chnl->auto_sync_timer))
 			dev_vdbg(&mcde_dev->dev,
@@ -46,12 +46,24 @@ struct dispdev_buffer_info {
 	struct dispdev_config buf_cfg;
 };
 
+/*
+ * fence is a hwmem fence fd signaled when the buffer is ready, e.g. the
+ * output fence of the b2r2 blit rendering it, or -1. The buffer is not
+ * scanned out before the fence is signaled.
+ */
+struct dispdev_fenced_buffer_info {
+	struct dispdev_buffer_info buffer;
+	int32_t fence;
+};
+
 #define DISPDEV_SET_CONFIG_IOC        _IOW('D', 1, struct dispdev_config)
 #define DISPDEV_GET_CONFIG_IOC        _IOR('D', 2, struct dispdev_config)
 #define DISPDEV_REGISTER_BUFFER_IOC   _IO('D', 3)
 #define DISPDEV_UNREGISTER_BUFFER_IOC _IO('D', 4)
 #define DISPDEV_QUEUE_BUFFER_IOC      _IOW('D', 5, struct dispdev_buffer_info)
 #define DISPDEV_DEQUEUE_BUFFER_IOC    _IO('D', 6)
+#define DISPDEV_QUEUE_FENCED_BUFFER_IOC \
+			_IOW('D', 7, struct dispdev_fenced_buffer_info)
 
 #ifdef __KERNEL__
 
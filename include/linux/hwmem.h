@@ -164,6 +164,25 @@ struct hwmem_set_domain_request {
 	struct hwmem_region_us region;
 };
 
+/**
+ * @brief Maximum number of buffers in one set domain batch.
+ */
+#define HWMEM_MAX_SET_DOMAIN_BATCH 64
+
+/**
+ * @brief Set domain batch request data.
+ */
+struct hwmem_set_domain_batch_request {
+	/**
+	 * @brief [in] Number of requests, at most HWMEM_MAX_SET_DOMAIN_BATCH.
+	 */
+	__u32 count;
+	/**
+	 * @brief [in] Array of count set domain requests.
+	 */
+	struct hwmem_set_domain_request *requests;
+};
+
 /**
  * @brief Pin request data.
  */
@@ -359,6 +378,59 @@ struct hwmem_get_info_request {
  */
 #define HWMEM_IMPORT_FD_IOC _IO('W', 12)
 
+/**
+ * @brief Prepares several buffers for CPU access.
+ *
+ * Equivalent to one HWMEM_SET_CPU_DOMAIN_IOC per buffer but cheaper.
+ *
+ * Input is a pointer to a hwmem_set_domain_batch_request struct.
+ *
+ * @return Zero on success, or a negative error code.
+ */
+#define HWMEM_SET_CPU_DOMAIN_BATCH_IOC _IOW('W', 13, \
+					struct hwmem_set_domain_batch_request)
+
+/**
+ * @brief Prepares several buffers for access by any DMA hardware.
+ *
+ * Equivalent to one HWMEM_SET_SYNC_DOMAIN_IOC per buffer but the cache
+ * maintenance for all buffers is done together, typically for all buffers
+ * of a frame.
+ *
+ * Input is a pointer to a hwmem_set_domain_batch_request struct.
+ *
+ * @return Zero on success, or a negative error code.
+ */
+#define HWMEM_SET_SYNC_DOMAIN_BATCH_IOC _IOW('W', 14, \
+					struct hwmem_set_domain_batch_request)
+
+/**
+ * @brief Creates a fence that is signaled from user space.
+ *
+ * Fences are used to order buffer accesses between hardware blocks without
+ * waiting in user space, e.g. to let the display controller start scanning
+ * out a buffer as soon as the GPU has finished rendering it. A fence is
+ * represented by a file descriptor that can be polled, POLLIN is returned
+ * when the fence is signaled (and POLLERR too if it was signaled with an
+ * error).
+ *
+ * The returned file descriptor is the only one that can signal the fence,
+ * see HWMEM_FENCE_SIGNAL_IOC. If it is closed before the fence has been
+ * signaled, the fence is signaled with -EPIPE.
+ *
+ * @return A fence file descriptor on success, or a negative error code.
+ */
+#define HWMEM_CREATE_FENCE_IOC _IO('W', 15)
+
+/**
+ * @brief Signals a fence. Issued on a fence file descriptor.
+ *
+ * Input is the status, zero for success or a negative error code.
+ *
+ * @return Zero on success, or a negative error code.
+ */
+#define HWMEM_FENCE_SIGNAL_IOC _IO('W', 16)
+
 #ifdef __KERNEL__
 
 /* Kernel API */
@@ -431,6 +503,25 @@ struct hwmem_mem_chunk {
 	size_t size;
 };
 
+/**
+ * @brief One buffer of a hwmem_set_domain_batch call.
+ */
+struct hwmem_set_domain_entry {
+	/**
+	 * @brief Buffer to be prepared.
+	 */
+	struct hwmem_alloc *alloc;
+	/**
+	 * @brief Flags defining memory access mode of the call.
+	 */
+	enum hwmem_access access;
+	/**
+	 * @brief Minimum area of the buffer to be prepared, NULL for the
+	 * whole buffer.
+	 */
+	struct hwmem_region *region;
+};
+
 /**
  * @brief Allocates <size> number of bytes.
  *
@@ -466,6 +557,21 @@ void hwmem_release(struct hwmem_alloc *alloc);
 int hwmem_set_domain(struct hwmem_alloc *alloc, enum hwmem_access access,
 		enum hwmem_domain domain, struct hwmem_region *region);
 
+/**
+ * @brief Set the domain of several buffers and prepare them for access.
+ *
+ * Has the same effect as calling hwmem_set_domain for each buffer but the
+ * cache maintenance for all buffers is done together, which is cheaper.
+ *
+ * @param entries Buffers to be prepared.
+ * @param num_entries Number of buffers.
+ * @param domain Value specifying the memory domain.
+ *
+ * @return Zero on success, or a negative error code.
+ */
+int hwmem_set_domain_batch(struct hwmem_set_domain_entry *entries,
+			size_t num_entries, enum hwmem_domain domain);
+
 /**
  * @brief Pins the buffer.
  *
@@ -570,8 +676,128 @@ s32 hwmem_get_name(struct hwmem_alloc *alloc);
 struct hwmem_alloc *hwmem_resolve_by_name(s32 name);
 
 
+/**
+ * @brief A fence, signaled once when some hardware is done with a buffer.
+ */
+struct hwmem_fence;
+
+/**
+ * @brief Callback waiting for a fence to be signaled.
+ */
+struct hwmem_fence_waiter {
+	struct list_head list;
+	/**
+	 * @brief Called once when the fence is signaled. Can be called in
+	 * atomic context and must not call any hwmem_fence function on the
+	 * same fence except hwmem_fence_get.
+	 */
+	void (*func)(struct hwmem_fence_waiter *waiter, int status);
+};
+
+/**
+ * @brief Creates a fence, to be signaled by the caller.
+ *
+ * @return Pointer to the fence with one reference, or a negative error code.
+ */
+struct hwmem_fence *hwmem_fence_create(void);
+
+/**
+ * @brief Adds a fence reference.
+ *
+ * @param fence Fence.
+ */
+void hwmem_fence_get(struct hwmem_fence *fence);
+
+/**
+ * @brief Releases a fence reference. The fence is freed when the last
+ * reference is released.
+ *
+ * @param fence Fence.
+ */
+void hwmem_fence_put(struct hwmem_fence *fence);
+
+/**
+ * @brief Signals a fence. Only the first call has any effect. Can be called
+ * in atomic context.
+ *
+ * @param fence Fence.
+ * @param status Zero if the buffer is ready, or a negative error code if
+ * the operation producing it failed.
+ */
+void hwmem_fence_signal(struct hwmem_fence *fence, int status);
+
+/**
+ * @brief Returns the status of a fence.
+ *
+ * @param fence Fence.
+ *
+ * @return 1 if the fence has not been signaled, otherwise the status it was
+ * signaled with.
+ */
+int hwmem_fence_status(struct hwmem_fence *fence);
+
+/**
+ * @brief Waits for a fence to be signaled.
+ *
+ * @param fence Fence.
+ * @param timeout Timeout in jiffies, or MAX_SCHEDULE_TIMEOUT.
+ *
+ * @return The status the fence was signaled with, -ETIME on timeout or
+ * -ERESTARTSYS if interrupted.
+ */
+int hwmem_fence_wait(struct hwmem_fence *fence, long timeout);
+
+/**
+ * @brief Registers a callback to be called when a fence is signaled.
+ *
+ * @param fence Fence.
+ * @param waiter Callback, must stay valid until it has been called or
+ * removed.
+ *
+ * @return Zero if the callback was registered, 1 if the fence is already
+ * signaled in which case the callback is not called.
+ */
+int hwmem_fence_add_waiter(struct hwmem_fence *fence,
+				struct hwmem_fence_waiter *waiter);
+
+/**
+ * @brief Removes a callback registered with hwmem_fence_add_waiter.
+ *
+ * @param fence Fence.
+ * @param waiter Callback.
+ *
+ * @return true if the callback was removed before being called, false if
+ * the call has already completed.
+ */
+bool hwmem_fence_remove_waiter(struct hwmem_fence *fence,
+				struct hwmem_fence_waiter *waiter);
+
+/**
+ * @brief Creates a file for a fence, to be installed in a file descriptor
+ * passed to user space. The file holds a fence reference. The caller
+ * reserves the file descriptor with get_unused_fd_flags first, so that
+ * nothing can fail once it has committed to the operation the fence is for.
+ *
+ * @param fence Fence.
+ *
+ * @return The file on success, or a negative error code.
+ */
+struct file *hwmem_fence_get_file(struct hwmem_fence *fence);
+
+/**
+ * @brief Looks up the fence of a fence file descriptor. This call will add a
+ * fence reference, to be released with hwmem_fence_put.
+ *
+ * @param fd Fence file descriptor.
+ *
+ * @return Pointer to the fence, or a negative error code.
+ */
+struct hwmem_fence *hwmem_fence_get_by_fd(int fd);
+
 /* Internal */
 
+int hwmem_fence_create_user_fd(void);
+
 struct hwmem_platform_data {
 	/* Physical address of memory region */
 	u32 start;
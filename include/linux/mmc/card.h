@@ -46,6 +46,19 @@ struct mmc_ext_csd {
 	unsigned int		hs_max_dtr;
 	unsigned int		sectors;
 	unsigned int		card_type;
+	u8			max_packed_writes;	/* 0: not supported */
+	u8			max_packed_reads;
+};
+
+/*
+ * Writes issued by the block driver, for debugfs. Updated from the queue
+ * thread only.
+ */
+struct mmc_wr_pack_stats {
+	unsigned int		packed_cmds;	/* packed transfers issued */
+	unsigned int		packed_reqs;	/* requests sent within those */
+	unsigned int		unpacked_reqs;	/* requests sent on their own */
+	unsigned int		fallbacks;	/* packed transfers redone unpacked */
 };
 
 struct sd_scr {
@@ -122,6 +135,8 @@ struct mmc_card {
 	const char		**info;		/* info strings */
 	struct sdio_func_tuple	*tuples;	/* unknown common tuples */
 
+	struct mmc_wr_pack_stats wr_pack_stats;	/* packed write statistics */
+
 	struct dentry		*debugfs_root;
 };
 
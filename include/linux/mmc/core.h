@@ -9,6 +9,7 @@
 #define LINUX_MMC_CORE_H
 
 #include <linux/interrupt.h>
+#include <linux/completion.h>
 #include <linux/device.h>
 
 struct request;
@@ -115,13 +116,16 @@ struct mmc_data {
 
 	unsigned int		sg_len;		/* size of scatter list */
 	struct scatterlist	*sg;		/* I/O scatter list */
+	s32			host_cookie;	/* host private data */
 };
 
 struct mmc_request {
+	struct mmc_command	*sbc;		/* SET_BLOCK_COUNT, sent first */
 	struct mmc_command	*cmd;
 	struct mmc_data		*data;
 	struct mmc_command	*stop;
 
+	struct completion	completion;
 	void			*done_data;	/* completion data */
 	void			(*done)(struct mmc_request *);/* completion function */
 };
@@ -129,6 +133,18 @@ struct mmc_request {
 struct mmc_host;
 struct mmc_card;
 
+/*
+ * A request started with mmc_start_req(). err_check is called once the
+ * request is done and returns 0 if it succeeded, otherwise a value of the
+ * caller's choosing that is handed back by mmc_start_req().
+ */
+struct mmc_async_req {
+	struct mmc_request	*mrq;
+	int (*err_check)(struct mmc_card *, struct mmc_async_req *);
+};
+
+extern struct mmc_async_req *mmc_start_req(struct mmc_host *,
+	struct mmc_async_req *, int *);
 extern void mmc_wait_for_req(struct mmc_host *, struct mmc_request *);
 extern int mmc_wait_for_cmd(struct mmc_host *, struct mmc_command *, int);
 extern int mmc_wait_for_app_cmd(struct mmc_host *, struct mmc_card *,
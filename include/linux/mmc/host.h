@@ -99,6 +99,18 @@ struct mmc_host_ops {
 	int (*enable)(struct mmc_host *host);
 	int (*disable)(struct mmc_host *host, int lazy);
 	void	(*request)(struct mmc_host *host, struct mmc_request *req);
+	/*
+	 * Optional. 'pre_req' lets the host prepare a request, e.g. map its
+	 * data for DMA, while the previous request is still in progress.
+	 * 'is_first_req' is set when no other request is active, in which
+	 * case the preparation can as well be left to 'request'. 'post_req'
+	 * undoes the preparation once the request is done, or with a non-zero
+	 * 'err' when a prepared request is cancelled without being started.
+	 */
+	void	(*pre_req)(struct mmc_host *host, struct mmc_request *req,
+			   bool is_first_req);
+	void	(*post_req)(struct mmc_host *host, struct mmc_request *req,
+			    int err);
 	void    (*dump_regs)(struct mmc_host *host);
 	void    (*abort_request)(struct mmc_host *host);
 	/*
@@ -215,6 +227,7 @@ struct mmc_host {
 	struct delayed_work	disable;	/* disabling work */
 
 	struct mmc_card		*card;		/* device attached to this host */
+	struct mmc_async_req	*areq;		/* active async request */
 
 	wait_queue_head_t	wq;
 	struct task_struct	*claimer;	/* task that has host claimed */
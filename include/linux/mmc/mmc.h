@@ -251,6 +251,7 @@ struct _mmc_csd {
  * EXT_CSD fields
  */
 
+#define EXT_CSD_DATA_SECTOR_SIZE	61	/* RO */
 #define EXT_CSD_BUS_WIDTH	183	/* R/W */
 #define EXT_CSD_HS_TIMING	185	/* R/W */
 #define EXT_CSD_CARD_TYPE	196	/* RO */
@@ -258,6 +259,8 @@ struct _mmc_csd {
 #define EXT_CSD_REV		192	/* RO */
 #define EXT_CSD_SEC_CNT		212	/* RO, 4 bytes */
 #define EXT_CSD_S_A_TIMEOUT	217
+#define EXT_CSD_MAX_PACKED_WRITES	500	/* RO */
+#define EXT_CSD_MAX_PACKED_READS	501	/* RO */
 
 /*
  * EXT_CSD field definitions
@@ -283,6 +286,14 @@ struct _mmc_csd {
 #define EXT_CSD_DDR_BUS_WIDTH_4	5	/* Card is in 4 bit DDR mode */
 #define EXT_CSD_DDR_BUS_WIDTH_8	6	/* Card is in 8 bit DDR mode */
 
+/*
+ * Packed commands (eMMC 4.5)
+ */
+
+#define MMC_CMD23_ARG_PACKED	(1<<30)	/* CMD23 of a packed command */
+#define MMC_PACKED_CMD_VER	0x01	/* Packed command header version */
+#define MMC_PACKED_CMD_WR	0x02	/* Packed command header: write */
+
 /*
  * MMC_SWITCH access modes
  */
@@ -406,6 +406,50 @@ struct b2r2_blt_req {
 	__u32                     report2;
 };
 
+/**
+ * Max number of requests in one struct b2r2_blt_batch_req
+ */
+#define B2R2_BLT_MAX_BATCH_COUNT 32
+
+/**
+ * struct b2r2_blt_batch_req - Specifies a batch of requests to B2R2
+ *
+ * @count: Number of requests in @reqs (1 - B2R2_BLT_MAX_BATCH_COUNT)
+ * @reqs: Pointer to an array of @count requests. The requests are
+ *        performed in array order.
+ *
+ * The node lists of all requests are chained and executed as one B2R2
+ * job, so all requests in a batch share one request id and complete at
+ * the same time. Requests that B2R2 can not perform in one job (generic
+ * path) are executed separately, in order. The batch is asynchronous
+ * only if B2R2_BLT_FLAG_ASYNCH is set for all requests in it.
+ */
+struct b2r2_blt_batch_req {
+	__u32                     count;
+	struct b2r2_blt_req       *reqs;
+};
+
+/**
+ * struct b2r2_blt_fence_req - Specifies a request to B2R2 ordered by fences
+ *
+ * @req: Pointer to the request. The request is always asynchronous.
+ * @in_fence: Hwmem fence file descriptor that is signaled when the source
+ *            buffers are ready, or -1. B2R2 starts the request after the
+ *            fence has been signaled. The request is cancelled if the
+ *            fence is signaled with an error.
+ * @out_fence: Returns a hwmem fence file descriptor that is signaled when
+ *             the request is done, with an error if it was cancelled.
+ *             The fence can be passed on to e.g. the display to scan out
+ *             the destination buffer without waiting in user space.
+ *
+ * See HWMEM_CREATE_FENCE_IOC in <linux/hwmem.h>.
+ */
+struct b2r2_blt_fence_req {
+	struct b2r2_blt_req       *req;
+	__s32                     in_fence;
+	__s32                     out_fence;
+};
+
 /**
  * enum b2r2_blt_cap -  Capabilities that can be queried for.
  *
@@ -615,4 +659,28 @@ struct b2r2_blt_report {
 #define B2R2_BLT_QUERY_CAP_IOC  _IOWR(B2R2_BLT_IOC_MAGIC, 3, \
 				  struct b2r2_blt_query_cap)
 
+/**
+ * The B2R2_BLT_BATCH_IOC ioctl adds a batch of blit requests to B2R2.
+ *
+ * Supplied parameter shall be a pointer to a struct b2r2_blt_batch_req.
+ *
+ * Returns the request id of the last job added if >= 0, else a negative
+ * error code. Waiting for this request id using B2R2_BLT_SYNC_IOC waits
+ * for the whole batch.
+ */
+#define B2R2_BLT_BATCH_IOC  _IOW(B2R2_BLT_IOC_MAGIC, 4, \
+				  struct b2r2_blt_batch_req)
+
+/**
+ * The B2R2_BLT_FENCE_IOC ioctl adds a blit request to B2R2 that waits for
+ * an input fence and signals an output fence when done.
+ *
+ * Supplied parameter shall be a pointer to a struct b2r2_blt_fence_req.
+ *
+ * Returns an unique request id if >= 0, else a negative error code.
+ * On success the out_fence member has been filled in.
+ */
+#define B2R2_BLT_FENCE_IOC  _IOWR(B2R2_BLT_IOC_MAGIC, 5, \
+				  struct b2r2_blt_fence_req)
+
 #endif /* #ifdef _LINUX_VIDEO_B2R2_BLT_H */
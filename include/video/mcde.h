@@ -11,6 +11,9 @@
 #ifndef __MCDE__H__
 #define __MCDE__H__
 
+#include <linux/workqueue.h>
+#include <linux/hwmem.h>
+
 /* Physical interface types */
 enum mcde_port_type {
 	MCDE_PORTTYPE_DSI = 0,
@@ -294,6 +297,8 @@ struct mcde_overlay_info {
 	struct mcde_rectangle dirty;
 };
 
+struct mcde_overlay_fence_listener;
+
 struct mcde_overlay {
 	struct kobject kobj;
 	struct list_head list; /* mcde_display_device.ovlys */
@@ -301,6 +306,19 @@ struct mcde_overlay {
 	struct mcde_display_device *ddev;
 	struct mcde_overlay_info info;
 	struct mcde_ovly_state *state;
+
+	/* Fenced update, see mcde_dss_update_overlay_fenced */
+	struct hwmem_fence *fence; /* Pending update, ddev->display_lock */
+	struct mcde_overlay_info fence_info;
+	struct mcde_overlay_fence_listener *fence_listener;
+	struct hwmem_fence_waiter fence_waiter;
+	struct work_struct fence_work;
+
+	/* Transparency tracking, see mcde_dss_overlay_is_transparent */
+	spinlock_t check_lock;
+	struct mcde_rectangle check_area; /* Not known to be transparent */
+	bool check_changed; /* Written since the last check */
+	bool transparent; /* Result of the last check */
 };
 
 /*
@@ -316,6 +334,19 @@ struct mcde_palette_table {
 
 struct mcde_chnl_state;
 
+/*
+ * Notified when the frame of an asynchronous update has been latched, i.e.
+ * when the buffers of all earlier updates may be reused. seq is the newest
+ * completed update, earlier ones are implicitly complete. Called from
+ * interrupt context with the listener lock held, so it must not start
+ * updates or add/remove listeners.
+ */
+struct mcde_chnl_frame_listener {
+	struct list_head list;
+	void (*frame_done)(struct mcde_chnl_frame_listener *listener,
+							u32 seq, int status);
+};
+
 struct mcde_chnl_state *mcde_chnl_get(enum mcde_chnl chnl_id,
 			enum mcde_fifo fifo, const struct mcde_port *port);
 int mcde_chnl_set_pixel_format(struct mcde_chnl_state *chnl,
@@ -332,6 +363,8 @@ int mcde_chnl_set_rotation(struct mcde_chnl_state *chnl,
 		enum mcde_display_rotation rotation, u32 rotbuf1, u32 rotbuf2);
 int mcde_chnl_enable_synchronized_update(struct mcde_chnl_state *chnl,
 								bool enable);
+int mcde_chnl_enable_partial_update(struct mcde_chnl_state *chnl,
+								bool enable);
 int mcde_chnl_set_power_mode(struct mcde_chnl_state *chnl,
 				enum mcde_display_power_mode power_mode);
 
@@ -339,8 +372,15 @@ int mcde_chnl_apply(struct mcde_chnl_state *chnl);
 int mcde_chnl_update(struct mcde_chnl_state *chnl,
 			struct mcde_rectangle *update_area,
 			bool tripple_buffer);
+int mcde_chnl_update_async(struct mcde_chnl_state *chnl,
+			struct mcde_rectangle *update_area, u32 *seq);
 void mcde_chnl_put(struct mcde_chnl_state *chnl);
 
+void mcde_chnl_add_frame_listener(struct mcde_chnl_state *chnl,
+			struct mcde_chnl_frame_listener *listener);
+void mcde_chnl_remove_frame_listener(struct mcde_chnl_state *chnl,
+			struct mcde_chnl_frame_listener *listener);
+
 void mcde_chnl_stop_flow(struct mcde_chnl_state *chnl);
 
 void mcde_chnl_enable(struct mcde_chnl_state *chnl);
@@ -56,6 +56,7 @@ struct mcde_display_device {
 	enum mcde_ovly_pix_fmt pixel_format;
 	enum mcde_display_rotation rotation;
 	bool synchronized_update;
+	bool partial_update; /* only the invalidated area is sent */
 	struct mcde_video_mode video_mode;
 	int update_flags;
 	bool stay_alive;
@@ -100,6 +101,8 @@ struct mcde_display_device {
 	int (*invalidate_area)(struct mcde_display_device *dev,
 						struct mcde_rectangle *area);
 	int (*update)(struct mcde_display_device *dev, bool tripple_buffer);
+	/* Optional, does not wait for the frame, see mcde_chnl_update_async */
+	int (*update_async)(struct mcde_display_device *dev, u32 *seq);
 	int (*prepare_for_update)(struct mcde_display_device *dev,
 		u16 x, u16 y, u16 w, u16 h);
 	int (*on_first_update)(struct mcde_display_device *dev);
@@ -33,6 +33,34 @@ int mcde_dss_apply_overlay(struct mcde_overlay *ovl,
 void mcde_dss_get_overlay_info(struct mcde_overlay *ovly,
 				struct mcde_overlay_info *info);
 int mcde_dss_update_overlay(struct mcde_overlay *ovl, bool tripple_buffer);
+/*      Does not wait for the frame, *seq is reported by frame listeners */
+int mcde_dss_update_overlay_async(struct mcde_overlay *ovl, u32 *seq);
+int mcde_dss_add_frame_listener(struct mcde_display_device *ddev,
+	struct mcde_chnl_frame_listener *listener);
+void mcde_dss_remove_frame_listener(struct mcde_display_device *ddev,
+	struct mcde_chnl_frame_listener *listener);
+/*
+ * Notified from a work once a fenced update was done. status is the result
+ * of the update, seq as for mcde_dss_update_overlay_async, or the error the
+ * fence was signaled with if the buffer was dropped and the previous one is
+ * still displayed.
+ */
+struct mcde_overlay_fence_listener {
+	void (*fence_done)(struct mcde_overlay_fence_listener *listener,
+							u32 seq, int status);
+};
+
+/*      Applies info and updates once fence is signaled, without blocking.
+ *      Replaces a pending fenced update, which is then not notified, as do
+ *      mcde_dss_apply_overlay and mcde_dss_disable_overlay */
+int mcde_dss_update_overlay_fenced(struct mcde_overlay *ovl,
+	struct mcde_overlay_info *info, struct hwmem_fence *fence,
+	struct mcde_overlay_fence_listener *listener);
+/*      Area (NULL for all) of the overlay buffer has been written */
+void mcde_dss_overlay_written(struct mcde_overlay *ovl,
+	struct mcde_rectangle *area);
+/*      Transparent or black (RGB = 0), only written areas are checked */
+bool mcde_dss_overlay_is_transparent(struct mcde_overlay *ovl);
 
 void mcde_dss_get_native_resolution(struct mcde_display_device *ddev,
 	u16 *x_res, u16 *y_res);
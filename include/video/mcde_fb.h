@@ -18,6 +18,10 @@
 #else
 #include <linux/types.h>
 #include <linux/hwmem.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
+#include <linux/ktime.h>
 #endif
 
 #ifdef __KERNEL__
@@ -27,12 +31,50 @@
 #endif
 #endif
 
+/*
+ * Area of the visible buffer that changed. Command mode displays are sent
+ * only this area, other displays the full frame.
+ */
+struct mcde_update_area {
+	uint16_t x;
+	uint16_t y;
+	uint16_t w;
+	uint16_t h;
+};
+
+/*
+ * Timestamps of a flip (pan), in CLOCK_MONOTONIC ns. queue is when it was
+ * panned to, latch when it was handed to the channel and scanout when the
+ * channel reported the frame done, that is once the whole frame has been
+ * sent to the display, not when the display started showing it. id counts
+ * flips, starting at 1.
+ */
+struct mcde_flip_times {
+	uint32_t id;
+	uint32_t yoffset;
+	int64_t queue_ns;
+	int64_t latch_ns;
+	int64_t scanout_ns;
+};
+
 #define MCDE_GET_BUFFER_NAME_IOC _IO('M', 1)
+#define MCDE_UPDATE_AREA_IOC _IOW('M', 2, struct mcde_update_area)
+/* Times of the latest flip that reached the display */
+#define MCDE_GET_FLIP_TIMES_IOC _IOR('M', 3, struct mcde_flip_times)
 
 #ifdef __KERNEL__
 #define to_mcde_fb(x) ((struct mcde_fb *)(x)->par)
 
 #define MCDE_FB_MAX_NUM_OVERLAYS 3
+#define MCDE_FB_FLIP_QUEUE_DEPTH 4
+
+struct mcde_fb_flip {
+	u32 id;
+	u32 yoffset;
+	u32 seq; /* Of the channel update, valid once submitted */
+	ktime_t queue;
+	ktime_t latch;
+};
 
 struct mcde_fb {
 	int num_ovlys;
@@ -47,6 +89,23 @@ struct mcde_fb {
 #endif
 	bool mcde_opp_requested;
 
+	/*
+	 * Flip queue, oldest first. The oldest flip is submitted to the
+	 * channel when the previous one has reached the display.
+	 */
+	struct fb_info *fbi;
+	spinlock_t flip_lock;
+	struct mcde_fb_flip flips[MCDE_FB_FLIP_QUEUE_DEPTH];
+	u8 flip_head;
+	u8 flip_count;
+	bool flip_submitted;
+	u32 flip_id;
+	u32 flip_done_seq;
+	struct mcde_flip_times last_flip;
+	wait_queue_head_t flip_waitq;
+	struct work_struct flip_work;
+	struct mcde_chnl_frame_listener flip_listener;
+	bool flip_listener_added;
 };
 
 /* MCDE fbdev API */
@@ -0,0 +1,404 @@
+/* $(CROSS_COMPILE)gcc -Wall -O2 -I../../drivers/staging/android \
+ *	-o binder_stress binder_stress.c -lpthread
+ */
+
+/*
+ * Copyright (C) ST-Ericsson SA 2011
+ * License terms: GNU General Public License (GPL) version 2
+ *
+ * Binder throughput stress test. A server process becomes the context
+ * manager and answers every transaction with a reply of the same size from
+ * a pool of looper threads. The client then runs synchronous transactions
+ * against it from 1, 2, 4, ... threads and reports the transactions per
+ * second for each thread count.
+ *
+ * The context manager must be free, so stop servicemanager (and with it the
+ * Android framework) before running this.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "binder.h"
+
+#define MAP_SIZE	(1024 * 1024)
+#define MAX_PAYLOAD	4096
+
+static const char *dev = "/dev/binder";
+static int max_threads = 8;
+static int seconds = 5;
+static size_t payload = 128;
+
+static int binder_fd;
+static volatile int stop;
+static char payload_buf[MAX_PAYLOAD];
+
+struct cmd_buf {
+	size_t len;
+	uint32_t data[128];
+};
+
+struct client {
+	pthread_t thread;
+	unsigned long count;
+};
+
+static int binder_open(void)
+{
+	struct binder_version version;
+
+	binder_fd = open(dev, O_RDWR);
+	if (binder_fd < 0) {
+		perror(dev);
+		return -1;
+	}
+
+	if (ioctl(binder_fd, BINDER_VERSION, &version) < 0 ||
+	    version.protocol_version != BINDER_CURRENT_PROTOCOL_VERSION) {
+		fprintf(stderr, "%s: unsupported binder protocol\n", dev);
+		return -1;
+	}
+
+	if (mmap(NULL, MAP_SIZE, PROT_READ, MAP_PRIVATE, binder_fd, 0) ==
+	    MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Writes the commands in wb and reads returns into rbuf */
+static void binder_write_read(struct cmd_buf *wb, void *rbuf, size_t rsize,
+			      size_t *rlen)
+{
+	struct binder_write_read bwr;
+
+	bwr.write_size = wb->len;
+	bwr.write_consumed = 0;
+	bwr.write_buffer = (unsigned long)wb->data;
+	bwr.read_size = rsize;
+	bwr.read_consumed = 0;
+	bwr.read_buffer = (unsigned long)rbuf;
+
+	/* The driver carries on from the consumed counts */
+	while (ioctl(binder_fd, BINDER_WRITE_READ, &bwr) < 0) {
+		if (errno != EINTR) {
+			perror("BINDER_WRITE_READ");
+			exit(1);
+		}
+	}
+
+	wb->len = 0;
+	if (rlen)
+		*rlen = bwr.read_consumed;
+}
+
+static void put(struct cmd_buf *wb, const void *data, size_t size)
+{
+	memcpy((char *)wb->data + wb->len, data, size);
+	wb->len += size;
+}
+
+static void put_cmd(struct cmd_buf *wb, uint32_t cmd)
+{
+	put(wb, &cmd, sizeof(cmd));
+}
+
+static void put_free_buffer(struct cmd_buf *wb, const void *buffer)
+{
+	put_cmd(wb, BC_FREE_BUFFER);
+	put(wb, &buffer, sizeof(buffer));
+}
+
+static void put_txn(struct cmd_buf *wb, uint32_t cmd, size_t size)
+{
+	struct binder_transaction_data tr;
+
+	memset(&tr, 0, sizeof(tr));
+	tr.target.handle = 0;
+	tr.code = 1;
+	tr.data_size = size;
+	tr.data.ptr.buffer = payload_buf;
+
+	put_cmd(wb, cmd);
+	put(wb, &tr, sizeof(tr));
+}
+
+/* Returns the return command following the one at p */
+static const char *next_return(const char *p)
+{
+	return p + sizeof(uint32_t) + _IOC_SIZE(*(uint32_t *)p);
+}
+
+static void fail_return(uint32_t cmd)
+{
+	fprintf(stderr, "binder_stress: unexpected return %#x\n", cmd);
+	exit(1);
+}
+
+static void *server_thread(void *arg)
+{
+	struct cmd_buf wb = { 0 };
+	uint32_t rbuf[128];
+	size_t rlen;
+
+	put_cmd(&wb, BC_ENTER_LOOPER);
+	for (;;) {
+		const char *p = (const char *)rbuf;
+		const char *end;
+
+		binder_write_read(&wb, rbuf, sizeof(rbuf), &rlen);
+		for (end = p + rlen; p < end; p = next_return(p)) {
+			uint32_t cmd = *(uint32_t *)p;
+			const void *data = p + sizeof(uint32_t);
+			struct binder_transaction_data tr;
+
+			switch (cmd) {
+			case BR_TRANSACTION:
+				/* Echo a reply of the same size */
+				memcpy(&tr, data, sizeof(tr));
+				put_free_buffer(&wb, tr.data.ptr.buffer);
+				put_txn(&wb, BC_REPLY, tr.data_size);
+				break;
+			case BR_INCREFS:
+				put_cmd(&wb, BC_INCREFS_DONE);
+				put(&wb, data,
+				    sizeof(struct binder_ptr_cookie));
+				break;
+			case BR_ACQUIRE:
+				put_cmd(&wb, BC_ACQUIRE_DONE);
+				put(&wb, data,
+				    sizeof(struct binder_ptr_cookie));
+				break;
+			case BR_ERROR:
+			case BR_FAILED_REPLY:
+			case BR_DEAD_REPLY:
+				fail_return(cmd);
+				break;
+			default:
+				break;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+static void run_server(int ready)
+{
+	pthread_t thread;
+	int i;
+
+	if (binder_open())
+		exit(1);
+
+	if (ioctl(binder_fd, BINDER_SET_CONTEXT_MGR, 0) < 0) {
+		perror("BINDER_SET_CONTEXT_MGR (is servicemanager running?)");
+		exit(1);
+	}
+
+	/* One looper per client thread, this thread is one of them */
+	for (i = 1; i < max_threads; i++) {
+		if (pthread_create(&thread, NULL, server_thread, NULL)) {
+			fprintf(stderr, "binder_stress: no server thread\n");
+			exit(1);
+		}
+	}
+
+	if (write(ready, "", 1) != 1)
+		exit(1);
+	close(ready);
+
+	server_thread(NULL);
+}
+
+static void *client_thread(void *arg)
+{
+	struct client *client = arg;
+	struct cmd_buf wb = { 0 };
+	uint32_t rbuf[128];
+	size_t rlen;
+
+	while (!stop) {
+		int replied = 0;
+
+		put_txn(&wb, BC_TRANSACTION, payload);
+		while (!replied) {
+			const char *p = (const char *)rbuf;
+			const char *end;
+
+			binder_write_read(&wb, rbuf, sizeof(rbuf), &rlen);
+			for (end = p + rlen; p < end; p = next_return(p)) {
+				uint32_t cmd = *(uint32_t *)p;
+				struct binder_transaction_data tr;
+
+				switch (cmd) {
+				case BR_REPLY:
+					/* Freed along with the next call */
+					memcpy(&tr, p + sizeof(uint32_t),
+					       sizeof(tr));
+					put_free_buffer(&wb,
+							tr.data.ptr.buffer);
+					replied = 1;
+					break;
+				case BR_ERROR:
+				case BR_FAILED_REPLY:
+				case BR_DEAD_REPLY:
+					fail_return(cmd);
+					break;
+				default:
+					break;
+				}
+			}
+		}
+		client->count++;
+	}
+
+	binder_write_read(&wb, NULL, 0, NULL);
+	ioctl(binder_fd, BINDER_THREAD_EXIT, 0);
+
+	return NULL;
+}
+
+/* Runs nr_threads clients for the test duration, returns transactions/s */
+static double run_clients(int nr_threads, unsigned long *total)
+{
+	struct client *clients;
+	struct timeval start;
+	struct timeval end;
+	double elapsed;
+	int i;
+
+	clients = calloc(nr_threads, sizeof(*clients));
+	if (!clients) {
+		perror("calloc");
+		exit(1);
+	}
+
+	stop = 0;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&clients[i].thread, NULL, client_thread,
+				   &clients[i])) {
+			fprintf(stderr, "binder_stress: no client thread\n");
+			exit(1);
+		}
+	}
+
+	sleep(seconds);
+	stop = 1;
+
+	*total = 0;
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(clients[i].thread, NULL);
+		*total += clients[i].count;
+	}
+	gettimeofday(&end, NULL);
+
+	free(clients);
+
+	elapsed = (end.tv_sec - start.tv_sec) +
+		(end.tv_usec - start.tv_usec) / 1000000.0;
+
+	return *total / elapsed;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-d device] [-t max threads] "
+		"[-s seconds per run] [-b payload bytes]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long total;
+	double rate;
+	pid_t server;
+	int ready[2];
+	char c;
+	int n;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:t:s:b:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		case 'b':
+			payload = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (max_threads < 1 || seconds < 1 || payload > MAX_PAYLOAD)
+		usage(argv[0]);
+
+	if (pipe(ready) < 0) {
+		perror("pipe");
+		return 1;
+	}
+
+	server = fork();
+	if (server < 0) {
+		perror("fork");
+		return 1;
+	}
+	if (server == 0) {
+		close(ready[0]);
+		prctl(PR_SET_PDEATHSIG, SIGKILL);
+		run_server(ready[1]);
+		return 0;
+	}
+
+	close(ready[1]);
+	if (read(ready[0], &c, 1) != 1) {
+		fprintf(stderr, "binder_stress: server did not start\n");
+		waitpid(server, NULL, 0);
+		return 1;
+	}
+	close(ready[0]);
+
+	if (binder_open()) {
+		kill(server, SIGKILL);
+		waitpid(server, NULL, 0);
+		return 1;
+	}
+
+	printf("%8s %14s %12s\n", "threads", "transactions", "trans/s");
+	for (n = 1; ; n = n * 2 < max_threads ? n * 2 : max_threads) {
+		rate = run_clients(n, &total);
+		printf("%8d %14lu %12.0f\n", n, total, rate);
+		fflush(stdout);
+		if (n == max_threads)
+			break;
+	}
+
+	kill(server, SIGKILL);
+	waitpid(server, NULL, 0);
+
+	return 0;
+}
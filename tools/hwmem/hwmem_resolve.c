@@ -0,0 +1,244 @@
+/* $(CROSS_COMPILE)gcc -Wall -O2 -iquote ../../include/linux \
+ *	-o hwmem_resolve hwmem_resolve.c -lpthread
+ */
+
+/*
+ * Copyright (C) ST-Ericsson SA 2011
+ * License terms: GNU General Public License (GPL) version 2
+ *
+ * hwmem resolve and pin microbenchmark. A set of contiguous buffers is
+ * allocated and exported, then 1, 2, 4, ... threads each import a buffer by
+ * its global name, pin it, unpin it and release it again, which is what
+ * the display and graphics drivers do per buffer every frame. Reports the
+ * loops per second for each thread count.
+ *
+ * Each thread has its own hwmem file, so that only the driver's global and
+ * per buffer locking is measured, not the per file lock. With -b 1 all
+ * threads work on the same buffer.
+ */
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#include "hwmem.h"
+
+static const char *dev = "/dev/" HWMEM_DEFAULT_DEVICE_NAME;
+static int max_threads = 8;
+static int seconds = 5;
+static int nr_bufs = 16;
+
+static int32_t *names;
+static volatile int stop;
+
+struct worker {
+	pthread_t thread;
+	int first_buf;
+	unsigned long count;
+	int failed;
+};
+
+static void *worker_thread(void *arg)
+{
+	struct worker *w = arg;
+	int buf = w->first_buf;
+	int fd;
+
+	fd = open(dev, O_RDWR);
+	if (fd < 0) {
+		perror(dev);
+		w->failed = 1;
+		return NULL;
+	}
+
+	while (!stop) {
+		struct hwmem_pin_request req;
+		int id;
+
+		id = ioctl(fd, HWMEM_IMPORT_IOC, names[buf]);
+		if (id < 0) {
+			perror("HWMEM_IMPORT_IOC");
+			w->failed = 1;
+			break;
+		}
+
+		memset(&req, 0, sizeof(req));
+		req.id = id;
+		if (ioctl(fd, HWMEM_PIN_IOC, &req) < 0 ||
+		    ioctl(fd, HWMEM_UNPIN_IOC, id) < 0) {
+			perror("HWMEM_PIN_IOC/HWMEM_UNPIN_IOC");
+			w->failed = 1;
+			break;
+		}
+
+		if (ioctl(fd, HWMEM_RELEASE_IOC, id) < 0) {
+			perror("HWMEM_RELEASE_IOC");
+			w->failed = 1;
+			break;
+		}
+
+		w->count++;
+		if (++buf == nr_bufs)
+			buf = 0;
+	}
+
+	close(fd);
+
+	return NULL;
+}
+
+/* Runs nr_threads workers for the test duration, returns loops/s */
+static double run_workers(int nr_threads, unsigned long *total)
+{
+	struct worker *workers;
+	struct timeval start;
+	struct timeval end;
+	double elapsed;
+	int failed = 0;
+	int i;
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!workers) {
+		perror("calloc");
+		exit(1);
+	}
+
+	stop = 0;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nr_threads; i++) {
+		workers[i].first_buf = i % nr_bufs;
+		if (pthread_create(&workers[i].thread, NULL, worker_thread,
+				   &workers[i])) {
+			fprintf(stderr, "hwmem_resolve: no worker thread\n");
+			exit(1);
+		}
+	}
+
+	sleep(seconds);
+	stop = 1;
+
+	*total = 0;
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		*total += workers[i].count;
+		failed |= workers[i].failed;
+	}
+	gettimeofday(&end, NULL);
+
+	free(workers);
+
+	if (failed)
+		exit(1);
+
+	elapsed = (end.tv_sec - start.tv_sec) +
+		(end.tv_usec - start.tv_usec) / 1000000.0;
+
+	return *total / elapsed;
+}
+
+/* Allocates and exports the buffers, they live as long as fd is open */
+static int alloc_bufs(int fd)
+{
+	struct hwmem_alloc_request req;
+	int i;
+
+	names = calloc(nr_bufs, sizeof(*names));
+	if (!names) {
+		perror("calloc");
+		return -1;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.size = 4096;
+	req.flags = HWMEM_ALLOC_HINT_WRITE_COMBINE | HWMEM_ALLOC_HINT_UNCACHED;
+	req.default_access = HWMEM_ACCESS_READ | HWMEM_ACCESS_WRITE |
+			     HWMEM_ACCESS_IMPORT;
+	req.mem_type = HWMEM_MEM_CONTIGUOUS_SYS;
+
+	for (i = 0; i < nr_bufs; i++) {
+		int id = ioctl(fd, HWMEM_ALLOC_IOC, &req);
+
+		if (id < 0) {
+			perror("HWMEM_ALLOC_IOC");
+			return -1;
+		}
+
+		names[i] = ioctl(fd, HWMEM_EXPORT_IOC, id);
+		if (names[i] < 0) {
+			perror("HWMEM_EXPORT_IOC");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-d device] [-t max threads] "
+		"[-s seconds per run] [-b buffers]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long total;
+	double rate;
+	int fd;
+	int n;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:t:s:b:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 't':
+			max_threads = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		case 'b':
+			nr_bufs = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (max_threads < 1 || seconds < 1 || nr_bufs < 1)
+		usage(argv[0]);
+
+	fd = open(dev, O_RDWR);
+	if (fd < 0) {
+		perror(dev);
+		return 1;
+	}
+
+	if (alloc_bufs(fd)) {
+		close(fd);
+		return 1;
+	}
+
+	printf("%8s %14s %12s\n", "threads", "loops", "loops/s");
+	for (n = 1; ; n = n * 2 < max_threads ? n * 2 : max_threads) {
+		rate = run_workers(n, &total);
+		printf("%8d %14lu %12.0f\n", n, total, rate);
+		fflush(stdout);
+		if (n == max_threads)
+			break;
+	}
+
+	close(fd);
+
+	return 0;
+}
@@ -0,0 +1,346 @@
+/* $(CROSS_COMPILE)gcc -Wall -O2 -iquote ../../include/linux \
+ *	-o hwmem_trace hwmem_trace.c -lrt
+ */
+
+/*
+ * Copyright (C) ST-Ericsson SA 2011
+ * License terms: GNU General Public License (GPL) version 2
+ *
+ * hwmem contiguous allocator stress test. Replays buffer allocation traces
+ * of the camera and video use cases against /dev/hwmem, interleaved one
+ * operation at a time so that they fragment the contiguous region the way
+ * running both at once does. A trace that reaches its end frees what it
+ * still holds and starts over, until every trace has run the requested
+ * number of rounds. Reports the alloc and release times and the failed
+ * allocs per trace, followed by the allocator's own summary from debugfs.
+ *
+ * Traces can also be read from files, one operation per line:
+ *	a <slot> <bytes>	allocate a buffer into slot
+ *	f <slot>		release the buffer in slot
+ * Empty lines and lines starting with '#' are skipped.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <sys/ioctl.h>
+#include <sys/types.h>
+
+#include "hwmem.h"
+
+#define MAX_TRACES	8
+#define MAX_SLOTS	64
+#define MAX_OPS		1024
+
+#define NV12(w, h)	((w) * (h) * 3 / 2)
+
+struct trace_op {
+	char op;		/* 'a' or 'f', 0 ends the trace */
+	int slot;
+	uint32_t size;
+};
+
+struct trace {
+	const char *name;
+	const struct trace_op *ops;
+	int next;
+	int rounds;
+	int32_t ids[MAX_SLOTS];	/* 0 if the slot is empty */
+
+	/* Stats */
+	unsigned long allocs;
+	unsigned long failed_allocs;
+	unsigned long releases;
+	uint64_t alloc_ns;
+	uint64_t max_alloc_ns;
+	uint64_t release_ns;
+};
+
+/* Viewfinder, still capture and back to the viewfinder */
+static const struct trace_op camera_ops[] = {
+	{ 'a', 0, NV12(640, 480) }, { 'a', 1, NV12(640, 480) },
+	{ 'a', 2, NV12(640, 480) }, { 'a', 3, NV12(640, 480) },
+	{ 'a', 4, NV12(640, 480) }, { 'a', 5, NV12(640, 480) },
+	{ 'a', 6, 64 * 1024 }, { 'a', 7, 64 * 1024 },
+	{ 'f', 0 }, { 'f', 1 }, { 'f', 2 }, { 'f', 3 },
+	{ 'a', 8, NV12(2592, 1944) }, { 'a', 9, NV12(2592, 1944) },
+	{ 'a', 10, 2 * 1024 * 1024 }, { 'a', 11, NV12(160, 120) },
+	{ 'f', 8 }, { 'f', 9 }, { 'f', 10 }, { 'f', 11 },
+	{ 'a', 0, NV12(640, 480) }, { 'a', 1, NV12(640, 480) },
+	{ 'a', 2, NV12(640, 480) }, { 'a', 3, NV12(640, 480) },
+	{ 0 }
+};
+
+/* 720p decode, then a resolution change to 1080p */
+static const struct trace_op video_ops[] = {
+	{ 'a', 0, 1024 * 1024 },
+	{ 'a', 1, NV12(1280, 720) }, { 'a', 2, NV12(1280, 720) },
+	{ 'a', 3, NV12(1280, 720) }, { 'a', 4, NV12(1280, 720) },
+	{ 'a', 5, NV12(1280, 720) }, { 'a', 6, NV12(1280, 720) },
+	{ 'a', 7, NV12(1280, 720) }, { 'a', 8, NV12(1280, 720) },
+	{ 'f', 1 }, { 'f', 2 }, { 'f', 3 }, { 'f', 4 },
+	{ 'f', 5 }, { 'f', 6 }, { 'f', 7 }, { 'f', 8 },
+	{ 'f', 0 }, { 'a', 0, 2 * 1024 * 1024 },
+	{ 'a', 1, NV12(1920, 1088) }, { 'a', 2, NV12(1920, 1088) },
+	{ 'a', 3, NV12(1920, 1088) }, { 'a', 4, NV12(1920, 1088) },
+	{ 'a', 5, NV12(1920, 1088) }, { 'a', 6, NV12(1920, 1088) },
+	{ 0 }
+};
+
+static const char *dev = "/dev/" HWMEM_DEFAULT_DEVICE_NAME;
+static const char *stats_file = "/sys/kernel/debug/cona/hwmem_allocs";
+static int rounds = 100;
+
+static int hwmem_fd;
+static struct trace traces[MAX_TRACES];
+static int nr_traces;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void add_trace(const char *name, const struct trace_op *ops)
+{
+	if (nr_traces == MAX_TRACES) {
+		fprintf(stderr, "hwmem_trace: at most %d traces\n",
+			MAX_TRACES);
+		exit(1);
+	}
+
+	traces[nr_traces].name = name;
+	traces[nr_traces].ops = ops;
+	nr_traces++;
+}
+
+static void load_trace(const char *path)
+{
+	struct trace_op *ops;
+	char line[128];
+	FILE *f;
+	int n = 0;
+	int lineno = 0;
+
+	ops = calloc(MAX_OPS + 1, sizeof(*ops));
+	if (!ops) {
+		perror("calloc");
+		exit(1);
+	}
+
+	f = fopen(path, "r");
+	if (!f) {
+		perror(path);
+		exit(1);
+	}
+
+	while (fgets(line, sizeof(line), f)) {
+		struct trace_op *op = &ops[n];
+		unsigned long size = 0;
+		char c;
+		int fields;
+
+		lineno++;
+		if (sscanf(line, " %c", &c) != 1 || c == '#')
+			continue;
+
+		fields = sscanf(line, " %c %d %lu", &op->op, &op->slot, &size);
+		if (n == MAX_OPS || op->slot < 0 || op->slot >= MAX_SLOTS ||
+		    (op->op == 'a' && (fields != 3 || !size)) ||
+		    (op->op == 'f' && fields < 2) ||
+		    (op->op != 'a' && op->op != 'f')) {
+			fprintf(stderr, "%s:%d: bad trace line\n", path,
+				lineno);
+			exit(1);
+		}
+		op->size = size;
+		n++;
+	}
+
+	fclose(f);
+
+	add_trace(path, ops);
+}
+
+static void trace_alloc(struct trace *t, int slot, uint32_t size)
+{
+	struct hwmem_alloc_request req;
+	uint64_t start;
+	uint64_t ns;
+	int id;
+
+	/* Traces must release a slot before reusing it */
+	if (t->ids[slot]) {
+		fprintf(stderr, "hwmem_trace: %s: slot %d allocated twice\n",
+			t->name, slot);
+		exit(1);
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.size = size;
+	req.flags = HWMEM_ALLOC_HINT_WRITE_COMBINE | HWMEM_ALLOC_HINT_UNCACHED;
+	req.default_access = HWMEM_ACCESS_READ | HWMEM_ACCESS_WRITE;
+	req.mem_type = HWMEM_MEM_CONTIGUOUS_SYS;
+
+	start = now_ns();
+	id = ioctl(hwmem_fd, HWMEM_ALLOC_IOC, &req);
+	ns = now_ns() - start;
+
+	if (id < 0) {
+		if (errno != ENOMEM) {
+			perror("HWMEM_ALLOC_IOC");
+			exit(1);
+		}
+		t->failed_allocs++;
+		return;
+	}
+
+	t->ids[slot] = id;
+	t->allocs++;
+	t->alloc_ns += ns;
+	if (ns > t->max_alloc_ns)
+		t->max_alloc_ns = ns;
+}
+
+/* Releasing an empty slot is fine, its alloc may have failed */
+static void trace_release(struct trace *t, int slot)
+{
+	uint64_t start;
+
+	if (!t->ids[slot])
+		return;
+
+	start = now_ns();
+	if (ioctl(hwmem_fd, HWMEM_RELEASE_IOC, t->ids[slot]) < 0) {
+		perror("HWMEM_RELEASE_IOC");
+		exit(1);
+	}
+	t->release_ns += now_ns() - start;
+	t->releases++;
+
+	t->ids[slot] = 0;
+}
+
+/* Runs the next operation of t, starting over at the end of the trace */
+static void trace_step(struct trace *t)
+{
+	const struct trace_op *op = &t->ops[t->next];
+	int slot;
+
+	if (!op->op) {
+		for (slot = 0; slot < MAX_SLOTS; slot++)
+			trace_release(t, slot);
+		t->next = 0;
+		t->rounds++;
+		return;
+	}
+
+	if (op->op == 'a')
+		trace_alloc(t, op->slot, op->size);
+	else
+		trace_release(t, op->slot);
+	t->next++;
+}
+
+static int traces_done(void)
+{
+	int i;
+
+	for (i = 0; i < nr_traces; i++) {
+		if (traces[i].rounds < rounds)
+			return 0;
+	}
+
+	return 1;
+}
+
+static void print_stats(void)
+{
+	char line[256];
+	FILE *f;
+	int i;
+
+	printf("%-12s %8s %8s %14s %14s %14s\n", "trace", "allocs",
+	       "failed", "alloc avg us", "alloc max us", "release avg us");
+	for (i = 0; i < nr_traces; i++) {
+		struct trace *t = &traces[i];
+
+		printf("%-12s %8lu %8lu %14.1f %14.1f %14.1f\n", t->name,
+		       t->allocs, t->failed_allocs,
+		       t->allocs ? t->alloc_ns / 1000.0 / t->allocs : 0,
+		       t->max_alloc_ns / 1000.0,
+		       t->releases ? t->release_ns / 1000.0 / t->releases : 0);
+	}
+
+	/* The first line is the allocator summary */
+	f = fopen(stats_file, "r");
+	if (!f)
+		return;
+	if (fgets(line, sizeof(line), f))
+		printf("cona %s", line);
+	fclose(f);
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-d device] [-r rounds] "
+		"[-f trace file]...\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	int opt;
+	int i;
+
+	while ((opt = getopt(argc, argv, "d:r:f:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 'f':
+			load_trace(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (rounds < 1)
+		usage(argv[0]);
+
+	if (!nr_traces) {
+		add_trace("camera", camera_ops);
+		add_trace("video", video_ops);
+	}
+
+	hwmem_fd = open(dev, O_RDWR);
+	if (hwmem_fd < 0) {
+		perror(dev);
+		return 1;
+	}
+
+	while (!traces_done()) {
+		for (i = 0; i < nr_traces; i++)
+			trace_step(&traces[i]);
+	}
+
+	print_stats();
+
+	/* Closing the device releases what the traces still hold */
+	close(hwmem_fd);
+
+	return 0;
+}
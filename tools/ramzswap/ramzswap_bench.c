@@ -0,0 +1,287 @@
+/* $(CROSS_COMPILE)gcc -Wall -O2 -o ramzswap_bench ramzswap_bench.c -lpthread
+ */
+
+/*
+ * Copyright (C) ST-Ericsson SA 2011
+ * License terms: GNU General Public License (GPL) version 2
+ *
+ * ramzswap swap storm throughput benchmark. Worker threads pinned to the
+ * first 1, then 2, ... CPUs each own a range of swap slots on the device and
+ * cycle through it, reading back and checking the page last stored in a
+ * slot (swap-in) before storing a new one (swap-out), with single page
+ * O_DIRECT I/O just like the swap code issues. Pages are about half
+ * compressible and all different, so neither the same page nor the dedup
+ * shortcut is taken. Writes compress with the per-CPU stream of the CPU
+ * they run on, so the rate should scale with the CPU count.
+ *
+ * The device must be initialized (rzscontrol --init) and not in use as
+ * swap: its contents are overwritten.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+static const char *dev = "/dev/ramzswap0";
+static int max_cpus = 2;
+static int threads_per_cpu = 2;
+static int seconds = 5;
+static unsigned long slots_per_thread = 2048;
+
+static int dev_fd;
+static long page_size;
+static volatile int stop;
+
+struct worker {
+	pthread_t thread;
+	int cpu;
+	unsigned long first_slot;
+	uint32_t id;
+	uint32_t *stamps;	/* last stamp stored per slot, 0 if none */
+	unsigned long swapouts;
+	unsigned long swapins;
+	int failed;
+};
+
+/* Every eighth word carries the stamp, the rest compresses well */
+static void fill_page(uint32_t *page, uint32_t stamp)
+{
+	size_t words = page_size / sizeof(uint32_t);
+	size_t i;
+
+	for (i = 0; i < words; i++)
+		page[i] = (i & 7) ? (uint32_t)(i >> 3) : stamp + (uint32_t)i;
+}
+
+static int pin_cpu(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+
+	return sched_setaffinity(0, sizeof(set), &set);
+}
+
+static void *worker_thread(void *arg)
+{
+	struct worker *w = arg;
+	uint32_t *page;
+	uint32_t *expect;
+	uint32_t seq = 0;
+	unsigned long i = 0;
+
+	if (pin_cpu(w->cpu) < 0) {
+		perror("sched_setaffinity");
+		w->failed = 1;
+		return NULL;
+	}
+
+	/* O_DIRECT wants page aligned buffers */
+	if (posix_memalign((void **)&page, page_size, page_size) ||
+	    posix_memalign((void **)&expect, page_size, page_size)) {
+		fprintf(stderr, "ramzswap_bench: no page buffers\n");
+		w->failed = 1;
+		return NULL;
+	}
+
+	while (!stop) {
+		off_t off = (off_t)(w->first_slot + i) * page_size;
+
+		if (w->stamps[i]) {
+			if (pread(dev_fd, page, page_size, off) != page_size) {
+				perror("pread");
+				w->failed = 1;
+				break;
+			}
+			fill_page(expect, w->stamps[i]);
+			if (memcmp(page, expect, page_size)) {
+				fprintf(stderr, "ramzswap_bench: slot %lu "
+					"read back corrupt\n",
+					w->first_slot + i);
+				w->failed = 1;
+				break;
+			}
+			w->swapins++;
+		}
+
+		/* Unique per thread and store, never 0 as id is at least 1 */
+		w->stamps[i] = (w->id << 24) | (++seq & 0xffffff);
+		fill_page(page, w->stamps[i]);
+		if (pwrite(dev_fd, page, page_size, off) != page_size) {
+			perror("pwrite");
+			w->failed = 1;
+			break;
+		}
+		w->swapouts++;
+
+		if (++i == slots_per_thread)
+			i = 0;
+	}
+
+	free(expect);
+	free(page);
+
+	return NULL;
+}
+
+/*
+ * Runs threads_per_cpu workers on each of the first nr_cpus CPUs for the
+ * test duration. Returns 0 and the swap-outs and swap-ins per second.
+ */
+static int run_workers(int nr_cpus, double *outs, double *ins)
+{
+	int nr_threads = nr_cpus * threads_per_cpu;
+	struct worker *workers;
+	struct timeval start;
+	struct timeval end;
+	unsigned long swapouts = 0;
+	unsigned long swapins = 0;
+	double elapsed;
+	int failed = 0;
+	int i;
+
+	workers = calloc(nr_threads, sizeof(*workers));
+	if (!workers) {
+		perror("calloc");
+		exit(1);
+	}
+
+	for (i = 0; i < nr_threads; i++) {
+		workers[i].cpu = i % nr_cpus;
+		workers[i].first_slot = i * slots_per_thread;
+		workers[i].id = i + 1;
+		workers[i].stamps = calloc(slots_per_thread,
+					   sizeof(*workers[i].stamps));
+		if (!workers[i].stamps) {
+			perror("calloc");
+			exit(1);
+		}
+	}
+
+	stop = 0;
+	gettimeofday(&start, NULL);
+	for (i = 0; i < nr_threads; i++) {
+		if (pthread_create(&workers[i].thread, NULL, worker_thread,
+				   &workers[i])) {
+			fprintf(stderr, "ramzswap_bench: no worker thread\n");
+			exit(1);
+		}
+	}
+
+	sleep(seconds);
+	stop = 1;
+
+	for (i = 0; i < nr_threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		swapouts += workers[i].swapouts;
+		swapins += workers[i].swapins;
+		failed |= workers[i].failed;
+		free(workers[i].stamps);
+	}
+	gettimeofday(&end, NULL);
+
+	free(workers);
+
+	elapsed = (end.tv_sec - start.tv_sec) +
+		(end.tv_usec - start.tv_usec) / 1000000.0;
+
+	*outs = swapouts / elapsed;
+	*ins = swapins / elapsed;
+
+	return failed ? -1 : 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-d device] [-c max cpus] "
+		"[-t threads per cpu] [-s seconds per run] "
+		"[-p pages per thread]\n", name);
+	exit(1);
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t disksize;
+	double outs;
+	double ins;
+	int n;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "d:c:t:s:p:")) != -1) {
+		switch (opt) {
+		case 'd':
+			dev = optarg;
+			break;
+		case 'c':
+			max_cpus = atoi(optarg);
+			break;
+		case 't':
+			threads_per_cpu = atoi(optarg);
+			break;
+		case 's':
+			seconds = atoi(optarg);
+			break;
+		case 'p':
+			slots_per_thread = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	/* Thread ids must fit the top byte of the stamps */
+	if (max_cpus < 1 || threads_per_cpu < 1 || seconds < 1 ||
+	    max_cpus * threads_per_cpu > 255 || !slots_per_thread)
+		usage(argv[0]);
+
+	page_size = sysconf(_SC_PAGESIZE);
+
+	dev_fd = open(dev, O_RDWR | O_DIRECT);
+	if (dev_fd < 0) {
+		perror(dev);
+		return 1;
+	}
+
+	if (ioctl(dev_fd, BLKGETSIZE64, &disksize) < 0) {
+		perror("BLKGETSIZE64");
+		return 1;
+	}
+	if (disksize / page_size <
+	    (uint64_t)max_cpus * threads_per_cpu * slots_per_thread) {
+		fprintf(stderr, "%s: too small for %d x %lu pages "
+			"(not initialized?)\n", dev,
+			max_cpus * threads_per_cpu, slots_per_thread);
+		return 1;
+	}
+
+	printf("%5s %8s %12s %12s %10s\n", "cpus", "threads",
+	       "swapouts/s", "swapins/s", "MB/s");
+	for (n = 1; n <= max_cpus; n++) {
+		if (run_workers(n, &outs, &ins)) {
+			close(dev_fd);
+			return 1;
+		}
+		printf("%5d %8d %12.0f %12.0f %10.1f\n", n,
+		       n * threads_per_cpu, outs, ins,
+		       (outs + ins) * page_size / (1024 * 1024));
+		fflush(stdout);
+	}
+
+	close(dev_fd);
+
+	return 0;
+}